@@ -23,6 +23,7 @@
 #include <string.h>
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #include "Log.h"
@@ -46,19 +47,24 @@ using namespace std;
   */
 
 class AnException {
+	protected:
+		/// Picks out the constructor AnExpectedException uses
+		enum ExpectedTag { Expected };
+
 	public:
 		/**
 		  * @memo The standard way to instantiate an Exception class.
 		  * @doc  This is the standard way to create and then throw
 		  *       AnException.  This allows for a custom message, 
 		  *       a standard message, as well as file and line info
-		  *       for debugging purposes.
+		  *       for debugging purposes.  Only the names on the EnEx
+		  *       stack are captured here - the stack trace text is
+		  *       built the first time Stack() is called.
 		  * @param id  The exception id for lookup purposes.
 		  * @param file The name of the file that this occurred in.  
-		  *             This is truncated at 255 bytes.
 		  * @param line The line number in the file where this happened.
 		  * @param msg The custom message for this exception. This 
-		  *            message is truncated at 255 bytes.  For a longer
+		  *            message is truncated at 1023 bytes.  For a longer
 		  *            and more detailed message, use the exception id
 		  *            and look up the message in the list.
 		  * @param ... This is the variable list of parameters that
@@ -67,47 +73,52 @@ class AnException {
 		  */
 		AnException(int id, const char *file, int line, const char *msg, ...)
 		{
-			va_list ap;
-			char buffer[1024];
-			
-			va_start(ap, msg);
-
-			memset(buffer, 0, 1024);
-			m_file.erase();
 			m_file = file;
-
+			m_id = id;
+			m_line = line;
+			m_staticMsg = NULL;
+
+			if(strchr(msg, '%') == NULL){
+				// Nothing to fill in.
+				m_message = msg;
+			} else {
+				// The arguments are gone once we return, so this part can't wait.
+				va_list ap;
+				char buffer[1024];
+				va_start(ap, msg);
 #ifdef _WIN32
-			_vsnprintf(buffer, 1023, msg, ap);
+				_vsnprintf(buffer, 1023, msg, ap);
+				buffer[1023] = '\0'; // not terminated when it truncates
 #else
-			vsnprintf(buffer, 1023, msg, ap);
+				vsnprintf(buffer, 1024, msg, ap);
 #endif
-			m_message.erase();
-			m_message = buffer;
-			m_id = id;
-			m_line = line;
-			va_end(ap);
-
-			m_stack = EnEx::GetStackTrace()();
-
-			DEBUG(FL, 
-				"Generating exception:\n"
-				"=====================\n" 
-				"%s\n"
-				"=====================\n"
-				"In File: %s\n"
-				"On Line: %d\n"
-				"With ID: %d\n"
-				"=====================\n"
-				"%s\n"
-				"=====================\n",
-				m_message.c_str(),
-				m_file.c_str(),
-				m_line,
-				m_id,
-				m_stack.c_str()
-			);
-
-			
+				va_end(ap);
+				m_message = buffer;
+			}
+
+			m_tid = Thread::CurrentThreadId();
+			EnEx::GetStackFrames(m_frames);
+			m_stackDone = false;
+
+			if(Log::DebugOn()){
+				DEBUG(FL, 
+					"Generating exception:\n"
+					"=====================\n" 
+					"%s\n"
+					"=====================\n"
+					"In File: %s\n"
+					"On Line: %d\n"
+					"With ID: %d\n"
+					"=====================\n"
+					"%s\n"
+					"=====================\n",
+					Msg(),
+					m_file.c_str(),
+					m_line,
+					m_id,
+					Stack()
+				);
+			}
 		}	
 
 		/// The destructor.  It doesn't have to do much.
@@ -137,29 +148,71 @@ class AnException {
 		/// Use this function to retrieve the message.
 		const char *Msg(void)
 		{
+			if(m_staticMsg != NULL){
+				return m_staticMsg;
+			}
 			return m_message.c_str();
 		}	
 
 		/// Use this function to add more to the message string.
 		void AddMsg(const char *new_msg)
 		{
+			if(m_staticMsg != NULL){
+				m_message = m_staticMsg;
+				m_staticMsg = NULL;
+			}
 			m_message.append(new_msg);
 		}
 
 		/// Use this function to retrieve the stack trace captured at the time of the exception.
 		const char* Stack(void){
+			if(!m_stackDone){
+				m_stack = EnEx::FormatStackTrace(m_tid, m_frames)();
+				m_stackDone = true;
+			}
 			return m_stack.c_str();
 		}
 
 	protected:
 
+		/** Builds an exception with a message that is used as it is - no formatting, no
+		  * copy, no stack and no logging.  See AnExpectedException.
+		  */
+		AnException(ExpectedTag tag, int id, const char* file, int line, const char* msg)
+		{
+			m_file = file;
+			m_id = id;
+			m_line = line;
+			m_staticMsg = msg;
+			m_tid = Thread::CurrentThreadId();
+			m_stackDone = true; // nothing to show
+		}
+
 		string m_message;
+		const char* m_staticMsg; // our message, if it hasn't been copied into m_message
 		string m_file;
 		int  m_id;
 		int  m_line;
+		THREAD_ID_TYPE m_tid;
+		vector<const char*> m_frames; // the EnEx stack, until Stack() formats it
+		bool m_stackDone;
 		string m_stack;
 
 };
 
+/**
+  * A cheap AnException for conditions that are expected in normal running, like a read
+  * timing out.  The message is kept as a pointer, so it must be a string literal (or
+  * outlive the exception), and there is no formatting, no stack trace and no DEBUG log.
+  * Catch it as AnException like any other.
+  */
+class AnExpectedException : public AnException {
+	public:
+		AnExpectedException(int id, const char* file, int line, const char* msg) :
+			AnException(Expected, id, file, line, msg) {}
+
+		virtual ~AnExpectedException() {}
+};
+
 
 #endif //AnException_h defined.
@@ -0,0 +1,391 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+#if !defined(_WIN32) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+#include "Clock.h"
+using namespace SLib;
+
+/// How long we watch the TSC against the monotonic clock when calibrating
+static const uint64_t CLOCK_CALIBRATE_NANOS = 20000000;
+
+/// How far apart (in nanoseconds) two cpus' TSCs may be before we stop trusting them
+static const int64_t CLOCK_MAX_DRIFT_NANOS = 2000;
+
+/// How often WallNanos lines the monotonic clock up with the system time
+static const uint64_t CLOCK_WALL_SYNC_NANOS = 1000000000;
+
+volatile int Clock::m_source = CLOCK_SOURCE_NONE;
+double Clock::m_nanosPerTick = 1.0;
+bool Clock::m_allowTSC = true;
+
+/// The tick count when the clock was set up - Nanos() counts from here
+static uint64_t clock_base_ticks = 0;
+
+/// The system time less Nanos(), and the Nanos() value when we need to look again
+static volatile int64_t clock_wall_offset = 0;
+static volatile uint64_t clock_wall_next_sync = 0;
+
+#ifdef _WIN32
+static INIT_ONCE clock_setup_once = INIT_ONCE_STATIC_INIT;
+static LARGE_INTEGER clock_qpc_frequency;
+
+static BOOL CALLBACK clockSetupOnce(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	(*(void (*)(void))param)();
+	return TRUE;
+}
+#else
+static pthread_once_t clock_setup_once = PTHREAD_ONCE_INIT;
+#endif
+
+uint64_t Clock::SlowTicks(void)
+{
+	if(m_source == CLOCK_SOURCE_NONE){
+		Source();
+		if(m_source == CLOCK_SOURCE_TSC){
+			return ReadTSC();
+		}
+	}
+	return MonotonicNanos();
+}
+
+uint64_t Clock::NanosToTicks(uint64_t nanos)
+{
+	if(Source() == CLOCK_SOURCE_TSC){
+		return (uint64_t)(nanos / m_nanosPerTick);
+	}
+	return nanos;
+}
+
+uint64_t Clock::Nanos(void)
+{
+	uint64_t now = Ticks();
+	return Elapsed(clock_base_ticks, now);
+}
+
+uint64_t Clock::WallNanos(void)
+{
+	uint64_t now = Nanos();
+	uint64_t next = clock_wall_next_sync;
+	if(now >= next){
+		// Only one thread needs to look at the system time - the rest carry on with the
+		// offset they have.
+#ifdef _WIN32
+		if(InterlockedCompareExchange64((volatile LONG64*)&clock_wall_next_sync,
+			(LONG64)(now + CLOCK_WALL_SYNC_NANOS), (LONG64)next) == (LONG64)next
+		){
+			InterlockedExchange64((volatile LONG64*)&clock_wall_offset,
+				(LONG64)(SystemWallNanos() - now));
+		}
+#else
+		if(__sync_bool_compare_and_swap(&clock_wall_next_sync, next, now + CLOCK_WALL_SYNC_NANOS)){
+			int64_t offset = (int64_t)(SystemWallNanos() - now);
+			__sync_lock_test_and_set(&clock_wall_offset, offset);
+		}
+#endif
+	}
+	int64_t offset = clock_wall_offset;
+	if(offset == 0){
+		// The very first sync is still under way on another thread.
+		offset = (int64_t)(SystemWallNanos() - now);
+	}
+	return now + offset;
+}
+
+int Clock::Source(void)
+{
+	if(m_source == CLOCK_SOURCE_NONE){
+#ifdef _WIN32
+		InitOnceExecuteOnce(&clock_setup_once, clockSetupOnce, (PVOID)&Clock::Setup, NULL);
+#else
+		pthread_once(&clock_setup_once, &Clock::Setup);
+#endif
+	}
+	return m_source;
+}
+
+const char* Clock::SourceName(void)
+{
+	if(Source() == CLOCK_SOURCE_TSC){
+		return "tsc";
+	}
+#ifdef _WIN32
+	return "qpc";
+#else
+	return "monotonic";
+#endif
+}
+
+double Clock::TicksPerSecond(void)
+{
+	if(Source() == CLOCK_SOURCE_TSC){
+		return 1000000000.0 / m_nanosPerTick;
+	}
+	return 0.0;
+}
+
+void Clock::AllowTSC(bool allow)
+{
+	m_allowTSC = allow;
+}
+
+void Clock::Setup(void)
+{
+	const char* env = getenv("SLIB_CLOCK");
+	if(env != NULL && strcmp(env, "monotonic") == 0){
+		m_allowTSC = false;
+	}
+#ifdef _WIN32
+	QueryPerformanceFrequency(&clock_qpc_frequency);
+#endif
+	Calibrate();
+}
+
+bool Clock::Calibrate(void)
+{
+	double nanosPerTick = 0.0;
+	if(m_allowTSC && HasInvariantTSC()){
+		nanosPerTick = MeasureTSC();
+		if(nanosPerTick <= 0.0 || !CheckDrift(nanosPerTick)){
+			nanosPerTick = 0.0;
+		}
+	}
+
+	// WallNanos has to line up again against our new Nanos()
+	clock_wall_next_sync = 0;
+	if(nanosPerTick > 0.0){
+		m_nanosPerTick = nanosPerTick;
+		clock_base_ticks = ReadTSC();
+		m_source = CLOCK_SOURCE_TSC;
+		return true;
+	} else {
+		m_nanosPerTick = 1.0;
+		clock_base_ticks = MonotonicNanos();
+		m_source = CLOCK_SOURCE_MONOTONIC;
+		return false;
+	}
+}
+
+uint64_t Clock::MonotonicNanos(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	uint64_t freq = (uint64_t)clock_qpc_frequency.QuadPart;
+	uint64_t c = (uint64_t)count.QuadPart;
+	return (c / freq) * 1000000000 + (c % freq) * 1000000000 / freq;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+uint64_t Clock::ThreadCpuNanos(void)
+{
+#ifdef _WIN32
+	FILETIME created, exited, kernel, user;
+	if(!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)){
+		return 0;
+	}
+	uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (k + u) * 100; // 100ns units
+#else
+	struct timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0){
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+uint64_t Clock::SystemWallNanos(void)
+{
+#ifdef _WIN32
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	uint64_t t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	return (t - 116444736000000000ULL) * 100; // 100ns units since 1601
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+bool Clock::HasInvariantTSC(void)
+{
+	unsigned int regs[4] = { 0, 0, 0, 0 };
+#if defined(_M_X64) || defined(_M_IX86)
+	__cpuid((int*)regs, 0x80000000);
+	if(regs[0] < 0x80000007){
+		return false;
+	}
+	__cpuid((int*)regs, 0x80000001);
+	bool rdtscp = (regs[3] & (1 << 27)) != 0;
+	__cpuid((int*)regs, 0x80000007);
+	bool invariant = (regs[3] & (1 << 8)) != 0;
+	return rdtscp && invariant;
+#elif defined(__x86_64__) || defined(__i386__)
+	if(__get_cpuid_max(0x80000000, NULL) < 0x80000007){
+		return false;
+	}
+	__get_cpuid(0x80000001, &regs[0], &regs[1], &regs[2], &regs[3]);
+	bool rdtscp = (regs[3] & (1 << 27)) != 0;
+	__get_cpuid(0x80000007, &regs[0], &regs[1], &regs[2], &regs[3]);
+	bool invariant = (regs[3] & (1 << 8)) != 0;
+	return rdtscp && invariant;
+#else
+	return false;
+#endif
+}
+
+/** Reads the TSC and the monotonic clock at (as near as we can get to) the same moment.
+  * We read the monotonic clock either side of the TSC a few times and keep the tightest
+  * pair.
+  */
+static void clockReadPair(uint64_t (*mono)(void), uint64_t (*tsc)(void), uint64_t& monoNanos,
+	uint64_t& tscTicks)
+{
+	uint64_t best = (uint64_t)-1;
+	for(int i = 0; i < 5; i++){
+		uint64_t before = mono();
+		uint64_t t = tsc();
+		uint64_t after = mono();
+		if(after - before < best){
+			best = after - before;
+			monoNanos = before + (after - before) / 2;
+			tscTicks = t;
+		}
+	}
+}
+
+/// Plain function versions of our private readers, for clockReadPair and the drift thread.
+static uint64_t (*clock_mono_reader)(void) = NULL;
+static uint64_t (*clock_tsc_reader)(void) = NULL;
+
+double Clock::MeasureTSC(void)
+{
+	clock_mono_reader = &Clock::MonotonicNanos;
+	clock_tsc_reader = &Clock::ReadTSC;
+
+	uint64_t mono1 = 0, tsc1 = 0, mono2 = 0, tsc2 = 0;
+	clockReadPair(clock_mono_reader, clock_tsc_reader, mono1, tsc1);
+	do {
+		clockReadPair(clock_mono_reader, clock_tsc_reader, mono2, tsc2);
+	} while(mono2 - mono1 < CLOCK_CALIBRATE_NANOS);
+
+	if(tsc2 <= tsc1){
+		return 0.0; // the TSC isn't moving - don't use it
+	}
+	return (double)(mono2 - mono1) / (double)(tsc2 - tsc1);
+}
+
+#ifdef __linux__
+/// What the drift check thread works with
+struct ClockDriftCheck {
+	double nanosPerTick;
+	bool ok;
+};
+
+/** Moves itself onto each cpu in turn and compares the TSC with the monotonic clock there.
+  * This runs on its own thread so the caller's cpu affinity is left alone.
+  */
+static void* clockDriftThread(void* arg)
+{
+	ClockDriftCheck* check = (ClockDriftCheck*)arg;
+	check->ok = true;
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0){
+		return NULL; // can't move around - trust the flag
+	}
+
+	bool haveFirst = false;
+	uint64_t firstMono = 0, firstTSC = 0;
+	for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		if(!CPU_ISSET(cpu, &allowed)){
+			continue;
+		}
+		cpu_set_t one;
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		if(sched_setaffinity(0, sizeof(cpu_set_t), &one) != 0){
+			continue;
+		}
+		uint64_t mono = 0, tsc = 0;
+		clockReadPair(clock_mono_reader, clock_tsc_reader, mono, tsc);
+		if(!haveFirst){
+			firstMono = mono;
+			firstTSC = tsc;
+			haveFirst = true;
+			continue;
+		}
+		// Where this cpu's TSC says we are, against where the monotonic clock says we are.
+		int64_t byTSC = (int64_t)(((double)(int64_t)(tsc - firstTSC)) * check->nanosPerTick);
+		int64_t byMono = (int64_t)(mono - firstMono);
+		int64_t drift = byTSC - byMono;
+		if(drift > CLOCK_MAX_DRIFT_NANOS || drift < -CLOCK_MAX_DRIFT_NANOS){
+			check->ok = false;
+			break;
+		}
+	}
+	return NULL;
+}
+#endif
+
+bool Clock::CheckDrift(double nanosPerTick)
+{
+#ifdef __linux__
+	ClockDriftCheck check;
+	check.nanosPerTick = nanosPerTick;
+	check.ok = true;
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, clockDriftThread, &check) != 0){
+		return true; // no thread to check with - trust the invariant TSC flag
+	}
+	pthread_join(thread, NULL);
+	return check.ok;
+#else
+	// Elsewhere we trust the invariant TSC flag - windows and OS X both synchronize it.
+	return true;
+#endif
+}
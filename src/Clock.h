@@ -0,0 +1,182 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace SLib {
+
+/// Clock::Source() before the clock has been set up
+#define CLOCK_SOURCE_NONE 0
+
+/// Ticks are read with rdtscp and converted with our calibration
+#define CLOCK_SOURCE_TSC 1
+
+/// Ticks are nanoseconds from the operating system's monotonic clock
+#define CLOCK_SOURCE_MONOTONIC 2
+
+/**
+  * A high resolution, monotonic clock for timing code.  Ticks() is the fast read: on
+  * x86 machines with an invariant TSC it is a single rdtscp instruction, and the tick
+  * count is turned into nanoseconds with a rate we measure against CLOCK_MONOTONIC the
+  * first time the clock is used.  While calibrating we also read the TSC on every cpu
+  * we are allowed to run on, and if any of them disagree by more than a couple of
+  * microseconds we don't trust it.  Anywhere the TSC can't be used (other cpus, no
+  * invariant TSC, a bad drift check) Ticks() reads clock_gettime(CLOCK_MONOTONIC)
+  * instead (QueryPerformanceCounter on windows), and a tick is a nanosecond.
+  * <P>
+  * Ticks only mean something relative to each other.  Use Elapsed() or TicksToNanos() to
+  * turn a difference into nanoseconds, and Nanos() or WallNanos() when you want a time.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT Clock
+{
+	public:
+		/// Returns the current tick count.  Only differences between tick counts mean anything.
+		static inline uint64_t Ticks(void)
+		{
+			if(m_source == CLOCK_SOURCE_TSC){
+				return ReadTSC();
+			}
+			return SlowTicks();
+		}
+
+		/// Converts a number of ticks into nanoseconds.
+		static inline uint64_t TicksToNanos(uint64_t ticks)
+		{
+			if(m_source == CLOCK_SOURCE_TSC){
+				return (uint64_t)(ticks * m_nanosPerTick);
+			}
+			return ticks;
+		}
+
+		/// Converts a number of nanoseconds into ticks.
+		static uint64_t NanosToTicks(uint64_t nanos);
+
+		/// Returns the nanoseconds between two tick counts, or 0 if end is before start.
+		static inline uint64_t Elapsed(uint64_t startTicks, uint64_t endTicks)
+		{
+			if(endTicks <= startTicks){
+				return 0;
+			}
+			return TicksToNanos(endTicks - startTicks);
+		}
+
+		/// Returns monotonic nanoseconds since the clock was set up.
+		static uint64_t Nanos(void);
+
+		/** Returns the wall clock time as nanoseconds since 1970, read from the monotonic
+		  * clock.  We line the two clocks up again once a second, so this follows changes
+		  * to the system time within a second of them happening.
+		  */
+		static uint64_t WallNanos(void);
+
+		/** Returns the cpu time the calling thread has used, in nanoseconds.  This is a
+		  * system call on most platforms - a few hundred nanoseconds - so don't use it on
+		  * every pass through something small.  Windows only counts it in scheduler quanta.
+		  */
+		static uint64_t ThreadCpuNanos(void);
+
+		/** Returns CLOCK_SOURCE_TSC or CLOCK_SOURCE_MONOTONIC, setting the clock up first if
+		  * this is the first time it is used.
+		  */
+		static int Source(void);
+
+		/// Returns a short description of the clock we are using, for log messages.
+		static const char* SourceName(void);
+
+		/// Returns the TSC rate we calibrated, in ticks per second, or 0 if we aren't using it.
+		static double TicksPerSecond(void);
+
+		/** Measures the TSC against the monotonic clock again and re-runs the cross cpu
+		  * check.  Calibration happens by itself the first time the clock is used - call
+		  * this if you suspect the cpu frequency has changed underneath us.  Returns true if
+		  * the TSC is (still) in use.  Don't call it while other threads are timing things:
+		  * tick counts taken before and after a recalibration don't compare.
+		  */
+		static bool Calibrate(void);
+
+		/** Set this to false before the clock is first used to make it ignore the TSC and
+		  * always read the monotonic clock.  The SLIB_CLOCK environment variable does the
+		  * same thing when it is set to "monotonic".
+		  */
+		static void AllowTSC(bool allow);
+
+	private:
+		/// Reads the TSC.  rdtscp waits for the instructions before it to finish.
+		static inline uint64_t ReadTSC(void)
+		{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+			unsigned int aux;
+			return __rdtscp(&aux);
+#else
+			return 0;
+#endif
+		}
+
+		/// Sets the clock up if needed, and reads the monotonic clock.
+		static uint64_t SlowTicks(void);
+
+		/// Reads the operating system's monotonic clock in nanoseconds.
+		static uint64_t MonotonicNanos(void);
+
+		/// Reads the operating system's wall clock in nanoseconds since 1970.
+		static uint64_t SystemWallNanos(void);
+
+		/// Returns true if this cpu has an invariant TSC and rdtscp.
+		static bool HasInvariantTSC(void);
+
+		/// Measures the TSC rate against the monotonic clock.  Returns nanoseconds per tick.
+		static double MeasureTSC(void);
+
+		/// Reads the TSC on each cpu we may run on, and returns true if they all agree.
+		static bool CheckDrift(double nanosPerTick);
+
+		/// Sets the clock up the first time through.
+		static void Setup(void);
+
+		/// Which clock Ticks() reads
+		static volatile int m_source;
+
+		/// Our TSC calibration
+		static double m_nanosPerTick;
+
+		/// Whether we may use the TSC at all
+		static bool m_allowTSC;
+};
+
+} // End Namespace SLib
+
+#endif // CLOCK_H Defined
@@ -1,8 +1,16 @@
 /* C Standard Headers */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #ifndef _WIN32
 #include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
 #endif
 
 
@@ -10,13 +18,15 @@
 #include <vector>
 #include <utility>
 #include <map>
+#include <string>
 using namespace std;
 
 /* SLib Headers */
 #include "EnEx.h"
-#include "Timer.h"
+#include "Clock.h"
 #include "Thread.h"
 #include "Log.h"
+#include "Tools.h"
 #include "xmlinc.h"
 using namespace SLib;
 
@@ -28,24 +38,419 @@ using namespace SLib;
 map<const char*, EnExProfile*>* global_hit_counter = NULL;
 SLib::Mutex* global_hit_counter_mutex = NULL;
 
-/** This is the list of entry exit stats that we keep for every thread
-    that runs in the system.  It's indexed by the thread id and maintained
-    by each individual thread.
+#ifdef _WIN32
+#define ENEX_THREAD_LOCAL __declspec(thread)
+#else
+#define ENEX_THREAD_LOCAL __thread
+#endif
+
+/** Keeps the compiler (and on weaker cpus than x86, the cpu) from moving the writes a
+    thread makes to its own counters past the sequence number or count that publishes
+    them to readers on other threads - and the reads the other way.
+*/
+#if defined(_WIN32)
+#define ENEX_BARRIER() MemoryBarrier()
+#elif defined(__x86_64__) || defined(__i386__)
+#define ENEX_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define ENEX_BARRIER() __sync_synchronize()
+#endif
+
+/** One node in a call tree: the method at the end of one unique call path.  Times are
+    in Clock ticks.  Children are found by their method name pointer - each EnEx or
+    ENEX_SITE call site has its own.
+*/
+struct SLib::EnExCallNode {
+	const char* methodName;
+	EnExCallNode* parent;
+	vector<EnExCallNode*> children;
+	uint64_t hits;
+	uint64_t inclusiveTicks;
+	uint64_t childTicks; // the part of inclusiveTicks spent in our children
+
+	EnExCallNode(const char* name, EnExCallNode* p) :
+		methodName(name), parent(p), hits(0), inclusiveTicks(0), childTicks(0) {}
+};
+
+/** One span in a thread's trace ring.  Times are Clock ticks.
+*/
+struct EnExTraceEvent {
+	const char* methodName;
+	uint64_t begin;
+	uint64_t end;
+};
+
+/// The number of different stacks each thread's sample table can count
+#define ENEX_SAMPLE_SLOTS 512
+
+/** One stack in a thread's sample table.  Filled in by the thread's own signal handler -
+    used is set once the frames are in place.  reported is only touched by readers.
 */
-vector< pair< 
-	THREAD_ID_TYPE, 
-	map<const char*, EnExProfile*>* 
-> >* hit_counter_list = NULL;
-
-/** This is the stack trace for each thread.
- */
-vector< pair<
-	THREAD_ID_TYPE,
-	vector<const char*>*
-> >* stack_trace_list = NULL;
+struct EnExSampleSlot {
+	volatile uint64_t count;
+	uint64_t reported;
+	volatile int used;
+	int depth;
+	const char* frames[ ENEX_SAMPLE_DEPTH ];
+};
+
+/** This is everything EnterExit keeps for one thread: its entry exit stats,
+    its stack trace, its call tree, trace ring and samples.  Only the thread itself
+    records into it - anyone else just reads.
+*/
+struct SLib::EnExThreadData {
+	THREAD_ID_TYPE tid;
+	map<const char*, EnExProfile*> hitCounter;
+	vector<const char*> stackTrace;
+	vector<EnExProfile*> siteProfiles; // indexed by EnExCallSite::m_id
+	EnExCallNode* callRoot;
+	EnExCallNode* callCurrent; // the innermost call we are in
+	EnExTraceEvent* traceRing; // allocated the first time we trace
+	int traceSize;
+	volatile uint64_t traceCount; // spans ever written - the next goes at traceCount % traceSize
+	SLib::Mutex* mapMutex; // held by us while adding to hitCounter, and by anyone else reading it
+	map<const char*, EnExProfile*> savedCounters; // what SaveToGlobal last passed on
+
+	// Our stack again, as the sampling profiler's signal handler can read it: a fixed array
+	// and a depth, with no allocation.  The depth can go past the end of the array.
+	const char* volatile sigStack[ ENEX_SAMPLE_DEPTH ];
+	volatile int sigDepth;
+
+	// The sampling profiler's counts, allocated before our timer is started
+	EnExSampleSlot* sampleSlots;
+	volatile uint64_t samplesDropped; // our table was full
+
+	// The profile of the innermost timed scope we are in, for allocation counting
+	EnExProfile* volatile currentProfile;
+#ifdef __linux__
+	pid_t kernelTid;
+	timer_t sampleTimer;
+	bool hasSampleTimer;
+#endif
+
+	EnExThreadData() : callRoot(new EnExCallNode(NULL, NULL)), traceRing(NULL), traceSize(0),
+		traceCount(0), mapMutex(new SLib::Mutex()), sigDepth(0), sampleSlots(NULL),
+		samplesDropped(0), currentProfile(NULL)
+	{
+		callCurrent = callRoot;
+#ifdef __linux__
+		kernelTid = 0;
+		hasSampleTimer = false;
+#endif
+	}
+};
+
+/** This is our thread's own block, so finding it costs nothing after the first time.
+*/
+static ENEX_THREAD_LOCAL EnExThreadData* our_thread_data = NULL;
+
+/** This is the list of every thread's block.  Threads are only added to it (or
+    take over the block of a finished thread that had the same id) while holding
+    the hit_counter_list_add_mutex.
+*/
+vector< EnExThreadData* >* thread_data_list = NULL;
 
 SLib::Mutex* hit_counter_list_add_mutex = NULL;
 
+/** The next call site id to hand out, the subsystems that are turned on, and whether
+    ENEX_SITE profiling is on at all.  EnExCallSite::Enabled is the two put together.
+    All changed under the hit_counter_list_add_mutex.
+*/
+static int next_call_site_id = 0;
+static uint32_t enabled_subsystems = 0xFFFFFFFF;
+static bool profiling_enabled = true;
+volatile uint32_t EnExCallSite::Enabled = 0xFFFFFFFF;
+
+/** This is the global call tree, merged from each thread's tree by SaveToGlobal under
+    the global_hit_counter_mutex.
+*/
+EnExCallNode* global_call_tree = NULL;
+
+EnExCallNode* GlobalCallTree()
+{
+	if(global_call_tree == NULL){
+		global_call_tree = new EnExCallNode(NULL, NULL);
+	}
+	return global_call_tree;
+}
+
+/** Finds (or adds) the child of parent for the given method.
+*/
+static EnExCallNode* callChild(EnExCallNode* parent, const char* methodName)
+{
+	for(size_t i = 0, l = parent->children.size(); i < l; i++){
+		if(parent->children[i]->methodName == methodName){
+			return parent->children[i];
+		}
+	}
+	EnExCallNode* child = new EnExCallNode(methodName, parent);
+	parent->children.push_back(child);
+	return child;
+}
+
+/** Steps our thread down into a call to methodName.
+*/
+static inline EnExCallNode* enterCall(EnExThreadData* data, const char* methodName)
+{
+	EnExCallNode* node = callChild(data->callCurrent, methodName);
+	node->hits++;
+	data->callCurrent = node;
+	return node;
+}
+
+/** Steps our thread back out of a call that took the given ticks.
+*/
+static inline void exitCall(EnExThreadData* data, EnExCallNode* node, uint64_t ticks)
+{
+	node->inclusiveTicks += ticks;
+	node->parent->childTicks += ticks;
+	data->callCurrent = node->parent;
+}
+
+/** Adds the numbers from one call tree into another, adding any paths it is missing.
+*/
+static void mergeCallTree(EnExCallNode* into, EnExCallNode* from)
+{
+	into->hits += from->hits;
+	into->inclusiveTicks += from->inclusiveTicks;
+	into->childTicks += from->childTicks;
+	for(size_t i = 0, l = from->children.size(); i < l; i++){
+		mergeCallTree( callChild(into, from->children[i]->methodName), from->children[i] );
+	}
+}
+
+/** Zeros the numbers in a call tree.  The paths stay, since a thread may be inside them.
+*/
+static void resetCallTree(EnExCallNode* node)
+{
+	node->hits = 0;
+	node->inclusiveTicks = 0;
+	node->childTicks = 0;
+	for(size_t i = 0, l = node->children.size(); i < l; i++){
+		resetCallTree(node->children[i]);
+	}
+}
+
+/** Writes one folded stack line for each path under node that has time of its own.
+*/
+static void foldCallTree(EnExCallNode* node, const twine& path, twine& output)
+{
+	twine tmp;
+	for(size_t i = 0, l = node->children.size(); i < l; i++){
+		EnExCallNode* child = node->children[i];
+		twine name = child->methodName;
+		name.replace(';', ','); // the frame separator
+		twine childPath = path;
+		if(!childPath.empty()){
+			childPath += ";";
+		}
+		childPath += name;
+		uint64_t self = child->inclusiveTicks > child->childTicks ?
+			child->inclusiveTicks - child->childTicks : 0;
+		if(self != 0){
+			tmp.format("%s %llu\n", childPath(), (unsigned long long)Clock::TicksToNanos(self));
+			output += tmp;
+		}
+		foldCallTree(child, childPath, output);
+	}
+}
+
+/** Adds a Call node under parent for each child of node, nested the same way.
+*/
+static void recordCallTree(xmlNodePtr parent, EnExCallNode* node)
+{
+	twine tmp;
+	for(size_t i = 0, l = node->children.size(); i < l; i++){
+		EnExCallNode* child = node->children[i];
+		uint64_t self = child->inclusiveTicks > child->childTicks ?
+			child->inclusiveTicks - child->childTicks : 0;
+		xmlNodePtr call = xmlNewChild(parent, NULL, (const xmlChar*)"Call", NULL);
+		xmlSetProp(call, (const xmlChar*)"MethodName", (const xmlChar*)child->methodName);
+		tmp.format("%llu", (unsigned long long)child->hits);
+		xmlSetProp(call, (const xmlChar*)"Hits", tmp);
+		tmp.format("%llu", (unsigned long long)Clock::TicksToNanos(child->inclusiveTicks));
+		xmlSetProp(call, (const xmlChar*)"InclusiveNanos", tmp);
+		tmp.format("%llu", (unsigned long long)Clock::TicksToNanos(self));
+		xmlSetProp(call, (const xmlChar*)"SelfNanos", tmp);
+		recordCallTree(call, child);
+	}
+}
+
+/** Whether we are tracing, how big new trace rings are, and when tracing started.  Set by
+    StartTracing and StopTracing under the hit_counter_list_add_mutex.
+*/
+static volatile bool trace_enabled = false;
+static int trace_ring_size = 65536;
+static uint64_t trace_start_ticks = 0;
+
+/** Adds a finished span to our thread's trace ring.
+*/
+static void traceCall(EnExThreadData* data, const char* methodName, uint64_t begin, uint64_t end)
+{
+	if(data->traceRing == NULL){
+		data->traceSize = trace_ring_size;
+		data->traceRing = new EnExTraceEvent[ data->traceSize ];
+	}
+	EnExTraceEvent& ev = data->traceRing[ data->traceCount % data->traceSize ];
+	ev.methodName = methodName;
+	ev.begin = begin;
+	ev.end = end;
+	ENEX_BARRIER();
+	data->traceCount = data->traceCount + 1;
+}
+
+/** Adds a method name to a JSON string, escaped.
+*/
+static void jsonEscape(twine& output, const char* name)
+{
+	for(const char* c = name; *c != '\0'; c++){
+		if(*c == '"' || *c == '\\'){
+			output += '\\';
+			output += *c;
+		} else if((unsigned char)*c < 0x20){
+			output += ' ';
+		} else {
+			output += *c;
+		}
+	}
+}
+
+/** Whether scopes are timed, and whether the sampling profiler is running and how often
+    it fires.  Changed under the hit_counter_list_add_mutex.
+*/
+static volatile bool timing_enabled = true;
+static volatile bool alloc_tracking = false;
+static bool sampling_enabled = false;
+static long sampling_interval_ns = 10000000;
+
+// The methods EnableCpuTime has selected.  The generation changes with the selection, so
+// each profile only has to look through it once after a change.
+static volatile uint32_t cpu_time_generation = 0;
+static bool cpu_time_all = false;
+static vector<string>* cpu_time_methods = NULL;
+
+/** Pushes a method onto our thread's signal-safe stack.
+*/
+static inline void sigPush(EnExThreadData* data, const char* methodName)
+{
+	int depth = data->sigDepth;
+	if(depth < ENEX_SAMPLE_DEPTH){
+		data->sigStack[ depth ] = methodName;
+	}
+	data->sigDepth = depth + 1;
+}
+
+/** Pops our thread's signal-safe stack.
+*/
+static inline void sigPop(EnExThreadData* data)
+{
+	data->sigDepth = data->sigDepth - 1;
+}
+
+#ifndef _WIN32
+/** Counts the stack our thread is in.  Runs in our SIGPROF handler, so it only reads our
+    thread's own data and never allocates or locks.
+*/
+static void recordSample(EnExThreadData* data)
+{
+	int depth = data->sigDepth;
+	if(depth > ENEX_SAMPLE_DEPTH){
+		depth = ENEX_SAMPLE_DEPTH;
+	}
+	if(depth < 0){
+		depth = 0;
+	}
+	const char* frames[ ENEX_SAMPLE_DEPTH ];
+	uintptr_t hash = (uintptr_t)depth;
+	for(int i = 0; i < depth; i++){
+		frames[i] = data->sigStack[i];
+		hash = hash * 31 + ((uintptr_t)frames[i] >> 3);
+	}
+
+	for(int probe = 0; probe < ENEX_SAMPLE_SLOTS; probe++){
+		EnExSampleSlot& slot = data->sampleSlots[ (hash + probe) % ENEX_SAMPLE_SLOTS ];
+		if(slot.used){
+			if(slot.depth != depth || memcmp(slot.frames, frames, depth * sizeof(const char*)) != 0){
+				continue;
+			}
+		} else {
+			slot.depth = depth;
+			memcpy(slot.frames, frames, depth * sizeof(const char*));
+			ENEX_BARRIER();
+			slot.used = 1;
+		}
+		slot.count = slot.count + 1;
+		return;
+	}
+	data->samplesDropped = data->samplesDropped + 1;
+}
+
+static void enexSampleHandler(int sig, siginfo_t* info, void* context)
+{
+	int savedErrno = errno;
+	EnExThreadData* data = our_thread_data;
+	if(data != NULL && data->sampleSlots != NULL){
+		recordSample(data);
+	}
+	errno = savedErrno;
+}
+#endif
+
+#ifdef __linux__
+/** Starts the given thread's cpu time timer.  The thread may have finished - then the
+    kernel turns us down and we leave it be.
+*/
+static void armSampleTimer(EnExThreadData* data)
+{
+	if(data->hasSampleTimer || data->kernelTid == 0){
+		return;
+	}
+	// The thread's cpu clock, by kernel thread id (what pthread_getcpuclockid works out)
+	clockid_t clock = (clockid_t)((~(unsigned int)data->kernelTid) << 3) | 6;
+	struct sigevent sev;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGPROF;
+#ifdef sigev_notify_thread_id
+	sev.sigev_notify_thread_id = data->kernelTid;
+#else
+	sev._sigev_un._tid = data->kernelTid;
+#endif
+	if(timer_create(clock, &sev, &data->sampleTimer) != 0){
+		return;
+	}
+	struct itimerspec its;
+	its.it_interval.tv_sec = sampling_interval_ns / 1000000000;
+	its.it_interval.tv_nsec = sampling_interval_ns % 1000000000;
+	its.it_value = its.it_interval;
+	timer_settime(data->sampleTimer, 0, &its, NULL);
+	data->hasSampleTimer = true;
+}
+
+static void disarmSampleTimer(EnExThreadData* data)
+{
+	if(data->hasSampleTimer){
+		timer_delete(data->sampleTimer);
+		data->hasSampleTimer = false;
+	}
+}
+#endif
+
+/** Gets a thread ready to be sampled.  Called under the hit_counter_list_add_mutex.
+*/
+static void startSamplingThread(EnExThreadData* data)
+{
+	if(data->sampleSlots == NULL){
+		EnExSampleSlot* slots = new EnExSampleSlot[ ENEX_SAMPLE_SLOTS ];
+		memset(slots, 0, sizeof(EnExSampleSlot) * ENEX_SAMPLE_SLOTS);
+		ENEX_BARRIER();
+		data->sampleSlots = slots;
+	}
+#ifdef __linux__
+	armSampleTimer(data);
+#endif
+}
+
 map<const char*, EnExProfile*>& GlobalHitCounter()
 {
 	if(global_hit_counter == NULL){
@@ -62,12 +467,12 @@ SLib::Mutex* GlobalHitCounterMutex()
 	return global_hit_counter_mutex;
 }
 
-vector< pair< THREAD_ID_TYPE, map< const char*, EnExProfile*>* > >& HitCounterList()
+vector< EnExThreadData* >& ThreadDataList()
 {
-	if(hit_counter_list == NULL){
-		hit_counter_list = new vector< pair< THREAD_ID_TYPE, map< const char*, EnExProfile*>* > >();
+	if(thread_data_list == NULL){
+		thread_data_list = new vector< EnExThreadData* >();
 	}
-	return *hit_counter_list;
+	return *thread_data_list;
 }
 
 SLib::Mutex* HitCounterListAddMutex()
@@ -78,14 +483,6 @@ SLib::Mutex* HitCounterListAddMutex()
 	return hit_counter_list_add_mutex;
 }
 
-vector< pair < THREAD_ID_TYPE, vector<const char*>* > >& StackTraceList()
-{
-	if(stack_trace_list == NULL){
-		stack_trace_list = new vector< pair< THREAD_ID_TYPE, vector<const char*>* > >();
-	}
-	return *stack_trace_list;
-}
-
 EnterExit::EnterExit(const char* methodName) : 
 	m_file(""),
 	m_line(0),
@@ -124,76 +521,456 @@ EnterExit::EnterExit(const char* file, int line, const char* methodName, bool sa
 
 void EnterExit::Init(void)
 {
-	m_hitCounter = FindOurHitCounter();
-	m_stackTrace = FindOurStackTrace();
+	EnExThreadData* our_data = FindOurThreadData();
+	m_data = our_data;
+	m_hitCounter = &(our_data->hitCounter);
+	m_stackTrace = &(our_data->stackTrace);
+	// Our own bookkeeping doesn't count against anyone's allocations.
+	m_outerProfile = our_data->currentProfile;
+	our_data->currentProfile = NULL;
 
-	map<const char*, EnExProfile*>::iterator it = m_hitCounter->find(m_methodName);
-	if(it != m_hitCounter->end()){
-		// keep track of this for exit timing.
-		m_methodProfile = it->second; 
-		m_methodProfile->HitsInc();
+	if(!timing_enabled){
+		// Just the stacks - no profile for this one.
+		m_methodProfile = NULL;
 	} else {
-		// keep track of this for exit timing.
-		m_methodProfile = new EnExProfile(m_methodName);
-		(*m_hitCounter)[ m_methodName ] = m_methodProfile;
+		map<const char*, EnExProfile*>::iterator it = m_hitCounter->find(m_methodName);
+		if(it != m_hitCounter->end()){
+			// keep track of this for exit timing.
+			m_methodProfile = it->second; 
+			m_methodProfile->HitsInc();
+		} else {
+			// keep track of this for exit timing.
+			m_methodProfile = new EnExProfile(m_methodName);
+			SLib::Lock map_lock(our_data->mapMutex);
+			(*m_hitCounter)[ m_methodName ] = m_methodProfile;
+		}
 	}
 
 	if(m_line) TRACE(m_file, m_line, "%s: Entering Method", m_methodName);
 	m_stackTrace->push_back(m_methodName);
-	m_methodEntryStamp = Timer::GetCycleCount();
+	sigPush(our_data, m_methodName);
+	if(m_methodProfile != NULL){
+		m_callNode = enterCall(our_data, m_methodName);
+		our_data->currentProfile = m_methodProfile;
+		m_cpuTimed = m_methodProfile->CpuTimed();
+		m_methodEntryStamp = Clock::Ticks();
+		if(m_cpuTimed){
+			m_cpuEntryStamp = Clock::ThreadCpuNanos();
+		}
+	} else {
+		our_data->currentProfile = m_outerProfile;
+	}
 }
 
-map<const char*, EnExProfile*>* EnterExit::FindOurHitCounter(void)
+EnExThreadData* EnterExit::FindOurThreadData(void)
 {
+	if(our_thread_data != NULL){
+		return our_thread_data;
+	}
+
+	// First time through on this thread.  Register our block - the list is only
+	// ever read or changed while holding the mutex.
 	THREAD_ID_TYPE tid = Thread::CurrentThreadId();
-	for(size_t i = 0, l = HitCounterList().size(); i < l; i++){
-		if(HitCounterList()[i].first == tid){
-			return HitCounterList()[i].second;
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	for(size_t i = 0, l = ThreadDataList().size(); i < l; i++){
+		if(ThreadDataList()[i]->tid == tid){
+			// A finished thread had our id - carry on with its numbers, as we always have.
+			our_thread_data = ThreadDataList()[i];
+			our_thread_data->sigDepth = 0;
+			our_thread_data->currentProfile = NULL;
+#ifdef __linux__
+			disarmSampleTimer(our_thread_data); // it was for the old thread
+			our_thread_data->kernelTid = (pid_t)syscall(SYS_gettid);
+#endif
+			if(sampling_enabled){
+				startSamplingThread(our_thread_data);
+			}
+			return our_thread_data;
 		}
 	}
-	// If we get here, then our tid was not in the list.  Add it in.
-	pair<THREAD_ID_TYPE, map<const char*, EnExProfile*>* > the_pair;
-	the_pair.first = tid;
-	the_pair.second = new map<const char*, EnExProfile*>();
-	{ // for scope
-		SLib::Lock the_lock(HitCounterListAddMutex());
-		HitCounterList().push_back(the_pair);
-	} // mutex released here
-	return the_pair.second;
+	EnExThreadData* data = new EnExThreadData();
+	data->tid = tid;
+#ifdef __linux__
+	data->kernelTid = (pid_t)syscall(SYS_gettid);
+#endif
+	if(sampling_enabled){
+		startSamplingThread(data);
+	}
+	our_thread_data = data;
+	ThreadDataList().push_back(data);
+	return our_thread_data;
 }
 
-vector<const char*>* EnterExit::FindOurStackTrace(void)
+map<const char*, EnExProfile*>* EnterExit::FindOurHitCounter(void)
 {
-	THREAD_ID_TYPE tid = Thread::CurrentThreadId();
-	for(size_t i = 0, l = StackTraceList().size(); i < l; i++){
-		if(StackTraceList()[i].first == tid){
-			return StackTraceList()[i].second;
-		}
-	}
+	return &(FindOurThreadData()->hitCounter);
+}
 
-	// If we get here, then our tid was not in the list.  Add it in.
-	pair<THREAD_ID_TYPE, vector<const char*>* > the_pair;
-	the_pair.first = tid;
-	the_pair.second = new vector<const char*>();
-	{ // for scope
-		SLib::Lock the_lock(HitCounterListAddMutex());
-		StackTraceList().push_back(the_pair);
-	} // mutex released here
-	return the_pair.second;
+vector<const char*>* EnterExit::FindOurStackTrace(void)
+{
+	return &(FindOurThreadData()->stackTrace);
 }
 
 EnterExit::~EnterExit()
 {
-	m_methodExitStamp = Timer::GetCycleCount();
+	if(m_methodProfile != NULL){
+		if(m_cpuTimed){
+			uint64_t cpuExit = Clock::ThreadCpuNanos();
+			m_methodExitStamp = Clock::Ticks();
+			m_methodProfile->RecordCpuTime(cpuExit - m_cpuEntryStamp,
+				Clock::Elapsed(m_methodEntryStamp, m_methodExitStamp));
+		} else {
+			m_methodExitStamp = Clock::Ticks();
+		}
+	}
 	if(m_line) TRACE(m_file, m_line, "%s: Exiting Method", m_methodName);
 	m_stackTrace->pop_back();
+	sigPop(m_data);
 
-	m_methodProfile->RecordEntryExit(m_methodEntryStamp, m_methodExitStamp);
+	if(m_methodProfile != NULL){
+		m_data->currentProfile = NULL;
+		m_methodProfile->RecordEntryExit(m_methodEntryStamp, m_methodExitStamp);
+		exitCall(m_data, m_callNode, m_methodExitStamp - m_methodEntryStamp);
+		if(trace_enabled){
+			traceCall(m_data, m_methodName, m_methodEntryStamp, m_methodExitStamp);
+		}
+	}
 
 	if(m_saveToGlobal){
 		// Save our whole hit counter map to the global aggregate
+		m_data->currentProfile = NULL;
 		SaveToGlobal();
 	}
+	m_data->currentProfile = m_outerProfile;
+}
+
+EnExCallSite::EnExCallSite(const char* methodName, int subsystem)
+{
+	m_methodName = methodName;
+	m_mask = (uint32_t)1 << (subsystem & 31);
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	m_id = next_call_site_id++;
+}
+
+void EnterExit::EnableProfiling(bool on)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	profiling_enabled = on;
+	EnExCallSite::Enabled = profiling_enabled ? enabled_subsystems : 0;
+}
+
+void EnterExit::EnableSubsystem(int subsystem, bool on)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	uint32_t mask = (uint32_t)1 << (subsystem & 31);
+	if(on){
+		enabled_subsystems |= mask;
+	} else {
+		enabled_subsystems &= ~mask;
+	}
+	EnExCallSite::Enabled = profiling_enabled ? enabled_subsystems : 0;
+}
+
+void EnterExitSite::Enter(EnExCallSite& site)
+{
+	m_data = EnterExit::FindOurThreadData();
+	m_outerProfile = m_data->currentProfile;
+	m_data->currentProfile = NULL; // our bookkeeping doesn't count against anyone
+	m_data->stackTrace.push_back(site.m_methodName);
+	sigPush(m_data, site.m_methodName);
+	if(!timing_enabled){
+		m_methodProfile = NULL;
+		m_data->currentProfile = m_outerProfile;
+		return;
+	}
+
+	if(site.m_id >= (int)m_data->siteProfiles.size()){
+		m_data->siteProfiles.resize( site.m_id + 1, NULL );
+	}
+	m_methodProfile = m_data->siteProfiles[ site.m_id ];
+	if(m_methodProfile != NULL){
+		m_methodProfile->HitsInc();
+	} else {
+		// First time through here on this thread.  Share the profile with any EnEx that
+		// uses the same name, so the reports show one line for it.
+		map<const char*, EnExProfile*>::iterator it = m_data->hitCounter.find(site.m_methodName);
+		if(it != m_data->hitCounter.end()){
+			m_methodProfile = it->second;
+			m_methodProfile->HitsInc();
+		} else {
+			m_methodProfile = new EnExProfile(site.m_methodName);
+			SLib::Lock map_lock(m_data->mapMutex);
+			m_data->hitCounter[ site.m_methodName ] = m_methodProfile;
+		}
+		m_data->siteProfiles[ site.m_id ] = m_methodProfile;
+	}
+
+	m_callNode = enterCall(m_data, site.m_methodName);
+	m_data->currentProfile = m_methodProfile;
+	m_cpuTimed = m_methodProfile->CpuTimed();
+	m_methodEntryStamp = Clock::Ticks();
+	if(m_cpuTimed){
+		m_cpuEntryStamp = Clock::ThreadCpuNanos();
+	}
+}
+
+void EnterExitSite::Exit(void)
+{
+	if(m_methodProfile == NULL){
+		m_data->stackTrace.pop_back();
+		sigPop(m_data);
+		return;
+	}
+	uint64_t cpuExit = m_cpuTimed ? Clock::ThreadCpuNanos() : 0;
+	uint64_t exitStamp = Clock::Ticks();
+	if(m_cpuTimed){
+		m_methodProfile->RecordCpuTime(cpuExit - m_cpuEntryStamp,
+			Clock::Elapsed(m_methodEntryStamp, exitStamp));
+	}
+	m_data->stackTrace.pop_back();
+	sigPop(m_data);
+	m_data->currentProfile = NULL;
+	m_methodProfile->RecordEntryExit(m_methodEntryStamp, exitStamp);
+	exitCall(m_data, m_callNode, exitStamp - m_methodEntryStamp);
+	if(trace_enabled){
+		traceCall(m_data, m_callNode->methodName, m_methodEntryStamp, exitStamp);
+	}
+	m_data->currentProfile = m_outerProfile;
+}
+
+void EnterExit::StartTracing(int eventsPerThread)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	if(eventsPerThread > 0){
+		trace_ring_size = eventsPerThread; // rings that already exist keep their size
+	}
+	trace_start_ticks = Clock::Ticks();
+	trace_enabled = true;
+}
+
+void EnterExit::StopTracing(void)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	trace_enabled = false;
+}
+
+void EnterExit::GetTraceEvents(twine& output)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+#ifdef _WIN32
+	unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+	unsigned long pid = (unsigned long)getpid();
+#endif
+	twine tmp;
+	bool first = true;
+	output += "{\"traceEvents\":[\n";
+	for(size_t t = 0, l = ThreadDataList().size(); t < l; t++){
+		EnExThreadData* data = ThreadDataList()[t];
+		if(data->traceRing == NULL){
+			continue;
+		}
+		unsigned long tid = (unsigned long)(uintptr_t)data->tid;
+		tmp.format("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,"
+			"\"args\":{\"name\":\"thread %lu\"}}", first ? "" : ",\n", pid, tid, tid);
+		output += tmp;
+		first = false;
+
+		// Copy out what the ring holds, then drop anything the thread overwrote while we
+		// were copying.
+		uint64_t count = data->traceCount;
+		ENEX_BARRIER();
+		uint64_t size = (uint64_t)data->traceSize;
+		uint64_t from = count > size ? count - size : 0;
+		vector<EnExTraceEvent> events;
+		events.reserve( (size_t)(count - from) );
+		for(uint64_t i = from; i < count; i++){
+			events.push_back( data->traceRing[ i % size ] );
+		}
+		ENEX_BARRIER();
+		uint64_t after = data->traceCount;
+		uint64_t valid = after > size ? after - size : 0;
+
+		for(uint64_t i = from; i < count; i++){
+			EnExTraceEvent& ev = events[ (size_t)(i - from) ];
+			if(i < valid || ev.begin < trace_start_ticks){
+				continue;
+			}
+			output += ",\n{\"name\":\"";
+			jsonEscape(output, ev.methodName);
+			tmp.format("\",\"cat\":\"enex\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu}",
+				Clock::TicksToNanos(ev.begin - trace_start_ticks) / 1000.0,
+				Clock::Elapsed(ev.begin, ev.end) / 1000.0,
+				pid, tid);
+			output += tmp;
+		}
+	}
+	output += "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void EnterExit::EnableAllocTracking(bool on)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	alloc_tracking = on;
+}
+
+void EnterExit::RecordAllocation(size_t bytes)
+{
+	if(!alloc_tracking){
+		return;
+	}
+	// Only threads that already have a block - registering one would allocate.
+	EnExThreadData* data = our_thread_data;
+	if(data == NULL){
+		return;
+	}
+	EnExProfile* profile = data->currentProfile;
+	if(profile != NULL){
+		profile->RecordAllocation(bytes);
+	}
+}
+
+void EnterExit::EnableCpuTime(const char* methodName, bool on)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	if(methodName == NULL){
+		cpu_time_all = on;
+	} else {
+		if(cpu_time_methods == NULL){
+			cpu_time_methods = new vector<string>();
+		}
+		vector<string>::iterator it;
+		for(it = cpu_time_methods->begin(); it != cpu_time_methods->end(); it++){
+			if(*it == methodName){
+				break;
+			}
+		}
+		if(on && it == cpu_time_methods->end()){
+			cpu_time_methods->push_back(methodName);
+		} else if(!on && it != cpu_time_methods->end()){
+			cpu_time_methods->erase(it);
+		}
+	}
+	cpu_time_generation = cpu_time_generation + 1;
+}
+
+void EnterExit::EnableTiming(bool on)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	timing_enabled = on;
+}
+
+bool EnterExit::StartSampling(int hz)
+{
+#ifdef _WIN32
+	return false;
+#else
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	if(sampling_enabled){
+		return true;
+	}
+	if(hz <= 0){
+		hz = 100;
+	}
+	sampling_interval_ns = 1000000000L / hz;
+
+	// Our handler stays installed after we stop, in case a signal is still on its way.
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = enexSampleHandler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if(sigaction(SIGPROF, &sa, NULL) != 0){
+		return false;
+	}
+
+	sampling_enabled = true;
+	for(size_t i = 0, l = ThreadDataList().size(); i < l; i++){
+		startSamplingThread(ThreadDataList()[i]);
+	}
+#ifndef __linux__
+	// No per-thread timers - the kernel sends SIGPROF to whichever thread is using the cpu.
+	struct itimerval itv;
+	itv.it_interval.tv_sec = sampling_interval_ns / 1000000000;
+	itv.it_interval.tv_usec = (sampling_interval_ns % 1000000000) / 1000;
+	itv.it_value = itv.it_interval;
+	setitimer(ITIMER_PROF, &itv, NULL);
+#endif
+	return true;
+#endif
+}
+
+void EnterExit::StopSampling(void)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+	if(!sampling_enabled){
+		return;
+	}
+	sampling_enabled = false;
+#ifdef __linux__
+	for(size_t i = 0, l = ThreadDataList().size(); i < l; i++){
+		disarmSampleTimer(ThreadDataList()[i]);
+	}
+#elif !defined(_WIN32)
+	struct itimerval itv;
+	memset(&itv, 0, sizeof(itv));
+	setitimer(ITIMER_PROF, &itv, NULL);
+#endif
+}
+
+void EnterExit::GetSampledStacks(twine& output, bool reset)
+{
+	SLib::Lock the_lock(HitCounterListAddMutex());
+
+	// The same stack on different threads is one line.
+	map<string, uint64_t> stacks;
+	uint64_t dropped = 0;
+	for(size_t t = 0, l = ThreadDataList().size(); t < l; t++){
+		EnExThreadData* data = ThreadDataList()[t];
+		if(data->sampleSlots == NULL){
+			continue;
+		}
+		for(int i = 0; i < ENEX_SAMPLE_SLOTS; i++){
+			EnExSampleSlot& slot = data->sampleSlots[i];
+			if(!slot.used){
+				continue;
+			}
+			ENEX_BARRIER();
+			uint64_t count = slot.count;
+			uint64_t samples = count - slot.reported;
+			if(reset){
+				slot.reported = count;
+			}
+			if(samples == 0){
+				continue;
+			}
+			string key;
+			for(int f = 0; f < slot.depth; f++){
+				if(f != 0){
+					key += ";";
+				}
+				for(const char* c = slot.frames[f]; *c != '\0'; c++){
+					key += (*c == ';') ? ',' : *c;
+				}
+			}
+			if(slot.depth == 0){
+				key = "(outside EnEx)";
+			}
+			stacks[key] += samples;
+		}
+		dropped += data->samplesDropped;
+	}
+
+	twine tmp;
+	map<string, uint64_t>::iterator it;
+	for(it = stacks.begin(); it != stacks.end(); it++){
+		tmp.format("%s %llu\n", it->first.c_str(), (unsigned long long)it->second);
+		output += tmp;
+	}
+	if(dropped != 0){
+		tmp.format("(sample table full) %llu\n", (unsigned long long)dropped);
+		output += tmp;
+	}
 }
 
 void EnterExit::PrintStackTrace(void)
@@ -217,13 +994,27 @@ void EnterExit::PrintStackTrace(int channel)
 }
 
 twine EnterExit::GetStackTrace(void)
+{
+	return FormatStackTrace( Thread::CurrentThreadId(), *FindOurStackTrace() );
+}
+
+void EnterExit::GetStackFrames(vector<const char*>& frames)
+{
+	EnExThreadData* data = our_thread_data;
+	if(data == NULL){
+		frames.clear();
+		return;
+	}
+	frames = data->stackTrace;
+}
+
+twine EnterExit::FormatStackTrace(THREAD_ID_TYPE tid, const vector<const char*>& frames)
 {
 	twine tmp, msg;
-	tmp.format("Stack trace for thread: %d\n", (uint32_t)(intptr_t)Thread::CurrentThreadId() );
+	tmp.format("Stack trace for thread: %d\n", (uint32_t)(intptr_t)tid );
 	msg += tmp;
-	vector<const char*>* stack_trace = FindOurStackTrace();
-	for(int i = 0; i < (int)stack_trace->size(); i++){
-		tmp.format("\t%s\n", stack_trace->at( i ) );
+	for(int i = 0; i < (int)frames.size(); i++){
+		tmp.format("\t%s\n", frames[i] );
 		msg += tmp;
 	}
 	return msg;
@@ -254,15 +1045,25 @@ void EnterExit::SaveToGlobal(void)
 			GlobalHitCounter()[ our_it->first ] = glob_method_profile;
 		}
 
-		// Now update the global method profile with our information:
-		glob_method_profile->Add( *(our_it->second) );
-
-		// After adding it to the global profile, remember to zero out our values
-		// so that we don't double things up in the global profile later.
-		our_it->second->Reset();
+		// Now update the global method profile with what has happened since we last
+		// did this.  Our own numbers are left alone, so EnExSnapshot still sees them.
+		EnExProfile* saved = m_data->savedCounters[ our_it->first ];
+		if(saved == NULL){
+			glob_method_profile->Add( *(our_it->second) );
+			m_data->savedCounters[ our_it->first ] = new EnExProfile( *(our_it->second) );
+		} else {
+			EnExProfile delta( *(our_it->second) );
+			delta.Subtract( *saved );
+			glob_method_profile->Add( delta );
+			*saved = *(our_it->second);
+		}
 
 	}
 
+	// And the same for our call tree
+	mergeCallTree(GlobalCallTree(), m_data->callRoot);
+	resetCallTree(m_data->callRoot);
+
 	// Exiting this method releases the lock on the global hit counter map.
 }
 
@@ -270,27 +1071,51 @@ void EnterExit::PrintHitMap(void)
 {
 	map<const char*, EnExProfile*>* hit_counters = FindOurHitCounter();
 	map<const char*, EnExProfile*>::iterator it;
-	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%12s\t%12s\t%12s\t%12s\t%12s\t%14s\t%16s\t%16s\n",
 		"Method Name",
 		"Total Hits",
-		"Average Cycles",
-		"Min Cycles",
-		"Max Cycles",
-		"Total Cycles");
-	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+		"Average ns",
+		"Min ns",
+		"Max ns",
+		"Total ns",
+		"p50 ns",
+		"p90 ns",
+		"p99 ns",
+		"p99.9 ns",
+		"Allocs",
+		"Alloc bytes",
+		"CPU ns",
+		"Off-CPU ns");
+	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%12s\t%12s\t%12s\t%12s\t%12s\t%14s\t%16s\t%16s\n",
 		"===========",
 		"==========",
-		"==============",
-		"==========",
 		"==========",
-		"============");
+		"======",
+		"======",
+		"========",
+		"======",
+		"======",
+		"======",
+		"========",
+		"======",
+		"===========",
+		"======",
+		"==========");
 	for(it = hit_counters->begin(); it != hit_counters->end(); it++){
-		printf("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
+		printf("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%12.0f\t%12.0f\t%12.0f\t%12.0f\t%12llu\t%14llu\t%16.0f\t%16.0f\n",
 			it->first, it->second->Hits(),
 			it->second->AvgTime(),
 			it->second->MinTime(),
 			it->second->MaxTime(),
-			it->second->TotalTime()
+			it->second->TotalTime(),
+			it->second->Percentile(50),
+			it->second->Percentile(90),
+			it->second->Percentile(99),
+			it->second->Percentile(99.9),
+			(unsigned long long)it->second->Allocations(),
+			(unsigned long long)it->second->AllocatedBytes(),
+			it->second->CpuTime(),
+			it->second->OffCpuTime()
 		);
 		if(it->second->StopProfile()){
 			printf("\tProfiling stopped after a thousand hits with an average less than 0.0001\n");
@@ -300,28 +1125,53 @@ void EnterExit::PrintHitMap(void)
 
 void EnterExit::PrintGlobalHitMap(void)
 {
+	SLib::Lock the_lock(GlobalHitCounterMutex());
 	map<const char*, EnExProfile*>::iterator it;
-	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%12s\t%12s\t%12s\t%12s\t%12s\t%14s\t%16s\t%16s\n",
 		"Method Name",
 		"Total Hits",
-		"Average Cycles",
-		"Min Cycles",
-		"Max Cycles",
-		"Total Cycles");
-	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+		"Average ns",
+		"Min ns",
+		"Max ns",
+		"Total ns",
+		"p50 ns",
+		"p90 ns",
+		"p99 ns",
+		"p99.9 ns",
+		"Allocs",
+		"Alloc bytes",
+		"CPU ns",
+		"Off-CPU ns");
+	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%12s\t%12s\t%12s\t%12s\t%12s\t%14s\t%16s\t%16s\n",
 		"===========",
 		"==========",
-		"==============",
 		"==========",
-		"==========",
-		"============");
+		"======",
+		"======",
+		"========",
+		"======",
+		"======",
+		"======",
+		"========",
+		"======",
+		"===========",
+		"======",
+		"==========");
 	for(it = GlobalHitCounter().begin(); it != GlobalHitCounter().end(); it++){
-		printf("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
+		printf("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%12.0f\t%12.0f\t%12.0f\t%12.0f\t%12llu\t%14llu\t%16.0f\t%16.0f\n",
 			it->first, it->second->Hits(),
 			it->second->AvgTime(),
 			it->second->MinTime(),
 			it->second->MaxTime(),
-			it->second->TotalTime()
+			it->second->TotalTime(),
+			it->second->Percentile(50),
+			it->second->Percentile(90),
+			it->second->Percentile(99),
+			it->second->Percentile(99.9),
+			(unsigned long long)it->second->Allocations(),
+			(unsigned long long)it->second->AllocatedBytes(),
+			it->second->CpuTime(),
+			it->second->OffCpuTime()
 		);
 		if(it->second->StopProfile()){
 			printf("\tProfiling stopped after a thousand hits with an average less than 0.0001\n");
@@ -329,44 +1179,76 @@ void EnterExit::PrintGlobalHitMap(void)
 	}
 }
 
-void EnterExit::PrintGlobalHitMap(twine& output)
+void EnterExit::PrintGlobalHitMap(twine& output, bool reset)
 {
+	SLib::Lock the_lock(GlobalHitCounterMutex());
 	twine tmp;
 	map<const char*, EnExProfile*>::iterator it;
-	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%12s\t%12s\t%12s\t%12s\t%12s\t%14s\t%16s\t%16s\n",
 		"Method Name",
 		"Total Hits",
-		"Average Cycles",
-		"Min Cycles",
-		"Max Cycles",
-		"Total Cycles");
+		"Average ns",
+		"Min ns",
+		"Max ns",
+		"Total ns",
+		"p50 ns",
+		"p90 ns",
+		"p99 ns",
+		"p99.9 ns",
+		"Allocs",
+		"Alloc bytes",
+		"CPU ns",
+		"Off-CPU ns");
 	output += tmp;
-	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%12s\t%12s\t%12s\t%12s\t%12s\t%14s\t%16s\t%16s\n",
 		"===========",
 		"==========",
-		"==============",
-		"==========",
 		"==========",
-		"============");
+		"======",
+		"======",
+		"========",
+		"======",
+		"======",
+		"======",
+		"========",
+		"======",
+		"===========",
+		"======",
+		"==========");
 	output += tmp;
 	for(it = GlobalHitCounter().begin(); it != GlobalHitCounter().end(); it++){
-		tmp.format("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
+		tmp.format("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%12.0f\t%12.0f\t%12.0f\t%12.0f\t%12llu\t%14llu\t%16.0f\t%16.0f\n",
 			it->first, it->second->Hits(),
 			it->second->AvgTime(),
 			it->second->MinTime(),
 			it->second->MaxTime(),
-			it->second->TotalTime()
+			it->second->TotalTime(),
+			it->second->Percentile(50),
+			it->second->Percentile(90),
+			it->second->Percentile(99),
+			it->second->Percentile(99.9),
+			(unsigned long long)it->second->Allocations(),
+			(unsigned long long)it->second->AllocatedBytes(),
+			it->second->CpuTime(),
+			it->second->OffCpuTime()
 		);
 		output += tmp;
 		if(it->second->StopProfile()){
 			tmp.format("\tProfiling stopped after a thousand hits with an average less than 0.0001\n");
 			output += tmp;
 		}
+		if(reset){
+			it->second->Reset();
+		}
+	}
+	if(reset){
+		resetCallTree(GlobalCallTree());
 	}
 }
 
-void EnterExit::RecordGlobalHitMap(xmlNodePtr node)
+void EnterExit::RecordGlobalHitMap(xmlNodePtr node, bool reset)
 {
+	SLib::Lock the_lock(GlobalHitCounterMutex());
 	twine tmp;
 	map<const char*, EnExProfile*>::iterator it;
 
@@ -375,22 +1257,76 @@ void EnterExit::RecordGlobalHitMap(xmlNodePtr node)
 		xmlSetProp(child, (const xmlChar*)"MethodName", (const xmlChar*)it->first);
 		tmp.format("%ld", it->second->Hits());
 		xmlSetProp(child, (const xmlChar*)"TotalHits", tmp);
-		tmp.format("%ld", (long)it->second->AvgTime());
+		// The Cycles attributes have always been microseconds - keep them that way for
+		// anyone reading them, and give the full resolution in the Nanos ones.
+		tmp.format("%ld", (long)(it->second->AvgTime() / 1000));
 		xmlSetProp(child, (const xmlChar*)"AverageCycles", tmp);
-		tmp.format("%ld", (long)it->second->MinTime());
+		tmp.format("%ld", (long)(it->second->MinTime() / 1000));
 		xmlSetProp(child, (const xmlChar*)"MinCycles", tmp);
-		tmp.format("%ld", (long)it->second->MaxTime());
+		tmp.format("%ld", (long)(it->second->MaxTime() / 1000));
 		xmlSetProp(child, (const xmlChar*)"MaxCycles", tmp);
-		tmp.format("%ld", (long)it->second->TotalTime());
+		tmp.format("%ld", (long)(it->second->TotalTime() / 1000));
 		xmlSetProp(child, (const xmlChar*)"TotalCycles", tmp);
+		tmp.format("%.0f", it->second->AvgTime());
+		xmlSetProp(child, (const xmlChar*)"AverageNanos", tmp);
+		tmp.format("%.0f", it->second->MinTime());
+		xmlSetProp(child, (const xmlChar*)"MinNanos", tmp);
+		tmp.format("%.0f", it->second->MaxTime());
+		xmlSetProp(child, (const xmlChar*)"MaxNanos", tmp);
+		tmp.format("%.0f", it->second->TotalTime());
+		xmlSetProp(child, (const xmlChar*)"TotalNanos", tmp);
+		tmp.format("%.0f", it->second->Percentile(50));
+		xmlSetProp(child, (const xmlChar*)"P50Nanos", tmp);
+		tmp.format("%.0f", it->second->Percentile(90));
+		xmlSetProp(child, (const xmlChar*)"P90Nanos", tmp);
+		tmp.format("%.0f", it->second->Percentile(99));
+		xmlSetProp(child, (const xmlChar*)"P99Nanos", tmp);
+		tmp.format("%.0f", it->second->Percentile(99.9));
+		xmlSetProp(child, (const xmlChar*)"P999Nanos", tmp);
+		tmp.format("%llu", (unsigned long long)it->second->Allocations());
+		xmlSetProp(child, (const xmlChar*)"Allocations", tmp);
+		tmp.format("%llu", (unsigned long long)it->second->AllocatedBytes());
+		xmlSetProp(child, (const xmlChar*)"AllocatedBytes", tmp);
+		tmp.format("%llu", (unsigned long long)it->second->CpuHits());
+		xmlSetProp(child, (const xmlChar*)"CpuHits", tmp);
+		tmp.format("%.0f", it->second->CpuTime());
+		xmlSetProp(child, (const xmlChar*)"CpuNanos", tmp);
+		tmp.format("%.0f", it->second->OffCpuTime());
+		xmlSetProp(child, (const xmlChar*)"OffCpuNanos", tmp);
+		if(reset){
+			it->second->Reset();
+		}
+	}
+
+	xmlNodePtr tree = xmlNewChild(node, NULL, (const xmlChar*)"CallTree", NULL);
+	recordCallTree(tree, GlobalCallTree());
+	if(reset){
+		resetCallTree(GlobalCallTree());
+	}
+}
+
+void EnterExit::GetFoldedStacks(twine& output, bool reset)
+{
+	SLib::Lock the_lock(GlobalHitCounterMutex());
+	foldCallTree(GlobalCallTree(), twine(), output);
+	if(reset){
+		resetCallTree(GlobalCallTree());
 	}
 }
 
 EnExProfile::EnExProfile(const char* methodName)
 {
 	m_methodName = methodName;
+	m_seq = 0;
 	m_hits = 1;	
 	m_totalTime = 0;
+	m_allocs = 0;
+	m_allocBytes = 0;
+	m_cpuHits = 0;
+	m_cpuTime = 0;
+	m_offCpuTime = 0;
+	m_cpuGeneration = 0;
+	m_cpuTimed = false;
 	m_minTime = 0;
 	m_maxTime = 0;
 	m_stopProfile = false;
@@ -407,18 +1343,30 @@ void EnExProfile::Reset(void)
 	m_totalTime = 0;
 	m_minTime = 0;
 	m_maxTime = 0;
+	m_allocs = 0;
+	m_allocBytes = 0;
+	m_cpuHits = 0;
+	m_cpuTime = 0;
+	m_offCpuTime = 0;
+	m_histogram.Reset();
 }
 
 void EnExProfile::Add( const EnExProfile& eep)
 {
 	m_hits += eep.m_hits;
 	m_totalTime += eep.m_totalTime;
-	if(eep.m_minTime < m_minTime){
+	if(m_minTime == 0 || (eep.m_minTime != 0 && eep.m_minTime < m_minTime)){
 		m_minTime = eep.m_minTime;
 	}
 	if(eep.m_maxTime > m_maxTime){
 		m_maxTime = eep.m_maxTime;
 	}
+	m_allocs += eep.m_allocs;
+	m_allocBytes += eep.m_allocBytes;
+	m_cpuHits += eep.m_cpuHits;
+	m_cpuTime += eep.m_cpuTime;
+	m_offCpuTime += eep.m_offCpuTime;
+	m_histogram.Add( eep.m_histogram );
 }
 
 unsigned long EnExProfile::Hits(void)
@@ -448,22 +1396,35 @@ void EnExProfile::StopProfile(bool tf)
 
 double EnExProfile::AvgTime(void)
 {
+	if(m_hits == 0){
+		return 0.0;
+	}
 	return TotalTime() / m_hits * 1.0;
 }
 
 double EnExProfile::MinTime(void)
 {
-	return (double)m_minTime;
+	return (double)Clock::TicksToNanos(m_minTime);
 }
 
 double EnExProfile::MaxTime(void)
 {
-	return (double)m_maxTime;
+	return (double)Clock::TicksToNanos(m_maxTime);
 }
 
 double EnExProfile::TotalTime(void)
 {
-	return (double)m_totalTime;
+	return (double)Clock::TicksToNanos(m_totalTime);
+}
+
+double EnExProfile::Percentile(double pct)
+{
+	return (double)m_histogram.Percentile(pct);
+}
+
+const EnExHistogram& EnExProfile::Histogram(void)
+{
+	return m_histogram;
 }
 
 void EnExProfile::RecordEntryExit(uint64_t entry, uint64_t exit)
@@ -473,6 +1434,10 @@ void EnExProfile::RecordEntryExit(uint64_t entry, uint64_t exit)
 		diff = 0;
 	}
 
+	// Let anyone taking a Snapshot know we are part way through changing things.
+	m_seq = m_seq + 1;
+	ENEX_BARRIER();
+
 	// Add To the total time:
 	m_totalTime += diff;
 
@@ -486,4 +1451,484 @@ void EnExProfile::RecordEntryExit(uint64_t entry, uint64_t exit)
 		m_maxTime = diff;
 	}
 
+	m_histogram.Record( Clock::TicksToNanos(diff) );
+
+	ENEX_BARRIER();
+	m_seq = m_seq + 1;
+}
+
+const char* EnExProfile::MethodName(void)
+{
+	return m_methodName;
+}
+
+uint64_t EnExProfile::Allocations(void)
+{
+	return m_allocs;
+}
+
+uint64_t EnExProfile::AllocatedBytes(void)
+{
+	return m_allocBytes;
+}
+
+void EnExProfile::RecordAllocation(size_t bytes)
+{
+	m_allocs++;
+	m_allocBytes += bytes;
+}
+
+uint64_t EnExProfile::CpuHits(void)
+{
+	return m_cpuHits;
+}
+
+double EnExProfile::CpuTime(void)
+{
+	return (double)m_cpuTime;
+}
+
+double EnExProfile::OffCpuTime(void)
+{
+	return (double)m_offCpuTime;
+}
+
+void EnExProfile::RecordCpuTime(uint64_t cpuNanos, uint64_t wallNanos)
+{
+	m_seq = m_seq + 1;
+	ENEX_BARRIER();
+
+	m_cpuHits++;
+	m_cpuTime += cpuNanos;
+	// The two clocks tick differently (windows counts cpu time in quanta), so a busy call
+	// can show a little more cpu than wall time.
+	if(wallNanos > cpuNanos){
+		m_offCpuTime += wallNanos - cpuNanos;
+	}
+
+	ENEX_BARRIER();
+	m_seq = m_seq + 1;
+}
+
+bool EnExProfile::CpuTimed(void)
+{
+	if(m_cpuGeneration != cpu_time_generation){
+		// The selection has changed since we last looked.
+		SLib::Lock the_lock(HitCounterListAddMutex());
+		m_cpuTimed = cpu_time_all;
+		for(size_t i = 0; !m_cpuTimed && cpu_time_methods != NULL && i < cpu_time_methods->size(); i++){
+			m_cpuTimed = (*cpu_time_methods)[i] == m_methodName;
+		}
+		m_cpuGeneration = cpu_time_generation;
+	}
+	return m_cpuTimed;
+}
+
+void EnExProfile::Snapshot(EnExProfile& copy)
+{
+	// The numbers that go together are read again if the owning thread changed them as we
+	// read - it only ever holds them for a few instructions.
+	uint32_t before, after;
+	for(int tries = 0; tries < 1000; tries++){
+		before = m_seq;
+		ENEX_BARRIER();
+		copy.m_hits = *(volatile uint64_t*)&m_hits;
+		copy.m_totalTime = *(volatile uint64_t*)&m_totalTime;
+		copy.m_minTime = *(volatile uint64_t*)&m_minTime;
+		copy.m_maxTime = *(volatile uint64_t*)&m_maxTime;
+		copy.m_cpuHits = *(volatile uint64_t*)&m_cpuHits;
+		copy.m_cpuTime = *(volatile uint64_t*)&m_cpuTime;
+		copy.m_offCpuTime = *(volatile uint64_t*)&m_offCpuTime;
+		ENEX_BARRIER();
+		after = m_seq;
+		if(before == after && (before & 1) == 0){
+			break;
+		}
+	}
+	copy.m_allocs = *(volatile uint64_t*)&m_allocs;
+	copy.m_allocBytes = *(volatile uint64_t*)&m_allocBytes;
+	copy.m_methodName = m_methodName;
+	copy.m_stopProfile = m_stopProfile;
+	m_histogram.Snapshot( copy.m_histogram );
+}
+
+void EnExProfile::Subtract(const EnExProfile& earlier)
+{
+	m_hits = m_hits > earlier.m_hits ? m_hits - earlier.m_hits : 0;
+	m_totalTime = m_totalTime > earlier.m_totalTime ? m_totalTime - earlier.m_totalTime : 0;
+	m_allocs = m_allocs > earlier.m_allocs ? m_allocs - earlier.m_allocs : 0;
+	m_allocBytes = m_allocBytes > earlier.m_allocBytes ? m_allocBytes - earlier.m_allocBytes : 0;
+	m_cpuHits = m_cpuHits > earlier.m_cpuHits ? m_cpuHits - earlier.m_cpuHits : 0;
+	m_cpuTime = m_cpuTime > earlier.m_cpuTime ? m_cpuTime - earlier.m_cpuTime : 0;
+	m_offCpuTime = m_offCpuTime > earlier.m_offCpuTime ? m_offCpuTime - earlier.m_offCpuTime : 0;
+	m_histogram.Subtract( earlier.m_histogram );
+	if(m_histogram.Count() == 0){
+		m_minTime = 0;
+		m_maxTime = 0;
+	} else {
+		// Our min and max are for all time - narrow them down to the buckets that are left.
+		uint64_t low = Clock::NanosToTicks( m_histogram.Min() );
+		uint64_t high = Clock::NanosToTicks( m_histogram.Max() );
+		if(low > m_minTime){
+			m_minTime = low;
+		}
+		if(high < m_maxTime){
+			m_maxTime = high;
+		}
+	}
+
+}
+
+EnExHistogram::EnExHistogram()
+{
+	Reset();
+}
+
+void EnExHistogram::Reset(void)
+{
+	memset(m_counts, 0, sizeof(m_counts));
+	m_count = 0;
+	m_max = 0;
+}
+
+int EnExHistogram::BucketFor(uint64_t nanos)
+{
+	if(nanos < 2 * ENEX_HISTOGRAM_SUB_COUNT){
+		// The first two powers of two are one bucket per value
+		return (int)nanos;
+	}
+	if(nanos >= ((uint64_t)1 << ENEX_HISTOGRAM_MAX_BITS)){
+		return ENEX_HISTOGRAM_BUCKETS - 1;
+	}
+#ifdef _WIN32
+	unsigned long top;
+	_BitScanReverse64(&top, nanos);
+	int msb = (int)top;
+#else
+	int msb = 63 - __builtin_clzll(nanos);
+#endif
+	// Keep the top ENEX_HISTOGRAM_SUB_BITS + 1 bits: the leading one picks the power of two,
+	// and the rest pick the sub-bucket within it.
+	int shift = msb - ENEX_HISTOGRAM_SUB_BITS;
+	return (shift + 1) * ENEX_HISTOGRAM_SUB_COUNT + (int)(nanos >> shift) - ENEX_HISTOGRAM_SUB_COUNT;
+}
+
+uint64_t EnExHistogram::BucketTop(int bucket)
+{
+	if(bucket < 2 * ENEX_HISTOGRAM_SUB_COUNT){
+		return (uint64_t)bucket;
+	}
+	if(bucket >= ENEX_HISTOGRAM_BUCKETS - 1){
+		return (uint64_t)-1;
+	}
+	int shift = bucket / ENEX_HISTOGRAM_SUB_COUNT - 1;
+	uint64_t sub = (uint64_t)(bucket % ENEX_HISTOGRAM_SUB_COUNT + ENEX_HISTOGRAM_SUB_COUNT);
+	return ((sub + 1) << shift) - 1;
+}
+
+void EnExHistogram::Record(uint64_t nanos)
+{
+	m_counts[ BucketFor(nanos) ]++;
+	m_count++;
+	if(nanos > m_max){
+		m_max = nanos;
+	}
+}
+
+void EnExHistogram::Add(const EnExHistogram& other)
+{
+	for(int i = 0; i < ENEX_HISTOGRAM_BUCKETS; i++){
+		m_counts[i] += other.m_counts[i];
+	}
+	m_count += other.m_count;
+	if(other.m_max > m_max){
+		m_max = other.m_max;
+	}
+}
+
+void EnExHistogram::Subtract(const EnExHistogram& earlier)
+{
+	int highest = -1;
+	for(int i = 0; i < ENEX_HISTOGRAM_BUCKETS; i++){
+		m_counts[i] = m_counts[i] > earlier.m_counts[i] ? m_counts[i] - earlier.m_counts[i] : 0;
+		if(m_counts[i] != 0){
+			highest = i;
+		}
+	}
+	m_count = m_count > earlier.m_count ? m_count - earlier.m_count : 0;
+	if(highest < 0){
+		m_max = 0;
+	} else if(BucketTop(highest) < m_max){
+		m_max = BucketTop(highest);
+	}
+}
+
+void EnExHistogram::Snapshot(EnExHistogram& copy) const
+{
+	const volatile uint64_t* counts = m_counts;
+	for(int i = 0; i < ENEX_HISTOGRAM_BUCKETS; i++){
+		copy.m_counts[i] = counts[i];
+	}
+	copy.m_count = *(const volatile uint64_t*)&m_count;
+	copy.m_max = *(const volatile uint64_t*)&m_max;
+}
+
+uint64_t EnExHistogram::Count(void) const
+{
+	return m_count;
+}
+
+uint64_t EnExHistogram::Min(void) const
+{
+	for(int i = 0; i < ENEX_HISTOGRAM_BUCKETS; i++){
+		if(m_counts[i] != 0){
+			return i == 0 ? 0 : BucketTop(i - 1) + 1;
+		}
+	}
+	return 0;
+}
+
+uint64_t EnExHistogram::Max(void) const
+{
+	return m_max;
+}
+
+uint64_t EnExHistogram::Percentile(double pct) const
+{
+	if(m_count == 0){
+		return 0;
+	}
+	// The rank of the call we want, counting from 1
+	uint64_t want = (uint64_t)((pct / 100.0) * m_count + 0.5);
+	if(want < 1){
+		want = 1;
+	}
+	if(want > m_count){
+		want = m_count;
+	}
+	uint64_t seen = 0;
+	for(int i = 0; i < ENEX_HISTOGRAM_BUCKETS; i++){
+		seen += m_counts[i];
+		if(seen >= want){
+			uint64_t top = BucketTop(i);
+			return top < m_max ? top : m_max;
+		}
+	}
+	return m_max;
+}
+
+EnExSnapshot::EnExSnapshot()
+{
+
+}
+
+EnExSnapshot::~EnExSnapshot()
+{
+	Clear();
+}
+
+void EnExSnapshot::Clear(void)
+{
+	map<const char*, EnExProfile*>::iterator it;
+	for(size_t i = 0; i < m_threads.size(); i++){
+		for(it = m_threads[i]->begin(); it != m_threads[i]->end(); it++){
+			delete it->second;
+		}
+		delete m_threads[i];
+	}
+	m_threads.clear();
+	m_tids.clear();
+	for(it = m_global.begin(); it != m_global.end(); it++){
+		delete it->second;
+	}
+	m_global.clear();
+}
+
+void EnExSnapshot::Take(void)
+{
+	Clear();
+
+	// Copy the list of threads, so new threads don't wait on us while we read.
+	vector<EnExThreadData*> threads;
+	{
+		SLib::Lock the_lock(HitCounterListAddMutex());
+		threads = ThreadDataList();
+	}
+
+	for(size_t i = 0; i < threads.size(); i++){
+		EnExThreadData* data = threads[i];
+		map<const char*, EnExProfile*>* profiles = new map<const char*, EnExProfile*>();
+		{
+			// Only held by the owning thread when it adds a method it hasn't seen before.
+			SLib::Lock map_lock(data->mapMutex);
+			map<const char*, EnExProfile*>::iterator it;
+			for(it = data->hitCounter.begin(); it != data->hitCounter.end(); it++){
+				EnExProfile* copy = new EnExProfile(it->first);
+				it->second->Snapshot( *copy );
+				(*profiles)[ it->first ] = copy;
+			}
+		}
+		m_tids.push_back(data->tid);
+		m_threads.push_back(profiles);
+		CopyProfiles(m_global, *profiles);
+	}
+}
+
+void EnExSnapshot::Difference(const EnExSnapshot& later, const EnExSnapshot& earlier)
+{
+	Clear();
+	// Threads are only ever added to the end of the list, so thread i is the same
+	// thread in both.
+	for(size_t i = 0; i < later.m_threads.size(); i++){
+		map<const char*, EnExProfile*>* profiles = new map<const char*, EnExProfile*>();
+		CopyProfiles(*profiles, *later.m_threads[i]);
+		if(i < earlier.m_threads.size()){
+			map<const char*, EnExProfile*>::iterator it;
+			for(it = profiles->begin(); it != profiles->end(); it++){
+				map<const char*, EnExProfile*>::const_iterator was =
+					earlier.m_threads[i]->find(it->first);
+				if(was != earlier.m_threads[i]->end()){
+					it->second->Subtract( *(was->second) );
+				}
+			}
+		}
+		m_tids.push_back(later.m_tids[i]);
+		m_threads.push_back(profiles);
+		CopyProfiles(m_global, *profiles);
+	}
+}
+
+void EnExSnapshot::CopyProfiles(map<const char*, EnExProfile*>& into,
+	const map<const char*, EnExProfile*>& from)
+{
+	map<const char*, EnExProfile*>::const_iterator it;
+	for(it = from.begin(); it != from.end(); it++){
+		map<const char*, EnExProfile*>::iterator have = into.find(it->first);
+		if(have == into.end()){
+			into[ it->first ] = new EnExProfile( *(it->second) );
+		} else {
+			have->second->Add( *(it->second) );
+		}
+	}
+}
+
+size_t EnExSnapshot::ThreadCount(void) const
+{
+	return m_threads.size();
+}
+
+THREAD_ID_TYPE EnExSnapshot::ThreadId(size_t i) const
+{
+	return m_tids[i];
+}
+
+map<const char*, EnExProfile*>& EnExSnapshot::ThreadProfiles(size_t i)
+{
+	return *(m_threads[i]);
+}
+
+map<const char*, EnExProfile*>& EnExSnapshot::Global(void)
+{
+	return m_global;
+}
+
+void EnExSnapshot::Print(twine& output)
+{
+	twine tmp;
+	map<const char*, EnExProfile*>::iterator it;
+	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%12s\t%12s\t%12s\t%12s\t%12s\t%14s\t%16s\t%16s\n",
+		"Method Name", "Total Hits", "Average ns", "Min ns", "Max ns", "Total ns",
+		"p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "Allocs", "Alloc bytes",
+		"CPU ns", "Off-CPU ns");
+	output += tmp;
+	for(it = m_global.begin(); it != m_global.end(); it++){
+		tmp.format("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%12.0f\t%12.0f\t%12.0f\t%12.0f\t%12llu\t%14llu\t%16.0f\t%16.0f\n",
+			it->first, it->second->Hits(),
+			it->second->AvgTime(),
+			it->second->MinTime(),
+			it->second->MaxTime(),
+			it->second->TotalTime(),
+			it->second->Percentile(50),
+			it->second->Percentile(90),
+			it->second->Percentile(99),
+			it->second->Percentile(99.9),
+			(unsigned long long)it->second->Allocations(),
+			(unsigned long long)it->second->AllocatedBytes(),
+			it->second->CpuTime(),
+			it->second->OffCpuTime()
+		);
+		output += tmp;
+	}
+}
+
+EnExAggregator::EnExAggregator(int intervalMS, Callback callback, void* arg)
+{
+	m_intervalMS = intervalMS;
+	m_callback = callback;
+	m_arg = arg;
+	m_thread = NULL;
+	m_stopping = false;
+	m_mutex = new SLib::Mutex();
+	m_last = new EnExSnapshot();
+	m_last->Take();
+}
+
+EnExAggregator::~EnExAggregator()
+{
+	Stop();
+	delete m_last;
+	delete m_mutex;
+}
+
+void EnExAggregator::Start(void)
+{
+	if(m_thread != NULL){
+		return;
+	}
+	m_stopping = false;
+	m_thread = new SLib::Thread();
+	m_thread->start(Run, this);
+}
+
+void EnExAggregator::Stop(void)
+{
+	if(m_thread == NULL){
+		return;
+	}
+	m_stopping = true;
+	m_thread->join();
+	delete m_thread;
+	m_thread = NULL;
+}
+
+void EnExAggregator::Sample(void)
+{
+	SLib::Lock the_lock(m_mutex);
+	EnExSnapshot* now = new EnExSnapshot();
+	now->Take();
+	EnExSnapshot delta;
+	delta.Difference(*now, *m_last);
+	delete m_last;
+	m_last = now;
+	if(m_callback != NULL){
+		m_callback(delta, m_arg);
+	}
+}
+
+void* EnExAggregator::Run(void* arg)
+{
+	EnExAggregator* us = (EnExAggregator*)arg;
+	uint64_t next = Clock::Nanos() + (uint64_t)us->m_intervalMS * 1000000;
+	while(!us->m_stopping){
+		// Sleep in short steps so Stop() doesn't have to wait out a long interval.
+		uint64_t now = Clock::Nanos();
+		if(now < next){
+			uint64_t ms = (next - now) / 1000000;
+			Tools::msleep( ms > 50 ? 50 : (ms == 0 ? 1 : (int)ms) );
+			continue;
+		}
+		us->Sample();
+		next += (uint64_t)us->m_intervalMS * 1000000;
+	}
+	return NULL;
 }
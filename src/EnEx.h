@@ -24,6 +24,93 @@ using namespace std;
 #include "xmlinc.h"
 namespace SLib {
 
+/// The profile and stack trace EnterExit keeps for each thread.  Defined in EnEx.cpp.
+struct EnExThreadData;
+
+/// One unique call path in a thread's (or the global) call tree.  Defined in EnEx.cpp.
+struct EnExCallNode;
+
+/** Subsystems an ENEX_SITE_IN call site can belong to, so profiling can be turned on and
+  * off a piece at a time with EnterExit::EnableSubsystem.  Applications can use their own
+  * numbers from ENEX_SUBSYSTEM_USER up to 31.
+  */
+#define ENEX_SUBSYSTEM_DEFAULT 0
+#define ENEX_SUBSYSTEM_MEMBUF 1
+#define ENEX_SUBSYSTEM_FILE 2
+#define ENEX_SUBSYSTEM_USER 8
+
+/** The deepest EnEx stack the sampling profiler sees.  Frames nested deeper than this are
+  * left off the end of each sample.
+  */
+#define ENEX_SAMPLE_DEPTH 32
+
+/// Sub-buckets in each power of two of an EnExHistogram - each is within 1/16th (6%) of its value
+#define ENEX_HISTOGRAM_SUB_BITS 4
+#define ENEX_HISTOGRAM_SUB_COUNT (1 << ENEX_HISTOGRAM_SUB_BITS)
+
+/// Values of 2^ENEX_HISTOGRAM_MAX_BITS nanoseconds (about 18 minutes) and up share the top bucket
+#define ENEX_HISTOGRAM_MAX_BITS 40
+
+/// The number of buckets in an EnExHistogram
+#define ENEX_HISTOGRAM_BUCKETS ((ENEX_HISTOGRAM_MAX_BITS - ENEX_HISTOGRAM_SUB_BITS + 1) * ENEX_HISTOGRAM_SUB_COUNT)
+
+/** A log-linear (HDR style) histogram of call times in nanoseconds.  Each power of two is
+  * split into 16 equal buckets, so memory is fixed and a percentile is always within 6%
+  * of the real value.  Recording is a couple of shifts and an increment - no locks, since
+  * each thread only ever records into its own profiles.  Histograms merge by adding their
+  * buckets together.
+  */
+class DLLEXPORT EnExHistogram {
+	public:
+		EnExHistogram();
+
+		/// Counts one call that took the given number of nanoseconds.
+		void Record(uint64_t nanos);
+
+		/// Adds another histogram's counts into ours.
+		void Add(const EnExHistogram& other);
+
+		/** Takes away the counts of an earlier copy of this histogram, leaving what has been
+		  * recorded since.  Max becomes the top of the highest bucket left.
+		  */
+		void Subtract(const EnExHistogram& earlier);
+
+		/** Copies our counts into copy while the thread that owns us may still be
+		  * recording.  Each count is read whole, but a call being recorded as we copy may
+		  * show up in some of them and not others.
+		  */
+		void Snapshot(EnExHistogram& copy) const;
+
+		/// Clears all of our counts.
+		void Reset(void);
+
+		/// The number of calls we have recorded
+		uint64_t Count(void) const;
+
+		/// The longest call we have recorded, in nanoseconds
+		uint64_t Max(void) const;
+
+		/// The bottom of the lowest bucket with anything in it - at or under our fastest call
+		uint64_t Min(void) const;
+
+		/** Returns the time, in nanoseconds, that pct percent (0-100) of our calls came in
+		  * at or under.  This is the top of the bucket the percentile falls in, but never more
+		  * than Max().  Returns 0 if nothing has been recorded.
+		  */
+		uint64_t Percentile(double pct) const;
+
+		/// Returns the bucket that holds the given value
+		static int BucketFor(uint64_t nanos);
+
+		/// Returns the largest value that falls into the given bucket
+		static uint64_t BucketTop(int bucket);
+
+	private:
+		uint64_t m_counts[ ENEX_HISTOGRAM_BUCKETS ];
+		uint64_t m_count;
+		uint64_t m_max;
+};
+
 class DLLEXPORT EnExProfile {
 	public:
 
@@ -39,11 +126,19 @@ class DLLEXPORT EnExProfile {
 		bool StopProfile(void);
 		void StopProfile(bool tf);
 
+		/// Our timings, in nanoseconds
 		double AvgTime(void);
 		double MinTime(void);
 		double MaxTime(void);
 		double TotalTime(void);
 
+		/// Returns the time (nanoseconds) that pct percent of our calls came in under.
+		double Percentile(double pct);
+
+		/// Our histogram of call times
+		const EnExHistogram& Histogram(void);
+
+		/// Records one call.  entry and exit are Clock::Ticks() values.
 		void RecordEntryExit(uint64_t entry, uint64_t exit);
 
 		/** Add information from another profile object into ours.  This is primarily used
@@ -52,16 +147,196 @@ class DLLEXPORT EnExProfile {
 		  */
 		void Add( const EnExProfile& eep);
 
+		/** Takes away the numbers from an earlier copy of this profile, leaving what has
+		  * happened since.  Min and max come from what is left in the histogram.
+		  */
+		void Subtract( const EnExProfile& earlier);
+
+		/** Copies our numbers into copy while the thread that owns us may still be
+		  * recording.  The owning thread never waits for us - if it records a call while
+		  * we are reading, we read again.
+		  */
+		void Snapshot( EnExProfile& copy);
+
+		/// Our method name
+		const char* MethodName(void);
+
+		/// The number of allocations made while we were the innermost scope, and their size
+		uint64_t Allocations(void);
+		uint64_t AllocatedBytes(void);
+
+		/// Counts one allocation of the given size against us.
+		void RecordAllocation(size_t bytes);
+
+		/** The cpu time our calls used and the rest of their wall time, which they spent
+		  * off the cpu (blocked, waiting or descheduled), in nanoseconds.  Only calls made
+		  * while EnterExit::EnableCpuTime had selected us count - CpuHits says how many.
+		  */
+		uint64_t CpuHits(void);
+		double CpuTime(void);
+		double OffCpuTime(void);
+
+		/// Records the thread cpu time and wall time of one call, in nanoseconds.
+		void RecordCpuTime(uint64_t cpuNanos, uint64_t wallNanos);
+
+		/// Returns true if EnterExit::EnableCpuTime has selected our method.
+		bool CpuTimed(void);
+
 	private:
 		const char* m_methodName;
+		volatile uint32_t m_seq; // odd while RecordEntryExit is changing us
 		uint64_t m_hits;
 		uint64_t m_totalTime;
 		uint64_t m_minTime;
 		uint64_t m_maxTime;
+		uint64_t m_allocs;
+		uint64_t m_allocBytes;
+		uint64_t m_cpuHits;
+		uint64_t m_cpuTime;
+		uint64_t m_offCpuTime;
+		uint32_t m_cpuGeneration; // the selection m_cpuTimed was worked out for
+		bool m_cpuTimed;
+		EnExHistogram m_histogram;
 		bool m_stopProfile;
 };
 
 
+/** This describes one place in the code that is profiled with ENEX_SITE.  It is a
+  * function static, so it is built (and given its id) once, the first time through.
+  */
+class DLLEXPORT EnExCallSite {
+	public:
+		/// Registers a new call site and gives it the next id.
+		EnExCallSite(const char* methodName, int subsystem = ENEX_SUBSYSTEM_DEFAULT);
+
+		/// The method name we report under
+		const char* m_methodName;
+
+		/// Our index into each thread's array of call site profiles
+		int m_id;
+
+		/// The bit for our subsystem in Enabled
+		uint32_t m_mask;
+
+		/// Bit n is set while subsystem n is being profiled.  Use the EnterExit::Enable methods.
+		static volatile uint32_t Enabled;
+};
+
+class EnterExitSite;
+
+/**
+  * A copy of every thread's EnEx counters, taken without stopping any of them.  Take()
+  * reads the counters; Difference() turns two snapshots into what happened between them,
+  * thread by thread and for all threads together.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT EnExSnapshot {
+	private:
+		/// copy constructor is private to prevent use
+		EnExSnapshot(const EnExSnapshot& c) {}
+
+		/// assignmet operator is private to prevent use
+		EnExSnapshot& operator=(const EnExSnapshot& c) { return *this;}
+
+	public:
+		/// Builds an empty snapshot
+		EnExSnapshot();
+
+		/// Standard destructor
+		virtual ~EnExSnapshot();
+
+		/// Reads the counters of every thread that has used EnEx, replacing what we had.
+		void Take(void);
+
+		/// Makes us the difference between a later and an earlier snapshot.
+		void Difference(const EnExSnapshot& later, const EnExSnapshot& earlier);
+
+		/// The number of threads we hold
+		size_t ThreadCount(void) const;
+
+		/// The id of thread i
+		THREAD_ID_TYPE ThreadId(size_t i) const;
+
+		/// The profiles of thread i, by method name
+		map<const char*, EnExProfile*>& ThreadProfiles(size_t i);
+
+		/// Every thread's profiles added together, by method name
+		map<const char*, EnExProfile*>& Global(void);
+
+		/// Writes our global numbers in the same layout as EnterExit::PrintGlobalHitMap.
+		void Print(twine& output);
+
+		/// Empties us
+		void Clear(void);
+
+	private:
+		/// Adds a copy of each profile in from to into
+		static void CopyProfiles(map<const char*, EnExProfile*>& into,
+			const map<const char*, EnExProfile*>& from);
+
+		/// Thread ids and profiles, in the order the threads first used EnEx
+		vector<THREAD_ID_TYPE> m_tids;
+		vector< map<const char*, EnExProfile*>* > m_threads;
+
+		/// The sum of m_threads
+		map<const char*, EnExProfile*> m_global;
+};
+
+/**
+  * Takes an EnExSnapshot every intervalMS on a thread of its own, and hands the
+  * difference from the one before to a callback - the global and per-thread numbers for
+  * that interval.  None of the threads being profiled are stopped or locked to do it.
+  * Sample() does the same thing on demand.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT EnExAggregator {
+	private:
+		/// copy constructor is private to prevent use
+		EnExAggregator(const EnExAggregator& c) {}
+
+		/// assignmet operator is private to prevent use
+		EnExAggregator& operator=(const EnExAggregator& c) { return *this;}
+
+	public:
+		/// What we call with each interval's numbers
+		typedef void (*Callback)(EnExSnapshot& delta, void* arg);
+
+		/** Builds an aggregator that calls callback with arg every intervalMS, once
+		  * Start() is called.  The first interval starts now.
+		  */
+		EnExAggregator(int intervalMS, Callback callback, void* arg);
+
+		/// Standard destructor - stops our thread.
+		virtual ~EnExAggregator();
+
+		/// Starts our thread
+		void Start(void);
+
+		/// Stops our thread and waits for it to finish.
+		void Stop(void);
+
+		/// Ends the current interval now and hands its numbers to the callback.
+		void Sample(void);
+
+	private:
+		/// Our thread's main loop
+		static void* Run(void* arg);
+
+		int m_intervalMS;
+		Callback m_callback;
+		void* m_arg;
+		SLib::Thread* m_thread;
+		volatile bool m_stopping;
+
+		/// Guards m_last, so Sample() can be called while our thread is running
+		SLib::Mutex* m_mutex;
+
+		/// The snapshot that started the current interval
+		EnExSnapshot* m_last;
+};
+
 class DLLEXPORT EnterExit {
 	public:
 		/** Constructor requires a name of the current method.
@@ -96,14 +371,87 @@ class DLLEXPORT EnterExit {
 		static void PrintGlobalHitMap(void);
 
 		/** This will print out  the hit counters for all threads based on what has been
-		    stored in the global hit counter aggregate area.
+		    stored in the global hit counter aggregate area.  Set reset to clear the
+		    global numbers once they have been printed, so each report covers the
+		    interval since the last one.
 		  */
-		static void PrintGlobalHitMap(twine& output);
+		static void PrintGlobalHitMap(twine& output, bool reset = false);
 
 		/** This will save our current hit map data as a series of HitMap nodes added as
-		 * children under the given node.
+		 * children under the given node, followed by a CallTree node holding the global
+		 * call tree as nested Call nodes.  Set reset to clear the global numbers once they
+		 * have been recorded.
 		 */
-		static void RecordGlobalHitMap(xmlNodePtr node);
+		static void RecordGlobalHitMap(xmlNodePtr node, bool reset = false);
+
+		/** This writes the global call tree in folded stack format - one line per call
+		  * path, "outer;middle;inner <self nanoseconds>" - ready for flamegraph.pl or
+		  * speedscope.  Set reset to clear the global call tree once it has been written.
+		  */
+		static void GetFoldedStacks(twine& output, bool reset = false);
+
+		/** Starts recording a timeline of every EnEx and ENEX_SITE scope that finishes, on
+		  * every thread, for GetTraceEvents.  Each thread keeps its latest eventsPerThread
+		  * spans in a ring of its own, so a long trace keeps the most recent part.  Anything
+		  * recorded before this call is dropped from the next export.
+		  */
+		static void StartTracing(int eventsPerThread = 65536);
+
+		/** Stops recording the timeline.  What has been recorded stays until the next
+		  * StartTracing.
+		  */
+		static void StopTracing(void);
+
+		/** Writes the recorded timeline as Chrome trace event JSON, which chrome://tracing
+		  * and Perfetto can load.  Each scope is a complete ("X") event with its start time and
+		  * duration in microseconds since StartTracing.  Threads may still be tracing while
+		  * we read - any spans they overwrite while we do are left out.
+		  */
+		static void GetTraceEvents(twine& output);
+
+		/** Turns allocation counting on or off.  While it is on, each allocation is counted
+		  * against the innermost timed EnEx or ENEX_SITE scope of the thread making it, and
+		  * shows up in the Allocs columns of the hit maps.  Allocations only reach us in
+		  * programs that link in EnExAlloc.o, which routes operator new (and on linux,
+		  * malloc, calloc and realloc) through RecordAllocation.
+		  */
+		static void EnableAllocTracking(bool on);
+
+		/** Called for each allocation by EnExAlloc.o.  Never allocates, and costs a test of
+		  * a flag when allocation counting is off.
+		  */
+		static void RecordAllocation(size_t bytes);
+
+		/** Selects a method to have its thread cpu time measured as well as its wall time,
+		  * so the hit maps can show how much of each call was spent off the cpu - waiting on
+		  * a lock, the disk or the network.  It costs two Clock::ThreadCpuNanos calls per
+		  * pass, so pick the scopes you are interested in.  A NULL methodName selects every
+		  * EnEx and ENEX_SITE scope.
+		  */
+		static void EnableCpuTime(const char* methodName, bool on);
+
+		/** Turns the timing side of EnEx and ENEX_SITE on or off.  Switched off, a scope
+		  * only keeps its thread's stack up to date - no clock reads, profiles, call trees
+		  * or trace spans - which is all the sampling profiler needs.
+		  */
+		static void EnableTiming(bool on);
+
+		/** Starts the sampling profiler: every 1/hz seconds of cpu time each thread that
+		  * has used EnEx is interrupted with SIGPROF, and the EnEx stack it is in is counted.
+		  * Uses a per-thread timer_create cpu clock timer on linux, and setitimer
+		  * elsewhere.  Returns false where signals aren't available (windows).  Slow system
+		  * calls in the sampled threads may return EINTR while this is running.
+		  */
+		static bool StartSampling(int hz = 100);
+
+		/// Stops the sampling profiler.  The samples stay until read with reset.
+		static void StopSampling(void);
+
+		/** Writes the sampled stacks in folded stack format - "outer;middle;inner <samples>" -
+		  * added up across threads.  Samples taken outside any EnEx scope are counted under
+		  * "(outside EnEx)".  Set reset to start counting again from zero.
+		  */
+		static void GetSampledStacks(twine& output, bool reset = false);
 
 		/** This will print our stack trace to standard output
 		  */
@@ -117,6 +465,16 @@ class DLLEXPORT EnterExit {
 		  */
 		static twine GetStackTrace(void);
 
+		/** Copies the method names on our thread's stack into frames, outermost first.  The
+		  * names aren't copied or formatted, and a thread that hasn't used EnEx isn't
+		  * registered - it just gets an empty list.  FormatStackTrace turns the list into
+		  * the same text GetStackTrace returns.
+		  */
+		static void GetStackFrames(vector<const char*>& frames);
+
+		/// Formats frames from GetStackFrames, taken on thread tid, the way GetStackTrace does.
+		static twine FormatStackTrace(THREAD_ID_TYPE tid, const vector<const char*>& frames);
+
 		/** This handles saving our thread-local hit counter information into the
 		    global structure.  This will take more time because we have to lock the
 		    global structure mutex, but if called only seldom on major functions, this
@@ -125,31 +483,92 @@ class DLLEXPORT EnterExit {
 		*/
 		void SaveToGlobal(void);
 
+		/** Turns ENEX_SITE profiling on or off everywhere.  Switched off, a call site costs
+		  * a test and a branch.  The subsystem settings are kept for when it comes back on.
+		  */
+		static void EnableProfiling(bool on);
+
+		/** Turns ENEX_SITE profiling on or off for a single subsystem (0-31).
+		  */
+		static void EnableSubsystem(int subsystem, bool on);
+
 	private:
+		friend class EnterExitSite;
 
 		/** Inner version of the constructor.
 		 */
 		void Init(void);
 
-		/** Looks up our thread-specific hit counter from the global list.
+		/** Returns our thread's profile block, registering it the first time through.
+		 */
+		static EnExThreadData* FindOurThreadData(void);
+
+		/** Looks up our thread-specific hit counter.
 		 */
 		static map<const char*, EnExProfile*>* FindOurHitCounter(void);
 
-		/** Looks up our thread-specific stack trace from the global list.
+		/** Looks up our thread-specific stack trace.
 		 */
 		static vector<const char*>* FindOurStackTrace(void);
 
 		const char* m_file;
 		int m_line;
 		const char* m_methodName;
+		EnExThreadData* m_data;
+		EnExCallNode* m_callNode;
+		EnExProfile* m_outerProfile;
 		uint64_t m_methodEntryStamp;
 		uint64_t m_methodExitStamp;
+		uint64_t m_cpuEntryStamp;
+		bool m_cpuTimed;
 		bool m_saveToGlobal;
 		EnExProfile* m_methodProfile;
 		map<const char*, EnExProfile*>* m_hitCounter;
 		vector<const char*>* m_stackTrace;
 };
 
+/** This profiles one pass through an ENEX_SITE call site.  Rather than looking its method
+  * up by name, it goes straight to its call site's slot in the thread's profile array.
+  * Don't use this directly - use the ENEX_SITE or ENEX_SITE_IN macros.
+  */
+class DLLEXPORT EnterExitSite {
+	public:
+		/// Records our entry if our call site's subsystem is turned on.
+		EnterExitSite(EnExCallSite& site) : m_data(NULL) {
+			if((EnExCallSite::Enabled & site.m_mask) != 0){
+				Enter(site);
+			}
+		}
+
+		/// Records our exit if we recorded our entry.
+		~EnterExitSite() {
+			if(m_data != NULL){
+				Exit();
+			}
+		}
+
+	private:
+		/// copy constructor is private to prevent use
+		EnterExitSite(const EnterExitSite& c) {}
+
+		/// assignmet operator is private to prevent use
+		EnterExitSite& operator=(const EnterExitSite& c) { return *this;}
+
+		/// Does the work of recording our entry
+		void Enter(EnExCallSite& site);
+
+		/// Does the work of recording our exit
+		void Exit(void);
+
+		EnExThreadData* m_data;
+		EnExProfile* m_methodProfile;
+		EnExCallNode* m_callNode;
+		EnExProfile* m_outerProfile;
+		uint64_t m_methodEntryStamp;
+		uint64_t m_cpuEntryStamp;
+		bool m_cpuTimed;
+};
+
 /** This is a mirror of the EnterExit class, but it does nothing.  We use a define to swap between these
   * two classes so that we can identify the amount of overhead that profiling adds to standard execution
   * time.
@@ -166,17 +585,50 @@ class EnterExitLight {
 
 		static void PrintHitMap(void) {printf("Compiled with light version.  Doing no profiling.\n");}
 		static void PrintGlobalHitMap(void) {printf("Compiled with light version.  Doing no profiling.\n");}
-		static void PrintGlobalHitMap(twine& output){};
-		static void RecordGlobalHitMap(xmlNodePtr node) {}
+		static void PrintGlobalHitMap(twine& output, bool reset = false){};
+		static void RecordGlobalHitMap(xmlNodePtr node, bool reset = false) {}
+		static void GetFoldedStacks(twine& output, bool reset = false) {}
+		static void StartTracing(int eventsPerThread = 65536) {}
+		static void StopTracing(void) {}
+		static void GetTraceEvents(twine& output) {}
+		static void EnableTiming(bool on) {}
+		static void EnableAllocTracking(bool on) {}
+		static void RecordAllocation(size_t bytes) {}
+		static void EnableCpuTime(const char* methodName, bool on) {}
+		static bool StartSampling(int hz = 100) { return false; }
+		static void StopSampling(void) {}
+		static void GetSampledStacks(twine& output, bool reset = false) {}
 		static void PrintStackTrace(void){}
 		static void PrintStackTrace(int channel){}
 		static twine GetStackTrace(void) {return twine("");}
+		static void GetStackFrames(vector<const char*>& frames) { frames.clear(); }
+		static twine FormatStackTrace(THREAD_ID_TYPE tid, const vector<const char*>& frames) {return twine("");}
 		void SaveToGlobal(void) {}
 
 };
 
-#define EnEx	EnterExit
-//#define EnEx	EnterExitLight
+/** Define ENEX_LIGHT (uncomment it here, or pass -DENEX_LIGHT) to swap in EnterExitLight.  EnEx
+  * and the ENEX_SITE macros then do nothing at all.
+  */
+//#define ENEX_LIGHT
+
+#ifdef ENEX_LIGHT
+#	define EnEx	EnterExitLight
+#	define ENEX_SITE_IN(subsystem, methodName) do {} while(0)
+#else
+#	define EnEx	EnterExit
+
+/** Profiles the enclosing scope under methodName as part of the given subsystem.
+  */
+#	define ENEX_SITE_IN(subsystem, methodName) \
+		static SLib::EnExCallSite enex_call_site(methodName, subsystem); \
+		SLib::EnterExitSite enex_site_scope(enex_call_site)
+#endif
+
+/** Profiles the enclosing scope under methodName, like EnEx ee(methodName) but without
+  * the lookups.  Use once per scope.
+  */
+#define ENEX_SITE(methodName) ENEX_SITE_IN(ENEX_SUBSYSTEM_DEFAULT, methodName)
 
 } // End SLib namespace
 
@@ -0,0 +1,125 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+/*
+ * Link this file into a program (it is not part of libSLib) to count allocations against
+ * the innermost EnEx scope that made them.  See EnterExit::EnableAllocTracking.  Nothing
+ * here may allocate: RecordAllocation only bumps counters in the scope's profile.
+ */
+
+#include <stdlib.h>
+#include <new>
+
+#include "EnEx.h"
+using namespace SLib;
+
+#ifdef __GLIBC__
+
+// glibc's own allocator, under the names it exports for this purpose.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+extern "C" void* malloc(size_t size)
+{
+	EnterExit::RecordAllocation(size);
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+	EnterExit::RecordAllocation(count * size);
+	return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+	EnterExit::RecordAllocation(size);
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr)
+{
+	__libc_free(ptr);
+}
+
+/// malloc above has already counted it
+static inline void* enexNew(size_t size)
+{
+	return malloc(size == 0 ? 1 : size);
+}
+
+#else
+
+/// Elsewhere we can only see operator new
+static inline void* enexNew(size_t size)
+{
+	EnterExit::RecordAllocation(size);
+	return malloc(size == 0 ? 1 : size);
+}
+
+#endif
+
+void* operator new(size_t size)
+{
+	void* ret = enexNew(size);
+	if(ret == NULL){
+		throw std::bad_alloc();
+	}
+	return ret;
+}
+
+void* operator new[](size_t size)
+{
+	void* ret = enexNew(size);
+	if(ret == NULL){
+		throw std::bad_alloc();
+	}
+	return ret;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+	return enexNew(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+	return enexNew(size);
+}
+
+void operator delete(void* ptr) throw()
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr) throw()
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) throw()
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) throw()
+{
+	free(ptr);
+}
@@ -11,13 +11,13 @@ using namespace SLib;
 
 File::File()
 {
-	EnEx ee("File::File()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::File()");
 	m_fp = NULL;
 }
 
 File::File(const twine& fileName) : m_fileName(fileName)
 {
-	EnEx ee("File::File(const twine fileName)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::File(const twine fileName)");
 	m_fp = fopen(m_fileName(), "rb");
 	if(m_fp == NULL){
 		throw AnException(0, FL, "Error opening file (%s).", m_fileName() );
@@ -27,13 +27,13 @@ File::File(const twine& fileName) : m_fileName(fileName)
 
 File::File(FILE* fp) : m_fp(fp)
 {
-	EnEx ee("File::File(File* fp)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::File(File* fp)");
 	getStat();
 }
 
 File::File(const File& f)
 {
-	EnEx ee("File::File(const File& f)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::File(const File& f)");
 	m_fp = f.m_fp;
 	m_fileName = f.m_fileName;
 	getStat();
@@ -41,13 +41,13 @@ File::File(const File& f)
 
 File::~File()
 {
-	EnEx ee("File::~File()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::~File()");
 	closeFile();
 }
 
 File& File::open(const twine& fileName)
 {
-	EnEx ee("File::open(const twine fileName)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::open(const twine fileName)");
 	closeFile();
 
 	m_fileName = fileName;
@@ -61,7 +61,7 @@ File& File::open(const twine& fileName)
 
 void File::closeFile()
 {
-	EnEx ee("File::closeFile()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::closeFile()");
 	if(m_fp != NULL){
 		fclose(m_fp);
 	}
@@ -71,7 +71,7 @@ void File::closeFile()
 
 void File::getStat()
 {
-	EnEx ee("File::getStat()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::getStat()");
 #ifdef _WIN32
 	_fstat(_fileno(m_fp), &m_stat);
 #else
@@ -81,7 +81,7 @@ void File::getStat()
 
 File& File::operator=(const File& f)
 {
-	EnEx ee("File::operator=(const File& f)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::operator=(const File& f)");
 	if(&f == this){
 		// Don't copy onto ourselves.
 		return *this;
@@ -95,7 +95,7 @@ File& File::operator=(const File& f)
 		
 File& File::operator=(FILE* fp)
 {
-	EnEx ee("File::operator=(FILE* fp)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::operator=(FILE* fp)");
 	if(m_fp == fp){
 		// Don't copy onto ourselves.
 		return *this;
@@ -109,13 +109,13 @@ File& File::operator=(FILE* fp)
 
 File::operator FILE*(void) const
 {
-	EnEx ee("File::operator FILE*(void)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::operator FILE*(void)");
 	return m_fp;
 }
 
 bool File::operator==(File& f) const
 {
-	EnEx ee("File::operator==(File& f)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::operator==(File& f)");
 	if(m_fp == f.m_fp){
 		return true;
 	} else {
@@ -126,19 +126,19 @@ bool File::operator==(File& f) const
 
 twine& File::name()
 {
-	EnEx ee("File::name()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::name()");
 	return m_fileName;
 }
 
 long File::size()
 {
-	EnEx ee("File::size()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::size()");
 	return m_stat.st_size;
 }
 
 Date File::lastAccess()
 {
-	EnEx ee("File::lastAccess()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::lastAccess()");
 	Date ret;
 	ret.SetValue(m_stat.st_atime);
 	return ret;
@@ -146,7 +146,7 @@ Date File::lastAccess()
 
 Date File::lastModified()
 {
-	EnEx ee("File::lastModified()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::lastModified()");
 	Date ret;
 	ret.SetValue(m_stat.st_mtime);
 	return ret;
@@ -154,7 +154,7 @@ Date File::lastModified()
 
 Date File::lastStatusChange()
 {
-	EnEx ee("File::lastStatusChange()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::lastStatusChange()");
 	Date ret;
 	ret.SetValue(m_stat.st_ctime);
 	return ret;
@@ -162,7 +162,7 @@ Date File::lastStatusChange()
 
 unsigned char* File::readContents()
 {
-	EnEx ee("File::readContents()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::readContents()");
 
 	unsigned char* buff = (unsigned char*)malloc(size());
 	if(buff == NULL){
@@ -181,7 +181,7 @@ unsigned char* File::readContents()
 
 MemBuf& File::readContents(MemBuf& contents)
 {
-	EnEx ee("File::readContentsAsMemBuf()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::readContentsAsMemBuf()");
 
 	contents.reserve( size() );
 
@@ -198,7 +198,7 @@ MemBuf& File::readContents(MemBuf& contents)
 
 twine File::readContentsAsTwine()
 {
-	EnEx ee("File::readContentsTwine()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::readContentsTwine()");
 
 	twine contents;
 	size_t content_size = size();
@@ -217,7 +217,7 @@ twine File::readContentsAsTwine()
 
 vector<twine> File::readLines()
 {
-	EnEx ee("File::readLines()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::readLines()");
 
 	twine contents;
 	contents.reserve(size());
@@ -241,7 +241,7 @@ vector<twine> File::readLines()
 
 size_t File::read(MemBuf& buffer)
 {
-	EnEx ee("File::read(char* buffer, size_t buffer_size)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::read(char* buffer, size_t buffer_size)");
 
 	size_t ret = fread(buffer.data(), 1, buffer.size(), m_fp);
 	return ret;
@@ -249,7 +249,7 @@ size_t File::read(MemBuf& buffer)
 
 bool File::Exists(const twine& fileName)
 {
-	EnEx ee("File::Exists(const twine& fileName)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::Exists(const twine& fileName)");
 
 	FILE* fp = fopen(fileName(), "rb");
 	if(fp == NULL){
@@ -262,7 +262,7 @@ bool File::Exists(const twine& fileName)
 
 vector<twine> File::listFiles(const twine& dirName)
 {
-	EnEx ee("File::listFiles()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::listFiles()");
 	vector<twine> ret;
 
 #ifdef _WIN32
@@ -318,7 +318,7 @@ vector<twine> File::listFiles(const twine& dirName)
 
 vector<twine> File::listFolders(const twine& dirName)
 {
-	EnEx ee("File::listFolders()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::listFolders()");
 	vector<twine> ret;
 
 #ifdef _WIN32
@@ -414,7 +414,7 @@ void File::writeToFile(const twine& fileName, const MemBuf& contents)
 
 void File::Copy(const twine& from, const twine& to)
 {
-	EnEx ee("File::Copy(twine& from, twine& to)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::Copy(twine& from, twine& to)");
 
 	File f(from);
 	MemBuf contents;
@@ -425,7 +425,7 @@ void File::Copy(const twine& from, const twine& to)
 
 void File::Move(const twine& from, const twine& to)
 {
-	EnEx ee("File::Move(twine& from, twine& to)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::Move(twine& from, twine& to)");
 
 #ifdef _WIN32
 	BOOL ret = MoveFile( from(), to() );
@@ -438,7 +438,7 @@ void File::Move(const twine& from, const twine& to)
 
 void File::EnsurePath(const twine& fileName)
 {
-	EnEx ee("File::EnsurePath(const twine& fileName)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::EnsurePath(const twine& fileName)");
 
 	vector<twine> segments;
 	twine seg;
@@ -490,7 +490,7 @@ void File::EnsurePath(const twine& fileName)
 
 void File::RmDir(const twine& dirName)
 {
-	EnEx ee("File::RmDir(const twine& dirName)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_FILE, "File::RmDir(const twine& dirName)");
 
 	if(dirName.length() == 0){
 		throw AnException(0, FL, "Empty directory name passed to File::RmDir()");
@@ -0,0 +1,216 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "FileWatch.h"
+#include "Tools.h"
+#include "Timer.h"
+using namespace SLib;
+
+/// How often we look at the file when we have to poll
+static const int FILEWATCH_POLL_MS = 100;
+
+FileWatch::FileWatch(const twine& fileName, bool allowEvents)
+{
+	m_fileName = fileName;
+	m_notifyFD = -1;
+	m_watchFD = -1;
+
+	// Split off the directory - that's what we watch, so we still see the file after a
+	// rotation renames it away and creates a new one.
+	size_t slash = TWINE_NOT_FOUND;
+	for(size_t i = 0; i < m_fileName.length(); i++){
+		if(m_fileName[i] == '/' || m_fileName[i] == '\\'){
+			slash = i;
+		}
+	}
+	if(slash == TWINE_NOT_FOUND){
+		m_dirName = ".";
+		m_baseName = m_fileName;
+	} else {
+		m_dirName = m_fileName.substr( 0, slash == 0 ? 1 : slash );
+		m_baseName = m_fileName.substr( slash + 1 );
+	}
+
+#ifdef __linux__
+	if(allowEvents){
+		m_notifyFD = inotify_init();
+		if(m_notifyFD >= 0){
+			m_watchFD = inotify_add_watch( m_notifyFD, m_dirName(),
+				IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO );
+			if(m_watchFD < 0){
+				close( m_notifyFD ); // fall back to polling
+				m_notifyFD = -1;
+			}
+		}
+	}
+#endif
+
+	readState( m_state );
+}
+
+FileWatch::~FileWatch()
+{
+#ifdef __linux__
+	if(m_notifyFD >= 0){
+		close( m_notifyFD ); // takes the watch with it
+	}
+#endif
+}
+
+bool FileWatch::eventDriven()
+{
+	return m_notifyFD >= 0;
+}
+
+void FileWatch::readState(FileState& state)
+{
+	memset( &state, 0, sizeof(FileState) );
+	struct stat st;
+	if(stat( m_fileName(), &st ) == 0){
+		state.inode = (unsigned long)st.st_ino;
+		state.size = (long)st.st_size;
+		state.mtime = (long)st.st_mtime;
+	}
+	twine walName = m_fileName + "-wal";
+	if(stat( walName(), &st ) == 0){
+		state.walSize = (long)st.st_size;
+		state.walMtime = (long)st.st_mtime;
+	}
+}
+
+int FileWatch::checkState()
+{
+	FileState now;
+	readState( now );
+
+	int ret = FILEWATCH_TIMEOUT;
+	if(now.size == 0 && now.inode == 0){
+		// The file is gone - most likely half way through a rotation.  Wait for the new one.
+		ret = FILEWATCH_TIMEOUT;
+		return ret;
+	}
+	if(now.inode != m_state.inode ||
+		(now.inode == 0 && now.size < m_state.size) // no inodes here (windows) - a shrink is the best we can do
+	){
+		ret = FILEWATCH_REPLACED;
+	} else if(now.size != m_state.size || now.mtime != m_state.mtime ||
+		now.walSize != m_state.walSize || now.walMtime != m_state.walMtime
+	){
+		ret = FILEWATCH_CHANGED;
+	}
+	m_state = now;
+	return ret;
+}
+
+int FileWatch::wait(int timeoutMS)
+{
+	if(m_notifyFD >= 0){
+		return eventWait( timeoutMS );
+	}
+	return pollWait( timeoutMS );
+}
+
+int FileWatch::pollWait(int timeoutMS)
+{
+	int waited = 0;
+	while(true){
+		int ret = checkState();
+		if(ret != FILEWATCH_TIMEOUT){
+			return ret;
+		}
+		if(waited >= timeoutMS){
+			return FILEWATCH_TIMEOUT;
+		}
+		Tools::msleep( FILEWATCH_POLL_MS );
+		waited += FILEWATCH_POLL_MS;
+	}
+}
+
+int FileWatch::eventWait(int timeoutMS)
+{
+#ifdef __linux__
+	struct pollfd pfd;
+	pfd.fd = m_notifyFD;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	Timer tt;
+	tt.Start();
+	int remaining = timeoutMS;
+	while(true){
+		int rc = poll( &pfd, 1, remaining );
+		if(rc <= 0){
+			// Nothing from inotify.  Look anyway, in case the file system doesn't send
+			// events (NFS, for one).
+			return checkState();
+		}
+
+		// Drain everything that has queued up, and see if any of it is about our files.
+		char buf[4096];
+		bool ours = false;
+		bool modified = false;
+		ssize_t len = read( m_notifyFD, buf, sizeof(buf) );
+		for(ssize_t i = 0; i < len; ){
+			struct inotify_event* ev = (struct inotify_event*)(buf + i);
+			if(ev->len != 0){
+				twine name = ev->name;
+				if(name == m_baseName || name == m_baseName + "-wal" ||
+					name == m_baseName + "-journal"
+				){
+					ours = true;
+					if((ev->mask & (IN_MODIFY | IN_CLOSE_WRITE)) != 0){
+						modified = true;
+					}
+				}
+			}
+			i += sizeof(struct inotify_event) + ev->len;
+		}
+		if(ours){
+			int ret = checkState();
+			if(ret != FILEWATCH_TIMEOUT){
+				return ret;
+			}
+			if(modified){
+				// Written in place - same size, and within the same second.
+				return FILEWATCH_CHANGED;
+			}
+			// A journal came and went, or the file is mid-rotation - keep waiting.
+		}
+		// Someone else's file in the same directory.  Keep waiting for what's left.
+		tt.Finish();
+		remaining = timeoutMS - (int)(tt.Duration() * 1000);
+		if(remaining <= 0){
+			return checkState();
+		}
+	}
+#else
+	return pollWait( timeoutMS );
+#endif
+}
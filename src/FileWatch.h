@@ -0,0 +1,120 @@
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include "twine.h"
+
+namespace SLib {
+
+/// FileWatch::wait timed out with nothing new
+#define FILEWATCH_TIMEOUT 0
+
+/// The file (or its -wal or -journal file) has been written to
+#define FILEWATCH_CHANGED 1
+
+/// The file has been replaced by a new one - it was rotated
+#define FILEWATCH_REPLACED 2
+
+/**
+  * This class waits for a file to change, so a tail doesn't have to keep asking.  On
+  * linux we use inotify on the file's directory, which also lets us see the file being
+  * renamed away and a new one created in its place (a rotation).  Anywhere inotify
+  * isn't available we fall back to polling the file's size, modification time and
+  * inode every 100ms.
+  * <P>
+  * The -wal and -journal files next to the file are watched too, so a SQLite writer in
+  * WAL mode wakes us up even though the main file doesn't change until a checkpoint.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT FileWatch
+{
+	private:
+		/// copy constructor is private to prevent use
+		FileWatch(const FileWatch& c) {}
+
+		/// assignmet operator is private to prevent use
+		FileWatch& operator=(const FileWatch& c) { return *this;}
+
+	public:
+		/** Starts watching the given file.  Set allowEvents to false to force polling.
+		  */
+		FileWatch(const twine& fileName, bool allowEvents = true);
+
+		/// Standard destructor
+		virtual ~FileWatch();
+
+		/** Waits up to timeoutMS for the file to change.  Returns FILEWATCH_TIMEOUT,
+		  * FILEWATCH_CHANGED or FILEWATCH_REPLACED.  After FILEWATCH_REPLACED we follow
+		  * the new file.
+		  */
+		int wait(int timeoutMS);
+
+		/// Returns true if we are using file system events, false if we are polling.
+		bool eventDriven();
+
+	protected:
+
+		/// What we know about the files we watch, for polling and for spotting rotations.
+		struct FileState {
+			unsigned long inode;
+			long size;
+			long mtime;
+			long walSize;
+			long walMtime;
+		};
+
+		/// Reads the current state of our files
+		void readState(FileState& state);
+
+		/// Compares a fresh state with m_state, saves it, and returns what happened.
+		int checkState();
+
+		/// Polls until something changes or timeoutMS passes
+		int pollWait(int timeoutMS);
+
+		/// Waits on our inotify handle
+		int eventWait(int timeoutMS);
+
+		/// The file we watch
+		twine m_fileName;
+
+		/// Its directory and its name within that directory
+		twine m_dirName;
+		twine m_baseName;
+
+		/// Our inotify handle and watch, or -1 when polling
+		int m_notifyFD;
+		int m_watchFD;
+
+		/// The state of our files when we last looked
+		FileState m_state;
+};
+
+} // End Namespace SLib
+
+#endif // FILEWATCH_H Defined
@@ -55,13 +55,14 @@
 #endif
 
 /**
-  * The timeout exception is thrown by timed read calls.
+  * The timeout exception is thrown by timed read calls.  Timeouts are routine, so this is
+  * a cheap AnExpectedException.
   */
-class ReadTimeout : public AnException
+class ReadTimeout : public AnExpectedException
 {
 	public:
 		ReadTimeout( const char *file, int line) :
-		AnException(0, file, line, "Socket Read Timed Out.") {}
+		AnExpectedException(0, file, line, "Socket Read Timed Out.") {}
 
 		virtual ~ReadTimeout() {}
 };
@@ -30,11 +30,16 @@
 #	include <sys/time.h>
 #endif
 
+#include <map>
+using namespace std;
+
 #include "Thread.h"
 #include "Log.h"
 #include "twine.h"
 #include "LogMsg.h"
 #include "MsgQueue.h"
+#include "Lock.h"
+#include "Timer.h"
 
 using namespace SLib;
 
@@ -52,6 +57,153 @@ static bool lazy_on = false;
 
 static MsgQueue<LogMsg*>* log_queue = NULL;
 
+// Messages logged to each channel.  Bumped with an atomic add, so loggers never wait on
+// whoever is reading them.
+#define LOG_CHANNELS 7
+static volatile uint64_t channel_counts[ LOG_CHANNELS ];
+
+/** This is the rate limiting and repeat tracking state for a single
+    log call site.
+*/
+struct LogSite {
+	twine file;
+	int line;
+	int perSecond;		// per-site override, 0 means use the default
+	int burst;
+	double tokens;
+	uint64_t lastRefill;
+	uint64_t pendingLimited;	// dropped since the last message we let through
+	uint64_t rateLimited;
+	uint64_t repeated;
+};
+
+/** Orders call sites by line first (cheap) and then by file name.  We compare
+    the file name text rather than the pointer because the same __FILE__ can
+    have a different address in different compilation units.
+*/
+struct LogSiteLess {
+	bool operator()(const pair<const char*, int>& a, const pair<const char*, int>& b) const {
+		if(a.second != b.second) return a.second < b.second;
+		return strcmp(a.first, b.first) < 0;
+	}
+};
+
+typedef map< pair<const char*, int>, LogSite*, LogSiteLess > LogSiteMap;
+
+static LogSiteMap* log_sites = NULL;
+static SLib::Mutex* log_sites_mutex = NULL;
+static int rate_per_second = 0;
+static int rate_burst = 0;
+static int rate_overrides = 0;
+static bool collapse_on = false;
+static LogMsg* last_msg = NULL;
+static uint64_t last_repeats = 0;
+
+static SLib::Mutex* LogSitesMutex()
+{
+	if(log_sites_mutex == NULL){
+		log_sites_mutex = new SLib::Mutex();
+	}
+	return log_sites_mutex;
+}
+
+/** Finds or creates the site record.  Caller must hold the log sites mutex.
+*/
+static LogSite* FindSite(const char* file, int line)
+{
+	if(log_sites == NULL){
+		log_sites = new LogSiteMap();
+	}
+	LogSiteMap::iterator it = log_sites->find( make_pair(file, line) );
+	if(it != log_sites->end()){
+		return it->second;
+	}
+	LogSite* site = new LogSite();
+	site->file = file;
+	site->line = line;
+	site->perSecond = 0;
+	site->burst = 0;
+	site->tokens = -1; // filled up on first use
+	site->lastRefill = 0;
+	site->pendingLimited = 0;
+	site->rateLimited = 0;
+	site->repeated = 0;
+	// Key on our own copy of the file name so the key outlives the caller's string.
+	(*log_sites)[ make_pair(site->file(), line) ] = site;
+	return site;
+}
+
+/** Builds the summary message that replaces a run of dropped or repeated messages.
+*/
+static LogMsg* SummaryMsg(const char* file, int line, int channel, const twine& appSession,
+	const char* what, uint64_t count)
+{
+	LogMsg* lm = new LogMsg(file, line);
+	lm->appSession = appSession;
+	lm->msg.format(what, (unsigned long)count);
+	lm->channel = channel;
+	return lm;
+}
+
+/** Returns true if the message about to be logged at this call site should be
+    dropped because the site has used up its rate limit.  This is checked before
+    the message is formatted so that dropped messages cost as little as possible.
+*/
+static bool RateLimited(const char* file, int line, int channel)
+{
+	if(rate_per_second == 0 && rate_overrides == 0){
+		return false; // rate limiting is off
+	}
+
+	LogMsg* summary = NULL;
+	{ // for scope
+		SLib::Lock the_lock(LogSitesMutex());
+		LogSite* site = FindSite(file, line);
+		int perSecond = site->perSecond ? site->perSecond : rate_per_second;
+		int burst = site->perSecond ? site->burst : rate_burst;
+		if(perSecond == 0){
+			return false;
+		}
+		if(burst < 1){
+			burst = 1;
+		}
+
+		uint64_t now = Timer::GetCycleCount();
+		if(site->tokens < 0){
+			site->tokens = burst;
+		} else if(now > site->lastRefill){
+			site->tokens += (double)(now - site->lastRefill) * perSecond / 1000000.0;
+			if(site->tokens > burst){
+				site->tokens = burst;
+			}
+		}
+		site->lastRefill = now;
+
+		if(site->tokens < 1.0){
+			site->rateLimited ++;
+			site->pendingLimited ++;
+			return true;
+		}
+		site->tokens -= 1.0;
+
+		if(site->pendingLimited != 0){
+			summary = SummaryMsg(file, line, channel, "",
+				"Rate limit suppressed %lu messages from this call site.", site->pendingLimited);
+			site->pendingLimited = 0;
+		}
+	} // mutex released here
+
+	if(summary != NULL){
+		Log::Persist(summary);
+	}
+	return false;
+}
+
+/** This does the actual work of writing the log message out to the disk or
+    adding it to our log queue in memory.
+*/
+static void WriteMsg(LogMsg* lm);
+
 void Log::TimeStamp(twine& t)
 {
 	t.reserve(64);
@@ -82,6 +234,9 @@ void Log::Init(const char *filename)
 {
 	FILE *tmp;
 
+	// Don't let a pending repeat summary get lost in the switch.
+	FlushRepeats();
+
 	if(loginit){
 		// switch streams here so that the logout pointer is
 		// never undefined.
@@ -143,9 +298,59 @@ MsgQueue<LogMsg*>& Log::GetLogQueue(void)
 }
 
 void Log::Persist(LogMsg* lm)
+{
+	if(lm->channel >= 0 && lm->channel < LOG_CHANNELS){
+#ifdef _WIN32
+		InterlockedIncrement64((volatile LONG64*)&channel_counts[ lm->channel ]);
+#else
+		__sync_fetch_and_add(&channel_counts[ lm->channel ], 1);
+#endif
+	}
+
+	if(!collapse_on){
+		WriteMsg(lm);
+		return;
+	}
+
+	LogMsg* summary = NULL;
+	{ // for scope
+		SLib::Lock the_lock(LogSitesMutex());
+		if(last_msg != NULL &&
+			last_msg->line == lm->line &&
+			last_msg->channel == lm->channel &&
+			last_msg->msg.compare(lm->msg) == 0 &&
+			last_msg->file.compare(lm->file) == 0 &&
+			last_msg->appSession.compare(lm->appSession) == 0
+		){
+			// Same as the last one - just count it.
+			last_repeats ++;
+			FindSite(lm->file(), lm->line)->repeated ++;
+			delete lm;
+			return;
+		}
+
+		if(last_msg != NULL && last_repeats != 0){
+			summary = SummaryMsg(last_msg->file(), last_msg->line, last_msg->channel,
+				last_msg->appSession, "Last message repeated %lu times.", last_repeats);
+		}
+		if(last_msg == NULL){
+			last_msg = new LogMsg(*lm);
+		} else {
+			*last_msg = *lm;
+		}
+		last_repeats = 0;
+	} // mutex released here
+
+	if(summary != NULL){
+		WriteMsg(summary);
+	}
+	WriteMsg(lm);
+}
+
+static void WriteMsg(LogMsg* lm)
 {
 	if(lazy_on){
-		GetLogQueue().AddMsg(lm);
+		Log::GetLogQueue().AddMsg(lm);
 	} else {
 		char local_tmp[32];
 		memset(local_tmp, 0, 32);
@@ -177,6 +382,97 @@ void Log::Persist(LogMsg* lm)
 		
 
 
+void Log::SetRateLimit(int perSecond, int burst)
+{
+	LogSitesMutex(); // make sure this exists before anyone checks the rate
+	rate_burst = burst;
+	rate_per_second = perSecond < 0 ? 0 : perSecond;
+}
+
+void Log::SetRateLimit(const char* file, int line, int perSecond, int burst)
+{
+	SLib::Lock the_lock(LogSitesMutex());
+	LogSite* site = FindSite(file, line);
+	if(site->perSecond != 0) rate_overrides--;
+	site->perSecond = perSecond < 0 ? 0 : perSecond;
+	site->burst = burst;
+	site->tokens = -1; // start the new limit with a full bucket
+	if(site->perSecond != 0) rate_overrides++;
+}
+
+void Log::SetCollapseRepeats(bool onoff)
+{
+	LogSitesMutex(); // make sure this exists before anyone collapses
+	if(!onoff){
+		FlushRepeats();
+	}
+	collapse_on = onoff;
+}
+
+bool Log::CollapseRepeatsOn(void)
+{
+	return collapse_on;
+}
+
+void Log::FlushRepeats(void)
+{
+	if(log_sites_mutex == NULL){
+		return; // never turned on
+	}
+
+	LogMsg* summary = NULL;
+	{ // for scope
+		SLib::Lock the_lock(LogSitesMutex());
+		if(last_msg != NULL){
+			if(last_repeats != 0){
+				summary = SummaryMsg(last_msg->file(), last_msg->line, last_msg->channel,
+					last_msg->appSession, "Last message repeated %lu times.", last_repeats);
+			}
+			delete last_msg;
+			last_msg = NULL;
+			last_repeats = 0;
+		}
+	} // mutex released here
+
+	if(summary != NULL){
+		WriteMsg(summary);
+	}
+}
+
+vector<LogSiteStats> Log::GetSuppressionStats(void)
+{
+	vector<LogSiteStats> ret;
+	if(log_sites_mutex == NULL){
+		return ret;
+	}
+
+	SLib::Lock the_lock(LogSitesMutex());
+	if(log_sites == NULL){
+		return ret;
+	}
+	for(LogSiteMap::iterator it = log_sites->begin(); it != log_sites->end(); it++){
+		LogSite* site = it->second;
+		if(site->rateLimited == 0 && site->repeated == 0){
+			continue;
+		}
+		LogSiteStats lss;
+		lss.file = site->file();
+		lss.line = site->line;
+		lss.rateLimited = site->rateLimited;
+		lss.repeated = site->repeated;
+		ret.push_back(lss);
+	}
+	return ret;
+}
+
+uint64_t Log::MessageCount(int channel)
+{
+	if(channel < 0 || channel >= LOG_CHANNELS){
+		return 0;
+	}
+	return channel_counts[ channel ];
+}
+
 void Log::SetPanic(bool	onoff)
 {
 	panicon = onoff;
@@ -190,6 +486,7 @@ bool Log::PanicOn(void)
 void Log::Panic(const char *file, int line, const char *msg, ...)
 {
 	if(!panicon) return;
+	if(RateLimited(file, line, 0)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 
@@ -208,6 +505,7 @@ void Log::Panic(const char *file, int line, const char *msg, ...)
 void Log::Panic(const twine& appSession, const char *file, int line, const char *msg, ...)
 {
 	if(!panicon) return;
+	if(RateLimited(file, line, 0)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 	lm->appSession = appSession;
@@ -237,6 +535,7 @@ bool Log::ErrorOn(void)
 void Log::Error(const char *file, int line, const char *msg, ...)
 {
 	if(!erroron) return;
+	if(RateLimited(file, line, 1)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 
@@ -255,6 +554,7 @@ void Log::Error(const char *file, int line, const char *msg, ...)
 void Log::Error(const twine& appSession, const char *file, int line, const char *msg, ...)
 {
 	if(!erroron) return;
+	if(RateLimited(file, line, 1)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 	lm->appSession = appSession;
@@ -284,6 +584,7 @@ bool Log::WarnOn(void)
 void Log::Warn(const char *file, int line, const char *msg, ...)
 {
 	if(!warnon) return;
+	if(RateLimited(file, line, 2)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 
@@ -302,6 +603,7 @@ void Log::Warn(const char *file, int line, const char *msg, ...)
 void Log::Warn(const twine& appSession, const char *file, int line, const char *msg, ...)
 {
 	if(!warnon) return;
+	if(RateLimited(file, line, 2)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 	lm->appSession = appSession;
@@ -331,6 +633,7 @@ bool Log::InfoOn(void)
 void Log::Info(const char *file, int line, const char *msg, ...)
 {
 	if(!infoon) return;
+	if(RateLimited(file, line, 3)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 
@@ -349,6 +652,7 @@ void Log::Info(const char *file, int line, const char *msg, ...)
 void Log::Info(const twine& appSession, const char *file, int line, const char *msg, ...)
 {
 	if(!infoon) return;
+	if(RateLimited(file, line, 3)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 	lm->appSession = appSession;
@@ -378,6 +682,7 @@ bool Log::DebugOn(void)
 void Log::Debug(const char *file, int line, const char *msg, ...)
 {
 	if(!debugon) return;
+	if(RateLimited(file, line, 4)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 
@@ -396,6 +701,7 @@ void Log::Debug(const char *file, int line, const char *msg, ...)
 void Log::Debug(const twine& appSession, const char *file, int line, const char *msg, ...)
 {
 	if(!debugon) return;
+	if(RateLimited(file, line, 4)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 	lm->appSession = appSession;
@@ -425,6 +731,7 @@ bool Log::TraceOn(void)
 void Log::Trace(const char *file, int line, const char *msg, ...)
 {
 	if(!traceon) return;
+	if(RateLimited(file, line, 5)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 
@@ -444,6 +751,7 @@ void Log::Trace(const char *file, int line, const char *msg, ...)
 void Log::Trace(const twine& appSession, const char *file, int line, const char *msg, ...)
 {
 	if(!traceon) return;
+	if(RateLimited(file, line, 5)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 	lm->appSession = appSession;
@@ -474,6 +782,7 @@ bool Log::SqlTraceOn(void)
 void Log::SqlTrace(const char *file, int line, const char *msg, ...)
 {
 	if(!sqltraceon) return;
+	if(RateLimited(file, line, 6)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 
@@ -492,6 +801,7 @@ void Log::SqlTrace(const char *file, int line, const char *msg, ...)
 void Log::SqlTrace(const twine& appSession, const char *file, int line, const char *msg, ...)
 {
 	if(!sqltraceon) return;
+	if(RateLimited(file, line, 6)) return;
 
 	LogMsg* lm = new LogMsg(file, line);
 	lm->appSession = appSession;
@@ -27,12 +27,35 @@
 #endif
 
 #include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+using namespace std;
+
 #include "twine.h"
 #include "MsgQueue.h"
 #include "LogMsg.h"
 
 namespace SLib {
 
+/**
+  * This holds the suppression counters for a single log call site.  A call
+  * site is the file and line passed to the log functions with FL.
+  */
+struct LogSiteStats {
+	/// Source file of the call site
+	const char* file;
+
+	/// Source line of the call site
+	int line;
+
+	/// Number of messages dropped by the rate limit at this site
+	uint64_t rateLimited;
+
+	/// Number of messages folded into a "Last message repeated" summary
+	uint64_t repeated;
+};
+
 /**
   * @memo This class encapsulates our logging functions.
   * @doc  This class encapsulates our logging functions.  All of the logging
@@ -238,6 +261,55 @@ class DLLEXPORT Log {
 		/// Indicates whethere SqlTrace is on or not.
 		static bool SqlTraceOn(void);
 
+		/**
+		  * Turns on rate limiting for every log call site.  Each call
+		  * site (identified by the FL file and line) gets its own token
+		  * bucket that refills at perSecond messages per second and holds
+		  * at most burst messages.  Messages that arrive when the bucket
+		  * is empty are dropped before they are formatted, and counted.
+		  * Passing a perSecond of 0 turns the default rate limit off.
+		  */
+		static void SetRateLimit(int perSecond, int burst);
+
+		/**
+		  * Sets a rate limit for one specific call site.  This overrides
+		  * the default given to SetRateLimit(perSecond, burst) for that
+		  * site only.  Passing a perSecond of 0 removes the override.
+		  */
+		static void SetRateLimit(const char* file, int line, int perSecond, int burst);
+
+		/**
+		  * Turns on collapsing of consecutive identical log messages.  When
+		  * the same message (file, line, channel and text) is logged several
+		  * times in a row, only the first one is written and the rest are
+		  * replaced by a single "Last message repeated N times" message.
+		  */
+		static void SetCollapseRepeats(bool onoff);
+
+		/// Indicates whether repeat collapsing is on or not.
+		static bool CollapseRepeatsOn(void);
+
+		/**
+		  * If repeat collapsing is on and we are holding back repeats of
+		  * the last message, this writes out the "Last message repeated"
+		  * summary now rather than waiting for the next different message.
+		  */
+		static void FlushRepeats(void);
+
+		/**
+		  * Returns the suppression counters for every call site that has
+		  * been rate limited or collapsed.  Counters are never reset.
+		  */
+		static vector<LogSiteStats> GetSuppressionStats(void);
+
+		/**
+		  * Returns the number of messages logged to a channel (0 Panic through
+		  * 6 SqlTrace) since we started.  Messages that were switched off or
+		  * rate limited are not counted, repeats that were collapsed are.
+		  * Reading this takes no locks.
+		  */
+		static uint64_t MessageCount(int channel);
+
 		/**
 		  * Produces a micro resolution timestamp and puts it
 		  * into t.
@@ -19,6 +19,7 @@
 #include "dptr.h"
 #include "Timer.h"
 #include "LogFile.h"
+#include "LogFileReader.h"
 using namespace SLib;
 
 twine m_machineName;
@@ -44,6 +45,8 @@ bool m_display_channel;
 bool m_show_stringtable;
 bool m_dump_data;
 bool m_watch_mode;
+bool m_since_set;
+int m_since_id;
 
 void printUsage(char* appName)
 {
@@ -75,6 +78,7 @@ void printUsage(char* appName)
 	"\t-b             Use this to display the string table\n"
 	"\t-x             Use this to export a dump of the message data directly\n"
 	"\t-w             Use this to Watch for new messages\n"
+	"\t--since-id ID  Use this to start after message ID (resume where a previous run left off)\n"
 	"\n");
 }
 
@@ -84,6 +88,12 @@ void getArgs(int argc, char** argv)
 	bool first_d = true;
 
 	for(int i = 2; i < argc; i++){
+		if(strcmp(argv[i], "--since-id") == 0 && i + 1 < argc){
+			i++;
+			m_since_set = true;
+			m_since_id = atoi(argv[i]);
+			continue;
+		}
 		if(argv[i][0] == '-'){
 			if(argv[i][1] == 'm'){
 				i++;
@@ -173,34 +183,33 @@ void getArgs(int argc, char** argv)
 	}
 }
 
-void printMessage(LogMsg* lm)
+void printSpan(const LogFileSpan& span)
+{
+	printf("%.*s|", span.length, span.data);
+}
+
+void printMessage(LogFileRecord& rec)
 {
 	char local_tmp[32];
 	memset(local_tmp, 0, 32);
 
-	if(m_display_id) printf("%d|", lm->id);
+	if(m_display_id) printf("%d|", rec.id());
 
 	if(m_display_date){
-#ifdef _WIN32
-		strftime(local_tmp, 32, "%Y/%m/%d %H:%M:%S", localtime(&(lm->timestamp.time)));
+		time_t secs = (time_t)rec.seconds();
+		strftime(local_tmp, 32, "%Y/%m/%d %H:%M:%S", localtime(&secs));
 		printf("%s.%.3d|",
-			local_tmp, (int)lm->timestamp.millitm
+			local_tmp, rec.fraction()
 		);
-#else
-		strftime(local_tmp, 32, "%Y/%m/%d %H:%M:%S", localtime(&(lm->timestamp.tv_sec)));
-		printf("%s.%.3d|",
-			local_tmp, (int)lm->timestamp.tv_usec
-		);
-#endif
 	}
 
-	if(m_display_machine) printf("%s|", lm->machineName());
-	if(m_display_app) printf("%s|", lm->appName());
-	if(m_display_thread) printf("%ld|", (intptr_t)lm->tid);
-	if(m_display_file) printf("%s|", lm->file());
-	if(m_display_line) printf("%d|", lm->line);
+	if(m_display_machine) printSpan(rec.machineName());
+	if(m_display_app) printSpan(rec.appName());
+	if(m_display_thread) printf("%d|", rec.tid());
+	if(m_display_file) printSpan(rec.file());
+	if(m_display_line) printf("%d|", rec.line());
 	if(m_display_channel) {
-		switch(lm->channel){
+		switch(rec.channel()){
 			case 0: printf("PANIC|"); break;
 			case 1: printf("ERROR|"); break;
 			case 2: printf("WARN|"); break;
@@ -210,72 +219,74 @@ void printMessage(LogMsg* lm)
 			case 6: printf("SQLTRACE|"); break;
 		}
 	}
-	printf("%s\n", lm->msg() );
+	LogFileSpan msg = rec.msg();
+	printf("%.*s\n", msg.length, msg.data );
 
 }
 
-void filterAndPrint(LogMsg* lm)
+void filterAndPrint(LogFileRecord& rec)
 {
 	bool filtersMatch = true;
+	int channel = rec.channel();
 
 	if(filtersMatch && m_panic == false){
-		if(lm->channel == 0){
+		if(channel == 0){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_error == false){
-		if(lm->channel == 1){
+		if(channel == 1){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_warn == false){
-		if(lm->channel == 2){
+		if(channel == 2){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_info == false){
-		if(lm->channel == 3){
+		if(channel == 3){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_debug == false){
-		if(lm->channel == 4){
+		if(channel == 4){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_trace == false){
-		if(lm->channel == 5){
+		if(channel == 5){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_sqltrace == false){
-		if(lm->channel == 6){
+		if(channel == 6){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_machineName.length() != 0){
-		if(lm->machineName.find( m_machineName ) == TWINE_NOT_FOUND){
+		if(!rec.machineName().contains( m_machineName )){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_appName.length() != 0){
-		if(lm->appName.find( m_appName ) == TWINE_NOT_FOUND){
+		if(!rec.appName().contains( m_appName )){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && matchThreadID != 0){
-		if((intptr_t)lm->tid != matchThreadID){
+		if(rec.tid() != matchThreadID){
 			filtersMatch = false;
 		}
 	}
 	if(filtersMatch && m_message.length() != 0){
-		if(lm->msg.find( m_message ) == TWINE_NOT_FOUND){
+		if(!rec.msg().contains( m_message )){
 			filtersMatch = false;
 		}
 	}
 
 	if(filtersMatch){
-		printMessage(lm);
+		printMessage(rec);
 	}
 
 }
@@ -293,6 +304,8 @@ int main(int argc, char** argv)
 	m_show_stringtable = false;
 	m_dump_data = false;
 	m_watch_mode = false;
+	m_since_set = false;
+	m_since_id = 0;
 
 	if(argc == 1){
 		printUsage(argv[0]);
@@ -338,52 +351,9 @@ int main(int argc, char** argv)
 	printf("=============================================\n");
 
 	try {
-		//printf("Opening log file: %s\n", logFileName() );
-		//printf("=============================================\n");
-		LogFile lf(logFileName,
-			1024 * 1024 * 10, // 10M max
-			10000, // entries max
-			1024 * 1024 * 1, // 1M string table
-			1024 * 10, // 10K strings
-			false, // don't re-use
-			false // don't clear at startup
-		);
-
-		//printf("Dumping Index stats and String table:\n");
-		//printf("=============================================\n");
-		if(m_show_stringtable){
-			lf.dumpIndexAndStrings();
-		}
-
-		int oldest = lf.getOldestMessageID();
-		int newest = lf.getNewestMessageID();
-		if(m_watch_mode && ( (newest - oldest) > 20 )){
-			oldest = newest - 20; // only print the last 20 messages
-			if(oldest < 0){
-				oldest = 0;
-			}
-		}
-		//printf("Looping over messages %d to %d:\n", oldest, newest);
-		//printf("=============================================\n");
-		for(int i = oldest; i <= newest; i++){
-			//printf("Looking for message: %d\n", i);
-			dptr<LogMsg> lm; lm = lf.getMessage(i);
-			if(lm == NULL) {
-				//printf("\tmessage %d not found!\n", i);
-				continue;
-			}
-			filterAndPrint( lm );
-		}			
-
-		if(m_dump_data){
-			lf.dumpMessageData();
-		}
-
-		lf.close();
-
-		if(m_watch_mode){ while(1){
-			Tools::msleep( 500 );
-			LogFile lfWatch(logFileName,
+		if(m_show_stringtable || m_dump_data){
+			// These come from the full LogFile - they are about its internals.
+			LogFile lf(logFileName,
 				1024 * 1024 * 10, // 10M max
 				10000, // entries max
 				1024 * 1024 * 1, // 1M string table
@@ -391,18 +361,41 @@ int main(int argc, char** argv)
 				false, // don't re-use
 				false // don't clear at startup
 			);
-			int new_newest = lfWatch.getNewestMessageID();
-			if(new_newest > newest){
-				for(int i = newest + 1; i <= new_newest; i++){
-					dptr<LogMsg> lm; lm = lfWatch.getMessage(i);
-					if(lm == NULL) continue;
-					filterAndPrint( lm );
-				}
+			if(m_show_stringtable){
+				lf.dumpIndexAndStrings();
+			}
+			if(m_dump_data){
+				lf.dumpMessageData();
+			}
+			lf.close();
+		}
 
-				newest = new_newest;
+		// Stream the messages straight out of the mapped file - nothing is copied, so a
+		// full log costs no more memory than an empty one.
+		LogFileReader reader(logFileName);
+		if(m_since_set){
+			reader.seekAfter( m_since_id );
+		} else if(m_watch_mode && reader.messageCount() > 20){
+			reader.seekAfter( reader.newestID() - 20 ); // only print the last 20 messages
+		}
+
+		LogFileRecord rec;
+		while(reader.next( rec )){
+			filterAndPrint( rec );
+		}
+
+		if(m_watch_mode){ while(1){
+			Tools::msleep( 500 );
+			reader.refresh();
+			while(reader.next( rec )){
+				filterAndPrint( rec );
 			}
+			fflush(stdout);
 		} }
 
+		printf("=============================================\n");
+		printf("Resume with: --since-id %d\n", reader.lastID() );
+
 	} catch (AnException& e){
 		printf("Exception caught opening log file (%s):\n%s\n", logFileName(),
 			e.Msg() );
@@ -1,7 +1,17 @@
 #include "LogFile.h"
 #include "Date.h"
+#include "File.h"
 using namespace SLib;
 
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /// The size of our LogFile signature = 8.
 static int SIGNATURE_SIZE = 8;
 
@@ -100,6 +110,13 @@ LogFile::LogFile(twine FileName, int max_size, bool reuse, bool clear_at_startup
 	m_reuse = reuse;
 	m_log = NULL;
 	m_clear_at_startup = clear_at_startup;
+	m_map = NULL;
+	m_map_handle = NULL;
+	m_map_size = 0;
+	m_map_pos = 0;
+	m_mapped = false;
+	m_sync_every = 0;
+	m_since_sync = 0;
 
 	m_indexes = NULL;
 	m_log_ids = NULL;
@@ -161,6 +178,13 @@ LogFile::LogFile(twine FileName, int max_size, int max_entries,
 	m_reuse = reuse;
 	m_log = NULL;
 	m_clear_at_startup = clear_at_startup;
+	m_map = NULL;
+	m_map_handle = NULL;
+	m_map_size = 0;
+	m_map_pos = 0;
+	m_mapped = false;
+	m_sync_every = 0;
+	m_since_sync = 0;
 
 	m_indexes = NULL;
 	m_log_ids = NULL;
@@ -203,90 +227,153 @@ void LogFile::writeMsg(LogMsg& msg)
 {
 	Lock theLock(m_mutex);
 
-	int start_of_messages = 
-		SIGNATURE_SIZE + 
-		INDEX_HEADER_SIZE + 
-		(m_index_header.index_count * INDEX_ENTRY_SIZE) + 
-		m_string_table_header.total_size;
-
 	// First we need to stringify this message by replacing all of
 	// it's static strings with references to our string table.
 	LogMsgStripped msg2(msg, this);
 
 	// How big is the message:
 	int msg_len = msg2.length();
-	if (msg_len > (m_max_size - start_of_messages)) {
+	if (msg_len > (m_max_size - startOfMessages())) {
 		throw AnException(0, FL, "Message size greater than max log file size.");
 	}
 
-	// Get the next index:
+	int offset = nextOffset(msg_len);
+	bool out_of_space = (m_index_header.record_count == m_index_header.index_count) ||
+		oldestInTheWay(offset, msg_len);
+
+	if(out_of_space && !m_reuse){
+		// Shut the file down, open another and then write the message again.
+		createNewFile();
+		LogMsgStripped fresh(msg, this); // the new file has an empty string table
+		appendMessage(fresh, startOfMessages(), fresh.length());
+		return;
+	}
+
+	if(out_of_space){
+		// Reusing the file - make room by dropping the oldest messages.
+		evictFor(offset, msg_len);
+	}
+	appendMessage(msg2, offset, msg_len);
+}
+
+int LogFile::startOfMessages()
+{
+	return SIGNATURE_SIZE +
+		INDEX_HEADER_SIZE +
+		(m_index_header.index_count * INDEX_ENTRY_SIZE) +
+		m_string_table_header.total_size;
+}
+
+int LogFile::nextOffset(int msg_len)
+{
+	if(m_index_header.record_count == 0){
+		return startOfMessages();
+	}
+
+	// Right after the newest message, unless that runs off the end of the file.
+	IndexEntry* newest = (*m_indexes)[m_index_header.newest_entry];
+	int offset = newest->offset + newest->length;
+	if(offset + msg_len > m_max_size){
+		offset = startOfMessages(); // wrap around to the front
+	}
+	return offset;
+}
+
+bool LogFile::oldestInTheWay(int offset, int msg_len)
+{
+	if(m_index_header.record_count == 0){
+		return false;
+	}
+
+	// Messages sit in the data area in the same order as the index ring, so the oldest
+	// message is always the next one past wherever we write.  If we miss it, we miss
+	// them all.
 	IndexEntry* oldest = (*m_indexes)[m_index_header.oldest_entry];
+	if(oldest->offset < offset + msg_len && offset < oldest->offset + oldest->length){
+		return true;
+	}
+
+	// When we wrap around to the front, anything left between the newest message and the
+	// end of the file is cut off from the ring - it has to go first.
 	IndexEntry* newest = (*m_indexes)[m_index_header.newest_entry];
+	int newest_end = newest->offset + newest->length;
+	return offset < newest_end && oldest->offset >= newest_end;
+}
 
-	// easy case: first one in
-	if (m_index_header.record_count == 0) {
-		IndexEntry* our_index = (*m_indexes)[0];
-		our_index->id = msg.id;
-		our_index->offset = start_of_messages;
-		our_index->length = msg_len;
-
-		m_index_header.record_count++;
-		m_index_header.oldest_entry = 0;
-		m_index_header.newest_entry = 0;
-		(*m_log_ids)[our_index->id] = our_index;
-
-		writeIndexHeader(); // Write the index header:
-		writeIndexEntry(0); // Write the new index entry
-		writeMessageEntry(0, msg2); // Write the new data
-		fflush(m_log);
+void LogFile::evictFor(int offset, int msg_len)
+{
+	vector<int> evicted;
+	while(m_index_header.record_count > 0 &&
+		(m_index_header.record_count == m_index_header.index_count ||
+		 oldestInTheWay(offset, msg_len))
+	){
+		evicted.push_back(m_index_header.oldest_entry);
+		m_index_header.oldest_entry = (m_index_header.oldest_entry + 1) % m_index_header.index_count;
+		m_index_header.record_count--;
+	}
 
-	} else if (m_index_header.record_count < m_index_header.index_count) {
-		// Still available indexes to be used.
-		int space_left;
-		if (oldest->offset <= newest->offset) {
-			// oldest still before newest in the physical layout.
-			// Haven't wrapped the log yet.
-			space_left = m_max_size - (newest->offset + newest->length);
-			if (msg_len < space_left) {
-				int which_index = m_index_header.record_count;
-				IndexEntry* our_index = (*m_indexes)[which_index];
-				our_index->id = msg.id;
-				our_index->offset = newest->offset + newest->length;
-				our_index->length = msg_len;
-
-				m_index_header.newest_entry = which_index;
-				m_index_header.record_count++;
-				(*m_log_ids)[our_index->id] = our_index;
-
-				writeIndexHeader(); // Write the index header:
-				writeIndexEntry(which_index); // Write the new index entry
-				writeMessageEntry(which_index, msg2); // Write the new data
-				fflush(m_log);
-
-			} else {
-				// Not enough space at the end of the file.
-				// If we are reusing the file, then wrap.
-				// If not, shut the file down, open another and then
-				// write the message again.
-				if(m_reuse){
-					throw AnException(0, FL, "Out of space.  Reuse not Implemented Yet.");
-				} else {
-					createNewFile();
-				}
-					
-			}
-		} else {
-			// We've wrapped the log in terms of physical layout.
-			// calculate how many messages need to be removed to open up
-			// a gap big enough for us to write to.
-			//throw AnException(0, FL, "Out of log space! Not Implemented Yet.");
-			createNewFile();
+	// The header goes first: once it is on disk, nobody will look at the messages we are
+	// about to overwrite.
+	writeIndexHeader();
+	flushFile();
+
+	for(size_t i = 0; i < evicted.size(); i++){
+		IndexEntry* ie = (*m_indexes)[evicted[i]];
+		if(m_log_ids->count(ie->id) != 0 && (*m_log_ids)[ie->id] == ie){
+			m_log_ids->erase(ie->id);
 		}
+		ie->offset = 0;
+		ie->length = 0;
+		ie->id = 0;
+		writeIndexEntry(evicted[i]);
+	}
+}
+
+void LogFile::appendMessage(LogMsgStripped& msg, int offset, int msg_len)
+{
+	int which_index;
+	if(m_index_header.record_count == 0){
+		which_index = m_index_header.oldest_entry;
 	} else {
-		// We've run out of indexes. Start a new file for logging.
-		createNewFile();
+		which_index = (m_index_header.newest_entry + 1) % m_index_header.index_count;
+	}
+
+	IndexEntry* our_index = (*m_indexes)[which_index];
+	our_index->id = msg.id;
+	our_index->offset = offset;
+	our_index->length = msg_len;
+
+	// Data and index entry first, then the header that makes them visible.  If we die in
+	// between, the header still describes a good set of messages.
+	writeMessageEntry(which_index, msg); // Write the new data
+	writeIndexEntry(which_index); // Write the new index entry
+	flushFile();
+
+	if(m_index_header.record_count == 0){
+		m_index_header.oldest_entry = which_index;
+	}
+	m_index_header.newest_entry = which_index;
+	m_index_header.record_count++;
+	(*m_log_ids)[our_index->id] = our_index;
+
+	writeIndexHeader(); // Write the index header:
+	if(m_map != NULL){
+		// Our stores are already in the page cache - the OS has them even if we die now.
+		// Getting them onto the disk is up to our sync cadence.
+		m_since_sync++;
+		if(m_sync_every > 0 && m_since_sync >= m_sync_every){
+			syncMap();
+		}
+	} else {
+		fflush(m_log);
+	}
+}
+
+void LogFile::flushFile()
+{
+	if(m_map == NULL){
+		fflush(m_log);
 	}
-	
 }
 
 int LogFile::messageCount() 
@@ -301,31 +388,12 @@ vector<LogMsg*>* LogFile::getAllMessages()
 
 	vector<LogMsg*>* ret = new vector<LogMsg*>();
 
-	if (m_index_header.oldest_entry < m_index_header.newest_entry) {
-		// run a straight loop to get them
-		for (int i = m_index_header.oldest_entry; i <= m_index_header.newest_entry; i++)
-		{
-			try {
-				ret->push_back(readMessageEntry( (*m_indexes)[i] ));
-			} catch (AnException&) {
-			}
-		}
-	} else {
-		// if oldest is bigger than newest, we've looped the table.
-		// first go from oldest to end of table:
-		for (int i = m_index_header.oldest_entry; i < m_index_header.index_count; i++)
-		{
-			try {
-				ret->push_back(readMessageEntry( (*m_indexes)[i] ));
-			} catch (AnException&) {
-			}
-		}
-		// Then go from beginning of table to newest
-		for (int i = 0; i <= m_index_header.newest_entry; i++) {
-			try {
-				ret->push_back(readMessageEntry( (*m_indexes)[i] ));
-			} catch (AnException&) {
-			}
+	// Walk the index ring from the oldest entry, wrapping at the end of the table.
+	for (int i = 0; i < m_index_header.record_count; i++) {
+		int which_index = (m_index_header.oldest_entry + i) % m_index_header.index_count;
+		try {
+			ret->push_back(readMessageEntry( (*m_indexes)[which_index] ));
+		} catch (AnException&) {
 		}
 	}
 
@@ -532,6 +600,7 @@ void LogFile::close()
 {
 	Lock theLock(m_mutex);	
 
+	unmapFile();
 	if(m_log != NULL){
 		fclose(m_log);
 	}
@@ -540,12 +609,21 @@ void LogFile::close()
 
 void LogFile::createNewFile()
 {
-	// First close the log file
-	close();
+	// First close the log file.  Not with close() - writeMsg calls us with our mutex held.
+	unmapFile();
+	if(m_log != NULL){
+		fclose(m_log);
+		m_log = NULL;
+	}
 	
 	// Then move it to a new name:
 	Date d;
-	twine newName = m_file_name + "." + d.GetValue("%Y%m%d%H%M%S"); 
+	twine stamp = d.GetValue("%Y%m%d%H%M%S");
+	twine newName = m_file_name + "." + stamp; 
+	for(int i = 1; File::Exists( newName ); i++){
+		// Rolled over more than once this second - don't overwrite the last one.
+		newName.format( "%s.%s.%d", m_file_name(), stamp(), i );
+	}
 	int res = rename( m_file_name(), newName() );
 	if(res){
 		throw AnException(0, FL, "Error renaming existing log file %s to %s",
@@ -554,6 +632,106 @@ void LogFile::createNewFile()
 	
 	// Then create our new log file:
 	createFile();
+	if(m_mapped){
+		mapFile();
+	}
+}
+
+void LogFile::useMemoryMap(int syncEvery)
+{
+	Lock theLock(m_mutex);
+
+	m_sync_every = syncEvery;
+	if(!m_mapped){
+		m_mapped = true;
+		mapFile();
+	}
+}
+
+void LogFile::sync()
+{
+	Lock theLock(m_mutex);
+
+	if(m_map != NULL){
+		syncMap();
+	} else if(m_log != NULL){
+		fflush(m_log);
+	}
+}
+
+void LogFile::mapFile()
+{
+	if(m_log == NULL || m_map != NULL){
+		return;
+	}
+	fflush(m_log); // anything stdio is holding has to be in the file before we map it
+
+	// Map the whole file, growing it to our max size first.  The on-disk format doesn't
+	// change - a file written through the map reads back through stdio and vice versa.
+#ifdef _WIN32
+	HANDLE fh = (HANDLE)_get_osfhandle( _fileno(m_log) );
+	LARGE_INTEGER size;
+	GetFileSizeEx( fh, &size );
+	m_map_size = (size_t)size.QuadPart > (size_t)m_max_size ? (size_t)size.QuadPart : (size_t)m_max_size;
+	HANDLE mh = CreateFileMapping( fh, NULL, PAGE_READWRITE, 0, (DWORD)m_map_size, NULL );
+	if(mh == NULL){
+		throw AnException(0, FL, "Error creating a file mapping for %s", m_file_name() );
+	}
+	m_map = (char*)MapViewOfFile( mh, FILE_MAP_ALL_ACCESS, 0, 0, m_map_size );
+	if(m_map == NULL){
+		CloseHandle( mh );
+		throw AnException(0, FL, "Error mapping %s", m_file_name() );
+	}
+	m_map_handle = mh;
+#else
+	int fd = fileno(m_log);
+	struct stat st;
+	if(fstat(fd, &st) != 0){
+		throw AnException(0, FL, "Error reading the size of %s", m_file_name() );
+	}
+	m_map_size = (size_t)st.st_size;
+	if(m_map_size < (size_t)m_max_size){
+		if(ftruncate(fd, m_max_size) != 0){
+			throw AnException(0, FL, "Error growing %s to %d bytes", m_file_name(), m_max_size );
+		}
+		m_map_size = (size_t)m_max_size;
+	}
+	void* map = mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED){
+		throw AnException(0, FL, "Error mapping %s", m_file_name() );
+	}
+	m_map = (char*)map;
+#endif
+	m_map_pos = 0;
+	m_since_sync = 0;
+}
+
+void LogFile::unmapFile()
+{
+	if(m_map == NULL){
+		return;
+	}
+	syncMap();
+#ifdef _WIN32
+	UnmapViewOfFile( m_map );
+	CloseHandle( (HANDLE)m_map_handle );
+	m_map_handle = NULL;
+#else
+	munmap( m_map, m_map_size );
+#endif
+	m_map = NULL;
+	m_map_size = 0;
+}
+
+void LogFile::syncMap()
+{
+#ifdef _WIN32
+	FlushViewOfFile( m_map, m_map_size );
+	FlushFileBuffers( (HANDLE)_get_osfhandle( _fileno(m_log) ) );
+#else
+	msync( m_map, m_map_size, MS_SYNC );
+#endif
+	m_since_sync = 0;
 }
 
 void LogFile::openFile()
@@ -625,7 +803,9 @@ void LogFile::readLogHeaders()
 			ie->length = readInt();
 			ie->id = readInt();
 
-			(*m_log_ids)[ie->id] = ie;
+			if(ie->offset != 0){
+				(*m_log_ids)[ie->id] = ie;
+			}
 			m_indexes->push_back(ie);
 		}
 
@@ -867,15 +1047,41 @@ void LogFile::write(int32_t value)
 	if(m_log == NULL){
 		throw AnException(0, FL, "Trying to write to a log file that has not been opened.");
 	}
+	if(m_map != NULL){
+		writeMapped( &value, sizeof(int32_t) );
+		return;
+	}
 	fwrite( &value, sizeof(int32_t), 1, m_log);
 }
 
+void LogFile::writeMapped(const void* data, size_t len)
+{
+	if(m_map_pos + len > m_map_size){
+		throw AnException(0, FL, "Trying to write past the end of our mapped log file.");
+	}
+	memcpy( m_map + m_map_pos, data, len );
+	m_map_pos += len;
+}
+
+void LogFile::readMapped(void* data, size_t len)
+{
+	if(m_map_pos + len > m_map_size){
+		throw AnException(0, FL, "Trying to read past the end of our mapped log file.");
+	}
+	memcpy( data, m_map + m_map_pos, len );
+	m_map_pos += len;
+}
+
 int32_t LogFile::readInt()
 {
 	if(m_log == NULL){
 		throw AnException(0, FL, "Trying to write to a log file that has not been opened.");
 	}
 	int ret = 0;
+	if(m_map != NULL){
+		readMapped( &ret, sizeof(int32_t) );
+		return ret;
+	}
 	size_t count = fread ( &ret, sizeof(int32_t), 1, m_log);
 	if(count != 1){
 		throw AnException(0, FL, "Error reading an int from our log file.");
@@ -888,6 +1094,10 @@ void LogFile::write(twine& value)
 	if(m_log == NULL){
 		throw AnException(0, FL, "Trying to write to a log file that has not been opened.");
 	}
+	if(m_map != NULL){
+		writeMapped( value.data(), value.length() );
+		return;
+	}
 	fwrite( value.data(), value.length(), 1, m_log);
 }
 
@@ -898,6 +1108,11 @@ twine LogFile::readTwine(size_t length)
 	}
 	twine ret;
 	ret.reserve(length);
+	if(m_map != NULL){
+		readMapped( ret.data(), length );
+		ret.check_size();
+		return ret;
+	}
 	size_t count = fread ( ret.data(), length, 1, m_log);
 	if(count != 1){
 		throw AnException(0, FL, "Error reading a twine from our log file.");
@@ -926,6 +1141,10 @@ void LogFile::seek(long offsetFromStart)
 	if(m_log == NULL){
 		throw AnException(0, FL, "Trying to write to a log file that has not been opened.");
 	}
+	if(m_map != NULL){
+		m_map_pos = (size_t)offsetFromStart;
+		return;
+	}
 	fseek(m_log, offsetFromStart, SEEK_SET);
 }
 
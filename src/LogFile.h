@@ -74,6 +74,13 @@ class DLLEXPORT LogMsgStripped : public LogMsg {
  * This is all done using a random access file structure on the disk. Each time
  * we write to the file, we ensure that it has been flushed to the disk so that
  * when we return from the writeMsg() call, the file has been saved.
+ * <P>
+ * The index entries and the message area are both rings.  When the file is
+ * full and we are set to reuse it, the oldest messages are dropped until the
+ * new one fits, and it is written back at the front of the message area.  The
+ * header is always written after the data it points to, and ahead of any data
+ * that overwrites a dropped message, so a crash never leaves the header
+ * describing a message that isn't there.
  * 
  * 
  * @author Steven M. Cherry
@@ -198,6 +205,27 @@ class DLLEXPORT LogFile {
 		/** This is the mutex that we use to keep log file access exclusive. */
 		Mutex* m_mutex;
 
+		/** Our memory mapping of the log file, when we are using one. */
+		char* m_map;
+
+		/** The windows file mapping handle behind m_map */
+		void* m_map_handle;
+
+		/** The size of our mapping */
+		size_t m_map_size;
+
+		/** Our current position in the mapping - the mapped version of the file position. */
+		size_t m_map_pos;
+
+		/** Set once useMemoryMap() is called, so new files get mapped too. */
+		bool m_mapped;
+
+		/** msync after this many messages.  0 leaves it to the OS. */
+		int m_sync_every;
+
+		/** Messages written since our last msync */
+		int m_since_sync;
+
 	public:
 
 		/** Standard constructor to open an existing or create a new log file.
@@ -282,6 +310,22 @@ class DLLEXPORT LogFile {
 		 * that we can re-open a new log file.
 		 */
 		void createNewFile();
+
+		/**
+		 * Switches us to writing through a memory mapping of the file instead of
+		 * stdio.  The file is grown to our max size and mapped whole, and messages
+		 * are copied into it with memcpy - no seeks, writes, or flushes per message.
+		 * The file format does not change.
+		 * <P>
+		 * Everything written is in the OS page cache as soon as writeMsg returns, so
+		 * it survives us crashing.  To survive the machine crashing as well, set
+		 * syncEvery: we msync the file after that many messages (1 = every message).
+		 * 0 leaves it up to the OS.
+		 */
+		void useMemoryMap(int syncEvery = 0);
+
+		/** Forces everything we have written out to the disk. */
+		void sync();
 	
 	private:
 
@@ -304,6 +348,30 @@ class DLLEXPORT LogFile {
 		 */
 		void createFile();
 
+		/** Returns the file offset where the message data area starts */
+		int startOfMessages();
+
+		/** Returns where the next message of the given length goes: right after the
+		 * newest message, or back at the start of the data area if it won't fit there.
+		 */
+		int nextOffset(int msg_len);
+
+		/** Returns true if our oldest message has to go before we can write msg_len
+		 * bytes at offset: we would overwrite it, or we are wrapping around and it is
+		 * stranded at the end of the file.
+		 */
+		bool oldestInTheWay(int offset, int msg_len);
+
+		/** Drops our oldest messages until msg_len bytes at offset won't overwrite
+		 * anything and there is a free index entry.
+		 */
+		void evictFor(int offset, int msg_len);
+
+		/** Writes the message at offset into the next index entry, and updates the
+		 * header to include it.
+		 */
+		void appendMessage(LogMsgStripped& msg, int offset, int msg_len);
+
 		void writeIndexHeader();
 
 		void writeIndexEntry(int which_index);
@@ -312,6 +380,24 @@ class DLLEXPORT LogFile {
 
 		LogMsg* readMessageEntry(IndexEntry* ie) ;
 
+		/** Maps our open log file into memory */
+		void mapFile();
+
+		/** Syncs and releases our memory mapping, if we have one */
+		void unmapFile();
+
+		/** msyncs our whole mapping */
+		void syncMap();
+
+		/** Flushes the writes so far for this message: fflush, or nothing when mapped. */
+		void flushFile();
+
+		/** Copies bytes into the mapping at our current position */
+		void writeMapped(const void* data, size_t len);
+
+		/** Copies bytes out of the mapping at our current position */
+		void readMapped(void* data, size_t len);
+
 		/** Writes an integer out to the current position of our log file stream */
 		void write(int32_t value);
 
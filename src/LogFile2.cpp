@@ -25,8 +25,25 @@
 #include "twine.h"
 #include "ZipFile.h"
 #include "File.h"
+#include "Tools.h"
+#include "Timer.h"
+
+#include <ctype.h>
+#include <zlib.h>
+
+#include <algorithm>
 using namespace SLib;
 
+/// Adds to one of our message counters.  Writers may be holding either of our locks.
+static inline void addToCount(volatile uint64_t* count, uint64_t n)
+{
+#ifdef _WIN32
+	InterlockedExchangeAdd64((volatile LONG64*)count, (LONG64)n);
+#else
+	__sync_fetch_and_add(count, n);
+#endif
+}
+
 LogFile2::LogFile2(const twine& logFileName, size_t maxFileSize)
 {
 	//printf("LogFile2::LogFile2(const twine& logFileName, size_t maxFileSize)\n");
@@ -37,12 +54,35 @@ LogFile2::LogFile2(const twine& logFileName, size_t maxFileSize)
 	m_db = NULL;
 	m_stmt = NULL;
 	m_insert_stmt = NULL;
+	m_bulk_insert_stmt = NULL;
+	m_dict_insert_stmt = NULL;
+	m_dict_select_stmt = NULL;
+	m_schema = 0;
+	m_textIndex = false;
+	m_term_insert_stmt = NULL;
 	m_stmt_begintran = NULL;
 	m_stmt_committran = NULL;
 	m_stmt_rollbacktran = NULL;
 	m_mutex = new Mutex();
 	m_cacheSize = 100;
 	m_cacheTime = 100;
+	m_flushThreadOn = false;
+	m_flushThreadStop = false;
+	m_flushThread = NULL;
+	m_inWAL = false;
+	m_lastCheckpoint = 0;
+	m_sizeEstimate = 0;
+	m_inSnapshot = false;
+	m_msgsIn = 0;
+	m_msgsOut = 0;
+	m_msgsWritten = 0;
+#ifdef _WIN32
+	InitializeCriticalSection( &m_cacheCS );
+	InitializeConditionVariable( &m_cacheCond );
+#else
+	m_cacheMutex = new Mutex();
+	pthread_cond_init( &m_cacheCond, NULL );
+#endif
 
 	try {
 		Setup();
@@ -63,12 +103,35 @@ LogFile2::LogFile2(bool readOnly, const twine& logFileName)
 	m_db = NULL;
 	m_stmt = NULL;
 	m_insert_stmt = NULL;
+	m_bulk_insert_stmt = NULL;
+	m_dict_insert_stmt = NULL;
+	m_dict_select_stmt = NULL;
+	m_schema = 0;
+	m_textIndex = false;
+	m_term_insert_stmt = NULL;
 	m_stmt_begintran = NULL;
 	m_stmt_committran = NULL;
 	m_stmt_rollbacktran = NULL;
 	m_mutex = new Mutex();
 	m_cacheSize = 100;
 	m_cacheTime = 100;
+	m_flushThreadOn = false;
+	m_flushThreadStop = false;
+	m_flushThread = NULL;
+	m_inWAL = false;
+	m_lastCheckpoint = 0;
+	m_sizeEstimate = 0;
+	m_inSnapshot = false;
+	m_msgsIn = 0;
+	m_msgsOut = 0;
+	m_msgsWritten = 0;
+#ifdef _WIN32
+	InitializeCriticalSection( &m_cacheCS );
+	InitializeConditionVariable( &m_cacheCond );
+#else
+	m_cacheMutex = new Mutex();
+	pthread_cond_init( &m_cacheCond, NULL );
+#endif
 
 	Setup(); // any exception trying to open the file is passed back in read-only mode.
 }
@@ -76,34 +139,34 @@ LogFile2::LogFile2(bool readOnly, const twine& logFileName)
 LogFile2::~LogFile2()
 {
 	//printf("LogFile2::~LogFile2()\n");
+	stopFlushThread();
+
 	{ // used for mutex scope
 		Lock theLock(m_mutex);
 
 		flushInternal(); // anything left in the cache goes to the disk
 
 		// Close off our log file
-		if(m_stmt != NULL){
-			sqlite3_finalize( m_stmt );
-		}
-		if(m_insert_stmt != NULL){
-			sqlite3_finalize( m_insert_stmt );
-		}
-		if(m_stmt_begintran != NULL){
-			sqlite3_finalize( m_stmt_begintran );
-		}
-		if(m_stmt_committran != NULL){
-			sqlite3_finalize( m_stmt_committran );
-		}
-		if(m_stmt_rollbacktran != NULL){
-			sqlite3_finalize( m_stmt_rollbacktran );
-		}
+		finalizeStatements();
 		if(m_db != NULL){
 			sqlite3_close(m_db);
 		}
 
+		// If the database could not be opened, the cache still owns its messages.
+		for(size_t i = 0; i < m_cache.size(); i++){
+			delete m_cache[i];
+		}
+		m_cache.clear();
+
 	} // mutex unlocked here
 
 	delete m_mutex;
+#ifdef _WIN32
+	DeleteCriticalSection( &m_cacheCS );
+#else
+	pthread_cond_destroy( &m_cacheCond );
+	delete m_cacheMutex;
+#endif
 
 	// that's it.
 }
@@ -111,31 +174,14 @@ LogFile2::~LogFile2()
 void LogFile2::close()
 {
 	//printf("LogFile2::close()\n");
+	stopFlushThread();
+
 	Lock theLock(m_mutex);
 
 	flushInternal(); // anything left in the cache goes to the disk
 
 	// Close off our log file
-	if(m_stmt != NULL){
-		sqlite3_finalize( m_stmt );
-		m_stmt = NULL;
-	}
-	if(m_insert_stmt != NULL){
-		sqlite3_finalize( m_insert_stmt );
-		m_insert_stmt = NULL;
-	}
-	if(m_stmt_begintran != NULL){
-		sqlite3_finalize( m_stmt_begintran );
-		m_stmt_begintran = NULL;
-	}
-	if(m_stmt_committran != NULL){
-		sqlite3_finalize( m_stmt_committran );
-		m_stmt_committran = NULL;
-	}
-	if(m_stmt_rollbacktran != NULL){
-		sqlite3_finalize( m_stmt_rollbacktran );
-		m_stmt_rollbacktran = NULL;
-	}
+	finalizeStatements();
 	if(m_db != NULL){
 		sqlite3_close(m_db);
 		m_db = NULL;
@@ -146,7 +192,6 @@ void LogFile2::close()
 void LogFile2::Setup(void)
 {
 	//printf("LogFile2::Setup()\n");
-	int rc = 0;
 
 	// Initialize sqlite3
 	sqlite3_initialize();
@@ -162,46 +207,538 @@ void LogFile2::Setup(void)
 		);
 	}
 	
-	// Check for our mainframe log table:
-	twine stmt = "select name from sqlite_master where type='table' and name='logtable'";
-	check_err( "prepare-check for our log table",
-		sqlite3_prepare( m_db, stmt(), (int)stmt.length(), &m_stmt, NULL)
-	);
-
-	rc = check_err( "execute-check for our log table", sqlite3_step( m_stmt ));
-	if(rc == 0){
+	// Find out which version of our schema this file uses.  Files written before the
+	// dictionary schema have a plain logtable table.  Newer ones have logrows, with a
+	// logtable view on top of it that puts the rows back together.
+	if(runPragma( "select count(1) from sqlite_master where type='table' and name='logrows';" ).get_int() != 0){
+		m_schema = 2;
+	} else if(runPragma( "select count(1) from sqlite_master where type='table' and name='logtable';" ).get_int() != 0){
+		m_schema = 1;
+	} else {
 		if(m_readOnly){
 			throw AnException(0, FL, "logtable does not exist - not creating in readonly mode.");
 		}
 		// table doesn't exist, create it:
-		sqlite3_finalize( m_stmt );
-		m_stmt = NULL;
-		
-		stmt.erase();
-		stmt.append( "create table logtable ( "
+		createSchema();
+		m_schema = 2;
+	}
+	m_textIndex = runPragma( "select count(1) from sqlite_master where type='table' and name='logterms';" ).get_int() != 0;
+
+	applyStorage();
+
+	if(!m_readOnly){
+		// Start our running size estimate from the real size of the file.
+		m_sizeEstimate = actualSize();
+	}
+}
+
+void LogFile2::createSchema()
+{
+	runPragma( "begin transaction;" );
+	try {
+		// Every distinct file, appName, machineName and appSession is stored once in
+		// logdict, and logrows refers to them by id.
+		runPragma( "create table logdict ( "
+			"id integer primary key autoincrement, "
+			"value varchar(10) unique "
+			");"
+		);
+		runPragma( "create table logrows ( "
 			"id integer primary key autoincrement, "
-			"file varchar(20), "
+			"file int, "
 			"line int, "
 			"tid int, "
 			"timestamp_a int, "
 			"timestamp_b int, "
 			"channel int, "
-			"appName varchar(10), "
-			"machineName varchar(10), "
-			"appSession varchar(10), "
+			"appName int, "
+			"machineName int, "
+			"appSession int, "
+			"msgflags int, "
 			"msg varchar(10) "
 			");"
 		);
-		check_err( "prepare - create log table",
-			sqlite3_prepare( m_db, stmt(), (int)stmt.length(), &m_stmt, NULL)
+		// Readers (and anyone's hand written where clauses) keep using logtable.
+		runPragma( "create view logtable as select "
+			"r.id as id, f.value as file, r.line as line, r.tid as tid, "
+			"r.timestamp_a as timestamp_a, r.timestamp_b as timestamp_b, r.channel as channel, "
+			"a.value as appName, m.value as machineName, s.value as appSession, "
+			"r.msg as msg, r.msgflags as msgflags "
+			"from logrows r "
+			"join logdict f on f.id = r.file "
+			"join logdict a on a.id = r.appName "
+			"join logdict m on m.id = r.machineName "
+			"join logdict s on s.id = r.appSession;"
 		);
-		check_err( "execute - create log table", sqlite3_step( m_stmt ));
+		runPragma( "commit transaction;" );
+	} catch (AnException& e){
+		runPragma( "rollback transaction;" );
+		throw e;
+	}
+}
 
+const char* LogFile2::selectColumns()
+{
+	if(m_schema == 2){
+		return "id, file, line, tid, timestamp_a, timestamp_b, channel, "
+			"appName, machineName, appSession, msg, msgflags ";
 	} else {
-		// table exists, find out stuff about it
+		// Old files have no msgflags - nothing in them is compressed.
+		return "id, file, line, tid, timestamp_a, timestamp_b, channel, "
+			"appName, machineName, appSession, msg, 0 ";
+	}
+}
+
+const char* LogFile2::rowTable()
+{
+	return m_schema == 2 ? "logrows" : "logtable";
+}
+
+int LogFile2::dictID(const twine& value)
+{
+	map<twine, int, LogFile2DictLess>::iterator it = m_dict.find( value );
+	if(it != m_dict.end()){
+		return it->second;
+	}
+
+	if(m_dict_insert_stmt == NULL){
+		twine sql = "insert or ignore into logdict ( value ) values ( ? );";
+		check_err( "prepare dict insert",
+			sqlite3_prepare( m_db, sql(), (int)sql.length(), &m_dict_insert_stmt, NULL)
+		);
+		sql = "select id from logdict where value = ?;";
+		check_err( "prepare dict select",
+			sqlite3_prepare( m_db, sql(), (int)sql.length(), &m_dict_select_stmt, NULL)
+		);
+	}
+
+	sqlite3_reset( m_dict_insert_stmt );
+	check_err( "bind dict insert",
+		sqlite3_bind_text( m_dict_insert_stmt, 1, value(), (int)value.length(), SQLITE_STATIC )
+	);
+	check_err( "exec dict insert", sqlite3_step( m_dict_insert_stmt ));
+
+	sqlite3_reset( m_dict_select_stmt );
+	check_err( "bind dict select",
+		sqlite3_bind_text( m_dict_select_stmt, 1, value(), (int)value.length(), SQLITE_STATIC )
+	);
+	if(check_err( "exec dict select", sqlite3_step( m_dict_select_stmt )) == 0){
+		throw AnException(0, FL, "Dictionary entry missing right after insert: %s", value() );
+	}
+	int id = sqlite3_column_int( m_dict_select_stmt, 0 );
+	sqlite3_reset( m_dict_select_stmt );
+
+	// appSession values can be unique per request - don't let the cache grow forever.
+	if(m_dict.size() >= 10000){
+		m_dict.clear();
+	}
+	m_dict[ value ] = id;
+	return id;
+}
+
+void LogFile2::finalizeDict()
+{
+	if(m_dict_insert_stmt != NULL){
+		sqlite3_finalize( m_dict_insert_stmt );
+		m_dict_insert_stmt = NULL;
+	}
+	if(m_dict_select_stmt != NULL){
+		sqlite3_finalize( m_dict_select_stmt );
+		m_dict_select_stmt = NULL;
+	}
+	if(m_term_insert_stmt != NULL){
+		sqlite3_finalize( m_term_insert_stmt );
+		m_term_insert_stmt = NULL;
+	}
+	m_dict.clear();
+}
+
+bool LogFile2::compressMsg(const twine& msg, twine& out)
+{
+	// Our format is the 4 byte big-endian length of the original, then the deflate data.
+	uLongf destLen = compressBound( (uLong)msg.length() );
+	out.reserve( destLen + 4 );
+	unsigned char* dest = (unsigned char*)out.data();
+	if(compress2( dest + 4, &destLen, (const Bytef*)msg(), (uLong)msg.length(), Z_BEST_SPEED ) != Z_OK){
+		return false;
+	}
+	if(destLen + 4 >= msg.length()){
+		return false; // not worth it
+	}
+	uint32_t len = (uint32_t)msg.length();
+	dest[0] = (unsigned char)(len >> 24);
+	dest[1] = (unsigned char)(len >> 16);
+	dest[2] = (unsigned char)(len >> 8);
+	dest[3] = (unsigned char)(len);
+	out.size( destLen + 4 );
+	return true;
+}
+
+void LogFile2::decompressMsg(const unsigned char* data, size_t length, twine& out)
+{
+	if(length < 4){
+		throw AnException(0, FL, "Compressed log message is too short (%d bytes)", (int)length );
+	}
+	uLongf destLen = ((uLongf)data[0] << 24) | ((uLongf)data[1] << 16) | ((uLongf)data[2] << 8) | (uLongf)data[3];
+	out.reserve( destLen + 1 );
+	if(uncompress( (Bytef*)out.data(), &destLen, data + 4, (uLong)(length - 4) ) != Z_OK){
+		throw AnException(0, FL, "Error uncompressing log message.");
+	}
+	out.data()[ destLen ] = '\0';
+	out.size( destLen );
+}
+
+void LogFile2::setStorage(const LogFile2Storage& storage)
+{
+	Lock theLock(m_mutex);
+	m_storage = storage;
+	applyStorage();
+}
+
+void LogFile2::applyStorage()
+{
+	if(m_db == NULL){
+		return;
+	}
+
+	twine sql;
+	if(m_storage.busyTimeout > 0){
+		sqlite3_busy_timeout( m_db, m_storage.busyTimeout );
+	}
+
+	if(!m_readOnly){
+		if(m_storage.walMode){
+			m_inWAL = (runPragma( "pragma journal_mode=WAL;" ).compare( "wal" ) == 0);
+		} else {
+			// Don't switch an existing WAL file back - just find out what it is.
+			m_inWAL = (runPragma( "pragma journal_mode;" ).compare( "wal" ) == 0);
+		}
+		if(m_storage.synchronous.length() != 0){
+			sql.format( "pragma synchronous=%s;", m_storage.synchronous() );
+			runPragma( sql );
+		}
+		if(m_inWAL && m_storage.checkpointInterval != 0){
+			// We'll checkpoint on our own schedule, not on every commit that crosses the threshold.
+			sqlite3_wal_autocheckpoint( m_db, 0 );
+		}
+	} else {
+		m_inWAL = (runPragma( "pragma journal_mode;" ).compare( "wal" ) == 0);
+	}
+
+	if(m_storage.mmapSize != 0){
+		sql.format( "pragma mmap_size=%lu;", (unsigned long)m_storage.mmapSize );
+		runPragma( sql );
+	}
+	if(m_storage.cacheSize != 0){
+		sql.format( "pragma cache_size=%d;", m_storage.cacheSize );
+		runPragma( sql );
+	}
+	if(m_storage.indexes && !m_readOnly){
+		// Statements prepared before a schema change won't run after it.
+		finalizeStatements();
+		createIndexes();
+	}
+	if(m_storage.textIndex && !m_textIndex && !m_readOnly){
+		finalizeStatements();
+		createTextIndex();
+	}
+}
+
+void LogFile2::finalizeStatements()
+{
+	if(m_stmt != NULL){
 		sqlite3_finalize( m_stmt );
 		m_stmt = NULL;
 	}
+	if(m_insert_stmt != NULL){
+		sqlite3_finalize( m_insert_stmt );
+		m_insert_stmt = NULL;
+	}
+	if(m_bulk_insert_stmt != NULL){
+		sqlite3_finalize( m_bulk_insert_stmt );
+		m_bulk_insert_stmt = NULL;
+	}
+	finalizeDict();
+	if(m_stmt_begintran != NULL){
+		sqlite3_finalize( m_stmt_begintran );
+		m_stmt_begintran = NULL;
+	}
+	if(m_stmt_committran != NULL){
+		sqlite3_finalize( m_stmt_committran );
+		m_stmt_committran = NULL;
+	}
+	if(m_stmt_rollbacktran != NULL){
+		sqlite3_finalize( m_stmt_rollbacktran );
+		m_stmt_rollbacktran = NULL;
+	}
+}
+
+void LogFile2::createTextIndex()
+{
+	runPragma( "begin transaction;" );
+	try {
+		runPragma( "create table logterms ( term varchar(10), id int );" );
+		runPragma( "create index logterms_term on logterms ( term, id );" );
+		m_textIndex = true;
+
+		// Index whatever is already in the file.
+		twine sql; sql.format( "select %s from logtable order by id;", selectColumns() );
+		sqlite3_stmt* stmt = NULL;
+		check_err( sql, sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL) );
+		vector<LogMsg*> rows;
+		try {
+			while(check_err( sql, sqlite3_step( stmt ) ) != 0){
+				rows.push_back( readRow( stmt ) );
+				if(rows.size() >= 5000){
+					indexTerms( rows );
+					for(size_t i = 0; i < rows.size(); i++){
+						delete rows[i];
+					}
+					rows.clear();
+				}
+			}
+			indexTerms( rows );
+		} catch (AnException& e){
+			for(size_t i = 0; i < rows.size(); i++){
+				delete rows[i];
+			}
+			sqlite3_finalize( stmt );
+			throw e;
+		}
+		for(size_t i = 0; i < rows.size(); i++){
+			delete rows[i];
+		}
+		sqlite3_finalize( stmt );
+		runPragma( "commit transaction;" );
+	} catch (AnException& e){
+		m_textIndex = false;
+		if(m_term_insert_stmt != NULL){
+			sqlite3_finalize( m_term_insert_stmt );
+			m_term_insert_stmt = NULL;
+		}
+		runPragma( "rollback transaction;" );
+		throw e;
+	}
+}
+
+/// Orders word index entries by term, then id, so they go into the index in order.
+static bool termEntryLess(const pair<twine, int>& a, const pair<twine, int>& b)
+{
+	int c = strcmp( a.first(), b.first() );
+	return c < 0 || (c == 0 && a.second < b.second);
+}
+
+void LogFile2::indexTerms(vector<LogMsg*>& rows)
+{
+	// Gather the whole batch and sort it.  Inserting in term order touches each part of
+	// the index once, instead of once per message.
+	vector< pair<twine, int> > entries;
+	vector<twine> terms;
+	for(size_t r = 0; r < rows.size(); r++){
+		tokenize( rows[r]->msg, terms );
+		for(size_t i = 0; i < terms.size(); i++){
+			if(isIndexedTerm( terms[i] )){
+				entries.push_back( pair<twine, int>( terms[i], rows[r]->id ) );
+			}
+		}
+	}
+	if(entries.size() == 0){
+		return;
+	}
+	sort( entries.begin(), entries.end(), termEntryLess );
+
+	if(m_term_insert_stmt == NULL){
+		twine sql = "insert into logterms ( term, id ) values ( ?, ? )";
+		for(size_t i = 1; i < LOGFILE2_TERM_ROWS; i++){
+			sql.append( ", ( ?, ? )" );
+		}
+		check_err( "prepare term insert",
+			sqlite3_prepare( m_db, sql(), (int)sql.length(), &m_term_insert_stmt, NULL)
+		);
+	}
+
+	size_t i = 0;
+	for( ; entries.size() - i >= LOGFILE2_TERM_ROWS; i += LOGFILE2_TERM_ROWS){
+		sqlite3_reset( m_term_insert_stmt );
+		bindTerms( m_term_insert_stmt, entries, i, LOGFILE2_TERM_ROWS );
+		check_err( "exec term insert", sqlite3_step( m_term_insert_stmt ));
+	}
+	if(i < entries.size()){
+		// The rest go in with a one-off statement sized to fit.
+		twine sql = "insert into logterms ( term, id ) values ( ?, ? )";
+		for(size_t j = i + 1; j < entries.size(); j++){
+			sql.append( ", ( ?, ? )" );
+		}
+		sqlite3_stmt* stmt = NULL;
+		check_err( "prepare term insert",
+			sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL)
+		);
+		try {
+			bindTerms( stmt, entries, i, entries.size() - i );
+			check_err( "exec term insert", sqlite3_step( stmt ));
+		} catch (AnException& e){
+			sqlite3_finalize( stmt );
+			throw e;
+		}
+		sqlite3_finalize( stmt );
+	}
+
+	// Each entry costs its term plus the id, twice over (table and index).
+	for(size_t e = 0; e < entries.size(); e++){
+		m_sizeEstimate += 2 * (entries[e].first.length() + 12);
+	}
+}
+
+void LogFile2::bindTerms(sqlite3_stmt* stmt, vector< pair<twine, int> >& entries, size_t start, size_t count)
+{
+	for(size_t j = 0; j < count; j++){
+		pair<twine, int>& e = entries[ start + j ];
+		check_err( "bind term", sqlite3_bind_text( stmt, (int)(j * 2 + 1),
+			e.first(), (int)e.first.length(), SQLITE_STATIC ) );
+		check_err( "bind term id", sqlite3_bind_int( stmt, (int)(j * 2 + 2), e.second ) );
+	}
+}
+
+bool LogFile2::isIndexedTerm(const twine& term)
+{
+	// Numbers are mostly ids and counters - nearly every one is different, so they would
+	// fill the index without making it useful.  Searches for them fall back to a scan.
+	if(term.length() < LOGFILE2_WORD_MIN || term.length() > LOGFILE2_WORD_MAX){
+		return false; // tokenize never put it there
+	}
+	for(size_t i = 0; i < term.length(); i++){
+		if(!isdigit( (unsigned char)term[i] )){
+			return true;
+		}
+	}
+	return false;
+}
+
+void LogFile2::tokenize(const twine& text, vector<twine>& tokens, bool anyLength)
+{
+	tokens.clear();
+	const char* p = text();
+	size_t len = text.length();
+	size_t i = 0;
+	while(i < len){
+		while(i < len && !(isalnum( (unsigned char)p[i] ) || p[i] == '_')){
+			i++;
+		}
+		size_t start = i;
+		while(i < len && (isalnum( (unsigned char)p[i] ) || p[i] == '_')){
+			i++;
+		}
+		if(i == start){
+			continue; // the end of the text
+		}
+		if(!anyLength && (i - start < LOGFILE2_WORD_MIN || i - start > LOGFILE2_WORD_MAX)){
+			continue; // too short to be worth indexing, or too long to be a word
+		}
+		twine word;
+		word.set( p + start, i - start );
+		for(size_t j = 0; j < word.length(); j++){
+			word.data()[j] = (char)tolower( (unsigned char)word.data()[j] );
+		}
+		tokens.push_back( word );
+	}
+
+	// Each word goes in once per message.
+	sort( tokens.begin(), tokens.end(), LogFile2DictLess() );
+	size_t kept = 0;
+	for(size_t j = 0; j < tokens.size(); j++){
+		if(kept == 0 || strcmp( tokens[kept - 1](), tokens[j]() ) != 0){
+			if(kept != j){
+				tokens[kept] = tokens[j];
+			}
+			kept++;
+		}
+	}
+	tokens.resize( kept );
+}
+
+bool LogFile2::hasTextIndex()
+{
+	Lock theLock(m_mutex);
+	return m_textIndex;
+}
+
+void LogFile2::createIndexes()
+{
+	const char* columns[] = { "timestamp_a", "channel", "appSession", "tid" };
+	for(int i = 0; i < 4; i++){
+		twine sql; sql.format( "create index if not exists %s_%s on %s ( %s );",
+			rowTable(), columns[i], rowTable(), columns[i] );
+		runPragma( sql );
+	}
+}
+
+twine LogFile2::runPragma(const twine& sql)
+{
+	twine ret;
+	sqlite3_stmt* stmt = NULL;
+	try {
+		check_err( sql, sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL));
+		int rc = check_err( sql, sqlite3_step( stmt ));
+		if(rc == 1 && sqlite3_column_text( stmt, 0 ) != NULL){
+			ret.set( (const char*)sqlite3_column_text( stmt, 0 ), (size_t)sqlite3_column_bytes( stmt, 0 ) );
+		}
+		sqlite3_finalize( stmt );
+		return ret;
+	} catch (AnException& e){
+		if(stmt != NULL){
+			sqlite3_finalize( stmt );
+			stmt = NULL;
+		}
+		throw e;
+	}
+}
+
+void LogFile2::checkpoint()
+{
+	Lock theLock(m_mutex);
+	checkpointInternal();
+}
+
+void LogFile2::checkpointInternal()
+{
+	if(m_db == NULL || !m_inWAL || m_readOnly){
+		return;
+	}
+	// Passive never waits on readers - it copies whatever it can and leaves the rest.
+	sqlite3_wal_checkpoint_v2( m_db, NULL, SQLITE_CHECKPOINT_PASSIVE, NULL, NULL );
+	m_lastCheckpoint = Timer::GetCycleCount() / 1000;
+}
+
+void LogFile2::beginSnapshot()
+{
+	Lock theLock(m_mutex);
+	if(m_inSnapshot){
+		return;
+	}
+	twine sql = "begin transaction;";
+	sqlite3_stmt* stmt = NULL;
+	check_err( sql, sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL));
+	try {
+		check_err( sql, sqlite3_step( stmt ));
+	} catch (AnException& e){
+		sqlite3_finalize( stmt );
+		throw e;
+	}
+	sqlite3_finalize( stmt );
+	m_inSnapshot = true;
+
+	// A deferred transaction doesn't pick its snapshot until the first read.  Do that now.
+	runPragma( "select count(1) from sqlite_master;" );
+}
+
+void LogFile2::endSnapshot()
+{
+	Lock theLock(m_mutex);
+	if(!m_inSnapshot){
+		return;
+	}
+	m_inSnapshot = false;
+	runPragma( "commit transaction;" );
 }
 
 int LogFile2::check_err(const twine& doingWhat, int rc)
@@ -224,6 +761,10 @@ int LogFile2::check_err(const twine& doingWhat, int rc)
 
 void LogFile2::flush()
 {
+	if(m_flushThreadOn){
+		swapAndFlush();
+		return;
+	}
 	Lock theLock(m_mutex);
 	flushInternal();
 }
@@ -244,7 +785,13 @@ void LogFile2::setCacheTime( size_t cacheTime )
 
 void LogFile2::flushInternal()
 {
-	if(m_cache.size() != 0 && m_db != NULL){
+	flushBatch( m_cache );
+}
+
+void LogFile2::flushBatch(vector<LogMsg*>& batch)
+{
+	if(batch.size() != 0 && m_db != NULL){
+		bool written = false;
 		try {
 			begin_transaction();
 		} catch(AnException&){
@@ -254,15 +801,15 @@ void LogFile2::flushInternal()
 			begin_transaction();
 		}
 		try {
-			for(size_t i = 0; i < m_cache.size(); i++){
-				writeOneMsg( m_cache[i] );
-			}
+			writeRows( batch );
 			bool commitSuccess = false;
 			int commitTries = 0;
+			int backoff = 1;
 			while(!commitSuccess){
 				try {
 					commit_transaction();
 					commitSuccess = true;
+					written = true;
 					break;
 				} catch (AnException& e){
 					twine emsg = e.Msg();
@@ -279,6 +826,14 @@ void LogFile2::flushInternal()
 							printf("Commit failure - 10 tries exceeded.\n");
 							throw e;
 						}
+						if(m_flushThreadOn){
+							// We are on the flush thread, so nobody is waiting on us.  Give
+							// the reader a chance to finish before we try again.
+							Tools::msleep( backoff );
+							if(backoff < 128){
+								backoff *= 2;
+							}
+						}
 					} else {
 						// This is a different error - rethrow the exction to the main handler.
 						throw e;
@@ -288,139 +843,442 @@ void LogFile2::flushInternal()
 		} catch (AnException& e){
 			// If we hit an error during the insert, we have little choice but to say something
 			// about it with printf and then rollback the transaction.
-			printf("Error writing (%d) messages to database: %s\n", (int)m_cache.size(), e.Msg() );
+			printf("Error writing (%d) messages to database: %s\n", (int)batch.size(), e.Msg() );
 			rollback_transaction();
 		}
-		m_cache.clear();
+
+		// Keep our running size estimate up to date.  Each row costs its text plus roughly
+		// 32 bytes of integer columns, record header and b-tree cell overhead, plus an entry
+		// in each of the four indexes createIndexes adds.
+		size_t indexBytes = m_storage.indexes ? 4 * LOGFILE2_INDEX_ENTRY_BYTES : 0;
+		for(size_t i = 0; i < batch.size(); i++){
+			LogMsg* lm = batch[i];
+			if(m_schema == 2){
+				// The other text columns are dictionary ids - count the message only.
+				m_sizeEstimate += 40 + lm->msg.length() + indexBytes;
+			} else {
+				m_sizeEstimate += 32 + lm->file.length() + lm->appName.length() + lm->machineName.length() +
+					lm->appSession.length() + lm->msg.length() + indexBytes;
+				if(m_storage.indexes){
+					m_sizeEstimate += lm->appSession.length(); // the appSession index keeps the text
+				}
+			}
+			delete lm;
+		}
+		if(written){
+			addToCount(&m_msgsWritten, batch.size());
+		}
+		addToCount(&m_msgsOut, batch.size());
+		batch.clear();
 		CheckSize();
+
+		if(m_inWAL && m_storage.checkpointInterval != 0 && m_db != NULL){
+			uint64_t now = Timer::GetCycleCount() / 1000;
+			if(now - m_lastCheckpoint >= m_storage.checkpointInterval){
+				checkpointInternal();
+			}
+		}
 	}
 }
 
-void LogFile2::checkFlushCache()
+void LogFile2::checkFlushCache()
+{
+	if(m_cache.size() >= m_cacheSize){ // Is the cache large enough to be written?
+		flushInternal();
+	} else {
+		if(m_cache.size() > 1) { // more than one message
+			// Check the time difference between the newest and oldest messages in the cache
+			LogMsg& lm1 = *m_cache[ m_cache.size() - 1 ]; // most recent log message.
+			LogMsg& lm2 = *m_cache[ 0 ];                  // oldest log message.
+#ifdef _WIN32
+			if(lm1.timestamp.time > lm2.timestamp.time){
+				// If the seconds are greater at all, then flush the cache.
+				flushInternal();
+			} else if(lm1.timestamp.millitm >= (lm2.timestamp.millitm + m_cacheTime)){
+				// seconds are the same, but milliseconds have elapsed more than m_cacheTime
+				flushInternal();
+			}
+#else
+			if(lm1.timestamp.tv_sec > lm2.timestamp.tv_sec){
+				// If the seconds are greater at all, then flush the cache.
+				flushInternal();
+			} else if(lm1.timestamp.tv_usec >= (lm2.timestamp.tv_usec + (m_cacheTime * 1000) )){
+				// seconds are the same, but milliseconds have elapsed more than m_cacheTime
+				flushInternal();
+			}
+#endif
+		}
+	}
+}
+
+void LogFile2::writeMsg(LogMsg& msg)
+{
+	//printf("LogFile2::writeMsg()\n");
+	if(m_readOnly){
+		throw AnException(0, FL, "writeMsg is not allowed in readonly mode.");
+	}
+	if(m_flushThreadOn){
+		LogMsg* msgCopy = new LogMsg( msg );
+		lockCache();
+		m_cache.push_back( msgCopy );
+		addToCount(&m_msgsIn, 1);
+		if(m_cache.size() >= m_cacheSize){
+			signalCache();
+		}
+		unlockCache();
+		return;
+	}
+
+	Lock theLock(m_mutex);
+
+	m_cache.push_back( new LogMsg( msg ) );
+	addToCount(&m_msgsIn, 1);
+	checkFlushCache();
+}
+
+void LogFile2::writeMsg(vector<LogMsg*>* messages)
+{
+	//printf("LogFile2::writeMsg(vector<LogMsg*>* messages)\n");
+	if(m_readOnly){
+		throw AnException(0, FL, "writeMsg is not allowed in readonly mode.");
+	}
+	vector<LogMsg*> copies;
+	copies.reserve( messages->size() );
+	for(size_t i = 0; i < messages->size(); i++){
+		copies.push_back( new LogMsg( *messages->at( i ) ) );
+	}
+	writeMsgBatch( &copies );
+}
+
+void LogFile2::writeMsgBatch(vector<LogMsg*>* messages)
+{
+	//printf("LogFile2::writeMsgBatch(vector<LogMsg*>* messages)\n");
+	if(m_readOnly){
+		for(size_t i = 0; i < messages->size(); i++){
+			delete messages->at( i );
+		}
+		messages->clear();
+		throw AnException(0, FL, "writeMsgBatch is not allowed in readonly mode.");
+	}
+	if(m_flushThreadOn){
+		lockCache();
+		m_cache.insert( m_cache.end(), messages->begin(), messages->end() );
+		addToCount(&m_msgsIn, messages->size());
+		if(m_cache.size() >= m_cacheSize){
+			signalCache();
+		}
+		unlockCache();
+		messages->clear(); // the pointers belong to the cache now
+		return;
+	}
+
+	Lock theLock(m_mutex);
+
+	m_cache.insert( m_cache.end(), messages->begin(), messages->end() );
+	addToCount(&m_msgsIn, messages->size());
+	messages->clear(); // the pointers belong to the cache now
+
+	checkFlushCache();
+}
+
+void LogFile2::startFlushThread()
+{
+	if(m_readOnly){
+		throw AnException(0, FL, "startFlushThread is not allowed in readonly mode.");
+	}
+	Lock theLock(m_mutex);
+	if(m_flushThreadOn){
+		return; // already running
+	}
+
+	// Anything already in the cache was written under the old rules - get it out first.
+	flushInternal();
+
+	// Size both halves of the double buffer up front so writers don't pay for a realloc.
+	m_cache.reserve( m_cacheSize );
+	m_flushBuf.reserve( m_cacheSize );
+
+	m_flushThreadStop = false;
+	m_flushThreadOn = true;
+	m_flushThread = new Thread();
+	m_flushThread->start( flushThreadStart, this );
+}
+
+void LogFile2::stopFlushThread()
+{
+	if(!m_flushThreadOn){
+		return;
+	}
+
+	lockCache();
+	m_flushThreadStop = true;
+	signalCache();
+	unlockCache();
+
+	m_flushThread->join();
+	delete m_flushThread;
+	m_flushThread = NULL;
+
+	// The flush thread drains the cache before it exits, but a writer may have slipped
+	// a message in after that.  Pick it up and switch back to flushing on the caller's thread.
+	Lock theLock(m_mutex);
+	lockCache();
+	m_flushThreadOn = false;
+	unlockCache();
+	flushInternal();
+}
+
+size_t LogFile2::cacheDepth()
+{
+	// Read out before in, so a flush that finishes between the two reads can't make
+	// out look bigger than in.
+	uint64_t out = m_msgsOut;
+	uint64_t in = m_msgsIn;
+	return in > out ? (size_t)(in - out) : 0;
+}
+
+uint64_t LogFile2::messagesWritten()
+{
+	return m_msgsWritten;
+}
+
+void* LogFile2::flushThreadStart(void* arg)
+{
+	LogFile2* lf = (LogFile2*)arg;
+	lf->flushThreadLoop();
+	return NULL;
+}
+
+void LogFile2::flushThreadLoop()
+{
+	while(true){
+		bool stopping;
+		lockCache();
+		if(!m_flushThreadStop && m_cache.size() < m_cacheSize){
+			// Wait for the cache to fill up, or for our cache time to expire.
+			waitCache( m_cacheTime );
+		}
+		stopping = m_flushThreadStop;
+		unlockCache();
+
+		try {
+			swapAndFlush();
+		} catch (AnException& e){
+			printf("Error flushing log cache from the flush thread: %s\n", e.Msg() );
+		}
+
+		if(stopping){
+			break;
+		}
+	}
+}
+
+void LogFile2::swapAndFlush()
+{
+	Lock theLock(m_mutex);
+
+	// Only hold the cache lock long enough to swap the buffers.  Writers go right
+	// back to filling m_cache while we write m_flushBuf to disk.
+	lockCache();
+	m_cache.swap( m_flushBuf );
+	unlockCache();
+
+	flushBatch( m_flushBuf );
+
+	// flushBatch leaves the batch alone if we have no database - drop what is left.
+	for(size_t i = 0; i < m_flushBuf.size(); i++){
+		delete m_flushBuf[i];
+	}
+	addToCount(&m_msgsOut, m_flushBuf.size());
+	m_flushBuf.clear();
+}
+
+void LogFile2::lockCache()
+{
+#ifdef _WIN32
+	EnterCriticalSection( &m_cacheCS );
+#else
+	m_cacheMutex->lock();
+#endif
+}
+
+void LogFile2::unlockCache()
+{
+#ifdef _WIN32
+	LeaveCriticalSection( &m_cacheCS );
+#else
+	m_cacheMutex->unlock();
+#endif
+}
+
+void LogFile2::signalCache()
 {
-	if(m_cache.size() >= m_cacheSize){ // Is the cache large enough to be written?
-		flushInternal();
-	} else {
-		if(m_cache.size() > 1) { // more than one message
-			// Check the time difference between the newest and oldest messages in the cache
-			LogMsg& lm1 = m_cache[ m_cache.size() - 1 ]; // most recent log message.
-			LogMsg& lm2 = m_cache[ 0 ];                  // oldest log message.
 #ifdef _WIN32
-			if(lm1.timestamp.time > lm2.timestamp.time){
-				// If the seconds are greater at all, then flush the cache.
-				flushInternal();
-			} else if(lm1.timestamp.millitm >= (lm2.timestamp.millitm + m_cacheTime)){
-				// seconds are the same, but milliseconds have elapsed more than m_cacheTime
-				flushInternal();
-			}
+	WakeConditionVariable( &m_cacheCond );
 #else
-			if(lm1.timestamp.tv_sec > lm2.timestamp.tv_sec){
-				// If the seconds are greater at all, then flush the cache.
-				flushInternal();
-			} else if(lm1.timestamp.tv_usec >= (lm2.timestamp.tv_usec + (m_cacheTime * 1000) )){
-				// seconds are the same, but milliseconds have elapsed more than m_cacheTime
-				flushInternal();
-			}
+	pthread_cond_signal( &m_cacheCond );
 #endif
-		}
+}
+
+void LogFile2::waitCache(size_t millis)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS( &m_cacheCond, &m_cacheCS, (DWORD)millis );
+#else
+	struct timespec abs_time;
+	clock_gettime( CLOCK_REALTIME, &abs_time );
+	abs_time.tv_sec += (millis / 1000);
+	abs_time.tv_nsec += ( millis % 1000 ) * 1000000;
+	if(abs_time.tv_nsec >= 1000000000){
+		abs_time.tv_sec ++;
+		abs_time.tv_nsec -= 1000000000;
 	}
+	pthread_cond_timedwait( &m_cacheCond, m_cacheMutex->internalMutex(), &abs_time );
+#endif
 }
 
-void LogFile2::writeMsg(LogMsg& msg)
+void LogFile2::writeOneMsg(LogMsg& msg)
 {
-	//printf("LogFile2::writeMsg()\n");
+	//printf("LogFile2::writeOneMsg()\n");
 	if(m_readOnly){
 		throw AnException(0, FL, "writeMsg is not allowed in readonly mode.");
 	}
-	Lock theLock(m_mutex);
 
-	LogMsg msgCopy( msg );
-	m_cache.push_back( msgCopy );
-	checkFlushCache();
+	if(m_insert_stmt == NULL){
+		twine sql = insertPrefix();
+		sql.append( insertRow() );
+		check_err( "prepare insert",
+			sqlite3_prepare( m_db, sql(), (int)sql.length(), &m_insert_stmt, NULL)
+		);
+	} else {
+		sqlite3_reset(m_insert_stmt);
+	}
+
+	bindMsg( m_insert_stmt, 0, msg );
+
+	// Run the insert.
+	check_err( "exec insert", sqlite3_step( m_insert_stmt ));
+
+	// Update the Message to indicate what the new ID is:
+	msg.id = (int)sqlite3_last_insert_rowid( m_db );
 }
 
-void LogFile2::writeMsg(vector<LogMsg*>* messages)
+void LogFile2::writeRows(vector<LogMsg*>& rows)
 {
-	//printf("LogFile2::writeMsg(vector<LogMsg*>* messages)\n");
+	//printf("LogFile2::writeRows()\n");
 	if(m_readOnly){
 		throw AnException(0, FL, "writeMsg is not allowed in readonly mode.");
 	}
-	Lock theLock(m_mutex);
 
-	for(size_t i = 0; i < messages->size(); i++){
-		LogMsg msgCopy( *messages->at( i ) );
-		m_cache.push_back( msgCopy );
+	size_t i = 0;
+	if(rows.size() >= LOGFILE2_BULK_ROWS){
+		if(m_bulk_insert_stmt == NULL){
+			twine sql = insertPrefix();
+			sql.append( insertRow() );
+			for(size_t r = 1; r < LOGFILE2_BULK_ROWS; r++){
+				sql.append( ", " );
+				sql.append( insertRow() );
+			}
+			check_err( "prepare bulk insert",
+				sqlite3_prepare( m_db, sql(), (int)sql.length(), &m_bulk_insert_stmt, NULL)
+			);
+		}
+
+		// One statement per LOGFILE2_BULK_ROWS messages saves a trip through the VDBE
+		// and the b-tree cursor setup for every row.
+		for( ; rows.size() - i >= LOGFILE2_BULK_ROWS; i += LOGFILE2_BULK_ROWS){
+			sqlite3_reset( m_bulk_insert_stmt );
+			for(size_t r = 0; r < LOGFILE2_BULK_ROWS; r++){
+				bindMsg( m_bulk_insert_stmt, (int)(r * (m_schema == 2 ? 11 : 10)), *rows[ i + r ] );
+			}
+			check_err( "exec bulk insert", sqlite3_step( m_bulk_insert_stmt ));
+
+			// Rows from a single insert get consecutive ids, ending at the last insert rowid.
+			int lastID = (int)sqlite3_last_insert_rowid( m_db );
+			for(size_t r = 0; r < LOGFILE2_BULK_ROWS; r++){
+				rows[ i + r ]->id = lastID - (int)(LOGFILE2_BULK_ROWS - 1 - r);
+			}
+		}
 	}
 
-	checkFlushCache();
+	// Whatever is left over goes in one at a time.
+	for( ; i < rows.size(); i++){
+		writeOneMsg( *rows[ i ] );
+	}
+
+	// The word index goes in the same transaction as the rows.
+	if(m_textIndex){
+		indexTerms( rows );
+	}
 }
 
-void LogFile2::writeOneMsg(LogMsg& msg)
+const char* LogFile2::insertPrefix()
 {
-	//printf("LogFile2::writeOneMsg()\n");
-	if(m_readOnly){
-		throw AnException(0, FL, "writeMsg is not allowed in readonly mode.");
+	if(m_schema == 2){
+		return "insert into logrows (file, line, tid, timestamp_a, timestamp_b, channel, "
+			" appName, machineName, appSession, msg, msgflags ) values ";
+	} else {
+		return "insert into logtable (file, line, tid, timestamp_a, timestamp_b, channel, "
+			" appName, machineName, appSession, msg ) values ";
 	}
+}
 
-	if(m_insert_stmt == NULL){
-		twine sql = 
-			"insert into logtable (file, line, tid, timestamp_a, timestamp_b, channel, "
-			" appName, machineName, appSession, msg ) "
-			" values ( ?, ?, ?, ?, ?, ?, "
-			" ?, ?, ?, ? ) "
-		;
-		check_err( "prepare insert",
-			sqlite3_prepare( m_db, sql(), (int)sql.length(), &m_insert_stmt, NULL)
-		);
+const char* LogFile2::insertRow()
+{
+	if(m_schema == 2){
+		return "( ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ? ) ";
 	} else {
-		sqlite3_reset(m_insert_stmt);
+		return "( ?, ?, ?, ?, ?, ?, ?, ?, ?, ? ) ";
+	}
+}
+
+void LogFile2::bindMsg(sqlite3_stmt* stmt, int base, LogMsg& msg)
+{
+	if(m_schema == 2){
+		bindMsgDict( stmt, base, msg );
+		return;
 	}
 
+	// Everything is bound SQLITE_STATIC - the messages outlive the step() that reads them.
 	check_err( "bind parm 1",
-		sqlite3_bind_text(m_insert_stmt, 1, msg.file(), (int)msg.file.length(), SQLITE_STATIC)
+		sqlite3_bind_text(stmt, base + 1, msg.file(), (int)msg.file.length(), SQLITE_STATIC)
 	);
 	check_err( "bind parm 2",
-		sqlite3_bind_int(m_insert_stmt, 2, msg.line )
+		sqlite3_bind_int(stmt, base + 2, msg.line )
 	);
 	check_err( "bind parm 3",
-		sqlite3_bind_int(m_insert_stmt, 3, (int)msg.tid)
+		sqlite3_bind_int(stmt, base + 3, (int)msg.tid)
 	);
 #ifdef _WIN32
 	check_err( "bind parm 4",
-		sqlite3_bind_int(m_insert_stmt, 4, (int)msg.timestamp.time)
+		sqlite3_bind_int(stmt, base + 4, (int)msg.timestamp.time)
 	);
 	check_err( "bind parm 5",
-		sqlite3_bind_int(m_insert_stmt, 5, (int)msg.timestamp.millitm)
+		sqlite3_bind_int(stmt, base + 5, (int)msg.timestamp.millitm)
 	);
 #else
 	check_err( "bind parm 4",
-		sqlite3_bind_int(m_insert_stmt, 4, (int)msg.timestamp.tv_sec)
+		sqlite3_bind_int(stmt, base + 4, (int)msg.timestamp.tv_sec)
 	);
 	check_err( "bind parm 5",
-		sqlite3_bind_int(m_insert_stmt, 5, (int)msg.timestamp.tv_usec)
+		sqlite3_bind_int(stmt, base + 5, (int)msg.timestamp.tv_usec)
 	);
 #endif
 	check_err( "bind parm 6",
-		sqlite3_bind_int(m_insert_stmt, 6, msg.channel )
+		sqlite3_bind_int(stmt, base + 6, msg.channel )
 	);
 	check_err( "bind parm 7",
-		sqlite3_bind_text(m_insert_stmt, 7, msg.appName(), (int)msg.appName.length(), SQLITE_STATIC)
+		sqlite3_bind_text(stmt, base + 7, msg.appName(), (int)msg.appName.length(), SQLITE_STATIC)
 	);
 	check_err( "bind parm 8",
-		sqlite3_bind_text(m_insert_stmt, 8, msg.machineName(), (int)msg.machineName.length(), SQLITE_STATIC)
+		sqlite3_bind_text(stmt, base + 8, msg.machineName(), (int)msg.machineName.length(), SQLITE_STATIC)
 	);
 	check_err( "bind parm 9",
-		sqlite3_bind_text(m_insert_stmt, 9, msg.appSession(), (int)msg.appSession.length(), SQLITE_STATIC)
+		sqlite3_bind_text(stmt, base + 9, msg.appSession(), (int)msg.appSession.length(), SQLITE_STATIC)
 	);
 	check_err( "bind parm 10",
-		sqlite3_bind_text(m_insert_stmt, 10, msg.msg(), (int)msg.msg.length(), SQLITE_STATIC)
+		sqlite3_bind_text(stmt, base + 10, msg.msg(), (int)msg.msg.length(), SQLITE_STATIC)
 	);
-
-	// Run the insert.
-	check_err( "exec insert", sqlite3_step( m_insert_stmt ));
-
-	// Update the Message to indicate what the new ID is:
-	msg.id = (int)sqlite3_last_insert_rowid( m_db );
 }
 
 void LogFile2::begin_transaction()
@@ -478,31 +1336,47 @@ void LogFile2::rollback_transaction()
 	}
 
 	check_err( "exec-rollback tran", sqlite3_step( m_stmt_rollbacktran ));
+
+	// Any dictionary entries added in this transaction are gone now.
+	m_dict.clear();
 }
 
 void LogFile2::CheckSize()
 {
-	//printf("LogFile2::messageCount()\n");
-	
+	//printf("LogFile2::CheckSize()\n");
+
+	// Our running estimate is kept up to date by flushBatch.  Only ask SQLite for the
+	// real size when the estimate says we might be over the limit.
+	if(m_sizeEstimate <= m_maxFileSize){
+		return;
+	}
+
+	m_sizeEstimate = actualSize();
+	if(m_sizeEstimate > m_maxFileSize){
+		createNewFile();
+	}
+}
+
+size_t LogFile2::actualSize()
+{
 	size_t page_size = 0, page_count = 0;
-	sqlite3_stmt* stmt;
+	sqlite3_stmt* stmt = NULL;
 	try {
 		twine sql = "pragma page_size;";
 		check_err( sql, sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL));
 		check_err( sql, sqlite3_step( stmt ));
 		page_size = sqlite3_column_int( stmt, 0 );
 		sqlite3_finalize(stmt);
+		stmt = NULL;
 
 		sql = "pragma page_count;";
 		check_err( sql, sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL));
 		check_err( sql, sqlite3_step( stmt ));
 		page_count = sqlite3_column_int( stmt, 0 );
 		sqlite3_finalize(stmt);
+		stmt = NULL;
 
-		size_t total_size = page_size * page_count;
-		if(total_size > m_maxFileSize){
-			createNewFile();
-		}
+		return page_size * page_count;
 
 	} catch (AnException& e){
 		if(stmt != NULL){
@@ -521,7 +1395,7 @@ int LogFile2::messageCount()
 	
 	sqlite3_stmt* stmt;
 	try {
-		twine sql = "select count(1) from logtable;";
+		twine sql; sql.format( "select count(1) from %s;", rowTable() );
 		check_err( sql,
 			sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL)
 		);
@@ -570,10 +1444,9 @@ LogMsg* LogFile2::getMessage(int id)
 	sqlite3_stmt* stmt;
 	try {
 		twine sql; sql.format(
-			"select id, file, line, tid, timestamp_a, timestamp_b, channel, "
-			"       appName, machineName, appSession, msg "
+			"select %s "
 			"from logtable "
-			"where id = %d;", id);
+			"where id = %d;", selectColumns(), id);
 		check_err( sql,
 			sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL)
 		);
@@ -585,35 +1458,14 @@ LogMsg* LogFile2::getMessage(int id)
 		} else {
 			// Ensure we have a sane list of columns:
 			int colCount = sqlite3_column_count(stmt);
-			if(colCount != 11){
+			if(colCount != 12){
 				WARN(FL, "We don't understand the layout of logtable table in the current log file.");
 				sqlite3_finalize( stmt );
 				return NULL;
 			}
 
 			// Pick up all of the columns:
-			dptr<LogMsg> ret = new LogMsg();
-			ret->id = sqlite3_column_int( stmt, 0 );
-			ret->file.set( 
-				(const char*)sqlite3_column_text(stmt, 1), (size_t)sqlite3_column_bytes(stmt, 1) );
-			ret->line = sqlite3_column_int( stmt, 2 );
-			ret->tid = sqlite3_column_int( stmt, 3 );
-#ifdef _WIN32
-			ret->timestamp.time = sqlite3_column_int( stmt, 4 );
-			ret->timestamp.millitm = (unsigned short)sqlite3_column_int( stmt, 5 );
-#else
-			ret->timestamp.tv_sec = sqlite3_column_int( stmt, 4 );
-			ret->timestamp.tv_usec = sqlite3_column_int( stmt, 5 );
-#endif
-			ret->channel = sqlite3_column_int( stmt, 6 );
-			ret->appName.set( 
-				(const char*)sqlite3_column_text(stmt, 7), (size_t)sqlite3_column_bytes(stmt, 7) );
-			ret->machineName.set( 
-				(const char*)sqlite3_column_text(stmt, 8), (size_t)sqlite3_column_bytes(stmt, 8) );
-			ret->appSession.set( 
-				(const char*)sqlite3_column_text(stmt, 9), (size_t)sqlite3_column_bytes(stmt, 9) );
-			ret->msg.set( 
-				(const char*)sqlite3_column_text(stmt, 10), (size_t)sqlite3_column_bytes(stmt, 10) );
+			dptr<LogMsg> ret = readRow( stmt );
 
 			sqlite3_finalize( stmt );
 			return ret.release();
@@ -636,10 +1488,10 @@ vector<LogMsg*>* LogFile2::getMessages(const twine& whereClause, int limit, int
 	sqlite3_stmt* stmt;
 	try {
 		twine sql; sql.format(
-			"select id, file, line, tid, timestamp_a, timestamp_b, channel, appName, machineName, appSession, msg "
+			"select %s "
 			"from logtable "
 			" %s ",
-			whereClause()
+			selectColumns(), whereClause()
 		);
 		if(limit != 0){
 			twine limitClause; limitClause.format(" limit %d offset %d ", limit, offset);
@@ -656,7 +1508,7 @@ vector<LogMsg*>* LogFile2::getMessages(const twine& whereClause, int limit, int
 		} else {
 			// Ensure we have a sane list of columns:
 			int colCount = sqlite3_column_count(stmt);
-			if(colCount != 11){
+			if(colCount != 12){
 				WARN(FL, "We don't understand the layout of logtable table in the current log file.");
 				sqlite3_finalize( stmt );
 				return ret;
@@ -664,28 +1516,7 @@ vector<LogMsg*>* LogFile2::getMessages(const twine& whereClause, int limit, int
 
 			while(rc != 0){
 				// Pick up all of the columns:
-				dptr<LogMsg> msg = new LogMsg();
-				msg->id = sqlite3_column_int( stmt, 0 );
-				msg->file.set( 
-					(const char*)sqlite3_column_text(stmt, 1), (size_t)sqlite3_column_bytes(stmt, 1) );
-				msg->line = sqlite3_column_int( stmt, 2 );
-				msg->tid = sqlite3_column_int( stmt, 3 );
-#ifdef _WIN32
-				msg->timestamp.time = sqlite3_column_int( stmt, 4 );
-				msg->timestamp.millitm = (unsigned short)sqlite3_column_int( stmt, 5 );
-#else
-				msg->timestamp.tv_sec = sqlite3_column_int( stmt, 4 );
-				msg->timestamp.tv_usec = sqlite3_column_int( stmt, 5 );
-#endif
-				msg->channel = sqlite3_column_int( stmt, 6 );
-				msg->appName.set( 
-					(const char*)sqlite3_column_text(stmt, 7), (size_t)sqlite3_column_bytes(stmt, 7) );
-				msg->machineName.set( 
-					(const char*)sqlite3_column_text(stmt, 8), (size_t)sqlite3_column_bytes(stmt, 8) );
-				msg->appSession.set( 
-					(const char*)sqlite3_column_text(stmt, 9), (size_t)sqlite3_column_bytes(stmt, 9) );
-				msg->msg.set( 
-					(const char*)sqlite3_column_text(stmt, 10), (size_t)sqlite3_column_bytes(stmt, 10) );
+				dptr<LogMsg> msg = readRow( stmt );
 
 				ret->push_back( msg.release() );
 
@@ -711,6 +1542,82 @@ vector<LogMsg*>* LogFile2::getMessages(const twine& whereClause, int limit, int
 	}
 }
 
+void LogFile2::bindMsgDict(sqlite3_stmt* stmt, int base, LogMsg& msg)
+{
+	check_err( "bind parm 1", sqlite3_bind_int(stmt, base + 1, dictID( msg.file ) ) );
+	check_err( "bind parm 2", sqlite3_bind_int(stmt, base + 2, msg.line ) );
+	check_err( "bind parm 3", sqlite3_bind_int(stmt, base + 3, (int)msg.tid) );
+#ifdef _WIN32
+	check_err( "bind parm 4", sqlite3_bind_int(stmt, base + 4, (int)msg.timestamp.time) );
+	check_err( "bind parm 5", sqlite3_bind_int(stmt, base + 5, (int)msg.timestamp.millitm) );
+#else
+	check_err( "bind parm 4", sqlite3_bind_int(stmt, base + 4, (int)msg.timestamp.tv_sec) );
+	check_err( "bind parm 5", sqlite3_bind_int(stmt, base + 5, (int)msg.timestamp.tv_usec) );
+#endif
+	check_err( "bind parm 6", sqlite3_bind_int(stmt, base + 6, msg.channel ) );
+	check_err( "bind parm 7", sqlite3_bind_int(stmt, base + 7, dictID( msg.appName ) ) );
+	check_err( "bind parm 8", sqlite3_bind_int(stmt, base + 8, dictID( msg.machineName ) ) );
+	check_err( "bind parm 9", sqlite3_bind_int(stmt, base + 9, dictID( msg.appSession ) ) );
+
+	twine packed;
+	if(m_storage.compressAbove != 0 && msg.msg.length() > m_storage.compressAbove &&
+		compressMsg( msg.msg, packed )
+	){
+		check_err( "bind parm 10",
+			sqlite3_bind_blob(stmt, base + 10, packed(), (int)packed.length(), SQLITE_TRANSIENT)
+		);
+		check_err( "bind parm 11", sqlite3_bind_int(stmt, base + 11, LOGFILE2_MSG_COMPRESSED ) );
+	} else {
+		check_err( "bind parm 10",
+			sqlite3_bind_text(stmt, base + 10, msg.msg(), (int)msg.msg.length(), SQLITE_STATIC)
+		);
+		check_err( "bind parm 11", sqlite3_bind_int(stmt, base + 11, 0 ) );
+	}
+}
+
+LogMsg* LogFile2::readRow(sqlite3_stmt* stmt)
+{
+	LogMsg* ret = new LogMsg();
+	ret->id = sqlite3_column_int( stmt, 0 );
+	ret->file.set( 
+		(const char*)sqlite3_column_text(stmt, 1), (size_t)sqlite3_column_bytes(stmt, 1) );
+	ret->line = sqlite3_column_int( stmt, 2 );
+	ret->tid = sqlite3_column_int( stmt, 3 );
+#ifdef _WIN32
+	ret->timestamp.time = sqlite3_column_int( stmt, 4 );
+	ret->timestamp.millitm = (unsigned short)sqlite3_column_int( stmt, 5 );
+#else
+	ret->timestamp.tv_sec = sqlite3_column_int( stmt, 4 );
+	ret->timestamp.tv_usec = sqlite3_column_int( stmt, 5 );
+#endif
+	ret->channel = sqlite3_column_int( stmt, 6 );
+	ret->appName.set( 
+		(const char*)sqlite3_column_text(stmt, 7), (size_t)sqlite3_column_bytes(stmt, 7) );
+	ret->machineName.set( 
+		(const char*)sqlite3_column_text(stmt, 8), (size_t)sqlite3_column_bytes(stmt, 8) );
+	ret->appSession.set( 
+		(const char*)sqlite3_column_text(stmt, 9), (size_t)sqlite3_column_bytes(stmt, 9) );
+	if(sqlite3_column_int( stmt, 11 ) & LOGFILE2_MSG_COMPRESSED){
+		try {
+			decompressMsg( (const unsigned char*)sqlite3_column_blob(stmt, 10),
+				(size_t)sqlite3_column_bytes(stmt, 10), ret->msg );
+		} catch (AnException& e){
+			delete ret;
+			throw e;
+		}
+	} else {
+		ret->msg.set( 
+			(const char*)sqlite3_column_text(stmt, 10), (size_t)sqlite3_column_bytes(stmt, 10) );
+	}
+	return ret;
+}
+
+LogFile2Cursor* LogFile2::query(const LogFile2Filter& filter, int pageSize)
+{
+	Lock theLock(m_mutex);
+	return new LogFile2Cursor( this, filter, pageSize );
+}
+
 int LogFile2::getOldestMessageID()
 {
 	//printf("LogFile2::getOldestMessageID()\n");
@@ -719,7 +1626,7 @@ int LogFile2::getOldestMessageID()
 	sqlite3_stmt* stmt;
 	try {
 
-		twine sql = "select min(id) from logtable;";
+		twine sql; sql.format( "select min(id) from %s;", rowTable() );
 		check_err(sql,
 			sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL)
 		);
@@ -744,7 +1651,7 @@ int LogFile2::getNewestMessageID()
 	sqlite3_stmt* stmt;
 	try {
 
-		twine sql = "select max(id) from logtable;";
+		twine sql; sql.format( "select max(id) from %s;", rowTable() );
 		check_err(sql,
 			sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL)
 		);
@@ -770,40 +1677,40 @@ void LogFile2::createNewFile()
 	}
 
 	// Close off our log file
-	if(m_stmt != NULL){
-		sqlite3_finalize( m_stmt );
-		m_stmt = NULL;
-	}
-	if(m_insert_stmt != NULL){
-		sqlite3_finalize( m_insert_stmt );
-		m_insert_stmt = NULL;
-	}
-	if(m_stmt_begintran != NULL){
-		sqlite3_finalize( m_stmt_begintran );
-		m_stmt_begintran = NULL;
-	}
-	if(m_stmt_committran != NULL){
-		sqlite3_finalize( m_stmt_committran );
-		m_stmt_committran = NULL;
-	}
-	if(m_stmt_rollbacktran != NULL){
-		sqlite3_finalize( m_stmt_rollbacktran );
-		m_stmt_rollbacktran = NULL;
-	}
+	finalizeStatements();
 	if(m_db != NULL){
+		if(m_inWAL){
+			// Get everything out of the WAL and into the file we are about to archive.
+			sqlite3_wal_checkpoint_v2( m_db, NULL, SQLITE_CHECKPOINT_FULL, NULL, NULL );
+		}
 		sqlite3_close(m_db);
 		m_db = NULL;
 	}
 
 	// Then move it to a new name:
 	Date d;
-	twine newName = m_logFileName + "." + d.GetValue("%Y%m%d%H%M%S");
+	twine stamp = d.GetValue("%Y%m%d%H%M%S");
+	twine newName = m_logFileName + "." + stamp;
+	for(int i = 1; File::Exists( newName + ".zip" ); i++){
+		// Rolled over more than once this second - don't overwrite the last archive.
+		newName.format( "%s.%s.%d", m_logFileName(), stamp(), i );
+	}
 	int res = rename( m_logFileName(), newName() );
 	if(res){
 		Setup(); // don't leave us without a log file
 		throw AnException(0, FL, "Error renaming existing log file %s to %s",
 			m_logFileName(), newName() );
 	}
+	if(m_inWAL){
+		// If a reader still has the old file open, SQLite leaves the -wal and -shm files
+		// behind.  Move them with the old file so our new file doesn't pick them up.
+		if(File::Exists( m_logFileName + "-wal" )){
+			rename( (m_logFileName + "-wal")(), (newName + "-wal")() );
+		}
+		if(File::Exists( m_logFileName + "-shm" )){
+			rename( (m_logFileName + "-shm")(), (newName + "-shm")() );
+		}
+	}
 	// Then zip it up to save space
 	ZipFile zf( newName + ".zip" );
 	zf.AddFile( newName );
@@ -811,8 +1718,300 @@ void LogFile2::createNewFile()
 
 	// Remove the unzipped version
 	File::Delete( newName );
+	if(File::Exists( newName + "-wal" )){
+		File::Delete( newName + "-wal" );
+	}
+	if(File::Exists( newName + "-shm" )){
+		File::Delete( newName + "-shm" );
+	}
 
 	// Then create our new log file:
 	Setup();
 }
 
+
+LogFile2Cursor::LogFile2Cursor(LogFile2* lf, const LogFile2Filter& filter, int pageSize)
+{
+	m_lf = lf;
+	m_filter = filter;
+	m_stmt = NULL;
+	m_pageSize = pageSize > 0 ? pageSize : 500;
+	m_lastID = filter.afterID;
+	m_pagePos = 0;
+	LogFile2::tokenize( m_filter.words, m_terms, true );
+	if(m_filter.words.length() != 0 && m_terms.size() == 0){
+		// Searching for nothing must not find everything.
+		throw AnException(0, FL, "No words to search for in (%s).", m_filter.words() );
+	}
+	if(m_filter.phrase && m_terms.size() != 0){
+		// The words have to be next to each other, as they are in words.
+		m_phrase = m_filter.words;
+	}
+
+	// Only the clauses we need go into the statement, so SQLite can pick the best index.
+	// Parameter 1 is always the last id we returned, and the limit is always last.
+	twine sql = "select ";
+	sql.append( m_lf->selectColumns() );
+	sql.append( "from logtable where id > ?1 " );
+	if(m_filter.since != 0){
+		sql.append( "and timestamp_a >= ?2 " );
+	}
+	if(m_filter.until != 0){
+		sql.append( "and timestamp_a <= ?3 " );
+	}
+	if((m_filter.channels & LOGFILE2_ALL_CHANNELS) != LOGFILE2_ALL_CHANNELS){
+		twine inList;
+		for(int c = 0; c < 7; c++){
+			if(m_filter.channels & LOGFILE2_CHANNEL(c)){
+				twine one; one.format( "%s%d", inList.length() == 0 ? "" : ",", c );
+				inList.append( one );
+			}
+		}
+		if(inList.length() == 0){
+			inList = "-1"; // no channels at all - match nothing
+		}
+		sql.append( "and channel in (" );
+		sql.append( inList );
+		sql.append( ") " );
+	}
+	if(m_filter.appSession.length() != 0){
+		sql.append( "and appSession = ?4 " );
+	}
+	if(m_filter.tid != 0){
+		sql.append( "and tid = ?5 " );
+	}
+	if(m_filter.text.length() != 0){
+		// Compressed messages can't be matched in SQL - fetchPage checks those itself.
+		// glob rather than like, so case matters - as it always has for LogDump.
+		if(m_lf->m_schema == 2){
+			sql.append( "and (msgflags <> 0 or msg glob ?6) " );
+		} else {
+			sql.append( "and msg glob ?6 " );
+		}
+	}
+	if(m_phrase.length() != 0){
+		// Words are matched without regard to case, so the phrase is too.
+		if(m_lf->m_schema == 2){
+			sql.append( "and (msgflags <> 0 or msg like ?10 escape '\\') " );
+		} else {
+			sql.append( "and msg like ?10 escape '\\' " );
+		}
+	}
+	for(size_t i = 0; i < m_terms.size(); i++){
+		twine clause;
+		if(m_lf->m_textIndex && LogFile2::isIndexedTerm( m_terms[i] )){
+			// Let the word index hand us the ids, starting after the last one we read.
+			clause.format( "and id in (select id from logterms where term = ?%d and id > ?1) ", (int)(11 + i) );
+		} else if(m_lf->m_schema == 2){
+			clause.format( "and (msgflags <> 0 or msg like ?%d escape '\\') ", (int)(11 + i) );
+		} else {
+			clause.format( "and msg like ?%d escape '\\' ", (int)(11 + i) );
+		}
+		sql.append( clause );
+	}
+	if(m_filter.machineName.length() != 0){
+		sql.append( "and machineName glob ?7 " );
+	}
+	if(m_filter.appName.length() != 0){
+		sql.append( "and appName glob ?8 " );
+	}
+	sql.append( "order by id limit ?9" );
+
+	m_lf->check_err( "LogFile2Cursor-prep",
+		sqlite3_prepare( m_lf->m_db, sql(), (int)sql.length(), &m_stmt, NULL)
+	);
+
+	// Bind everything that doesn't change from page to page.
+	try {
+		if(m_filter.since != 0){
+			m_lf->check_err( "LogFile2Cursor-bind since", sqlite3_bind_int( m_stmt, 2, (int)m_filter.since ) );
+		}
+		if(m_filter.until != 0){
+			m_lf->check_err( "LogFile2Cursor-bind until", sqlite3_bind_int( m_stmt, 3, (int)m_filter.until ) );
+		}
+		if(m_filter.appSession.length() != 0){
+			m_lf->check_err( "LogFile2Cursor-bind appSession", sqlite3_bind_text( m_stmt, 4,
+				m_filter.appSession(), (int)m_filter.appSession.length(), SQLITE_STATIC ) );
+		}
+		if(m_filter.tid != 0){
+			m_lf->check_err( "LogFile2Cursor-bind tid", sqlite3_bind_int( m_stmt, 5, m_filter.tid ) );
+		}
+		twine* globs[] = { &m_filter.text, &m_filter.machineName, &m_filter.appName };
+		for(int i = 0; i < 3; i++){
+			if(globs[i]->length() == 0){
+				continue;
+			}
+			// Turn "contains" into a glob pattern.  glob has no escape character - each
+			// wildcard goes in a set of its own.
+			twine pattern = "*";
+			for(size_t j = 0; j < globs[i]->length(); j++){
+				char ch = (*globs[i])[j];
+				if(ch == '*' || ch == '?' || ch == '['){
+					pattern.append( "[" );
+					pattern.append( &ch, 1 );
+					pattern.append( "]" );
+				} else {
+					pattern.append( &ch, 1 );
+				}
+			}
+			pattern.append( "*" );
+			m_lf->check_err( "LogFile2Cursor-bind glob", sqlite3_bind_text( m_stmt, 6 + i,
+				pattern(), (int)pattern.length(), SQLITE_TRANSIENT ) );
+		}
+		if(m_phrase.length() != 0){
+			// Turn "contains" into a like pattern, escaping the like wildcards.
+			twine pattern = "%";
+			for(size_t j = 0; j < m_phrase.length(); j++){
+				char ch = m_phrase[j];
+				if(ch == '%' || ch == '_' || ch == '\\'){
+					pattern.append( "\\" );
+				}
+				pattern.append( &ch, 1 );
+			}
+			pattern.append( "%" );
+			m_lf->check_err( "LogFile2Cursor-bind like", sqlite3_bind_text( m_stmt, 10,
+				pattern(), (int)pattern.length(), SQLITE_TRANSIENT ) );
+		}
+		m_lf->check_err( "LogFile2Cursor-bind limit", sqlite3_bind_int( m_stmt, 9, m_pageSize ) );
+		for(size_t i = 0; i < m_terms.size(); i++){
+			if(m_lf->m_textIndex && LogFile2::isIndexedTerm( m_terms[i] )){
+				m_lf->check_err( "LogFile2Cursor-bind term", sqlite3_bind_text( m_stmt, (int)(11 + i),
+					m_terms[i](), (int)m_terms[i].length(), SQLITE_STATIC ) );
+			} else {
+				// Words are only letters, digits and underscores - escape the underscores.
+				twine pattern = "%";
+				for(size_t j = 0; j < m_terms[i].length(); j++){
+					if(m_terms[i][j] == '_'){
+						pattern.append( "\\_" );
+					} else {
+						pattern.append( m_terms[i]() + j, 1 );
+					}
+				}
+				pattern.append( "%" );
+				m_lf->check_err( "LogFile2Cursor-bind term", sqlite3_bind_text( m_stmt, (int)(11 + i),
+					pattern(), (int)pattern.length(), SQLITE_TRANSIENT ) );
+			}
+		}
+	} catch (AnException& e){
+		sqlite3_finalize( m_stmt );
+		m_stmt = NULL;
+		throw e;
+	}
+}
+
+LogFile2Cursor::~LogFile2Cursor()
+{
+	for(size_t i = m_pagePos; i < m_page.size(); i++){
+		delete m_page[i];
+	}
+	m_page.clear();
+	if(m_stmt != NULL){
+		sqlite3_finalize( m_stmt );
+		m_stmt = NULL;
+	}
+}
+
+LogMsg* LogFile2Cursor::next()
+{
+	while(m_pagePos >= m_page.size()){
+		int rowsRead = fetchPage();
+		if(m_page.size() != 0){
+			break;
+		}
+		if(rowsRead < m_pageSize){
+			return NULL; // caught up
+		}
+		// A full page that we filtered out entirely - keep going.
+	}
+	LogMsg* ret = m_page[ m_pagePos ];
+	m_page[ m_pagePos ] = NULL;
+	m_pagePos++;
+	return ret;
+}
+
+int LogFile2Cursor::lastID()
+{
+	return m_lastID;
+}
+
+/// Folds ASCII upper case to lower case, and nothing else - the same folding SQLite's like does.
+static inline char likeFold(char ch)
+{
+	return (ch >= 'A' && ch <= 'Z') ? (char)(ch + ('a' - 'A')) : ch;
+}
+
+bool LogFile2Cursor::compressedMatches(const twine& msg)
+{
+	// The text filter is our glob: case matters, and so does every byte.
+	if(m_filter.text.length() != 0 && msg.find( m_filter.text ) == TWINE_NOT_FOUND){
+		return false;
+	}
+	// The phrase is our like: ASCII case is ignored.
+	if(m_phrase.length() != 0){
+		size_t plen = m_phrase.length();
+		bool found = false;
+		for(size_t i = 0; !found && i + plen <= msg.length(); i++){
+			size_t j = 0;
+			while(j < plen && likeFold( msg[i + j] ) == likeFold( m_phrase[j] )){
+				j++;
+			}
+			found = (j == plen);
+		}
+		if(!found){
+			return false;
+		}
+	}
+	return true;
+}
+
+int LogFile2Cursor::fetchPage()
+{
+	m_page.clear();
+	m_pagePos = 0;
+	int rowsRead = 0;
+
+	Lock theLock(m_lf->m_mutex);
+
+	try {
+		sqlite3_reset( m_stmt );
+		m_lf->check_err( "LogFile2Cursor-bind last id", sqlite3_bind_int( m_stmt, 1, m_lastID ) );
+		int rc = m_lf->check_err( "LogFile2Cursor-exec", sqlite3_step( m_stmt ) );
+		while(rc != 0){
+			rowsRead++;
+			bool compressed = (sqlite3_column_int( m_stmt, 11 ) & LOGFILE2_MSG_COMPRESSED) != 0;
+			LogMsg* lm = m_lf->readRow( m_stmt );
+			m_lastID = lm->id;
+			bool keep = true;
+			if(compressed && !compressedMatches( lm->msg )){
+				keep = false; // the sql let all compressed rows through - this one doesn't match
+			}
+			if(keep && m_terms.size() != 0){
+				// Terms that didn't come from the word index only matched substrings - check
+				// them as whole words.
+				vector<twine> words;
+				LogFile2::tokenize( lm->msg, words, true );
+				for(size_t i = 0; keep && i < m_terms.size(); i++){
+					if(!m_lf->m_textIndex || !LogFile2::isIndexedTerm( m_terms[i] )){
+						keep = binary_search( words.begin(), words.end(), m_terms[i], LogFile2DictLess() );
+					}
+				}
+			}
+			if(keep){
+				m_page.push_back( lm );
+			} else {
+				delete lm;
+			}
+			rc = m_lf->check_err( "LogFile2Cursor-next", sqlite3_step( m_stmt ) );
+		}
+		// Reset now so we don't hold a read lock on the file until the next page.
+		sqlite3_reset( m_stmt );
+	} catch (AnException& e){
+		sqlite3_reset( m_stmt );
+		for(size_t i = 0; i < m_page.size(); i++){
+			delete m_page[i];
+		}
+		m_page.clear();
+		throw e;
+	}
+	return rowsRead;
+}
@@ -28,8 +28,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <vector>
+#include <map>
 #include <utility>
 using namespace std;
 
@@ -37,10 +40,227 @@ using namespace std;
 #include "twine.h"
 #include "sptr.h"
 #include "Mutex.h"
+#include "Thread.h"
 #include "LogMsg.h"
 
+/// The number of rows in one multi-row insert.  10 or 11 columns each keeps us under
+/// SQLite's default limit of 999 bound parameters per statement.
+#define LOGFILE2_BULK_ROWS 50
+
+/// The number of (term, id) pairs in one word index insert.
+#define LOGFILE2_TERM_ROWS 200
+
+/// The shortest and longest words that go in the word index
+#define LOGFILE2_WORD_MIN 2
+#define LOGFILE2_WORD_MAX 64
+
+/// Roughly what one row costs each of the LogFile2Storage::indexes indexes: an integer
+/// key, the row id, the cell header and the space b-tree pages leave free.
+#define LOGFILE2_INDEX_ENTRY_BYTES 12
+
+/// msgflags bit: the msg column holds a zlib compressed message.
+#define LOGFILE2_MSG_COMPRESSED 1
+
 namespace SLib {
 
+/**
+  * This describes how LogFile2 asks SQLite to store our log file.  The defaults leave
+  * everything the way SQLite sets it up (rollback journal, synchronous=FULL).  Use
+  * Concurrent() to get a profile that lets readers like SLogDump watch the file without
+  * ever blocking the writer.
+  */
+struct DLLEXPORT LogFile2Storage {
+	/// Use journal_mode=WAL.  Readers see a snapshot and never block the writer.
+	bool walMode;
+
+	/// The synchronous setting to use: "OFF", "NORMAL", or "FULL".  Empty leaves the default.
+	twine synchronous;
+
+	/// The mmap_size in bytes.  0 leaves the default.  (Ignored by SQLite older than 3.7.17)
+	size_t mmapSize;
+
+	/// The cache_size pragma value.  Positive is pages, negative is KiB, 0 leaves the default.
+	int cacheSize;
+
+	/** How often, in milliseconds, the writer runs a passive WAL checkpoint after a flush.
+	  * When this is set we turn off SQLite's own auto-checkpoint on commit.  0 leaves
+	  * checkpointing to SQLite.
+	  */
+	size_t checkpointInterval;
+
+	/// How long, in milliseconds, to let SQLite retry on a busy database.  0 means don't wait.
+	int busyTimeout;
+
+	/** Create secondary indexes on timestamp, channel, appSession and tid.  These make
+	  * filtered queries fast, at the cost of some insert speed and file size.  Ignored
+	  * in read-only mode.
+	  */
+	bool indexes;
+
+	/** Messages longer than this many bytes are stored zlib compressed.  0 means never
+	  * compress.  Only files using the dictionary schema can hold compressed messages.
+	  */
+	size_t compressAbove;
+
+	/** Keep a word index (the logterms table) of every message, so LogFile2Filter::words
+	  * searches don't have to scan the whole file.  Turning this on for a file that
+	  * already has messages indexes them all first.  Once a file has the index we keep
+	  * it up to date whether this is set or not.
+	  */
+	bool textIndex;
+
+	/// Standard constructor - leaves everything at the SQLite defaults.
+	LogFile2Storage() : walMode(false), mmapSize(0), cacheSize(0), checkpointInterval(0),
+		busyTimeout(0), indexes(false), compressAbove(0), textIndex(false) {}
+
+	/// WAL, synchronous=NORMAL, a 64M mapping, an 8M cache, and checkpoints every second.
+	static LogFile2Storage Concurrent() {
+		LogFile2Storage ret;
+		ret.walMode = true;
+		ret.synchronous = "NORMAL";
+		ret.mmapSize = 64 * 1024 * 1024;
+		ret.cacheSize = -8192;
+		ret.checkpointInterval = 1000;
+		ret.busyTimeout = 100;
+		return ret;
+	}
+};
+
+/// Bit for a single channel in LogFile2Filter::channels.  Channel 0 is PANIC, 6 is SQLTRACE.
+#define LOGFILE2_CHANNEL(c) (1 << (c))
+
+/// All of the channels in LogFile2Filter::channels.
+#define LOGFILE2_ALL_CHANNELS 0x7F
+
+/**
+  * This describes which messages LogFile2::query should return.  Everything defaults to
+  * "match anything", so fill in only what you want to filter on.  All of the values are
+  * bound as parameters - nothing here is pasted into SQL text.
+  */
+struct DLLEXPORT LogFile2Filter {
+	/// Only return messages with an id greater than this.
+	int afterID;
+
+	/// Only return messages at or after this time (seconds since the epoch).  0 means any.
+	time_t since;
+
+	/// Only return messages at or before this time (seconds since the epoch).  0 means any.
+	time_t until;
+
+	/// Bitmask of LOGFILE2_CHANNEL values to include.
+	int channels;
+
+	/// Only return messages from this exact appSession.  Empty means any.
+	twine appSession;
+
+	/// Only return messages from this thread id.  0 means any.
+	int tid;
+
+	/// Only return messages whose text contains this.  Case matters.  Empty means any.
+	twine text;
+
+	/** Only return messages that contain all of these words.  Words are runs of letters,
+	  * digits and underscores, matched whole and without regard to case.  This uses the
+	  * word index if the file has one - words it leaves out (numbers, and words shorter
+	  * or longer than it keeps) are found by reading the messages.  Empty means any, but
+	  * words with no letters, digits or underscores in them at all is an error.
+	  */
+	twine words;
+
+	/** If set, the words must also appear together, in order, as they do in words.  Like
+	  * the words themselves, this ignores case.
+	  */
+	bool phrase;
+
+	/// Only return messages whose machineName contains this.  Case matters.  Empty means any.
+	twine machineName;
+
+	/// Only return messages whose appName contains this.  Case matters.  Empty means any.
+	twine appName;
+
+	/// Standard constructor - matches every message.
+	LogFile2Filter() : afterID(0), since(0), until(0), channels(LOGFILE2_ALL_CHANNELS), tid(0),
+		phrase(false) {}
+};
+
+class LogFile2;
+
+/// Orders our dictionary cache keys.  twine's own operator< doesn't order empty twines.
+struct LogFile2DictLess {
+	bool operator()(const twine& a, const twine& b) const {
+		return strcmp( a(), b() ) < 0;
+	}
+};
+
+/**
+  * A forward-only cursor over the messages matching a LogFile2Filter, in id order.  Rows
+  * are read a page at a time using the id of the last row we returned (id > last id), so
+  * every page costs the same no matter how deep into the file we are, and no read lock
+  * is held between pages.  When next() returns NULL you have caught up with the file;
+  * calling next() again later will pick up any messages written since.
+  * <P>
+  * Get one of these from LogFile2::query, and delete it before the LogFile2 goes away.
+  */
+class DLLEXPORT LogFile2Cursor
+{
+	private:
+		/// copy constructor is private to prevent use
+		LogFile2Cursor(const LogFile2Cursor& c) {}
+
+		/// assignmet operator is private to prevent use
+		LogFile2Cursor& operator=(const LogFile2Cursor& c) { return *this;}
+
+	public:
+		/// Builds our statement for the given filter.  Use LogFile2::query instead.
+		LogFile2Cursor(LogFile2* lf, const LogFile2Filter& filter, int pageSize);
+
+		/// Standard destructor
+		virtual ~LogFile2Cursor();
+
+		/** Returns the next matching message, or NULL if there are no more right now.
+		  * The caller owns the returned message.
+		  */
+		LogMsg* next();
+
+		/// Returns the id of the last row we have read.  The next page starts after it.
+		int lastID();
+
+	protected:
+
+		/// Reads the next page of rows into m_page.  Returns the number of rows read.
+		int fetchPage();
+
+		/** Checks a compressed message against our text and phrase filters, which the SQL
+		  * can't look inside.  The rules are the ones the SQL uses for every other row.
+		  */
+		bool compressedMatches(const twine& msg);
+
+		/// The log file we read from
+		LogFile2* m_lf;
+
+		/// Our filter
+		LogFile2Filter m_filter;
+
+		/// Our prepared statement - parameter 1 is always the last id
+		sqlite3_stmt* m_stmt;
+
+		/// The number of rows we read at a time
+		int m_pageSize;
+
+		/// The id of the last row we read
+		int m_lastID;
+
+		/// The current page of messages, and our position in it
+		vector<LogMsg*> m_page;
+		size_t m_pagePos;
+
+		/// The words from our filter, as LogFile2::tokenize found them
+		vector<twine> m_terms;
+
+		/// The words from our filter if they have to appear together, or empty
+		twine m_phrase;
+};
+
 /**
   * This class is responsible for handling the storage and retrieval of mainframe log 
   * messages.  We do this by wrapping a sqlite3 database and using it to store all of
@@ -87,6 +307,13 @@ class DLLEXPORT LogFile2
 		 */
 		void writeMsg(vector<LogMsg*>* messages);
 
+		/** This is the bulk ingest version of writeMsg.  We take ownership of every message
+		 * in the vector - the vector is emptied, and the messages will be deleted once they
+		 * are on disk.  Nothing is copied, and batches are written with multi-row inserts.
+		 * Use this when you are producing messages in volume and don't need them afterwards.
+		 */
+		void writeMsgBatch(vector<LogMsg*>* messages);
+
 		/** Returns the number of messages in our file.
 		 */
 		int messageCount();
@@ -98,6 +325,21 @@ class DLLEXPORT LogFile2
 		/** Retrieves log messages by free-form query - pass us the where clause. */
 		vector<LogMsg*>* getMessages( const twine& whereClause, int limit = 0, int offset = 0);
 
+		/** Returns a forward-only cursor over the messages that match the given filter.  The
+		  * caller owns the cursor, and must delete it before closing this log file.
+		  */
+		LogFile2Cursor* query(const LogFile2Filter& filter, int pageSize = 500);
+
+		/// Does this file have a word index?  (See LogFile2Storage::textIndex)
+		bool hasTextIndex();
+
+		/** Splits text into lower case words (runs of letters, digits and underscores), with
+		  * duplicates removed.  Unless anyLength is set, words shorter than LOGFILE2_WORD_MIN
+		  * or longer than LOGFILE2_WORD_MAX are left out - this is how the word index sees a
+		  * message.  Searches use anyLength, so that no word the caller gave us is dropped.
+		  */
+		static void tokenize(const twine& text, vector<twine>& tokens, bool anyLength = false);
+
 		/** Returns the ID of the oldest message in our log */
 		int getOldestMessageID();
 
@@ -135,6 +377,52 @@ class DLLEXPORT LogFile2
 		  */
 		void flush();
 
+		/** Starts a dedicated background thread that does all of our disk writes.  Once this
+		  * is running, writeMsg only appends to the in-memory cache and returns.  The flush
+		  * thread swaps the cache out when it reaches cacheSize entries or every cacheTime
+		  * milliseconds - whichever comes first - and commits the whole batch in a single
+		  * transaction.  "database is locked" retries are done with a backoff on the flush
+		  * thread, so they no longer stall the callers of writeMsg.
+		  */
+		void startFlushThread();
+
+		/** Stops the background flush thread, writing out anything left in the cache first.
+		  * After this, writeMsg goes back to flushing on the caller's thread.  Don't call this
+		  * while other threads are still writing to us.
+		  */
+		void stopFlushThread();
+
+		/** Returns the number of messages we have accepted but not yet written - the ones
+		  * in our cache, and any batch the flush thread is writing now.  Reads two counters
+		  * without taking our locks, so it is cheap enough to call from a metrics scrape.
+		  */
+		size_t cacheDepth();
+
+		/// Returns the number of messages we have written to the disk since we were opened.
+		uint64_t messagesWritten();
+
+		/** Sets the storage profile for our log file.  This is applied to the open file right
+		  * away and again every time createNewFile opens a new one.  In read-only mode only the
+		  * reader side settings (mmapSize, cacheSize, busyTimeout) are used - the journal mode
+		  * is a property of the file and is picked up from the writer automatically.
+		  */
+		void setStorage(const LogFile2Storage& storage);
+
+		/** Runs a passive WAL checkpoint now.  This copies what it can from the WAL back into
+		  * the database without waiting on any readers.  Does nothing if we are not in WAL mode.
+		  */
+		void checkpoint();
+
+		/** Starts a read snapshot.  All of the reads done until endSnapshot is called see the
+		  * log file exactly as it was when the snapshot started.  In WAL mode this never blocks
+		  * the writer.  Without WAL this holds a shared lock which will block the writer's commit,
+		  * so keep it short.
+		  */
+		void beginSnapshot();
+
+		/// Ends a read snapshot started with beginSnapshot.
+		void endSnapshot();
+
 	protected:
 
 		/// This method initializes our log file and ensures everything is properly setup
@@ -143,6 +431,60 @@ class DLLEXPORT LogFile2
 		/// Our common error checking routine for the SQLite calls - converts errors into exceptions
 		int check_err(const twine& doingWhat, int rc);
 
+		/// Builds a message from the current row of a select of selectColumns().
+		LogMsg* readRow(sqlite3_stmt* stmt);
+
+		/// Creates the dictionary schema in a new file: logdict, logrows and the logtable view.
+		void createSchema();
+
+		/// The 12 columns we select from logtable.  Old files get a constant 0 for msgflags.
+		const char* selectColumns();
+
+		/// The table that actually holds our rows: logrows, or logtable in old files.
+		const char* rowTable();
+
+		/// The start of our insert statement, up to the values keyword.
+		const char* insertPrefix();
+
+		/// One row of parameters for our insert statement.
+		const char* insertRow();
+
+		/// Binds a message for the dictionary schema: 11 columns, with ids for the strings.
+		void bindMsgDict(sqlite3_stmt* stmt, int base, LogMsg& msg);
+
+		/// Returns the logdict id for the given value, adding it if needed.
+		int dictID(const twine& value);
+
+		/// Finalizes our dictionary and word index statements and forgets the cached ids.
+		void finalizeDict();
+
+		/// Finalizes every statement we have prepared.  They are prepared again when needed.
+		void finalizeStatements();
+
+		/// Creates the word index, and indexes any messages already in the file.
+		void createTextIndex();
+
+		/// Adds the words of messages that have just been inserted to the word index.
+		void indexTerms(vector<LogMsg*>& rows);
+
+		/// Binds count (term, id) pairs, starting at entries[start], to a term insert.
+		void bindTerms(sqlite3_stmt* stmt, vector< pair<twine, int> >& entries, size_t start, size_t count);
+
+		/// Returns false for terms we leave out of the word index (all digits, too short or too long).
+		static bool isIndexedTerm(const twine& term);
+
+		/// Compresses a message into out.  Returns false if it doesn't get any smaller.
+		bool compressMsg(const twine& msg, twine& out);
+
+		/// Reverses compressMsg.
+		void decompressMsg(const unsigned char* data, size_t length, twine& out);
+
+		/// Creates our secondary indexes if they don't exist yet.
+		void createIndexes();
+
+		/// Our cursors use our database handle, mutex and error checking
+		friend class LogFile2Cursor;
+
 		/// Begins a transaction
 		void begin_transaction();
 
@@ -155,15 +497,57 @@ class DLLEXPORT LogFile2
 		/// Does the work of writing a single message to the logs
 		void writeOneMsg(LogMsg& msg);
 
+		/// Writes the given messages using multi-row inserts where possible.
+		void writeRows(vector<LogMsg*>& rows);
+
+		/// Binds the 10 columns of a message to the statement starting after parameter base.
+		void bindMsg(sqlite3_stmt* stmt, int base, LogMsg& msg);
+
 		/// Checks the current size of the database, and calls createNewFile if necessary.
 		void CheckSize();
 
+		/// Asks SQLite for the real size of the database (page_size * page_count).
+		size_t actualSize();
+
+		/// Applies our storage profile to the open database.
+		void applyStorage();
+
+		/// Runs a single pragma statement and returns the first column of the first row, if any.
+		twine runPragma(const twine& sql);
+
+		/// Runs a passive checkpoint without taking our mutex.
+		void checkpointInternal();
+
 		/// Flushes the internal cache.
 		void flushInternal();
 
+		/// Writes the given batch of messages to disk in a single transaction, and clears it.
+		void flushBatch(vector<LogMsg*>& batch);
+
 		/// Checks to see if the internal cache is ready to be written to disk - if so flushes the cache.
 		void checkFlushCache();
 
+		/// Swaps the cache out and writes it to disk.  Used when the flush thread is running.
+		void swapAndFlush();
+
+		/// The main loop of our background flush thread.
+		void flushThreadLoop();
+
+		/// The thread entry point for our background flush thread.
+		static void* flushThreadStart(void* arg);
+
+		/// Locks the cache when the flush thread is running.
+		void lockCache();
+
+		/// Unlocks the cache when the flush thread is running.
+		void unlockCache();
+
+		/// Wakes up the flush thread.
+		void signalCache();
+
+		/// Waits for a signal on the cache for at most the given number of milliseconds.
+		void waitCache(size_t millis);
+
 	private:
 
 		/// Our mutex to ensure single-threadded access to our database
@@ -181,6 +565,25 @@ class DLLEXPORT LogFile2
 		/// Our SQLite statement handle for inserting messages
 		sqlite3_stmt* m_insert_stmt;
 
+		/// Our SQLite statement handle for inserting LOGFILE2_BULK_ROWS messages at once
+		sqlite3_stmt* m_bulk_insert_stmt;
+
+		/// Our SQLite statement handles for adding to and looking up the dictionary
+		sqlite3_stmt* m_dict_insert_stmt;
+		sqlite3_stmt* m_dict_select_stmt;
+
+		/// Which schema our file uses: 1 is a plain logtable, 2 is the dictionary schema
+		int m_schema;
+
+		/// Does our file have a word index?
+		bool m_textIndex;
+
+		/// Our SQLite statement handle for adding to the word index
+		sqlite3_stmt* m_term_insert_stmt;
+
+		/// Cached dictionary ids, so we only look up new values
+		map<twine, int, LogFile2DictLess> m_dict;
+
 		/// Our SQLite statement handle for starting a transaction
 		sqlite3_stmt* m_stmt_begintran;
 
@@ -203,7 +606,48 @@ class DLLEXPORT LogFile2
 		size_t m_cacheTime;
 
 		/// Our log message cache:
-		vector<LogMsg> m_cache;
+		vector<LogMsg*> m_cache;
+
+		/// How our file should be stored
+		LogFile2Storage m_storage;
+
+		/// Are we actually in WAL mode?  (SQLite may refuse, for example on a network share)
+		bool m_inWAL;
+
+		/// The last time we ran a passive checkpoint
+		uint64_t m_lastCheckpoint;
+
+		/// A running estimate of our database size, updated with every flush
+		size_t m_sizeEstimate;
+
+		/// Are we inside beginSnapshot/endSnapshot?
+		bool m_inSnapshot;
+
+		/// Messages we have accepted, and messages that have left our cache (written or dropped)
+		volatile uint64_t m_msgsIn;
+		volatile uint64_t m_msgsOut;
+		volatile uint64_t m_msgsWritten;
+
+		/// The second half of our double buffer.  The flush thread swaps this with m_cache.
+		vector<LogMsg*> m_flushBuf;
+
+		/// Is our background flush thread running?
+		volatile bool m_flushThreadOn;
+
+		/// Tells our background flush thread to exit.
+		volatile bool m_flushThreadStop;
+
+		/// Our background flush thread
+		Thread* m_flushThread;
+
+		/// Protects m_cache while the flush thread is running
+#ifdef _WIN32
+		CRITICAL_SECTION m_cacheCS;
+		CONDITION_VARIABLE m_cacheCond;
+#else
+		Mutex* m_cacheMutex;
+		pthread_cond_t m_cacheCond;
+#endif
 
 };
 
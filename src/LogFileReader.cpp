@@ -0,0 +1,484 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "LogFileReader.h"
+#include "AnException.h"
+using namespace SLib;
+
+// These have to agree with the layout in LogFile.cpp.
+
+/// Our signature, and its size
+static const char* READER_SIGNATURE = "3141ZEDL";
+static const size_t READER_SIGNATURE_SIZE = 8;
+
+/// The index header: record count, index count, oldest entry, newest entry
+static const size_t READER_INDEX_HEADER_SIZE = 16;
+
+/// An index entry: offset, length, id
+static const size_t READER_INDEX_ENTRY_SIZE = 12;
+
+/// The string table header: total size, total indexes, index in use
+static const size_t READER_STRINGTAB_HEADER_SIZE = 12;
+
+/// A string table index entry: offset, length
+static const size_t READER_STRINGTAB_INDEX_ENTRY_SIZE = 8;
+
+/// Every message record starts with this
+static const int READER_EYE_CATCHER = 0x0BACADAB;
+
+/// Where things are in a message record
+static const int REC_ID = 4;
+static const int REC_SECONDS = 12;
+static const int REC_FRACTION = 16;
+static const int REC_LINE = 20;
+static const int REC_CHANNEL = 24;
+static const int REC_TID = 28;
+static const int REC_FLAGS = 32;
+static const int REC_STRINGS = 36;
+
+/// LogMsgStripped::length() counts the two timestamp fields as 8 bytes each, but they are
+/// written as 4, so a record really uses this many bytes less than its index entry says.
+static const int REC_LENGTH_SLACK = 8;
+
+/// The flag bit for each string field, in the order they are written
+static const int REC_STRING_FLAGS[4] = { 1, 2, 4, 8 };
+
+bool LogFileSpan::contains(const twine& needle) const
+{
+	int nlen = (int)needle.length();
+	if(nlen == 0){
+		return true;
+	}
+	for(int i = 0; i + nlen <= length; i++){
+		if(data[i] == needle[0] && memcmp( data + i, needle(), nlen ) == 0){
+			return true;
+		}
+	}
+	return false;
+}
+
+twine LogFileSpan::str() const
+{
+	twine ret;
+	if(length > 0){
+		ret.append( data, length );
+	}
+	return ret;
+}
+
+LogFileRecord::LogFileRecord()
+{
+	m_reader = NULL;
+	m_rec = NULL;
+	m_length = 0;
+}
+
+int LogFileRecord::intAt(int offset) const
+{
+	int32_t ret;
+	memcpy( &ret, m_rec + offset, sizeof(int32_t) );
+	return ret;
+}
+
+int LogFileRecord::id() const
+{
+	return intAt( REC_ID );
+}
+
+int LogFileRecord::seconds() const
+{
+	return intAt( REC_SECONDS );
+}
+
+int LogFileRecord::fraction() const
+{
+	return intAt( REC_FRACTION );
+}
+
+int LogFileRecord::line() const
+{
+	return intAt( REC_LINE );
+}
+
+int LogFileRecord::channel() const
+{
+	return intAt( REC_CHANNEL );
+}
+
+int LogFileRecord::tid() const
+{
+	return intAt( REC_TID );
+}
+
+LogFileSpan LogFileRecord::appName() const
+{
+	return stringAt( 0 );
+}
+
+LogFileSpan LogFileRecord::file() const
+{
+	return stringAt( 1 );
+}
+
+LogFileSpan LogFileRecord::msg() const
+{
+	return stringAt( 2 );
+}
+
+LogFileSpan LogFileRecord::machineName() const
+{
+	return stringAt( 3 );
+}
+
+LogFileSpan LogFileRecord::stringAt(int which) const
+{
+	LogFileSpan ret;
+	ret.data = "";
+	ret.length = 0;
+
+	// Step over the fields in front of the one we want.  Each one is either a string
+	// table id, or a length and the bytes themselves.
+	int flags = intAt( REC_FLAGS );
+	int pos = REC_STRINGS;
+	for(int i = 0; i <= which; i++){
+		if(pos + 4 > m_length){
+			return ret; // a damaged record
+		}
+		int value = intAt( pos );
+		pos += 4;
+		if((flags & REC_STRING_FLAGS[i]) != 0){
+			if(i == which){
+				return m_reader->stringTableEntry( value );
+			}
+		} else {
+			if(value < 0 || pos + value > m_length){
+				return ret; // a damaged record
+			}
+			if(i == which){
+				ret.data = m_rec + pos;
+				ret.length = value;
+				return ret;
+			}
+			pos += value;
+		}
+	}
+	return ret;
+}
+
+LogMsg* LogFileRecord::toLogMsg() const
+{
+	LogMsg* lm = new LogMsg();
+	lm->id = id();
+#ifdef _WIN32
+	lm->timestamp.time = seconds();
+	lm->timestamp.millitm = (unsigned short)fraction();
+#else
+	lm->timestamp.tv_sec = seconds();
+	lm->timestamp.tv_usec = fraction();
+#endif
+	lm->line = line();
+	lm->channel = channel();
+	lm->tid = tid();
+	lm->appName = appName().str();
+	lm->file = file().str();
+	lm->msg = msg().str();
+	lm->msg_static = (intAt( REC_FLAGS ) & 4) != 0;
+	lm->machineName = machineName().str();
+	return lm;
+}
+
+LogFileReader::LogFileReader(const twine& fileName)
+{
+	m_fileName = fileName;
+	m_fp = NULL;
+	m_map = NULL;
+	m_mapSize = 0;
+	m_mapHandle = NULL;
+	m_recordCount = 0;
+	m_indexCount = 0;
+	m_oldestEntry = 0;
+	m_stringTableStart = 0;
+	m_stringCount = 0;
+	m_stringIndexes = 0;
+	m_pos = 0;
+	m_lastID = 0;
+	m_hasLast = false;
+
+	m_fp = fopen( m_fileName(), "rb" );
+	if(m_fp == NULL){
+		throw AnException(0, FL, "Error opening log file %s", m_fileName() );
+	}
+	try {
+		mapFile();
+		if(memcmp( m_map, READER_SIGNATURE, READER_SIGNATURE_SIZE ) != 0){
+			throw AnException(0, FL, "Not a Proper log file.  Invalid Signature");
+		}
+		readHeaders();
+	} catch (AnException& e){
+		unmapFile();
+		fclose( m_fp );
+		m_fp = NULL;
+		throw e;
+	}
+}
+
+LogFileReader::~LogFileReader()
+{
+	unmapFile();
+	if(m_fp != NULL){
+		fclose( m_fp );
+	}
+}
+
+void LogFileReader::mapFile()
+{
+#ifdef _WIN32
+	HANDLE fh = (HANDLE)_get_osfhandle( _fileno(m_fp) );
+	LARGE_INTEGER size;
+	GetFileSizeEx( fh, &size );
+	m_mapSize = (size_t)size.QuadPart;
+#else
+	struct stat st;
+	if(fstat( fileno(m_fp), &st ) != 0){
+		throw AnException(0, FL, "Error reading the size of %s", m_fileName() );
+	}
+	m_mapSize = (size_t)st.st_size;
+#endif
+	if(m_mapSize < READER_SIGNATURE_SIZE + READER_INDEX_HEADER_SIZE){
+		m_mapSize = 0;
+		throw AnException(0, FL, "Not a Proper log file.  %s is too small.", m_fileName() );
+	}
+
+#ifdef _WIN32
+	HANDLE mh = CreateFileMapping( fh, NULL, PAGE_READONLY, 0, 0, NULL );
+	if(mh == NULL){
+		throw AnException(0, FL, "Error creating a file mapping for %s", m_fileName() );
+	}
+	m_map = (char*)MapViewOfFile( mh, FILE_MAP_READ, 0, 0, m_mapSize );
+	if(m_map == NULL){
+		CloseHandle( mh );
+		throw AnException(0, FL, "Error mapping %s", m_fileName() );
+	}
+	m_mapHandle = mh;
+#else
+	void* map = mmap( NULL, m_mapSize, PROT_READ, MAP_SHARED, fileno(m_fp), 0 );
+	if(map == MAP_FAILED){
+		throw AnException(0, FL, "Error mapping %s", m_fileName() );
+	}
+	m_map = (char*)map;
+#endif
+}
+
+void LogFileReader::unmapFile()
+{
+	if(m_map == NULL){
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile( m_map );
+	CloseHandle( (HANDLE)m_mapHandle );
+	m_mapHandle = NULL;
+#else
+	munmap( m_map, m_mapSize );
+#endif
+	m_map = NULL;
+	m_mapSize = 0;
+}
+
+void LogFileReader::readHeaders()
+{
+	size_t pos = READER_SIGNATURE_SIZE;
+	m_recordCount = intAt( pos );
+	m_indexCount = intAt( pos + 4 );
+	m_oldestEntry = intAt( pos + 8 );
+
+	m_stringTableStart = READER_SIGNATURE_SIZE + READER_INDEX_HEADER_SIZE +
+		(size_t)m_indexCount * READER_INDEX_ENTRY_SIZE;
+	if(m_indexCount < 0 || m_recordCount < 0 || m_recordCount > m_indexCount ||
+		!inMap( m_stringTableStart, READER_STRINGTAB_HEADER_SIZE )
+	){
+		throw AnException(0, FL, "Invalid index header in log file %s", m_fileName() );
+	}
+	m_stringIndexes = intAt( m_stringTableStart + 4 );
+	m_stringCount = intAt( m_stringTableStart + 8 );
+	if(m_stringCount < 0 || m_stringCount > m_stringIndexes){
+		m_stringCount = 0; // don't trust any of it
+	}
+}
+
+bool LogFileReader::inMap(size_t offset, size_t length) const
+{
+	return offset <= m_mapSize && length <= m_mapSize - offset;
+}
+
+int LogFileReader::intAt(size_t offset) const
+{
+	int32_t ret;
+	memcpy( &ret, m_map + offset, sizeof(int32_t) );
+	return ret;
+}
+
+const char* LogFileReader::indexEntry(int pos) const
+{
+	int which = (m_oldestEntry + pos) % m_indexCount;
+	return m_map + READER_SIGNATURE_SIZE + READER_INDEX_HEADER_SIZE +
+		(size_t)which * READER_INDEX_ENTRY_SIZE;
+}
+
+LogFileSpan LogFileReader::stringTableEntry(int which) const
+{
+	LogFileSpan ret;
+	ret.data = "";
+	ret.length = 0;
+	if(which < 0 || which >= m_stringCount){
+		return ret;
+	}
+	size_t entry = m_stringTableStart + READER_STRINGTAB_HEADER_SIZE +
+		(size_t)which * READER_STRINGTAB_INDEX_ENTRY_SIZE;
+	int offset = intAt( entry );
+	int length = intAt( entry + 4 );
+	if(offset <= 0 || length < 0 || !inMap( (size_t)offset, (size_t)length )){
+		return ret;
+	}
+	ret.data = m_map + offset;
+	ret.length = length;
+	return ret;
+}
+
+int LogFileReader::messageCount()
+{
+	return m_recordCount;
+}
+
+int LogFileReader::oldestID()
+{
+	if(m_recordCount == 0){
+		return 0;
+	}
+	int id;
+	memcpy( &id, indexEntry( 0 ) + 8, sizeof(int32_t) );
+	return id;
+}
+
+int LogFileReader::newestID()
+{
+	if(m_recordCount == 0){
+		return 0;
+	}
+	int id;
+	memcpy( &id, indexEntry( m_recordCount - 1 ) + 8, sizeof(int32_t) );
+	return id;
+}
+
+int LogFileReader::lastID()
+{
+	return m_lastID;
+}
+
+void LogFileReader::rewind()
+{
+	m_pos = 0;
+	m_lastID = 0;
+	m_hasLast = false;
+}
+
+void LogFileReader::seekAfter(int afterID)
+{
+	// Ids increase through the ring, so find the first one past afterID.
+	int lo = 0, hi = m_recordCount;
+	while(lo < hi){
+		int mid = lo + (hi - lo) / 2;
+		int id;
+		memcpy( &id, indexEntry( mid ) + 8, sizeof(int32_t) );
+		if(id <= afterID){
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	m_pos = lo;
+	m_lastID = afterID;
+	m_hasLast = true;
+}
+
+bool LogFileReader::next(LogFileRecord& rec)
+{
+	while(m_pos < m_recordCount){
+		const char* ie = indexEntry( m_pos );
+		m_pos++;
+
+		int offset, length, id;
+		memcpy( &offset, ie, sizeof(int32_t) );
+		memcpy( &length, ie + 4, sizeof(int32_t) );
+		memcpy( &id, ie + 8, sizeof(int32_t) );
+		length -= REC_LENGTH_SLACK;
+		if(offset <= 0 || length < REC_STRINGS || !inMap( (size_t)offset, (size_t)length )){
+			continue; // dropped, or written past what we have mapped
+		}
+
+		// The writer may have re-used this space since we read the header.
+		rec.m_reader = this;
+		rec.m_rec = m_map + offset;
+		rec.m_length = length;
+		if(rec.intAt( 0 ) != READER_EYE_CATCHER || rec.id() != id){
+			continue;
+		}
+
+		m_lastID = id;
+		m_hasLast = true;
+		return true;
+	}
+	return false;
+}
+
+void LogFileReader::refresh()
+{
+	// The stdio writer grows the file as it goes - pick up the new end.
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	GetFileSizeEx( (HANDLE)_get_osfhandle( _fileno(m_fp) ), &size );
+	size_t fileSize = (size_t)size.QuadPart;
+#else
+	struct stat st;
+	size_t fileSize = m_mapSize;
+	if(fstat( fileno(m_fp), &st ) == 0){
+		fileSize = (size_t)st.st_size;
+	}
+#endif
+	if(fileSize != m_mapSize){
+		unmapFile();
+		mapFile();
+	}
+	readHeaders();
+	if(m_hasLast){
+		seekAfter( m_lastID );
+	}
+}
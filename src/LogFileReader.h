@@ -0,0 +1,243 @@
+#ifndef LOGFILEREADER_H
+#define LOGFILEREADER_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "twine.h"
+#include "LogMsg.h"
+
+namespace SLib {
+
+class LogFileReader;
+
+/**
+  * A run of bytes inside a mapped log file.  It is not nul terminated - print it
+  * with printf("%.*s", span.length, span.data).
+  */
+struct DLLEXPORT LogFileSpan {
+	/// The first byte
+	const char* data;
+
+	/// The number of bytes
+	int length;
+
+	/// Returns true if needle appears anywhere in the span.
+	bool contains(const twine& needle) const;
+
+	/// Copies the span into a twine.
+	twine str() const;
+};
+
+/**
+  * A view of one message record, pointing straight into the reader's mapping.  Nothing
+  * is copied: the numeric fields are read from the record when asked for, and string
+  * table references are only looked up when you ask for that string.  A view is good
+  * until the next call to next() or refresh() on its reader.
+  */
+class DLLEXPORT LogFileRecord
+{
+	public:
+		/// Builds an empty view.  LogFileReader::next() fills it in.
+		LogFileRecord();
+
+		/// The message id
+		int id() const;
+
+		/// The timestamp seconds
+		int seconds() const;
+
+		/// The timestamp fraction: microseconds (milliseconds on windows)
+		int fraction() const;
+
+		/// The line number
+		int line() const;
+
+		/// The log channel
+		int channel() const;
+
+		/// The thread id
+		int tid() const;
+
+		/// The application name
+		LogFileSpan appName() const;
+
+		/// The source file name
+		LogFileSpan file() const;
+
+		/// The message text
+		LogFileSpan msg() const;
+
+		/// The machine name
+		LogFileSpan machineName() const;
+
+		/// Copies this record into a new LogMsg.  The caller owns it.
+		LogMsg* toLogMsg() const;
+
+	protected:
+		friend class LogFileReader;
+
+		/// Reads the int at the given byte offset into the record.
+		int intAt(int offset) const;
+
+		/** Finds string field 0-3 (application, file, message, machine) - either in the
+		  * string table, or inline in the record.
+		  */
+		LogFileSpan stringAt(int which) const;
+
+		/// The reader that owns our mapping
+		const LogFileReader* m_reader;
+
+		/// The start of our record (the eye catcher) in the mapping
+		const char* m_rec;
+
+		/// The number of bytes our record has
+		int m_length;
+};
+
+/**
+  * A read-only, zero-copy reader for the binary LogFile format.  The file is mapped
+  * into memory, and next() hands back LogFileRecord views in index ring order, oldest
+  * first, without building any LogMsg objects.  Memory use doesn't depend on how many
+  * messages the file holds.
+  * <P>
+  * Message ids are expected to increase through the ring (LogDump expects the same),
+  * so seekAfter() can binary search for a starting point.  A reader can follow a file
+  * that is still being written: refresh() picks up the writer's latest header and
+  * carries on after the last message we returned, even if the ring has wrapped
+  * underneath us.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogFileReader
+{
+	private:
+		/// copy constructor is private to prevent use
+		LogFileReader(const LogFileReader& c) {}
+
+		/// assignmet operator is private to prevent use
+		LogFileReader& operator=(const LogFileReader& c) { return *this;}
+
+	public:
+		/// Opens and maps the given log file.  Throws if it isn't a LogFile.
+		LogFileReader(const twine& fileName);
+
+		/// Standard destructor
+		virtual ~LogFileReader();
+
+		/// Returns the number of messages in the file
+		int messageCount();
+
+		/// Returns the id of the oldest message, or 0 if there are none
+		int oldestID();
+
+		/// Returns the id of the newest message, or 0 if there are none
+		int newestID();
+
+		/// Starts over at the oldest message in the file.
+		void rewind();
+
+		/** Positions us so that next() returns the first message with an id greater than
+		  * afterID.
+		  */
+		void seekAfter(int afterID);
+
+		/** Fills in rec with the next message and returns true, or returns false when we
+		  * are at the newest message.  Records that have been overwritten since the index
+		  * was read are skipped.
+		  */
+		bool next(LogFileRecord& rec);
+
+		/** Re-reads the header (and re-maps the file if it has grown), and positions us
+		  * after the last message next() returned.
+		  */
+		void refresh();
+
+		/** Returns the id of the last message next() returned (or the one given to
+		  * seekAfter()).  Pass it to seekAfter() later to carry on from here.
+		  */
+		int lastID();
+
+	protected:
+		friend class LogFileRecord;
+
+		/// Maps our file
+		void mapFile();
+
+		/// Releases our mapping
+		void unmapFile();
+
+		/// Reads the index and string table headers out of the mapping
+		void readHeaders();
+
+		/// Reads the int at the given file offset
+		int intAt(size_t offset) const;
+
+		/// Returns the index entry for ring position pos (0 = oldest)
+		const char* indexEntry(int pos) const;
+
+		/// Looks up a string table entry, returning an empty span if it is not valid.
+		LogFileSpan stringTableEntry(int which) const;
+
+		/// Returns true if the given range lies inside our mapping
+		bool inMap(size_t offset, size_t length) const;
+
+		/// Our file name
+		twine m_fileName;
+
+		/// Our open file
+		FILE* m_fp;
+
+		/// Our mapping, and its size
+		char* m_map;
+		size_t m_mapSize;
+
+		/// The windows file mapping handle behind m_map
+		void* m_mapHandle;
+
+		/// The index header, as of our last refresh
+		int m_recordCount;
+		int m_indexCount;
+		int m_oldestEntry;
+
+		/// Where the string table header starts, and how many strings it holds
+		size_t m_stringTableStart;
+		int m_stringCount;
+		int m_stringIndexes;
+
+		/// Our position in the ring - the next one next() will look at (0 = oldest)
+		int m_pos;
+
+		/// The id of the last message next() returned, if m_hasLast is set
+		int m_lastID;
+		bool m_hasLast;
+};
+
+} // End Namespace SLib
+
+#endif // LOGFILEREADER_H Defined
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include "LogMsg.h"
+#include "Clock.h"
 using namespace SLib;
 
 #ifdef _WIN32
@@ -117,10 +118,16 @@ LogMsg::~LogMsg()
 
 void LogMsg::SetTimestamp(void)
 {
+	// Our Clock is cheap to read, and keeps itself lined up with the system time.
+	uint64_t now = Clock::WallNanos();
 #ifdef _WIN32
-	ftime(&timestamp);
+	timestamp.time = (time_t)(now / 1000000000);
+	timestamp.millitm = (unsigned short)((now % 1000000000) / 1000000);
+	timestamp.timezone = 0;
+	timestamp.dstflag = 0;
 #else
-	gettimeofday(&timestamp, NULL);
+	timestamp.tv_sec = (time_t)(now / 1000000000);
+	timestamp.tv_usec = (suseconds_t)((now % 1000000000) / 1000);
 #endif
 }
 
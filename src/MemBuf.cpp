@@ -37,14 +37,14 @@ MemBuf::MemBuf() :
 	/* MemBuf's are used during log processing.  For this reason, do not include */
 	/* the ee(FL, ...) version of the EnEx call.                                */
 	/* ************************************************************************ */
-	EnEx ee("MemBuf::MemBuf()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::MemBuf()");
 }
 
 MemBuf::MemBuf(const MemBuf& t) :
 	m_data (NULL),
 	m_data_size (0)
 {
-	EnEx ee("MemBuf::MemBuf(const MemBuf& t)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::MemBuf(const MemBuf& t)");
 
 	// short circuit for source having nothing in it.
 	if(t.m_data_size == 0) {
@@ -60,7 +60,7 @@ MemBuf::MemBuf(const char* c) :
 	m_data (NULL),
 	m_data_size (0)
 {
-	EnEx ee("MemBuf::MemBuf(const char* c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::MemBuf(const char* c)");
 	if(c == NULL){
 		throw AnException(0, FL, "Input is null.");
 	}
@@ -74,7 +74,7 @@ MemBuf::MemBuf(const xmlChar* c) :
 	m_data (NULL),
 	m_data_size (0)
 {
-	EnEx ee("MemBuf::MemBuf(const xmlChar* c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::MemBuf(const xmlChar* c)");
 	if(c == NULL){
 		throw AnException(0, FL, "Input is null.");
 	}
@@ -88,7 +88,7 @@ MemBuf::MemBuf(const size_t s) :
 	m_data (NULL),
 	m_data_size (0)
 {
-	EnEx ee("MemBuf::MemBuf(const size_t s)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::MemBuf(const size_t s)");
 	reserve(s);
 	m_data_size = s;
 }
@@ -97,7 +97,7 @@ MemBuf::MemBuf(const twine& c):
 	m_data (NULL),
 	m_data_size (0)
 {
-	EnEx ee("MemBuf::MemBuf(const twine& c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::MemBuf(const twine& c)");
 
 	reserve( c.size() );
 	memcpy(m_data, c(), c.size());
@@ -107,7 +107,7 @@ MemBuf::MemBuf(const twine& c):
 
 MemBuf::~MemBuf() 
 {
-	EnEx ee("MemBuf::~MemBuf()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::~MemBuf()");
 	if(m_data_size > 0 || m_data != NULL){
 		if(m_data != NULL){
 			free(m_data);
@@ -119,7 +119,7 @@ MemBuf::~MemBuf()
 
 MemBuf& MemBuf::operator=(const MemBuf& t)
 {
-	EnEx ee("MemBuf::operator=(const MemBuf& t)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator=(const MemBuf& t)");
 	if(&t == this){
 		return *this;
 	}
@@ -140,7 +140,7 @@ MemBuf& MemBuf::operator=(const MemBuf& t)
 
 MemBuf& MemBuf::operator=(const char* c)
 {
-	EnEx ee("MemBuf::operator=(const char* c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator=(const char* c)");
 	if(c == NULL){
 		throw AnException(0, FL, "MemBuf = NULL not allowed.");
 	}
@@ -158,7 +158,7 @@ MemBuf& MemBuf::operator=(const char* c)
 
 MemBuf& MemBuf::operator=(const xmlChar* c)
 {
-	EnEx ee("MemBuf::operator=(const xmlChar* c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator=(const xmlChar* c)");
 
 	// Clear out anything that we have.
 	clear();
@@ -173,7 +173,7 @@ MemBuf& MemBuf::operator=(const xmlChar* c)
 	
 MemBuf& MemBuf::operator=(const twine& t)
 {
-	EnEx ee("MemBuf::operator=(const twine& t)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator=(const twine& t)");
 	
 	// Clear out anything that we have.
 	clear();
@@ -186,35 +186,35 @@ MemBuf& MemBuf::operator=(const twine& t)
 
 MemBuf& MemBuf::operator+=(const MemBuf& t)
 {
-	EnEx ee("MemBuf::operator+=(const MemBuf& t)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator+=(const MemBuf& t)");
 	append(t);
 	return *this;
 }
 
 MemBuf& MemBuf::operator+=(const char* c)
 {
-	EnEx ee("MemBuf::operator+=(const char* c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator+=(const char* c)");
 	append(c);
 	return *this;
 }
 
 MemBuf& MemBuf::operator+=(const xmlChar* c)
 {
-	EnEx ee("MemBuf::operator+=(const xmlChar* c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator+=(const xmlChar* c)");
 	append((const char*)c);
 	return *this;
 }
 
 MemBuf& MemBuf::operator+=(const twine& t)
 {
-	EnEx ee("MemBuf::operator+=(const size_t i)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator+=(const size_t i)");
 	append(t());
 	return *this;
 }
 
 const char MemBuf::operator[](size_t i) const
 {
-	EnEx ee("MemBuf::operator[](size_t i)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator[](size_t i)");
 	if( (i < 0) || (i >= m_data_size)){
 		throw AnException(0,FL,"MemBuf: Out Of Bounds Access");
 	}
@@ -223,13 +223,13 @@ const char MemBuf::operator[](size_t i) const
 
 const char* MemBuf::operator()() const
 {
-	EnEx ee("MemBuf::operator()()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::operator()()");
 	return (char*)m_data;
 }
 
 int MemBuf::compare( const MemBuf& other) const
 {
-	EnEx ee("MemBuf::compare( const MemBuf& other)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::compare( const MemBuf& other)");
 
 	// Are they both empty?
 	if(m_data_size == 0 && other.m_data_size == 0){
@@ -249,19 +249,19 @@ int MemBuf::compare( const MemBuf& other) const
 
 char* MemBuf::data(void)
 {
-	EnEx ee("MemBuf::data(void)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::data(void)");
 	return (char*)m_data;
 }
 
 MemBuf& MemBuf::set(const char* c)
 {
-	EnEx ee("MemBuf::set(const char* c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::set(const char* c)");
 	return operator=(c);
 }
 
 MemBuf& MemBuf::set(const char* c, size_t n)
 {
-	EnEx ee("MemBuf::set(const char* c, size_t n)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::set(const char* c, size_t n)");
 
 	// Clear out anything that we have
 	clear();
@@ -275,7 +275,7 @@ MemBuf& MemBuf::set(const char* c, size_t n)
 	
 MemBuf& MemBuf::replace(size_t start, const MemBuf& rep, size_t count)
 {
-	EnEx ee("MemBuf::replace(size_t start, const MemBuf& rep, size_t count)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::replace(size_t start, const MemBuf& rep, size_t count)");
 	bounds_check(start);
 	
 	if((start+count) >= m_data_size){
@@ -295,7 +295,7 @@ MemBuf& MemBuf::replace(size_t start, const MemBuf& rep, size_t count)
 
 MemBuf& MemBuf::replace(size_t start, const twine& rep, size_t count)
 {
-	EnEx ee("MemBuf::replace(size_t start, const twine& rep, size_t count)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::replace(size_t start, const twine& rep, size_t count)");
 	bounds_check(start);
 	
 	if((start+count) >= m_data_size){
@@ -315,7 +315,7 @@ MemBuf& MemBuf::replace(size_t start, const twine& rep, size_t count)
 
 MemBuf& MemBuf::replace(size_t pos, const char n)
 {
-	EnEx ee("MemBuf::replace(size_t pos, const char n)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::replace(size_t pos, const char n)");
 
 	bounds_check(pos);
 	((char*)m_data)[ pos ] = n;
@@ -325,7 +325,7 @@ MemBuf& MemBuf::replace(size_t pos, const char n)
 
 MemBuf& MemBuf::append(const char* c)
 {
-	EnEx ee("MemBuf::append(const char* c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::append(const char* c)");
 	if(c == NULL){
 		return *this; // nothing to append
 	}
@@ -341,7 +341,7 @@ MemBuf& MemBuf::append(const char* c)
 
 MemBuf& MemBuf::append(const char* c, size_t csize)
 {
-	EnEx ee("MemBuf::append(const char* c, size_t csize)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::append(const char* c, size_t csize)");
 	if(c == NULL || csize == 0){
 		return *this; // nothing to append
 	}
@@ -356,7 +356,7 @@ MemBuf& MemBuf::append(const char* c, size_t csize)
 
 MemBuf& MemBuf::append(const MemBuf& c)
 {
-	EnEx ee("MemBuf::append(const MemBuf& c)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::append(const MemBuf& c)");
 	if(c.size() == 0){
 		return *this; // nothing to append
 	}
@@ -371,7 +371,7 @@ MemBuf& MemBuf::append(const MemBuf& c)
 
 MemBuf& MemBuf::erase(size_t p, size_t n)
 {
-	EnEx ee("MemBuf::erase(size_t p, size_t n)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::erase(size_t p, size_t n)");
 
 	bounds_check(p);
 	bounds_check(p+n-1);
@@ -383,7 +383,7 @@ MemBuf& MemBuf::erase(size_t p, size_t n)
 
 MemBuf& MemBuf::erase(size_t p)
 {
-	EnEx ee("MemBuf::erase(size_t p)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::erase(size_t p)");
 	bounds_check(p);
 
 	// 0 1 2 3 4 5 6 7 8 9
@@ -399,7 +399,7 @@ MemBuf& MemBuf::erase(size_t p)
 
 MemBuf& MemBuf::erase(void)
 {
-	EnEx ee("MemBuf::erase(void)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::erase(void)");
 	if(m_data_size == 0){
 		return *this; // nothing to do
 	}
@@ -411,7 +411,7 @@ MemBuf& MemBuf::erase(void)
 
 MemBuf& MemBuf::clear(void)
 {
-	EnEx ee("MemBuf::clear(void)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::clear(void)");
 
 	if(m_data_size == 0){
 		return *this; // nothing to do
@@ -427,7 +427,7 @@ MemBuf& MemBuf::clear(void)
 
 MemBuf& MemBuf::reserve(size_t min_size) 
 {
-	EnEx ee("MemBuf::reserve(size_t min_size)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::reserve(size_t min_size)");
 	if(m_data_size == 0){
 		m_data = malloc(min_size + 10);
 		if(m_data == NULL){
@@ -455,25 +455,25 @@ MemBuf& MemBuf::reserve(size_t min_size)
 
 size_t MemBuf::size(void) const 
 { 
-	EnEx ee("MemBuf::size(void)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::size(void)");
 	return m_data_size; 
 }
 
 size_t MemBuf::length(void) const 
 { 
-	EnEx ee("MemBuf::length(void)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::length(void)");
 	return m_data_size; 
 }
 
 bool MemBuf::empty(void) const 
 { 
-	EnEx ee("MemBuf::empty(void)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::empty(void)");
 	return (m_data_size == 0); 
 }
 	
 void MemBuf::bounds_check(size_t p) const
 {
-	EnEx ee("MemBuf::bounds_check(size_t p)");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::bounds_check(size_t p)");
 	if( (p < 0) || (p >= m_data_size)){
 		throw AnException(0, FL, "MemBuf: Index out of bounds. p(%d) m_data_size(%d)", p, m_data_size);
 	}
@@ -481,7 +481,7 @@ void MemBuf::bounds_check(size_t p) const
 
 MemBuf& MemBuf::encode64()
 {
-	EnEx ee("MemBuf::encode64()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::encode64()");
 
 	// Run the conversion
 	size_t len;
@@ -502,7 +502,7 @@ MemBuf& MemBuf::encode64()
 
 MemBuf& MemBuf::decode64()
 {
-	EnEx ee("MemBuf::decode64()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::decode64()");
 
 	// Run the conversion
 	size_t len;
@@ -523,7 +523,7 @@ MemBuf& MemBuf::decode64()
 
 MemBuf& MemBuf::zip()
 {
-	EnEx ee("MemBuf::zip()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::zip()");
 
 
 	return *this;
@@ -531,7 +531,7 @@ MemBuf& MemBuf::zip()
 
 MemBuf& MemBuf::unzip()
 {
-	EnEx ee("MemBuf::unzip()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::unzip()");
 
 
 	return *this;
@@ -539,7 +539,7 @@ MemBuf& MemBuf::unzip()
 
 xmlDocPtr MemBuf::Encrypt(RSA* keypair, bool usePublic)
 {
-	EnEx ee("MemBuf::Encrypt()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::Encrypt()");
 
 	if(keypair == NULL){
 		throw AnException(0, FL, "Invalid RSA keypair given: NULL");
@@ -619,7 +619,7 @@ xmlDocPtr MemBuf::Encrypt(RSA* keypair, bool usePublic)
 
 MemBuf& MemBuf::Decrypt(xmlDocPtr doc, RSA* keypair, bool usePrivate)
 {
-	EnEx ee("MemBuf::Decrypt()");
+	ENEX_SITE_IN(ENEX_SUBSYSTEM_MEMBUF, "MemBuf::Decrypt()");
 
 	if(keypair == NULL){
 		throw AnException(0, FL, "Invalid RSA keypair given: NULL");
@@ -0,0 +1,685 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "MergedLogReader.h"
+#include "AnException.h"
+#include "File.h"
+#include "ZipFile.h"
+using namespace SLib;
+
+/// The most messages a single fill reads, however few files we have
+static const int MERGEDLOG_MAX_BATCH = 500;
+
+/// The page cache each LogFile2 gets, in KiB.  We read each file once, front to back.
+static const int MERGEDLOG_CACHE_KB = 256;
+
+/// Numbers the directories we unpack archives into, so no two readers share one
+static volatile long scratchCounter = 0;
+
+/**
+  * Returns a directory of our own to unpack an archive into: under the temp directory, so
+  * a read-only log directory is fine, and named for our pid and a counter, so concurrent
+  * readers (in this process or another) never unpack over, or remove, each other's files.
+  */
+static twine scratchDirName()
+{
+	twine dir;
+#ifdef _WIN32
+	long n = InterlockedIncrement( &scratchCounter );
+	char tmp[MAX_PATH + 1];
+	DWORD len = GetTempPathA( sizeof(tmp), tmp );
+	twine tmpDir = (len == 0 || len > MAX_PATH) ? ".\\" : tmp; // GetTempPath ends with a backslash
+	dir.format( "%sslibmerge.%lu.%ld", tmpDir(), (unsigned long)GetCurrentProcessId(), n );
+#else
+	long n = __sync_add_and_fetch( &scratchCounter, 1 );
+	const char* tmpDir = getenv( "TMPDIR" );
+	if(tmpDir == NULL || tmpDir[0] == '\0'){
+		tmpDir = "/tmp";
+	}
+	dir.format( "%s/slibmerge.%lu.%ld", tmpDir, (unsigned long)getpid(), n );
+#endif
+	return dir;
+}
+
+/// Returns the first regular file under dirName, or an empty twine.
+static twine firstFileUnder(const twine& dirName)
+{
+	vector<twine> files;
+	try {
+		files = File::listFiles( dirName );
+	} catch (AnException&){
+		// Nothing here.
+	}
+	if(files.size() != 0){
+		return dirName + "/" + files[0];
+	}
+	vector<twine> folders;
+	try {
+		folders = File::listFolders( dirName );
+	} catch (AnException&){
+		// Nothing here either.
+	}
+	for(size_t i = 0; i < folders.size(); i++){
+		if(folders[i] == "." || folders[i] == ".."){
+			continue;
+		}
+		twine ret = firstFileUnder( dirName + "/" + folders[i] );
+		if(ret.length() != 0){
+			return ret;
+		}
+	}
+	return "";
+}
+
+/// Folds ASCII upper case to lower case, and nothing else - the same folding SQLite's like does.
+static inline char likeFold(char ch)
+{
+	return (ch >= 'A' && ch <= 'Z') ? (char)(ch + ('a' - 'A')) : ch;
+}
+
+/// Returns true if the span contains needle, ignoring case as a LogFile2 phrase does.
+static bool containsNoCase(const LogFileSpan& span, const twine& needle)
+{
+	int nlen = (int)needle.length();
+	for(int i = 0; i + nlen <= span.length; i++){
+		int j = 0;
+		while(j < nlen && likeFold( span.data[i + j] ) == likeFold( needle[j] )){
+			j++;
+		}
+		if(j == nlen){
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MergedLogReader::HeapLater::operator()(const HeapEntry& a, const HeapEntry& b) const
+{
+	if(a.seconds != b.seconds) return a.seconds > b.seconds;
+	if(a.fraction != b.fraction) return a.fraction > b.fraction;
+	return a.source > b.source;
+}
+
+MergedLogReader::MergedLogReader(const LogFile2Filter& filter, int workers, int maxBuffered,
+	int maxOpen)
+{
+	m_filter = filter;
+	m_filter.afterID = 0; // ids don't carry from one file to the next
+	LogFile2::tokenize( m_filter.words, m_terms, true );
+	if(m_filter.words.length() != 0 && m_terms.size() == 0){
+		// Searching for nothing must not find everything.
+		throw AnException(0, FL, "No words to search for in (%s).", m_filter.words() );
+	}
+	m_workerCount = workers > 0 ? workers : 1;
+	m_maxBuffered = maxBuffered > 0 ? maxBuffered : 1;
+	// Every worker may be filling a file of its own, and still needs one it can close.
+	m_maxOpen = maxOpen > m_workerCount ? maxOpen : m_workerCount;
+	m_openCount = 0;
+	m_fillClock = 0;
+	m_batchSize = MERGEDLOG_MAX_BATCH;
+	m_started = false;
+	m_stopping = false;
+#ifdef _WIN32
+	InitializeCriticalSection( &m_queueCS );
+	InitializeConditionVariable( &m_jobCond );
+	InitializeConditionVariable( &m_doneCond );
+#else
+	m_queueMutex = new Mutex();
+	pthread_cond_init( &m_jobCond, NULL );
+	pthread_cond_init( &m_doneCond, NULL );
+#endif
+}
+
+MergedLogReader::~MergedLogReader()
+{
+	stop();
+	for(size_t i = 0; i < m_sources.size(); i++){
+		MergedLogSource* src = m_sources[i];
+		for(size_t j = src->pos; j < src->current.size(); j++){
+			delete src->current[j];
+		}
+		for(size_t j = 0; j < src->ready.size(); j++){
+			delete src->ready[j];
+		}
+		closeSource( *src );
+		delete src;
+	}
+#ifdef _WIN32
+	DeleteCriticalSection( &m_queueCS );
+#else
+	pthread_cond_destroy( &m_jobCond );
+	pthread_cond_destroy( &m_doneCond );
+	delete m_queueMutex;
+#endif
+}
+
+void MergedLogReader::addFile(const twine& fileName)
+{
+	if(m_started){
+		throw AnException(0, FL, "Files can't be added to a MergedLogReader once reading has started.");
+	}
+	MergedLogSource* src = new MergedLogSource();
+	src->fileName = fileName;
+	m_sources.push_back( src );
+}
+
+int MergedLogReader::addFiles(const twine& pattern)
+{
+	size_t slash = TWINE_NOT_FOUND;
+	for(size_t i = 0; i < pattern.length(); i++){
+		if(pattern[i] == '/' || pattern[i] == '\\'){
+			slash = i;
+		}
+	}
+	twine dirName, prefix, namePattern;
+	if(slash == TWINE_NOT_FOUND){
+		dirName = ".";
+		namePattern = pattern;
+	} else {
+		dirName = pattern.substr( 0, slash == 0 ? 1 : slash );
+		prefix = pattern.substr( 0, slash + 1 );
+		namePattern = pattern.substr( slash + 1 );
+	}
+
+	vector<twine> files;
+	try {
+		files = File::listFiles( dirName );
+	} catch (AnException&){
+		return 0; // no such directory - nothing matches
+	}
+	sort( files.begin(), files.end(), LogFile2DictLess() );
+
+	int added = 0;
+	for(size_t i = 0; i < files.size(); i++){
+		if(matchPattern( namePattern(), files[i]() )){
+			addFile( prefix + files[i] );
+			added++;
+		}
+	}
+	return added;
+}
+
+size_t MergedLogReader::fileCount()
+{
+	return m_sources.size();
+}
+
+bool MergedLogReader::matchPattern(const char* pattern, const char* name)
+{
+	// Walk both, remembering the last * so we can let it swallow one more character
+	// when the rest doesn't match.
+	const char* star = NULL;
+	const char* retry = NULL;
+	while(*name != '\0'){
+		if(*pattern == '*'){
+			star = pattern++;
+			retry = name;
+		} else if(*pattern == '?' || *pattern == *name){
+			pattern++;
+			name++;
+		} else if(star != NULL){
+			pattern = star + 1;
+			name = ++retry;
+		} else {
+			return false;
+		}
+	}
+	while(*pattern == '*'){
+		pattern++;
+	}
+	return *pattern == '\0';
+}
+
+LogMsg* MergedLogReader::next()
+{
+	if(!m_started){
+		start();
+	}
+	if(m_heap.size() == 0){
+		return NULL;
+	}
+
+	pop_heap( m_heap.begin(), m_heap.end(), HeapLater() );
+	size_t s = m_heap.back().source;
+	m_heap.pop_back();
+
+	MergedLogSource* src = m_sources[s];
+	LogMsg* ret = src->current[ src->pos ];
+	src->current[ src->pos ] = NULL;
+	src->pos++;
+	try {
+		if(src->pos < src->current.size()){
+			if(!src->nextQueued){
+				// The merge has reached this file - read its next batch while we use this one.
+				readAhead( s );
+			}
+			pushSource( s );
+		} else if(takeBatch( s, true )){
+			pushSource( s );
+		}
+	} catch (AnException&){
+		delete ret;
+		throw;
+	}
+	return ret;
+}
+
+void MergedLogReader::start()
+{
+	m_started = true;
+	if(m_sources.size() == 0){
+		return;
+	}
+
+	// Two batches per file have to fit in our budget.
+	m_batchSize = m_maxBuffered / (int)(m_sources.size() * 2);
+	if(m_batchSize > MERGEDLOG_MAX_BATCH) m_batchSize = MERGEDLOG_MAX_BATCH;
+	if(m_batchSize < 1) m_batchSize = 1;
+
+	// Every file gets its first fill queued before any worker starts.  Reading ahead
+	// waits until the merge reaches each file, so files we don't need yet can be closed.
+	lockQueue();
+	for(size_t i = 0; i < m_sources.size(); i++){
+		m_sources[i]->filling = true;
+		m_sources[i]->nextQueued = true;
+		m_jobs.push_back( i );
+	}
+	unlockQueue();
+
+	int workers = m_workerCount;
+	if(workers > (int)m_sources.size()){
+		workers = (int)m_sources.size();
+	}
+	for(int i = 0; i < workers; i++){
+		Thread* t = new Thread();
+		t->start( workerStart, this );
+		m_workers.push_back( t );
+	}
+
+	for(size_t i = 0; i < m_sources.size(); i++){
+		if(takeBatch( i, false )){
+			pushSource( i );
+		}
+	}
+}
+
+void MergedLogReader::stop()
+{
+	lockQueue();
+	m_stopping = true;
+	wakeQueue( &m_jobCond );
+	unlockQueue();
+	for(size_t i = 0; i < m_workers.size(); i++){
+		m_workers[i]->join();
+		delete m_workers[i];
+	}
+	m_workers.clear();
+}
+
+bool MergedLogReader::takeBatch(size_t s, bool readAhead)
+{
+	MergedLogSource* src = m_sources[s];
+	lockQueue();
+	if(!src->nextQueued && !src->done){
+		// Nobody has asked for this batch yet.
+		src->filling = true;
+		m_jobs.push_back( s );
+		wakeQueue( &m_jobCond );
+	}
+	while(src->filling){
+		waitQueue( &m_doneCond );
+	}
+	if(src->error.length() != 0){
+		twine err = src->error;
+		unlockQueue();
+		throw AnException(0, FL, "Error reading log file (%s): %s", src->fileName(), err() );
+	}
+
+	// Everything in current has been handed out - the caller owns those now.
+	src->current.swap( src->ready );
+	src->ready.clear();
+	src->pos = 0;
+	src->nextQueued = false;
+	if(readAhead && !src->done){
+		// Read ahead while this batch is merged.
+		src->filling = true;
+		src->nextQueued = true;
+		m_jobs.push_back( s );
+		wakeQueue( &m_jobCond );
+	}
+	unlockQueue();
+	return src->current.size() != 0;
+}
+
+void MergedLogReader::readAhead(size_t s)
+{
+	MergedLogSource* src = m_sources[s];
+	lockQueue();
+	if(!src->nextQueued && !src->done){
+		src->filling = true;
+		m_jobs.push_back( s );
+		wakeQueue( &m_jobCond );
+	}
+	src->nextQueued = true;
+	unlockQueue();
+}
+
+void MergedLogReader::pushSource(size_t s)
+{
+	LogMsg* lm = m_sources[s]->current[ m_sources[s]->pos ];
+	HeapEntry e;
+#ifdef _WIN32
+	e.seconds = (long)lm->timestamp.time;
+	e.fraction = (long)lm->timestamp.millitm;
+#else
+	e.seconds = (long)lm->timestamp.tv_sec;
+	e.fraction = (long)lm->timestamp.tv_usec;
+#endif
+	e.source = s;
+	m_heap.push_back( e );
+	push_heap( m_heap.begin(), m_heap.end(), HeapLater() );
+}
+
+bool MergedLogReader::fill(MergedLogSource& src)
+{
+	bool exhausted = false;
+	try {
+		if(src.cursor == NULL && src.reader == NULL){
+			makeRoom( src );
+			openSource( src );
+		}
+		if(src.cursor != NULL){
+			while((int)src.ready.size() < m_batchSize){
+				LogMsg* lm = src.cursor->next();
+				if(lm == NULL){
+					exhausted = true;
+					break;
+				}
+				// The cursor may have read past this one - carry on from what we returned.
+				src.resumeID = lm->id;
+				src.ready.push_back( lm );
+			}
+		} else {
+			LogFileRecord rec;
+			while((int)src.ready.size() < m_batchSize){
+				if(!src.reader->next( rec )){
+					exhausted = true;
+					break;
+				}
+				if(matches( rec )){
+					src.ready.push_back( rec.toLogMsg() );
+				}
+			}
+		}
+	} catch (AnException& e){
+		src.error = e.Msg();
+		for(size_t i = 0; i < src.ready.size(); i++){
+			delete src.ready[i];
+		}
+		src.ready.clear();
+		exhausted = true;
+	}
+	if(exhausted){
+		// Give back the file handle (and any unpacked archive) as soon as we can.
+		closeSource( src );
+	}
+	return exhausted;
+}
+
+void MergedLogReader::openSource(MergedLogSource& src)
+{
+	twine path = src.fileName;
+	if(path.length() > 4 && strcmp( path() + path.length() - 4, ".zip" ) == 0){
+		// A rotated LogFile2.  Unpack it somewhere of our own and read that.
+		src.scratchDir = scratchDirName();
+		ZipFile::Extract( path, src.scratchDir );
+		path = firstFileUnder( src.scratchDir );
+		if(path.length() == 0){
+			throw AnException(0, FL, "Archive (%s) is empty.", src.fileName() );
+		}
+	}
+
+	// SQLite files start with a fixed header.  Anything else had better be a LogFile.
+	char head[16];
+	memset( head, 0, sizeof(head) );
+	FILE* fp = fopen( path(), "rb" );
+	if(fp == NULL){
+		throw AnException(0, FL, "Error opening log file (%s)", path() );
+	}
+	size_t got = fread( head, 1, sizeof(head), fp );
+	fclose( fp );
+
+	if(got == sizeof(head) && memcmp( head, "SQLite format 3", 16 ) == 0){
+		src.lf = new LogFile2( true, path );
+		LogFile2Storage storage;
+		storage.busyTimeout = 100;
+		storage.cacheSize = -MERGEDLOG_CACHE_KB;
+		src.lf->setStorage( storage );
+		LogFile2Filter filter = m_filter;
+		if(src.resume){
+			filter.afterID = src.resumeID;
+		}
+		src.cursor = src.lf->query( filter, m_batchSize );
+	} else {
+		src.reader = new LogFileReader( path );
+		if(src.resume){
+			src.reader->seekAfter( src.resumeID );
+		}
+	}
+}
+
+void MergedLogReader::makeRoom(MergedLogSource& src)
+{
+	lockQueue();
+	while(m_openCount >= m_maxOpen){
+		MergedLogSource* idle = NULL;
+		for(size_t i = 0; i < m_sources.size(); i++){
+			MergedLogSource* other = m_sources[i];
+			if(other->open && !other->reading && !other->closing &&
+				(idle == NULL || other->lastFill < idle->lastFill)
+			){
+				idle = other;
+			}
+		}
+		if(idle == NULL){
+			// Every open file is being read or closed - wait for one of them.
+			waitQueue( &m_doneCond );
+			continue;
+		}
+		// Workers leave a closing file alone until we are done with it.
+		idle->closing = true;
+		idle->open = false;
+		m_openCount--;
+		unlockQueue();
+		suspendSource( *idle );
+		lockQueue();
+		idle->closing = false;
+		wakeQueue( &m_doneCond );
+	}
+	src.open = true;
+	m_openCount++;
+	unlockQueue();
+}
+
+void MergedLogReader::suspendSource(MergedLogSource& src)
+{
+	if(src.reader != NULL){
+		src.resumeID = src.reader->lastID();
+	}
+	src.resume = true;
+	closeSource( src );
+}
+
+void MergedLogReader::closeSource(MergedLogSource& src)
+{
+	if(src.cursor != NULL){
+		delete src.cursor;
+		src.cursor = NULL;
+	}
+	if(src.lf != NULL){
+		delete src.lf;
+		src.lf = NULL;
+	}
+	if(src.reader != NULL){
+		delete src.reader;
+		src.reader = NULL;
+	}
+	if(src.scratchDir.length() != 0){
+		try {
+			File::RmDir( src.scratchDir );
+		} catch (AnException&){
+			// Leave it - it doesn't change what we read.
+		}
+		src.scratchDir = "";
+	}
+}
+
+bool MergedLogReader::matches(const LogFileRecord& rec)
+{
+	int channel = rec.channel();
+	if((m_filter.channels & LOGFILE2_ALL_CHANNELS) != LOGFILE2_ALL_CHANNELS){
+		if(channel < 0 || channel > 6 || (m_filter.channels & LOGFILE2_CHANNEL(channel)) == 0){
+			return false;
+		}
+	}
+	if(m_filter.since != 0 && rec.seconds() < m_filter.since){
+		return false;
+	}
+	if(m_filter.until != 0 && rec.seconds() > m_filter.until){
+		return false;
+	}
+	if(m_filter.appSession.length() != 0){
+		return false; // LogFile doesn't keep the appSession
+	}
+	if(m_filter.tid != 0 && rec.tid() != m_filter.tid){
+		return false;
+	}
+	if(m_filter.machineName.length() != 0 && !rec.machineName().contains( m_filter.machineName )){
+		return false;
+	}
+	if(m_filter.appName.length() != 0 && !rec.appName().contains( m_filter.appName )){
+		return false;
+	}
+	LogFileSpan msg = rec.msg();
+	if(m_filter.text.length() != 0 && !msg.contains( m_filter.text )){
+		return false;
+	}
+	if(m_terms.size() != 0){
+		if(m_filter.phrase && !containsNoCase( msg, m_filter.words )){
+			return false;
+		}
+		vector<twine> words;
+		LogFile2::tokenize( msg.str(), words, true );
+		for(size_t i = 0; i < m_terms.size(); i++){
+			if(!binary_search( words.begin(), words.end(), m_terms[i], LogFile2DictLess() )){
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void MergedLogReader::workerLoop()
+{
+	lockQueue();
+	while(true){
+		while(m_jobs.size() == 0 && !m_stopping){
+			waitQueue( &m_jobCond );
+		}
+		if(m_stopping){
+			break;
+		}
+		size_t s = m_jobs.front();
+		m_jobs.pop_front();
+		while(m_sources[s]->closing){
+			waitQueue( &m_doneCond );
+		}
+		m_sources[s]->lastFill = ++m_fillClock;
+		m_sources[s]->reading = true;
+		unlockQueue();
+
+		bool exhausted = fill( *m_sources[s] );
+
+		lockQueue();
+		if(exhausted && m_sources[s]->open){
+			m_sources[s]->open = false; // fill has closed it
+			m_openCount--;
+		}
+		m_sources[s]->done = exhausted;
+		m_sources[s]->reading = false;
+		m_sources[s]->filling = false;
+		wakeQueue( &m_doneCond );
+	}
+	unlockQueue();
+}
+
+void* MergedLogReader::workerStart(void* arg)
+{
+	MergedLogReader* mlr = (MergedLogReader*)arg;
+	mlr->workerLoop();
+	return NULL;
+}
+
+void MergedLogReader::lockQueue()
+{
+#ifdef _WIN32
+	EnterCriticalSection( &m_queueCS );
+#else
+	m_queueMutex->lock();
+#endif
+}
+
+void MergedLogReader::unlockQueue()
+{
+#ifdef _WIN32
+	LeaveCriticalSection( &m_queueCS );
+#else
+	m_queueMutex->unlock();
+#endif
+}
+
+#ifdef _WIN32
+void MergedLogReader::waitQueue(CONDITION_VARIABLE* cond)
+{
+	SleepConditionVariableCS( cond, &m_queueCS, INFINITE );
+}
+
+void MergedLogReader::wakeQueue(CONDITION_VARIABLE* cond)
+{
+	WakeAllConditionVariable( cond );
+}
+#else
+void MergedLogReader::waitQueue(pthread_cond_t* cond)
+{
+	pthread_cond_wait( cond, m_queueMutex->internalMutex() );
+}
+
+void MergedLogReader::wakeQueue(pthread_cond_t* cond)
+{
+	pthread_cond_broadcast( cond );
+}
+#endif
@@ -0,0 +1,289 @@
+#ifndef MERGEDLOGREADER_H
+#define MERGEDLOGREADER_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include <vector>
+#include <deque>
+using namespace std;
+
+#include "twine.h"
+#include "Mutex.h"
+#include "Thread.h"
+#include "LogMsg.h"
+#include "LogFile2.h"
+#include "LogFileReader.h"
+
+namespace SLib {
+
+/**
+  * One of the files a MergedLogReader reads.  The worker that is filling (or closing) it
+  * owns the file handles.  done, filling, reading, closing, open and lastFill are guarded by the
+  * reader's queue lock, and current, pos and nextQueued belong to the thread calling next().
+  */
+struct MergedLogSource {
+	/// The file we were given
+	twine fileName;
+
+	/// Where we unpacked it, if it is a zip archive: a directory of our own under the temp
+	/// directory.  Removed when we are done with it.
+	twine scratchDir;
+
+	/// How we read it: a LogFile2 and cursor, or a LogFileReader.  Opened on first fill.
+	LogFile2* lf;
+	LogFile2Cursor* cursor;
+	LogFileReader* reader;
+
+	/// Set if we closed the file part way through, and the id to carry on after
+	bool resume;
+	int resumeID;
+
+	/// Messages a worker has read, waiting to be swapped into current
+	vector<LogMsg*> ready;
+
+	/// Messages being merged, and the next one to hand out
+	vector<LogMsg*> current;
+	size_t pos;
+
+	/// A worker has (or is queued to fill) ready
+	bool filling;
+
+	/// A fill of the batch after current has been queued, or the file is done
+	bool nextQueued;
+
+	/// The file is open, and counts against our limit of open files
+	bool open;
+
+	/// A worker is reading the file right now (filling is also set while it waits in the queue)
+	bool reading;
+
+	/// A worker is closing the file to make room for another
+	bool closing;
+
+	/// When the file was last filled - the longest idle open file is closed first
+	unsigned long lastFill;
+
+	/// The file has nothing more for us - once ready is used up, we are finished with it
+	bool done;
+
+	/// Set if reading the file failed
+	twine error;
+
+	MergedLogSource() : lf(NULL), cursor(NULL), reader(NULL), resume(false), resumeID(0), pos(0),
+		filling(false), nextQueued(false), open(false), reading(false), closing(false), lastFill(0),
+		done(false) {}
+};
+
+/**
+  * Reads a set of log files - LogFile2 databases, the zip archives LogFile2 rotates
+  * them into, and binary LogFile files - as one stream of messages in timestamp order.
+  * <P>
+  * A small pool of worker threads runs the filter against each file and reads the
+  * matches a batch at a time.  Each file holds at most two batches (one being merged,
+  * one being read ahead), and the batch size shrinks as files are added so the total
+  * stays under maxBuffered messages.  The merge itself is a heap with one entry per file.
+  * <P>
+  * At most maxOpen files are open at once - each open LogFile2 has its own page cache,
+  * and each open zip archive is unpacked on disk.  To open one more, the file that has
+  * waited longest since its last batch is closed (and its archive removed), and is
+  * reopened where it left off when the merge needs its next batch.  Rotated files hardly
+  * overlap in time, so each is usually opened once or twice.  Files that all overlap
+  * with each other cost a reopen per batch once there are more than maxOpen of them.
+  * <P>
+  * LogFile2 files use the filter's SQL; LogFile files are checked in memory by the same
+  * rules: text and names case sensitive, words and phrases without regard to case.
+  * afterID is ignored - ids are only meaningful within one file.  Messages with the same
+  * timestamp come out in the order their files were added.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT MergedLogReader
+{
+	private:
+		/// copy constructor is private to prevent use
+		MergedLogReader(const MergedLogReader& c) {}
+
+		/// assignmet operator is private to prevent use
+		MergedLogReader& operator=(const MergedLogReader& c) { return *this;}
+
+	public:
+		/** Builds a reader for the given filter.  workers is the size of the thread pool,
+		  * maxBuffered caps the number of messages held in memory across all files, and
+		  * maxOpen caps the number of files open at once.  maxOpen is never less than workers.
+		  */
+		MergedLogReader(const LogFile2Filter& filter, int workers = 4, int maxBuffered = 20000,
+			int maxOpen = 16);
+
+		/// Standard destructor - stops the workers and removes any unpacked archives.
+		virtual ~MergedLogReader();
+
+		/// Adds one file.  Files can't be added once next() has been called.
+		void addFile(const twine& fileName);
+
+		/** Adds every file matching pattern, in name order.  * and ? are allowed in the
+		  * last component of the path.  Returns the number of files added.
+		  */
+		int addFiles(const twine& pattern);
+
+		/// Returns the number of files we are reading.
+		size_t fileCount();
+
+		/** Returns the next message in timestamp order, or NULL when every file has been
+		  * read.  The caller owns the returned message.  Throws if a file can't be read.
+		  */
+		LogMsg* next();
+
+		/// Returns true if name matches pattern, where * is any run and ? is any one character.
+		static bool matchPattern(const char* pattern, const char* name);
+
+	protected:
+
+		/// One entry in our merge heap: the timestamp of a file's next message.
+		struct HeapEntry {
+			long seconds;
+			long fraction;
+			size_t source;
+		};
+
+		/// Orders the heap so the oldest message (then the first file) is on top.
+		struct HeapLater {
+			bool operator()(const HeapEntry& a, const HeapEntry& b) const;
+		};
+
+		/// Starts the workers, waits for every file's first batch and builds the heap.
+		void start();
+
+		/// Stops and joins the workers.
+		void stop();
+
+		/** Waits for source s to finish its fill and swaps its batch into current.  If
+		  * readAhead is set the next fill is queued straight away; otherwise that waits for
+		  * the merge to reach this source.  Returns false when the source has nothing left.
+		  */
+		bool takeBatch(size_t s, bool readAhead);
+
+		/// Queues the fill of the batch after source s's current one, if it isn't already.
+		void readAhead(size_t s);
+
+		/// Pushes source s onto the heap, keyed by its next message.
+		void pushSource(size_t s);
+
+		/** Reads the next batch for src into its ready list.  Runs on a worker.  Returns true
+		  * when the file has nothing more for us.
+		  */
+		bool fill(MergedLogSource& src);
+
+		/// Opens source src, unpacking it first if it is a zip archive.
+		void openSource(MergedLogSource& src);
+
+		/** Counts src as open, first closing the longest idle open file if we are already
+		  * at our limit.  Runs on a worker.
+		  */
+		void makeRoom(MergedLogSource& src);
+
+		/// Closes source src part way through, remembering where to carry on.
+		void suspendSource(MergedLogSource& src);
+
+		/// Closes source src and removes anything we unpacked for it.
+		void closeSource(MergedLogSource& src);
+
+		/// Returns true if a LogFile record passes our filter.
+		bool matches(const LogFileRecord& rec);
+
+		/// The main loop of each worker thread.
+		void workerLoop();
+
+		/// The thread entry point for our workers.
+		static void* workerStart(void* arg);
+
+		/// Locks our queue.
+		void lockQueue();
+
+		/// Unlocks our queue.
+		void unlockQueue();
+
+		/// Waits on the given condition, or wakes everyone waiting on it.  Our queue must be locked.
+#ifdef _WIN32
+		void waitQueue(CONDITION_VARIABLE* cond);
+		void wakeQueue(CONDITION_VARIABLE* cond);
+#else
+		void waitQueue(pthread_cond_t* cond);
+		void wakeQueue(pthread_cond_t* cond);
+#endif
+
+		/// Our filter, and the words from it as LogFile2::tokenize found them
+		LogFile2Filter m_filter;
+		vector<twine> m_terms;
+
+		/// The number of workers, and our limits on buffered messages and open files
+		int m_workerCount;
+		int m_maxBuffered;
+		int m_maxOpen;
+
+		/// The number of files open, and a count of fills for ordering them
+		int m_openCount;
+		unsigned long m_fillClock;
+
+		/// The number of messages each fill reads
+		int m_batchSize;
+
+		/// Our files
+		vector<MergedLogSource*> m_sources;
+
+		/// Our merge heap
+		vector<HeapEntry> m_heap;
+
+		/// True once next() has started the workers
+		bool m_started;
+
+		/// Our worker threads
+		vector<Thread*> m_workers;
+
+		/// Sources waiting for a worker, and whether the workers should exit
+		deque<size_t> m_jobs;
+		bool m_stopping;
+
+		/// Guards m_jobs, m_stopping, m_openCount, m_fillClock and each source's flags
+#ifdef _WIN32
+		CRITICAL_SECTION m_queueCS;
+		CONDITION_VARIABLE m_jobCond;
+		CONDITION_VARIABLE m_doneCond;
+#else
+		Mutex* m_queueMutex;
+		pthread_cond_t m_jobCond;
+		pthread_cond_t m_doneCond;
+#endif
+};
+
+} // End Namespace SLib
+
+#endif // MERGEDLOGREADER_H Defined
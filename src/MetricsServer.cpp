@@ -0,0 +1,469 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+#include <map>
+#include <string>
+
+#include "MetricsServer.h"
+#include "AnException.h"
+#include "EnEx.h"
+#include "Log.h"
+#include "Lock.h"
+using namespace SLib;
+
+/// How long the listener waits for a connection before checking whether to stop, in ms
+static const int METRICS_LISTEN_MS = 250;
+
+/// How long we wait on a client to send its request, in ms
+static const int METRICS_READ_MS = 2000;
+
+/// The largest request we read.  Anything past this is ignored.
+static const int METRICS_MAX_REQUEST = 8192;
+
+/// The Log channels, in channel number order
+static const char* metricsChannels[] = { "panic", "error", "warn", "info", "debug", "trace", "sqltrace" };
+static const int METRICS_CHANNELS = 7;
+
+/// The quantiles we publish for each EnEx profile
+static const double metricsQuantiles[] = { 50, 90, 99, 99.9 };
+static const char* metricsQuantileNames[] = { "0.5", "0.9", "0.99", "0.999" };
+static const char* metricsQuantileKeys[] = { "p50Nanos", "p90Nanos", "p99Nanos", "p999Nanos" };
+static const int METRICS_QUANTILES = 4;
+
+/// Adds a Prometheus label value, escaped.
+static void labelEscape(twine& output, const char* value)
+{
+	for(const char* c = value; *c != '\0'; c++){
+		if(*c == '"' || *c == '\\'){
+			output += '\\';
+			output += *c;
+		} else if(*c == '\n'){
+			output += "\\n";
+		} else {
+			output += *c;
+		}
+	}
+}
+
+/// Adds a JSON string body, escaped.
+static void jsonEscape(twine& output, const char* value)
+{
+	for(const char* c = value; *c != '\0'; c++){
+		if(*c == '"' || *c == '\\'){
+			output += '\\';
+			output += *c;
+		} else if((unsigned char)*c < 0x20){
+			output += ' ';
+		} else {
+			output += *c;
+		}
+	}
+}
+
+/// Adds a number the way both formats want it - integers without a fraction.
+static void appendNumber(twine& output, double value)
+{
+	twine tmp;
+	tmp.format("%.15g", value);
+	output += tmp;
+}
+
+/// Adds the # HELP and # TYPE lines for a metric.
+static void appendHeader(twine& output, const char* name, const char* help, const char* type)
+{
+	output.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	output.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+/// Adds one sample line: name{label="value"} number
+static void appendSample(twine& output, const char* name, const char* label, const char* value,
+	double number)
+{
+	output.append(name);
+	if(label != NULL){
+		output.append("{").append(label).append("=\"");
+		labelEscape(output, value);
+		output.append("\"}");
+	}
+	output += ' ';
+	appendNumber(output, number);
+	output += '\n';
+}
+
+/** Takes an EnEx snapshot and adds the profiles up by method name.  The same name can show
+    up under more than one pointer when it is used from different compilation units.
+*/
+static void readProfiles(map<string, EnExProfile*>& profiles)
+{
+	EnExSnapshot snap;
+	snap.Take();
+	map<const char*, EnExProfile*>& global = snap.Global();
+	map<const char*, EnExProfile*>::iterator it;
+	for(it = global.begin(); it != global.end(); it++){
+		EnExProfile*& sum = profiles[ it->first ];
+		if(sum == NULL){
+			sum = new EnExProfile(it->first);
+			sum->Reset();
+		}
+		sum->Add( *it->second );
+	}
+}
+
+/// Frees what readProfiles built.
+static void freeProfiles(map<string, EnExProfile*>& profiles)
+{
+	map<string, EnExProfile*>::iterator it;
+	for(it = profiles.begin(); it != profiles.end(); it++){
+		delete it->second;
+	}
+	profiles.clear();
+}
+
+MetricsServer::MetricsServer(int port, const char* bindAddress)
+{
+	m_requestedPort = port;
+	m_port = 0;
+	if(bindAddress != NULL){
+		m_bindAddress = bindAddress;
+	}
+	m_listener = NULL;
+	m_thread = NULL;
+	m_stop = false;
+	m_mutex = new Mutex();
+}
+
+MetricsServer::~MetricsServer()
+{
+	Stop();
+	delete m_mutex;
+}
+
+void MetricsServer::Start(void)
+{
+	if(m_thread != NULL){
+		return; // already running
+	}
+	m_listener = new Socket(m_requestedPort, false,
+		m_bindAddress.length() == 0 ? NULL : (char*)m_bindAddress());
+	m_port = m_listener->GetLocalPort();
+
+	// Listen once with no wait, so the port takes connections as soon as we return.
+	m_listener->Listen(0);
+
+	m_stop = false;
+	m_thread = new Thread();
+	m_thread->start( listenStart, this );
+}
+
+void MetricsServer::Stop(void)
+{
+	if(m_thread == NULL){
+		return;
+	}
+	m_stop = true;
+	m_thread->join();
+	delete m_thread;
+	m_thread = NULL;
+
+	delete m_listener;
+	m_listener = NULL;
+	m_port = 0;
+}
+
+unsigned short MetricsServer::Port(void)
+{
+	return m_port;
+}
+
+void MetricsServer::AddGauge(const twine& name, const twine& help, const twine& labelName,
+	const twine& labelValue, MetricsGaugeFunc func, void* arg, bool counter)
+{
+	MetricsGauge g;
+	g.name = name;
+	g.help = help;
+	g.labelName = labelName;
+	g.labelValue = labelValue;
+	g.counter = counter;
+	g.func = func;
+	g.arg = arg;
+
+	Lock theLock(m_mutex);
+	m_gauges.push_back( g );
+}
+
+vector<MetricsGauge> MetricsServer::gauges(void)
+{
+	Lock theLock(m_mutex);
+	return m_gauges;
+}
+
+void MetricsServer::GetText(twine& output)
+{
+	map<string, EnExProfile*> profiles;
+	readProfiles(profiles);
+	map<string, EnExProfile*>::iterator it;
+
+	appendHeader(output, "slib_enex_calls_total", "Calls into each EnEx scope.", "counter");
+	for(it = profiles.begin(); it != profiles.end(); it++){
+		appendSample(output, "slib_enex_calls_total", "method", it->first.c_str(),
+			(double)it->second->Hits());
+	}
+
+	appendHeader(output, "slib_enex_duration_seconds", "Time spent in each EnEx scope.", "summary");
+	for(it = profiles.begin(); it != profiles.end(); it++){
+		for(int q = 0; q < METRICS_QUANTILES; q++){
+			output.append("slib_enex_duration_seconds{method=\"");
+			labelEscape(output, it->first.c_str());
+			output.append("\",quantile=\"").append(metricsQuantileNames[q]).append("\"} ");
+			appendNumber(output, it->second->Percentile(metricsQuantiles[q]) / 1e9);
+			output += '\n';
+		}
+		appendSample(output, "slib_enex_duration_seconds_sum", "method", it->first.c_str(),
+			it->second->TotalTime() / 1e9);
+		appendSample(output, "slib_enex_duration_seconds_count", "method", it->first.c_str(),
+			(double)it->second->Histogram().Count());
+	}
+
+	appendHeader(output, "slib_enex_cpu_seconds_total",
+		"Thread cpu time used by EnEx scopes selected with EnableCpuTime.", "counter");
+	for(it = profiles.begin(); it != profiles.end(); it++){
+		appendSample(output, "slib_enex_cpu_seconds_total", "method", it->first.c_str(),
+			it->second->CpuTime() / 1e9);
+	}
+
+	appendHeader(output, "slib_enex_offcpu_seconds_total",
+		"Wall time EnEx scopes selected with EnableCpuTime spent off the cpu.", "counter");
+	for(it = profiles.begin(); it != profiles.end(); it++){
+		appendSample(output, "slib_enex_offcpu_seconds_total", "method", it->first.c_str(),
+			it->second->OffCpuTime() / 1e9);
+	}
+
+	appendHeader(output, "slib_enex_allocations_total",
+		"Allocations made inside each EnEx scope, when allocation tracking is on.", "counter");
+	for(it = profiles.begin(); it != profiles.end(); it++){
+		appendSample(output, "slib_enex_allocations_total", "method", it->first.c_str(),
+			(double)it->second->Allocations());
+	}
+
+	appendHeader(output, "slib_enex_allocated_bytes_total",
+		"Bytes allocated inside each EnEx scope, when allocation tracking is on.", "counter");
+	for(it = profiles.begin(); it != profiles.end(); it++){
+		appendSample(output, "slib_enex_allocated_bytes_total", "method", it->first.c_str(),
+			(double)it->second->AllocatedBytes());
+	}
+	freeProfiles(profiles);
+
+	appendHeader(output, "slib_log_messages_total", "Messages logged to each Log channel.", "counter");
+	for(int i = 0; i < METRICS_CHANNELS; i++){
+		appendSample(output, "slib_log_messages_total", "channel", metricsChannels[i],
+			(double)Log::MessageCount(i));
+	}
+
+	// Gauges that share a name go under one header.
+	vector<MetricsGauge> all = gauges();
+	vector<bool> done(all.size(), false);
+	for(size_t i = 0; i < all.size(); i++){
+		if(done[i]){
+			continue;
+		}
+		appendHeader(output, all[i].name(), all[i].help(), all[i].counter ? "counter" : "gauge");
+		for(size_t j = i; j < all.size(); j++){
+			if(done[j] || all[j].name != all[i].name){
+				continue;
+			}
+			done[j] = true;
+			appendSample(output, all[j].name(),
+				all[j].labelName.length() == 0 ? NULL : all[j].labelName(),
+				all[j].labelValue(), all[j].func(all[j].arg));
+		}
+	}
+}
+
+void MetricsServer::GetJson(twine& output)
+{
+	map<string, EnExProfile*> profiles;
+	readProfiles(profiles);
+	map<string, EnExProfile*>::iterator it;
+
+	output += "{\"enex\":[";
+	for(it = profiles.begin(); it != profiles.end(); it++){
+		EnExProfile* p = it->second;
+		if(it != profiles.begin()){
+			output += ',';
+		}
+		output += "\n{\"method\":\"";
+		jsonEscape(output, it->first.c_str());
+		output += "\",\"hits\":";
+		appendNumber(output, (double)p->Hits());
+		output += ",\"totalNanos\":";
+		appendNumber(output, p->TotalTime());
+		output += ",\"minNanos\":";
+		appendNumber(output, p->MinTime());
+		output += ",\"maxNanos\":";
+		appendNumber(output, p->MaxTime());
+		for(int q = 0; q < METRICS_QUANTILES; q++){
+			output.append(",\"").append(metricsQuantileKeys[q]).append("\":");
+			appendNumber(output, p->Percentile(metricsQuantiles[q]));
+		}
+		output += ",\"cpuNanos\":";
+		appendNumber(output, p->CpuTime());
+		output += ",\"offCpuNanos\":";
+		appendNumber(output, p->OffCpuTime());
+		output += ",\"allocations\":";
+		appendNumber(output, (double)p->Allocations());
+		output += ",\"allocatedBytes\":";
+		appendNumber(output, (double)p->AllocatedBytes());
+		output += '}';
+	}
+	freeProfiles(profiles);
+
+	output += "],\n\"log\":{";
+	for(int i = 0; i < METRICS_CHANNELS; i++){
+		if(i != 0){
+			output += ',';
+		}
+		output.append("\"").append(metricsChannels[i]).append("\":");
+		appendNumber(output, (double)Log::MessageCount(i));
+	}
+
+	output += "},\n\"gauges\":[";
+	vector<MetricsGauge> all = gauges();
+	for(size_t i = 0; i < all.size(); i++){
+		if(i != 0){
+			output += ',';
+		}
+		output += "\n{\"name\":\"";
+		jsonEscape(output, all[i].name());
+		output += '"';
+		if(all[i].labelName.length() != 0){
+			output += ",\"";
+			jsonEscape(output, all[i].labelName());
+			output += "\":\"";
+			jsonEscape(output, all[i].labelValue());
+			output += '"';
+		}
+		output += ",\"value\":";
+		appendNumber(output, all[i].func(all[i].arg));
+		output += '}';
+	}
+	output += "]}\n";
+}
+
+void MetricsServer::handle(GSocket* conn)
+{
+	// Read up to the end of the headers.  We don't take a body.
+	char request[ METRICS_MAX_REQUEST + 1 ];
+	int length = 0;
+	while(length < METRICS_MAX_REQUEST){
+		int got = conn->TimedGetRawData(request + length, METRICS_MAX_REQUEST - length, METRICS_READ_MS);
+		if(got <= 0){
+			break; // they closed their side
+		}
+		length += got;
+		request[length] = '\0';
+		if(strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL){
+			break;
+		}
+	}
+	request[length] = '\0';
+
+	// The request line: METHOD /path?query HTTP/1.x
+	char method[16] = "";
+	char target[1024] = "";
+	sscanf(request, "%15s %1023s", method, target);
+	twine path(target);
+	twine query;
+	size_t idx = path.find('?');
+	if(idx != TWINE_NOT_FOUND){
+		query = path.substr(idx + 1);
+		path = path.substr(0, idx);
+	}
+
+	twine status = "200 OK";
+	twine contentType;
+	twine body;
+	bool head = strcmp(method, "HEAD") == 0;
+	if(strcmp(method, "GET") != 0 && !head){
+		status = "405 Method Not Allowed";
+		contentType = "text/plain";
+		body = "Only GET and HEAD are supported.\n";
+	} else if(path == "/metrics.json" || (path == "/metrics" && query.find("format=json") != TWINE_NOT_FOUND)){
+		contentType = "application/json";
+		GetJson(body);
+	} else if(path == "/metrics"){
+		contentType = "text/plain; version=0.0.4; charset=utf-8";
+		GetText(body);
+	} else {
+		status = "404 Not Found";
+		contentType = "text/plain";
+		body = "Try /metrics or /metrics.json\n";
+	}
+
+	twine response;
+	response.format("HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+		status(), contentType(), (int)body.length());
+	if(!head){
+		response += body;
+	}
+	conn->SendData(response);
+}
+
+void MetricsServer::listenLoop(void)
+{
+#ifndef _WIN32
+	// A scraper that hangs up early shouldn't take the process down - let the write fail.
+	sigset_t pipe;
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe, NULL);
+#endif
+
+	while(!m_stop){
+		GSocket* conn = NULL;
+		try {
+			conn = m_listener->Listen( METRICS_LISTEN_MS );
+		} catch (AnException& e){
+			WARN(FL, "MetricsServer: error accepting a connection: %s", e.Msg());
+			continue;
+		}
+		if(conn == NULL){
+			continue;
+		}
+		try {
+			handle(conn);
+		} catch (AnException& e){
+			WARN(FL, "MetricsServer: error answering a request: %s", e.Msg());
+		}
+		delete conn;
+	}
+}
+
+void* MetricsServer::listenStart(void* arg)
+{
+	MetricsServer* ms = (MetricsServer*)arg;
+	ms->listenLoop();
+	return NULL;
+}
@@ -0,0 +1,181 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <vector>
+using namespace std;
+
+#include "twine.h"
+#include "Mutex.h"
+#include "Thread.h"
+#include "Socket.h"
+#include "LogFile2.h"
+
+namespace SLib {
+
+/// Reads the current value of a gauge registered with MetricsServer::AddGauge.
+typedef double (*MetricsGaugeFunc)(void* arg);
+
+/**
+  * One value a MetricsServer publishes alongside the EnEx and Log numbers.  It is read
+  * through func every time we are scraped.
+  */
+struct MetricsGauge {
+	/// The metric name, and its help text
+	twine name;
+	twine help;
+
+	/// The one label that tells this gauge apart from others with the same name
+	twine labelName;
+	twine labelValue;
+
+	/// True if the value only ever goes up
+	bool counter;
+
+	/// Reads the value
+	MetricsGaugeFunc func;
+	void* arg;
+};
+
+/**
+  * A small HTTP server that publishes our instrumentation for monitoring systems to
+  * collect.  One listener thread answers requests one at a time:
+  * <ul>
+  *   <li>GET /metrics - Prometheus text format, version 0.0.4</li>
+  *   <li>GET /metrics.json (or /metrics?format=json) - the same numbers as JSON</li>
+  * </ul>
+  * Each scrape publishes every EnEx profile (calls, a duration summary with the p50 to
+  * p99.9 quantiles, cpu and off-cpu time, allocations), the number of messages logged to
+  * each Log channel, and any gauges registered with AddGauge, AddLogFile or AddPool.
+  * <P>
+  * Nothing here slows down the code being measured.  EnEx numbers are read with
+  * EnExSnapshot, which never makes a profiled thread wait, the Log and LogFile2 counters
+  * are read without locks, and a pool is only locked long enough to count it.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT MetricsServer
+{
+	private:
+		/// copy constructor is private to prevent use
+		MetricsServer(const MetricsServer& c) {}
+
+		/// assignmet operator is private to prevent use
+		MetricsServer& operator=(const MetricsServer& c) { return *this;}
+
+	public:
+		/** Builds a server for the given port.  Port 0 picks a free one - ask Port() which.
+		  * bindAddress limits us to one interface ("127.0.0.1" keeps us on this machine);
+		  * NULL listens on all of them.  Nothing is served until Start().
+		  */
+		MetricsServer(int port = 0, const char* bindAddress = NULL);
+
+		/// Standard destructor - stops the server.
+		virtual ~MetricsServer();
+
+		/// Opens our port and starts the listener thread.  Throws if the port can't be opened.
+		void Start(void);
+
+		/// Stops the listener thread and closes our port.  Takes up to a quarter second.
+		void Stop(void);
+
+		/// Returns the port we are listening on, or 0 if we haven't been started.
+		unsigned short Port(void);
+
+		/** Publishes a value read by calling func(arg) on each scrape.  Gauges that share a
+		  * name are reported together, told apart by their label.  Set counter if the value
+		  * only ever goes up.  func is called on our listener thread - it must be safe to
+		  * call from there for as long as we are running.
+		  */
+		void AddGauge(const twine& name, const twine& help, const twine& labelName,
+			const twine& labelValue, MetricsGaugeFunc func, void* arg, bool counter = false);
+
+		/// Publishes a LogFile2's cache depth and written message count, labelled file=label.
+		void AddLogFile(const twine& label, LogFile2* lf) {
+			AddGauge("slib_logfile2_cache_depth", "Messages waiting in a LogFile2 cache to be written.",
+				"file", label, &logFileDepth, lf);
+			AddGauge("slib_logfile2_messages_written_total", "Messages a LogFile2 has written.",
+				"file", label, &logFileWritten, lf, true);
+		}
+
+		/// Publishes a Pool's size and the number of its objects in use, labelled pool=label.
+		template <class P> void AddPool(const twine& label, P& pool) {
+			AddGauge("slib_pool_objects", "Objects held by a pool.", "pool", label, &poolSize<P>, &pool);
+			AddGauge("slib_pool_in_use", "Pooled objects handed out and not yet released.",
+				"pool", label, &poolInUse<P>, &pool);
+		}
+
+		/// Writes everything we publish in Prometheus text format.
+		void GetText(twine& output);
+
+		/// Writes everything we publish as JSON.
+		void GetJson(twine& output);
+
+	protected:
+
+		/// Reads a LogFile2 for AddLogFile.
+		static double logFileDepth(void* lf) { return (double)((LogFile2*)lf)->cacheDepth(); }
+		static double logFileWritten(void* lf) { return (double)((LogFile2*)lf)->messagesWritten(); }
+
+		/// Reads a Pool for AddPool.
+		template <class P> static double poolSize(void* pool) { return ((P*)pool)->GetPoolSize(); }
+		template <class P> static double poolInUse(void* pool) { return ((P*)pool)->GetInUseSize(); }
+
+		/// Reads a request from conn and answers it.
+		void handle(GSocket* conn);
+
+		/// The main loop of our listener thread.
+		void listenLoop(void);
+
+		/// The thread entry point for our listener.
+		static void* listenStart(void* arg);
+
+		/// Copies our gauges, so their values can be read without holding our lock.
+		vector<MetricsGauge> gauges(void);
+
+		/// The port we were asked for, and the one we got
+		int m_requestedPort;
+		unsigned short m_port;
+
+		/// The interface to listen on, or empty for all of them
+		twine m_bindAddress;
+
+		/// Our listening socket
+		Socket* m_listener;
+
+		/// Our listener thread, and whether it should exit
+		Thread* m_thread;
+		volatile bool m_stop;
+
+		/// Our gauges, and the lock that guards them
+		vector<MetricsGauge> m_gauges;
+		Mutex* m_mutex;
+};
+
+} // End Namespace SLib
+
+#endif // METRICSSERVER_H Defined
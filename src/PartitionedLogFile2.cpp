@@ -0,0 +1,392 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "PartitionedLogFile2.h"
+#include "AnException.h"
+#include "File.h"
+#include "Lock.h"
+using namespace SLib;
+
+PartitionedLogFile2::PartitionedLogFile2(const twine& baseName, int bucketSeconds, int keepPartitions)
+{
+	if(bucketSeconds != LOGFILE2_PARTITION_HOUR && bucketSeconds != LOGFILE2_PARTITION_DAY){
+		throw AnException(0, FL, "PartitionedLogFile2 buckets must be an hour or a day (%d).", bucketSeconds);
+	}
+	m_mutex = new Mutex();
+	m_baseName = baseName;
+	m_bucketSeconds = bucketSeconds;
+	m_keepPartitions = keepPartitions;
+	m_cacheSize = 0;
+	m_current = NULL;
+	m_currentBucket = 0;
+
+	loadManifest();
+}
+
+PartitionedLogFile2::~PartitionedLogFile2()
+{
+	close();
+	delete m_mutex;
+}
+
+time_t PartitionedLogFile2::bucketFor(time_t when)
+{
+	return when - (when % m_bucketSeconds);
+}
+
+void PartitionedLogFile2::writeMsg(LogMsg& msg)
+{
+	Lock theLock(m_mutex);
+	routeTo( msg );
+	m_current->writeMsg( msg );
+}
+
+void PartitionedLogFile2::writeMsgBatch(vector<LogMsg*>* messages)
+{
+	Lock theLock(m_mutex);
+
+	// Hand the messages over in runs that share a partition.
+	vector<LogMsg*> run;
+	try {
+		for(size_t i = 0; i < messages->size(); i++){
+			LogMsg* lm = messages->at( i );
+#ifdef _WIN32
+			time_t bucket = bucketFor( lm->timestamp.time );
+#else
+			time_t bucket = bucketFor( lm->timestamp.tv_sec );
+#endif
+			if(m_current != NULL && bucket > m_currentBucket && run.size() != 0){
+				m_current->writeMsgBatch( &run ); // before routeTo moves us along
+			}
+			routeTo( *lm );
+			run.push_back( lm );
+			messages->at( i ) = NULL;
+		}
+		if(run.size() != 0){
+			m_current->writeMsgBatch( &run );
+		}
+		messages->clear();
+	} catch (AnException& e){
+		// We own these now - don't leak them.
+		for(size_t i = 0; i < run.size(); i++){
+			delete run[i];
+		}
+		for(size_t i = 0; i < messages->size(); i++){
+			delete messages->at( i );
+		}
+		messages->clear();
+		throw e;
+	}
+}
+
+void PartitionedLogFile2::flush()
+{
+	Lock theLock(m_mutex);
+	if(m_current != NULL){
+		m_current->flush();
+	}
+}
+
+void PartitionedLogFile2::close()
+{
+	Lock theLock(m_mutex);
+	if(m_current != NULL){
+		delete m_current; // flushes and closes
+		m_current = NULL;
+		m_currentBucket = 0;
+	}
+}
+
+void PartitionedLogFile2::setStorage(const LogFile2Storage& storage)
+{
+	Lock theLock(m_mutex);
+	m_storage = storage;
+	if(m_current != NULL){
+		m_current->setStorage( m_storage );
+	}
+}
+
+void PartitionedLogFile2::setCacheSize(size_t cacheSize)
+{
+	Lock theLock(m_mutex);
+	m_cacheSize = cacheSize;
+	if(m_current != NULL){
+		m_current->setCacheSize( m_cacheSize );
+	}
+}
+
+void PartitionedLogFile2::setRetention(int keepPartitions)
+{
+	Lock theLock(m_mutex);
+	m_keepPartitions = keepPartitions;
+	applyRetention();
+}
+
+void PartitionedLogFile2::applyRetention()
+{
+	if(m_keepPartitions <= 0 || m_manifest.size() == 0){
+		return;
+	}
+
+	// Count back from the newest bucket we know about.
+	time_t newest = m_manifest[ m_manifest.size() - 1 ].end - m_bucketSeconds;
+	if(m_currentBucket > newest){
+		newest = m_currentBucket;
+	}
+	time_t cutoff = newest - (time_t)(m_keepPartitions - 1) * m_bucketSeconds;
+
+	bool changed = false;
+	for(size_t i = 0; i < m_manifest.size(); ){
+		LogPartition& p = m_manifest[i];
+		if(p.end > cutoff || (m_current != NULL && p.end == m_currentBucket + m_bucketSeconds)){
+			i++;
+			continue;
+		}
+		// Dropping a whole partition is just deleting its files.
+		if(File::Exists( p.fileName )){
+			File::Delete( p.fileName );
+		}
+		if(File::Exists( p.fileName + "-wal" )){
+			File::Delete( p.fileName + "-wal" );
+		}
+		if(File::Exists( p.fileName + "-shm" )){
+			File::Delete( p.fileName + "-shm" );
+		}
+		m_manifest.erase( m_manifest.begin() + i );
+		changed = true;
+	}
+	if(changed){
+		saveManifest();
+	}
+}
+
+vector<LogPartition> PartitionedLogFile2::partitions()
+{
+	Lock theLock(m_mutex);
+	return m_manifest;
+}
+
+vector<LogPartition> PartitionedLogFile2::partitionsFor(time_t since, time_t until)
+{
+	Lock theLock(m_mutex);
+	vector<LogPartition> ret;
+	for(size_t i = 0; i < m_manifest.size(); i++){
+		LogPartition& p = m_manifest[i];
+		if(since != 0 && p.end <= since){
+			continue; // ends before the range starts
+		}
+		if(until != 0 && p.start > until){
+			continue; // starts after the range ends
+		}
+		ret.push_back( p );
+	}
+	return ret;
+}
+
+void PartitionedLogFile2::routeTo(LogMsg& msg)
+{
+#ifdef _WIN32
+	time_t when = msg.timestamp.time;
+#else
+	time_t when = msg.timestamp.tv_sec;
+#endif
+	time_t bucket = bucketFor( when );
+
+	if(m_current != NULL && bucket <= m_currentBucket){
+		if(bucket < m_currentBucket){
+			// A late message - it goes in the current partition, so widen its range.  That
+			// isn't necessarily the newest one, if we were reopened on an older bucket.
+			for(size_t i = 0; i < m_manifest.size(); i++){
+				LogPartition& p = m_manifest[i];
+				if(p.end == m_currentBucket + m_bucketSeconds){
+					if(when < p.start){
+						p.start = when;
+						saveManifest();
+					}
+					break;
+				}
+			}
+		}
+		return;
+	}
+
+	// Moving on to a new bucket.
+	if(m_current != NULL){
+		delete m_current;
+		m_current = NULL;
+	}
+
+	// Reopen the partition if we already have one for this bucket.
+	int found = -1;
+	for(size_t i = 0; i < m_manifest.size(); i++){
+		if(m_manifest[i].end == bucket + m_bucketSeconds){
+			found = (int)i;
+		}
+	}
+	if(found < 0){
+		LogPartition p;
+		p.start = when;
+		p.end = bucket + m_bucketSeconds;
+
+		char stamp[32];
+		struct tm tmBucket;
+#ifdef _WIN32
+		gmtime_s( &tmBucket, &bucket );
+#else
+		gmtime_r( &bucket, &tmBucket );
+#endif
+		strftime( stamp, sizeof(stamp),
+			m_bucketSeconds == LOGFILE2_PARTITION_HOUR ? "%Y%m%d%H" : "%Y%m%d", &tmBucket );
+		p.fileName = m_baseName + "." + stamp;
+
+		// Keep the manifest oldest first, even when we re-create a bucket that retention
+		// already dropped.
+		found = (int)m_manifest.size();
+		while(found > 0 && m_manifest[ found - 1 ].end > p.end){
+			found--;
+		}
+		m_manifest.insert( m_manifest.begin() + found, p );
+		saveManifest();
+	} else if(when < m_manifest[ found ].start){
+		m_manifest[ found ].start = when;
+		saveManifest();
+	}
+
+	// Partitions never size-rotate, so give LogFile2 a limit it won't reach.
+	m_current = new LogFile2( m_manifest[ found ].fileName, (size_t)-1 );
+	m_currentBucket = bucket;
+	m_current->setStorage( m_storage );
+	if(m_cacheSize != 0){
+		m_current->setCacheSize( m_cacheSize );
+	}
+
+	applyRetention();
+}
+
+void PartitionedLogFile2::loadManifest()
+{
+	m_manifest.clear();
+	twine manifestName = m_baseName + ".manifest";
+	if(!File::Exists( manifestName )){
+		return;
+	}
+
+	File manifest( manifestName );
+	vector<twine> lines = manifest.readLines();
+	for(size_t i = 0; i < lines.size(); i++){
+		long start = 0, end = 0;
+		int used = 0;
+		if(sscanf( lines[i](), "%ld %ld %n", &start, &end, &used ) < 2 || used == 0){
+			continue; // not one of ours
+		}
+		LogPartition p;
+		p.start = (time_t)start;
+		p.end = (time_t)end;
+		p.fileName = lines[i]() + used;
+		p.fileName.rtrim();
+		if(p.fileName.length() != 0){
+			m_manifest.push_back( p );
+		}
+	}
+}
+
+void PartitionedLogFile2::saveManifest()
+{
+	// Write the whole thing to a temp file, then rename it over the old one.  Readers
+	// always see either the old manifest or the new one.
+	twine contents;
+	for(size_t i = 0; i < m_manifest.size(); i++){
+		twine line; line.format( "%ld %ld %s\n", (long)m_manifest[i].start,
+			(long)m_manifest[i].end, m_manifest[i].fileName() );
+		contents.append( line );
+	}
+	twine manifestName = m_baseName + ".manifest";
+	twine tmpName = manifestName + ".tmp";
+	File::writeToFile( tmpName, contents );
+#ifdef _WIN32
+	remove( manifestName() ); // rename won't replace an existing file on windows
+#endif
+	if(rename( tmpName(), manifestName() ) != 0){
+		throw AnException(0, FL, "Error renaming %s to %s", tmpName(), manifestName() );
+	}
+}
+
+PartitionedLogFile2Cursor::PartitionedLogFile2Cursor(PartitionedLogFile2& plf,
+	const LogFile2Filter& filter, int pageSize)
+{
+	m_partitions = plf.partitionsFor( filter.since, filter.until );
+	m_index = 0;
+	m_filter = filter;
+	m_pageSize = pageSize;
+	m_lf = NULL;
+	m_cursor = NULL;
+}
+
+PartitionedLogFile2Cursor::~PartitionedLogFile2Cursor()
+{
+	closePartition();
+}
+
+size_t PartitionedLogFile2Cursor::partitionCount()
+{
+	return m_partitions.size();
+}
+
+void PartitionedLogFile2Cursor::closePartition()
+{
+	if(m_cursor != NULL){
+		delete m_cursor; // cursors go before the log file
+		m_cursor = NULL;
+	}
+	if(m_lf != NULL){
+		delete m_lf;
+		m_lf = NULL;
+	}
+}
+
+LogMsg* PartitionedLogFile2Cursor::next()
+{
+	while(true){
+		if(m_cursor == NULL){
+			if(m_index >= m_partitions.size()){
+				return NULL;
+			}
+			if(!File::Exists( m_partitions[ m_index ].fileName )){
+				m_index++; // dropped by retention since we started
+				continue;
+			}
+			m_lf = new LogFile2( true, m_partitions[ m_index ].fileName );
+			m_cursor = m_lf->query( m_filter, m_pageSize );
+		}
+
+		LogMsg* lm = m_cursor->next();
+		if(lm != NULL){
+			return lm;
+		}
+		if(m_index + 1 >= m_partitions.size()){
+			// Stay on the newest partition, so later calls pick up new messages.
+			return NULL;
+		}
+		closePartition();
+		m_index++;
+		m_filter.afterID = 0; // ids start over in every partition
+	}
+}
@@ -0,0 +1,222 @@
+#ifndef PARTITIONEDLOGFILE2_H
+#define PARTITIONEDLOGFILE2_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <time.h>
+
+#include <vector>
+using namespace std;
+
+#include "twine.h"
+#include "Mutex.h"
+#include "LogMsg.h"
+#include "LogFile2.h"
+
+namespace SLib {
+
+/// One partition file per hour
+#define LOGFILE2_PARTITION_HOUR 3600
+
+/// One partition file per day
+#define LOGFILE2_PARTITION_DAY 86400
+
+/**
+  * One entry in our manifest: a partition file and the time range it covers.
+  */
+struct DLLEXPORT LogPartition {
+	/// The earliest message timestamp in this partition (seconds since the epoch, UTC).
+	time_t start;
+
+	/// The end of this partition's bucket (exclusive).
+	time_t end;
+
+	/// The partition's file name
+	twine fileName;
+};
+
+/**
+  * This class splits a log into one LogFile2 per time bucket (an hour or a day).  A
+  * manifest file (baseName.manifest) lists the partitions and the time range each one
+  * covers.  Retention is handled by deleting whole partition files, so keeping "the last
+  * 7 days" never needs a DELETE or a VACUUM.  Queries only open the partitions that
+  * overlap the requested time range.
+  * <P>
+  * Partitions are never size-rotated - the time bucket is the unit of rotation.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT PartitionedLogFile2
+{
+	private:
+		/// copy constructor is private to prevent use
+		PartitionedLogFile2(const PartitionedLogFile2& c) {}
+
+		/// assignmet operator is private to prevent use
+		PartitionedLogFile2& operator=(const PartitionedLogFile2& c) { return *this;}
+
+	public:
+		/**
+		  * Opens (or starts) the partitioned log with the given base name.  Partition files
+		  * are named baseName.YYYYMMDD or baseName.YYYYMMDDHH.  keepPartitions is the number
+		  * of buckets to keep, counting back from the newest - 0 keeps everything.
+		  */
+		PartitionedLogFile2(const twine& baseName, int bucketSeconds = LOGFILE2_PARTITION_DAY,
+			int keepPartitions = 0);
+
+		/// Standard destructor
+		virtual ~PartitionedLogFile2();
+
+		/** Adds a message to the partition for its timestamp.  A message older than the
+		  * current partition (one that arrived late) is written to the current partition,
+		  * and the manifest is widened to cover it.
+		  */
+		void writeMsg(LogMsg& msg);
+
+		/// Adds a batch of messages.  Same ownership rules as LogFile2::writeMsgBatch.
+		void writeMsgBatch(vector<LogMsg*>* messages);
+
+		/// Writes anything cached in the current partition to disk.
+		void flush();
+
+		/// Closes the current partition.
+		void close();
+
+		/// Sets the storage profile used for every partition we open from now on.
+		void setStorage(const LogFile2Storage& storage);
+
+		/// Sets the cache size used for every partition we open from now on.
+		void setCacheSize(size_t cacheSize);
+
+		/// Changes how many buckets we keep, and applies it right away.
+		void setRetention(int keepPartitions);
+
+		/// Drops every partition older than our retention allows.
+		void applyRetention();
+
+		/// Returns a copy of our manifest, oldest partition first.
+		vector<LogPartition> partitions();
+
+		/// Returns the partitions that overlap the given time range.  0 means unbounded.
+		vector<LogPartition> partitionsFor(time_t since, time_t until);
+
+		/// Returns the bucket start for the given time.
+		time_t bucketFor(time_t when);
+
+	protected:
+
+		/// Reads our manifest from disk.
+		void loadManifest();
+
+		/// Writes our manifest to disk (to a temp file, then renamed into place).
+		void saveManifest();
+
+		/// Makes sure m_current is open on the partition for the given message.
+		void routeTo(LogMsg& msg);
+
+		/// Our mutex
+		Mutex* m_mutex;
+
+		/// The base name for our files
+		twine m_baseName;
+
+		/// The size of each bucket in seconds
+		int m_bucketSeconds;
+
+		/// The number of buckets we keep
+		int m_keepPartitions;
+
+		/// The storage profile for new partitions
+		LogFile2Storage m_storage;
+
+		/// The cache size for new partitions
+		size_t m_cacheSize;
+
+		/// Our manifest, oldest first
+		vector<LogPartition> m_manifest;
+
+		/// The partition we are writing to now
+		LogFile2* m_current;
+
+		/// The bucket start of m_current
+		time_t m_currentBucket;
+};
+
+/**
+  * A forward-only cursor that walks the partitions overlapping a filter's time range in
+  * order, running a LogFile2Cursor on each one.  Each partition is opened read-only while
+  * we are in it.  Message ids are only unique within a partition.
+  */
+class DLLEXPORT PartitionedLogFile2Cursor
+{
+	private:
+		/// copy constructor is private to prevent use
+		PartitionedLogFile2Cursor(const PartitionedLogFile2Cursor& c) {}
+
+		/// assignmet operator is private to prevent use
+		PartitionedLogFile2Cursor& operator=(const PartitionedLogFile2Cursor& c) { return *this;}
+
+	public:
+		/// Builds a cursor over the partitions of plf that overlap the filter.
+		PartitionedLogFile2Cursor(PartitionedLogFile2& plf, const LogFile2Filter& filter,
+			int pageSize = 500);
+
+		/// Standard destructor
+		virtual ~PartitionedLogFile2Cursor();
+
+		/** Returns the next matching message, or NULL if there are no more right now.
+		  * The caller owns the returned message.
+		  */
+		LogMsg* next();
+
+		/// Returns the number of partitions this cursor will visit.
+		size_t partitionCount();
+
+	protected:
+
+		/// Closes the partition we are in.
+		void closePartition();
+
+		/// The partitions we will visit
+		vector<LogPartition> m_partitions;
+
+		/// Which partition we are in
+		size_t m_index;
+
+		/// Our filter
+		LogFile2Filter m_filter;
+
+		/// Our page size
+		int m_pageSize;
+
+		/// The partition we are reading, and our cursor on it
+		LogFile2* m_lf;
+		LogFile2Cursor* m_cursor;
+};
+
+} // End Namespace SLib
+
+#endif // PARTITIONEDLOGFILE2_H Defined
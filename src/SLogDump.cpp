@@ -19,6 +19,8 @@
 #include "dptr.h"
 #include "Timer.h"
 #include "LogFile2.h"
+#include "FileWatch.h"
+#include "MergedLogReader.h"
 using namespace SLib;
 
 twine m_machineName;
@@ -26,6 +28,7 @@ twine m_appName;
 twine m_threadID;
 int matchThreadID;
 twine m_message;
+twine m_words;
 bool m_panic;
 bool m_error;
 bool m_warn;
@@ -50,11 +53,15 @@ void printUsage(char* appName)
 {
 	printf( "Usage: %s logFile <options>\n", appName);
 	printf(
+	"logFile may be a pattern like \"logs/viaserv.log*\" (quote it) to read every\n"
+	"matching file - rotated zip archives and LogFile files included - merged in time order.\n"
 	"Where options include the following:\n"
 	"\t-m MachineName Use this to filter on MachineName\n"
 	"\t-a AppName     Use this to filter on Application Name\n"
 	"\t-t ThreadID    Use this to filter on a thread ID\n"
-	"\t-s Message     Use this to filter on message text\n"
+	"\t-s Message     Use this to filter on message text (case sensitive)\n"
+	"\t-k Words       Use this to find messages with these whole words, in order, in any\n"
+	"\t               case.  If the log has a word index this doesn't scan the file.\n"
 	"\t-c*            Use this to include all log channels (default behaviour)\n"
 	"\t-c0            Use this to include the PANIC log channel\n"
 	"\t-c1            Use this to include the ERROR log channel\n"
@@ -76,7 +83,8 @@ void printUsage(char* appName)
 	"\t-d1            Shortcut for -di -dd -dt -dc\n"
 	"\t-b             Use this to display the string table\n"
 	"\t-x             Use this to export a dump of the message data directly\n"
-	"\t-w             Use this to Watch for new messages\n"
+	"\t-w             Use this to Watch for new messages.  Follows the log when it is\n"
+	"\t               rotated to a new file.\n"
 	"\n");
 }
 
@@ -103,6 +111,10 @@ void getArgs(int argc, char** argv)
 				i++;
 				m_message = argv[i];
 				continue;
+			} else if(argv[i][1] == 'k'){
+				i++;
+				m_words = argv[i];
+				continue;
 			} else if(argv[i][1] == 'w'){
 				m_watch_mode = true;
 			} else if(argv[i][1] == 'b'){
@@ -179,6 +191,34 @@ void getArgs(int argc, char** argv)
 	}
 }
 
+void printMessage(LogMsg* lm);
+
+LogFile2* openLog(const twine& logFileName)
+{
+	LogFile2* lf = new LogFile2(true, logFileName); // open in read-only mode
+
+	// Wait a little on a busy file rather than failing.  If the writer uses WAL mode
+	// we never hold it up - our reads come from a snapshot.
+	LogFile2Storage readerStorage;
+	readerStorage.busyTimeout = 100;
+	lf->setStorage( readerStorage );
+	return lf;
+}
+
+void printNew(LogFile2Cursor* cursor)
+{
+	try {
+		// The cursor picks up from the last message it returned.
+		while(true){
+			dptr<LogMsg> lm; lm = cursor->next();
+			if(lm == NULL) break;
+			printMessage( lm );
+		}
+	} catch (AnException&){
+		// These are because of database locking.  ignore them.
+	}
+}
+
 void printMessage(LogMsg* lm)
 {
 	char local_tmp[32];
@@ -221,72 +261,6 @@ void printMessage(LogMsg* lm)
 
 }
 
-void filterAndPrint(LogMsg* lm)
-{
-	bool filtersMatch = true;
-
-	if(filtersMatch && m_panic == false){
-		if(lm->channel == 0){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_error == false){
-		if(lm->channel == 1){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_warn == false){
-		if(lm->channel == 2){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_info == false){
-		if(lm->channel == 3){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_debug == false){
-		if(lm->channel == 4){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_trace == false){
-		if(lm->channel == 5){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_sqltrace == false){
-		if(lm->channel == 6){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_machineName.length() != 0){
-		if(lm->machineName.find( m_machineName ) == TWINE_NOT_FOUND){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_appName.length() != 0){
-		if(lm->appName.find( m_appName ) == TWINE_NOT_FOUND){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && matchThreadID != 0){
-		if((intptr_t)lm->tid != matchThreadID){
-			filtersMatch = false;
-		}
-	}
-	if(filtersMatch && m_message.length() != 0){
-		if(lm->msg.find( m_message ) == TWINE_NOT_FOUND){
-			filtersMatch = false;
-		}
-	}
-
-	if(filtersMatch){
-		printMessage(lm);
-	}
-
-}
-
 int main(int argc, char** argv)
 {
 	twine logFileName = "viaserv.log";
@@ -294,6 +268,7 @@ int main(int argc, char** argv)
 	m_appName = "";
 	m_threadID = "";
 	m_message = "";
+	m_words = "";
 	m_panic = m_error = m_warn = m_info = m_debug = m_trace = m_sqltrace = true;
 	m_display_id = m_display_date = m_display_machine = m_display_app = 
 		m_display_appsession = 
@@ -324,7 +299,8 @@ int main(int argc, char** argv)
 	if(m_machineName.length() != 0 ||
 		m_appName.length() != 0 ||
 		matchThreadID != 0 ||
-		m_message.length() != 0
+		m_message.length() != 0 ||
+		m_words.length() != 0
 	){
 		printf("Filtering on:\n");
 		if(m_machineName.length() != 0){
@@ -339,62 +315,119 @@ int main(int argc, char** argv)
 		if(m_message.length() != 0){
 			printf("Log Message contains: %s\n", m_message() );
 		}
+		if(m_words.length() != 0){
+			printf("Log Message has the words: %s\n", m_words() );
+		}
 	} else {
 		printf("No filtering applied.\n");
 	}
 
 	printf("=============================================\n");
 
+	// All of our filters go to the database, so we only read the rows we'll print.
+	LogFile2Filter filter;
+	filter.channels = 0;
+	if(m_panic) filter.channels |= LOGFILE2_CHANNEL(0);
+	if(m_error) filter.channels |= LOGFILE2_CHANNEL(1);
+	if(m_warn) filter.channels |= LOGFILE2_CHANNEL(2);
+	if(m_info) filter.channels |= LOGFILE2_CHANNEL(3);
+	if(m_debug) filter.channels |= LOGFILE2_CHANNEL(4);
+	if(m_trace) filter.channels |= LOGFILE2_CHANNEL(5);
+	if(m_sqltrace) filter.channels |= LOGFILE2_CHANNEL(6);
+	filter.tid = matchThreadID;
+	filter.machineName = m_machineName;
+	filter.appName = m_appName;
+	filter.text = m_message;
+	filter.words = m_words;
+	filter.phrase = true;
+
+	if(strchr( logFileName(), '*' ) != NULL || strchr( logFileName(), '?' ) != NULL){
+		if(m_watch_mode){
+			printf("-w can only watch a single log file.\n");
+			return 0;
+		}
+		try {
+			MergedLogReader mlr( filter );
+			if(mlr.addFiles( logFileName ) == 0){
+				printf("No log files match (%s)\n", logFileName() );
+				return 0;
+			}
+			while(true){
+				dptr<LogMsg> lm; lm = mlr.next();
+				if(lm == NULL) break;
+				printMessage( lm );
+			}
+		} catch (AnException& e){
+			printf("Exception caught reading log files (%s):\n%s\n", logFileName(),
+				e.Msg() );
+		}
+		return 0;
+	}
+
 	try {
 		//printf("Opening log file: %s\n", logFileName() );
 		//printf("=============================================\n");
-		LogFile2 lf(true, logFileName); // open in read-only mode
+		dptr<LogFile2> lf; lf = openLog( logFileName );
 
 		//printf("Dumping Index stats and String table:\n");
 		//printf("=============================================\n");
 		if(m_show_stringtable){
 		}
 
-		int oldest = lf.getOldestMessageID();
-		int newest = lf.getNewestMessageID();
-		if(m_watch_mode && ( (newest - oldest) > 20 )){
-			oldest = newest - 20; // only print the last 20 messages
-			if(oldest < 0){
-				oldest = 0;
+		if(m_watch_mode){
+			int newest = lf->getNewestMessageID();
+			filter.afterID = newest - 20; // only print the last 20 messages
+			if(filter.afterID < 0){
+				filter.afterID = 0;
 			}
 		}
-		//printf("Looping over messages %d to %d:\n", oldest, newest);
-		//printf("=============================================\n");
-		for(int i = oldest; i <= newest; i++){
-			//printf("Looking for message: %d\n", i);
-			dptr<LogMsg> lm; lm = lf.getMessage(i);
+
+		dptr<LogFile2Cursor> cursor; cursor = lf->query( filter );
+		while(true){
+			dptr<LogMsg> lm; lm = cursor->next();
 			if(lm == NULL) {
-				//printf("\tmessage %d not found!\n", i);
-				continue;
+				break;
 			}
-			filterAndPrint( lm );
-		}			
+			printMessage( lm );
+		}
 
 		if(m_dump_data){
 		}
 
-		if(m_watch_mode){ while(1){
-			Tools::msleep( 100 );
-			try {
-				int new_newest = lf.getNewestMessageID();
-				if(new_newest > newest){
-					for(int i = newest + 1; i <= new_newest; i++){
-						dptr<LogMsg> lm; lm = lf.getMessage(i);
-						if(lm == NULL) continue;
-						filterAndPrint( lm );
+		if(m_watch_mode){
+			// Sleep until the file (or its WAL) is written to, rather than asking the
+			// database every 100ms.  Where we can't get file system events FileWatch polls.
+			FileWatch watcher( logFileName );
+			bool reopen = false;
+			while(1){
+				int what = watcher.wait( 5000 );
+				if(what == FILEWATCH_REPLACED){
+					// Anything left in the file we were reading comes first - that's
+					// whatever was written just before the writer moved on.
+					if(cursor != NULL){
+						printNew( cursor );
 					}
-
-					newest = new_newest;
+					reopen = true;
+				} else if(what == FILEWATCH_TIMEOUT && !reopen){
+					continue;
 				}
-			} catch (AnException&){
-				// These are because of database locking.  ignore them.
+				if(reopen){
+					// The writer has moved on to a new file.  Start at its beginning.  It
+					// may not have its tables yet - if not we try again on the next wake up.
+					try {
+						cursor = (LogFile2Cursor*)NULL; // before the file it reads from
+						lf = (LogFile2*)NULL;
+						lf = openLog( logFileName );
+						filter.afterID = 0;
+						cursor = lf->query( filter );
+						reopen = false;
+					} catch (AnException&){
+						continue;
+					}
+				}
+				printNew( cursor );
 			}
-		} }
+		}
 
 	} catch (AnException& e){
 		printf("Exception caught opening log file (%s):\n%s\n", logFileName(),
@@ -24,7 +24,8 @@ using namespace SLib;
 
 Timer::Timer()
 {
-	// not much to do.
+	m_start_time = 0;
+	m_end_time = 0;
 }
 
 Timer::~Timer()
@@ -34,47 +35,26 @@ Timer::~Timer()
 
 void Timer::Start(void)
 {
-	ftime(&m_start_time);
+	m_start_time = Clock::Ticks();
 }
 
 void Timer::Finish(void)
 {
-	ftime(&m_end_time);
+	m_end_time = Clock::Ticks();
 }
 
 float Timer::Duration(void)
 {
-	double f1, f2, f3, f4, f5;
-
-	f1 = m_start_time.time;
-	f2 = m_start_time.millitm;
-	f2 /= 1000.0;
-
-	f3 = m_end_time.time;
-	f4 = m_end_time.millitm;
-	f4 /= 1000.0;
-
-	f5 = (f3+f4) - (f1+f2);
+	return (float)(Clock::Elapsed(m_start_time, m_end_time) / 1000000000.0);
+}
 
-	return (float)f5;
+uint64_t Timer::DurationNanos(void)
+{
+	return Clock::Elapsed(m_start_time, m_end_time);
 }
 
 uint64_t Timer::GetCycleCount(void)
 {
-#ifdef _WIN32
-	struct timeb tb;
-	uint64_t t1, t2;
-
-	ftime( &tb );
-
-	t1 = tb.time;
-	t2 = tb.millitm;
-	return t1 * 1000000 + t2 * 1000;
-#else
-	struct timeval tv;
-	gettimeofday( &tv, NULL);
-	return tv.tv_sec * 1000000 + tv.tv_usec;
-#endif
+	return Clock::Nanos() / 1000;
 }
 
-
@@ -1,7 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "EnEx.h"
+#include "Thread.h"
+#include "Timer.h"
+#include "XmlHelpers.h"
+#include "Tools.h"
 using namespace SLib;
 
 void func0(void);
@@ -10,12 +15,133 @@ void func2(void);
 void func3(void);
 void func4(void);
 void func5(void);
+void* threadWork(void* v);
+void runThreads(void);
+void runBenchmark(void);
+void runHistogram(void);
+void runCallTree(void);
+void runTracing(void);
+void runAggregator(void);
+void runSampling(void);
+void runAllocations(void);
+void runCpuTime(void);
+void allocWork(void);
+void sampleOuter(int hotMS, int coldMS);
+void spinFor(int ms);
+long samplesFor(const twine& folded, const char* path);
+void* aggWork(void* v);
+void aggCallback(EnExSnapshot& delta, void* arg);
+void* traceWork(void* v);
+size_t countOf(const twine& haystack, const char* needle);
+void callerA(void);
+void callerB(void);
+void callShared(void);
+double nsPer(int kind, int count);
+int checkPercentile(EnExHistogram& h, double pct, uint64_t actual);
 
 int main(void)
 {
 	func0();
 	EnEx printer("printer");
 	printer.PrintHitMap();
+
+	runThreads();
+
+	runBenchmark();
+
+	runHistogram();
+
+	runCallTree();
+
+	runTracing();
+
+	runAggregator();
+
+	runSampling();
+
+	runAllocations();
+
+	runCpuTime();
+}
+
+void runBenchmark(void)
+{
+	// What a profiled scope costs each way.
+	int count = 5000000;
+	double byName = nsPer(0, count);
+	double site = nsPer(1, count);
+	EnterExit::EnableSubsystem(ENEX_SUBSYSTEM_USER, false);
+	double subsystemOff = nsPer(1, count);
+	EnterExit::EnableSubsystem(ENEX_SUBSYSTEM_USER, true);
+	EnterExit::EnableProfiling(false);
+	double allOff = nsPer(1, count);
+	EnterExit::EnableProfiling(true);
+	double bare = nsPer(2, count);
+
+	printf("ns per scope: EnEx (%.1f) ENEX_SITE (%.1f) subsystem off (%.1f) profiling off (%.1f) none (%.1f)\n",
+		byName, site, subsystemOff, allOff, bare);
+	printf("Disabled ENEX_SITE cheaper than enabled: %s\n", allOff < site && subsystemOff < site ? "OK" : "ERROR");
+
+	// The call site's hits (only the enabled pass counts) go in the same map as everyone else's.
+	twine output;
+	EnEx saver("benchmark");
+	saver.SaveToGlobal();
+	EnterExit::PrintGlobalHitMap(output);
+	size_t idx = output.find("benchSite");
+	long hits = idx == TWINE_NOT_FOUND ? 0 : atol( output() + idx + 9 );
+	printf("ENEX_SITE recorded (%ld) hits expected (%d) %s\n", hits, count,
+		hits == count ? "OK" : "ERROR");
+}
+
+double nsPer(int kind, int count)
+{
+	volatile int work = 0;
+	Timer tt;
+	tt.Start();
+	for(int i = 0; i < count; i++){
+		if(kind == 0){
+			EnEx ee("benchByName");
+			work++;
+		} else if(kind == 1){
+			ENEX_SITE_IN(ENEX_SUBSYSTEM_USER, "benchSite");
+			work++;
+		} else {
+			work++;
+		}
+	}
+	tt.Finish();
+	return tt.Duration() * 1000000000.0 / count;
+}
+
+void runThreads(void)
+{
+	// Every thread registers its own profile the first time through.  None of the hits
+	// should be lost or land in another thread's counters.
+	Thread* threads[16];
+	for(int i = 0; i < 16; i++){
+		threads[i] = new Thread();
+		threads[i]->start(threadWork, NULL);
+	}
+	for(int i = 0; i < 16; i++){
+		threads[i]->join();
+		delete threads[i];
+	}
+	twine output;
+	EnterExit::PrintGlobalHitMap(output);
+	size_t idx = output.find("threadWork");
+	long hits = idx == TWINE_NOT_FOUND ? 0 : atol( output() + idx + 10 );
+	printf("16 threads recorded (%ld) hits to threadWork expected (160000) %s\n", hits,
+		hits == 160000 ? "OK" : "ERROR");
+}
+
+void* threadWork(void* v)
+{
+	for(int i = 0; i < 9999; i++){
+		EnEx ee("threadWork");
+		func5();
+	}
+	EnEx ee("threadWork", true); // hit 10,000 saves everything to the global view
+	return NULL;
 }
 
 void func0(void)
@@ -91,3 +217,430 @@ void func5(void)
 
 }
 
+int checkPercentile(EnExHistogram& h, double pct, uint64_t actual)
+{
+	// We report the top of the bucket, which is never under the real value and at most a
+	// sixteenth over it.
+	uint64_t got = h.Percentile(pct);
+	bool ok = got >= actual && got <= actual + actual / ENEX_HISTOGRAM_SUB_COUNT + 1;
+	printf("p%g is (%llu) actual (%llu) %s\n", pct, (unsigned long long)got,
+		(unsigned long long)actual, ok ? "OK" : "ERROR");
+	return ok ? 0 : 1;
+}
+
+void runHistogram(void)
+{
+	int errors = 0;
+
+	// Every value lands in a bucket whose top is at or above it, and the bucket before
+	// tops out below it.
+	for(uint64_t v = 1; v < ((uint64_t)1 << 39); v += v / 7 + 1){
+		int b = EnExHistogram::BucketFor(v);
+		if(EnExHistogram::BucketTop(b) < v || EnExHistogram::BucketTop(b - 1) >= v){
+			printf("ERROR: value (%llu) went to bucket (%d)\n", (unsigned long long)v, b);
+			errors++;
+			break;
+		}
+	}
+
+	// 1 to 100,000ns once each, recorded half into each of two histograms and then merged.
+	EnExHistogram whole, odd, even;
+	for(uint64_t v = 1; v <= 100000; v++){
+		whole.Record(v);
+		if(v % 2){
+			odd.Record(v);
+		} else {
+			even.Record(v);
+		}
+	}
+	odd.Add(even);
+	errors += checkPercentile(odd, 50, 50000);
+	errors += checkPercentile(odd, 90, 90000);
+	errors += checkPercentile(odd, 99, 99000);
+	errors += checkPercentile(odd, 99.9, 99900);
+	if(odd.Max() != 100000 || odd.Count() != 100000 || odd.Percentile(100) != 100000){
+		printf("ERROR: merged max (%llu) count (%llu)\n", (unsigned long long)odd.Max(),
+			(unsigned long long)odd.Count());
+		errors++;
+	}
+	for(int pct = 1; pct < 100; pct++){
+		if(odd.Percentile(pct) != whole.Percentile(pct)){
+			printf("ERROR: merged p%d differs from whole\n", pct);
+			errors++;
+		}
+	}
+
+	// Reset-on-read: the numbers are reported once, then start again from zero.
+	twine first, second;
+	EnterExit::PrintGlobalHitMap(first, true);
+	EnterExit::PrintGlobalHitMap(second);
+	size_t idx1 = first.find("benchSite");
+	size_t idx2 = second.find("benchSite");
+	long hits1 = idx1 == TWINE_NOT_FOUND ? 0 : atol( first() + idx1 + 9 );
+	long hits2 = idx2 == TWINE_NOT_FOUND ? -1 : atol( second() + idx2 + 9 );
+	if(hits1 == 0 || hits2 != 0){
+		printf("ERROR: reset-on-read reported (%ld) then (%ld) hits\n", hits1, hits2);
+		errors++;
+	}
+	printf("Histogram %s\n", errors == 0 ? "OK" : "ERROR");
+}
+
+void runCallTree(void)
+{
+	// callShared is called once by callerA and three times by callerB.  The call tree
+	// should keep the two apart.
+	{
+		EnEx saver("callTree", true);
+		for(int i = 0; i < 1000; i++){
+			callerA();
+			callerB();
+		}
+	}
+	int errors = 0;
+
+	twine folded;
+	EnterExit::GetFoldedStacks(folded);
+	if(folded.find("printer;callTree;callerA;callShared ") == TWINE_NOT_FOUND ||
+		folded.find("printer;callTree;callerB;callShared ") == TWINE_NOT_FOUND
+	){
+		printf("ERROR: folded stacks are missing a path:\n%s", folded());
+		errors++;
+	}
+
+	xmlDocPtr doc = xmlNewDoc((const xmlChar*)"1.0");
+	xmlNodePtr root = xmlNewDocNode(doc, NULL, (const xmlChar*)"Profile", NULL);
+	xmlDocSetRootElement(doc, root);
+	EnterExit::RecordGlobalHitMap(root);
+	xmlNodePtr node = XmlHelpers::FindChild(root, "CallTree");
+	const char* path[] = { "printer", "callTree", "callerB", "callShared" };
+	size_t sharedHits[2] = { 0, 0 };
+	for(int i = 0; i < 4 && node != NULL; i++){
+		if(i == 2){
+			// Look under callerA on the way past
+			xmlNodePtr a = XmlHelpers::FindChildWithAttribute(node, "Call", "MethodName", "callerA");
+			xmlNodePtr shared = a == NULL ? NULL :
+				XmlHelpers::FindChildWithAttribute(a, "Call", "MethodName", "callShared");
+			sharedHits[0] = shared == NULL ? 0 : XmlHelpers::getIntAttr(shared, "Hits");
+		}
+		node = XmlHelpers::FindChildWithAttribute(node, "Call", "MethodName", path[i]);
+	}
+	sharedHits[1] = node == NULL ? 0 : XmlHelpers::getIntAttr(node, "Hits");
+	xmlFreeDoc(doc);
+	if(sharedHits[0] != 1000 || sharedHits[1] != 3000){
+		printf("ERROR: callShared hits under callerA (%d) and callerB (%d)\n",
+			(int)sharedHits[0], (int)sharedHits[1]);
+		errors++;
+	}
+	printf("Call tree %s\n", errors == 0 ? "OK" : "ERROR");
+}
+
+void callerA(void)
+{
+	EnEx ee("callerA");
+	callShared();
+}
+
+void callerB(void)
+{
+	ENEX_SITE("callerB");
+	callShared();
+	callShared();
+	callShared();
+}
+
+void callShared(void)
+{
+	EnEx ee("callShared");
+	volatile int work = 0;
+	for(int i = 0; i < 100; i++){
+		work++;
+	}
+}
+
+void runTracing(void)
+{
+	// Our ring holds 1000 spans, so only the latest 1000 of our 2000 are exported.  Each of
+	// the four threads records 20 (10 callerA and 10 callShared).
+	EnterExit::StartTracing(1000);
+	for(int i = 0; i < 2000; i++){
+		callShared();
+	}
+	Thread* threads[4];
+	for(int i = 0; i < 4; i++){
+		threads[i] = new Thread();
+		threads[i]->start(traceWork, NULL);
+	}
+	for(int i = 0; i < 4; i++){
+		threads[i]->join();
+		delete threads[i];
+	}
+	EnterExit::StopTracing();
+	callShared(); // not traced
+
+	twine json;
+	EnterExit::GetTraceEvents(json);
+	size_t spans = countOf(json, "\"ph\":\"X\"");
+	size_t threadNames = countOf(json, "\"thread_name\"");
+	size_t callerA = countOf(json, "\"name\":\"callerA\"");
+	bool ok = spans == 1080 && threadNames == 5 && callerA == 40 &&
+		json.find("{\"traceEvents\":[") == 0;
+	printf("Trace exported (%d) spans on (%d) threads, (%d) callerA %s\n", (int)spans,
+		(int)threadNames, (int)callerA, ok ? "OK" : "ERROR");
+}
+
+void* traceWork(void* v)
+{
+	for(int i = 0; i < 10; i++){
+		callerA();
+	}
+	return NULL;
+}
+
+size_t countOf(const twine& haystack, const char* needle)
+{
+	size_t count = 0;
+	const char* p = haystack();
+	while((p = strstr(p, needle)) != NULL){
+		count++;
+		p++;
+	}
+	return count;
+}
+
+struct AggTotals {
+	long hits;
+	int intervals;
+	int mismatches;
+};
+
+void runAggregator(void)
+{
+	// Four threads each record 20,000 hits over a few hundred milliseconds while the
+	// aggregator samples every 50ms.  The interval deltas should add up to every hit, and
+	// each interval's threads should add up to its global number.
+	AggTotals totals = { 0, 0, 0 };
+	EnExAggregator agg(50, aggCallback, &totals);
+	agg.Start();
+	Thread* threads[4];
+	for(int i = 0; i < 4; i++){
+		threads[i] = new Thread();
+		threads[i]->start(aggWork, NULL);
+	}
+	for(int i = 0; i < 4; i++){
+		threads[i]->join();
+		delete threads[i];
+	}
+	agg.Stop();
+	agg.Sample(); // whatever came after the last interval
+	printf("Aggregator saw (%ld) hits in (%d) intervals expected (80000) %s\n", totals.hits,
+		totals.intervals, totals.hits == 80000 && totals.intervals > 2 && totals.mismatches == 0 ?
+		"OK" : "ERROR");
+
+	// Nobody's counters were zeroed to do that.
+	EnExSnapshot snap;
+	snap.Take();
+	int whole = 0;
+	for(size_t i = 0; i < snap.ThreadCount(); i++){
+		map<const char*, EnExProfile*>::iterator it;
+		for(it = snap.ThreadProfiles(i).begin(); it != snap.ThreadProfiles(i).end(); it++){
+			if(strcmp(it->first, "aggWork") == 0 && it->second->Hits() == 20000){
+				whole++;
+			}
+		}
+	}
+	printf("Threads still holding all (20000) of their hits (%d) %s\n", whole,
+		whole == 4 ? "OK" : "ERROR");
+}
+
+void* aggWork(void* v)
+{
+	for(int round = 0; round < 20; round++){
+		for(int i = 0; i < 1000; i++){
+			ENEX_SITE("aggWork");
+			callShared();
+		}
+		Tools::msleep(10);
+	}
+	return NULL;
+}
+
+void aggCallback(EnExSnapshot& delta, void* arg)
+{
+	AggTotals* totals = (AggTotals*)arg;
+	totals->intervals++;
+	long global = 0;
+	long threads = 0;
+	map<const char*, EnExProfile*>::iterator it;
+	for(it = delta.Global().begin(); it != delta.Global().end(); it++){
+		if(strcmp(it->first, "aggWork") == 0){
+			global = it->second->Hits();
+		}
+	}
+	for(size_t i = 0; i < delta.ThreadCount(); i++){
+		for(it = delta.ThreadProfiles(i).begin(); it != delta.ThreadProfiles(i).end(); it++){
+			if(strcmp(it->first, "aggWork") == 0){
+				threads += it->second->Hits();
+			}
+		}
+	}
+	totals->hits += global;
+	if(global != threads){
+		totals->mismatches++;
+	}
+}
+
+void runSampling(void)
+{
+	// With timing off a scope only keeps the stack up to date.
+	EnterExit::EnableTiming(false);
+	double stackOnly = nsPer(1, 5000000);
+	printf("ns per scope with timing off: ENEX_SITE (%.1f)\n", stackOnly);
+
+	// Spend three times as long in sampleHot as in sampleCold, and the samples should say so.
+	if(!EnterExit::StartSampling(1000)){
+		printf("Sampling isn't available here\n");
+		EnterExit::EnableTiming(true);
+		return;
+	}
+	sampleOuter(600, 200);
+	EnterExit::StopSampling();
+	EnterExit::EnableTiming(true);
+
+	twine folded;
+	EnterExit::GetSampledStacks(folded, true);
+	long hot = samplesFor(folded, "sampleOuter;sampleHot ");
+	long cold = samplesFor(folded, "sampleOuter;sampleCold ");
+	bool ok = hot > cold * 2 && cold > 0 && hot + cold > 100; // cpu timers only fire on a kernel tick
+	printf("Sampled (%ld) in sampleHot and (%ld) in sampleCold %s\n", hot, cold, ok ? "OK" : "ERROR");
+
+	twine again;
+	EnterExit::GetSampledStacks(again);
+	printf("Samples cleared on read %s\n", samplesFor(again, "sampleOuter;sampleHot ") == 0 ?
+		"OK" : "ERROR");
+}
+
+void sampleOuter(int hotMS, int coldMS)
+{
+	ENEX_SITE("sampleOuter");
+	{
+		ENEX_SITE("sampleHot");
+		spinFor(hotMS);
+	}
+	{
+		EnEx ee("sampleCold");
+		spinFor(coldMS);
+	}
+}
+
+void spinFor(int ms)
+{
+	// Busy, so we use cpu time and the cpu timer keeps firing.
+	volatile unsigned long work = 0;
+	Timer tt;
+	tt.Start();
+	do {
+		for(int i = 0; i < 10000; i++){
+			work++;
+		}
+		tt.Finish();
+	} while(tt.DurationNanos() < (uint64_t)ms * 1000000);
+}
+
+long samplesFor(const twine& folded, const char* path)
+{
+	size_t idx = folded.find(path);
+	if(idx == TWINE_NOT_FOUND){
+		return 0;
+	}
+	return atol( folded() + idx + strlen(path) );
+}
+
+void runAllocations(void)
+{
+	EnterExit::EnableAllocTracking(true);
+	{
+		EnEx saver("allocSaver", true);
+		allocWork();
+	}
+	EnterExit::EnableAllocTracking(false);
+
+	xmlDocPtr doc = xmlNewDoc((const xmlChar*)"1.0");
+	xmlNodePtr root = xmlNewDocNode(doc, NULL, (const xmlChar*)"Profile", NULL);
+	xmlDocSetRootElement(doc, root);
+	EnterExit::RecordGlobalHitMap(root);
+	xmlNodePtr outer = XmlHelpers::FindChildWithAttribute(root, "HitMap", "MethodName", "allocWork");
+	xmlNodePtr inner = XmlHelpers::FindChildWithAttribute(root, "HitMap", "MethodName", "allocInner");
+	size_t outerAllocs = outer == NULL ? 0 : XmlHelpers::getIntAttr(outer, "Allocations");
+	size_t outerBytes = outer == NULL ? 0 : XmlHelpers::getIntAttr(outer, "AllocatedBytes");
+	size_t innerAllocs = inner == NULL ? 0 : XmlHelpers::getIntAttr(inner, "Allocations");
+	size_t innerBytes = inner == NULL ? 0 : XmlHelpers::getIntAttr(inner, "AllocatedBytes");
+	xmlFreeDoc(doc);
+
+	// allocWork's own 100 new[]s, and the inner scope's 50 mallocs counted there instead
+	bool ok = outerAllocs == 100 && outerBytes == 100000 && innerAllocs == 50 && innerBytes == 3200;
+	printf("Allocations: allocWork (%d, %d bytes) allocInner (%d, %d bytes) %s\n",
+		(int)outerAllocs, (int)outerBytes, (int)innerAllocs, (int)innerBytes, ok ? "OK" : "ERROR");
+}
+
+void allocWork(void)
+{
+	static char* volatile sink[100];
+	ENEX_SITE("allocWork");
+	for(int i = 0; i < 100; i++){
+		sink[i] = new char[1000];
+	}
+	{
+		EnEx ee("allocInner");
+		for(int i = 0; i < 50; i++){
+			void* volatile p = malloc(64);
+			free(p);
+		}
+	}
+	for(int i = 0; i < 100; i++){
+		delete [] sink[i];
+	}
+}
+
+void runCpuTime(void)
+{
+	// One scope that sleeps and one that spins, for the same wall time.  Only the ones we
+	// select are measured.
+	EnterExit::EnableCpuTime("cpuSleeper", true);
+	EnterExit::EnableCpuTime("cpuSpinner", true);
+	{
+		EnEx saver("cpuSaver", true);
+		for(int i = 0; i < 5; i++){
+			{
+				EnEx ee("cpuSleeper");
+				Tools::msleep(20);
+			}
+			{
+				ENEX_SITE("cpuSpinner");
+				spinFor(20);
+			}
+		}
+	}
+	EnterExit::EnableCpuTime("cpuSleeper", false);
+	EnterExit::EnableCpuTime("cpuSpinner", false);
+
+	xmlDocPtr doc = xmlNewDoc((const xmlChar*)"1.0");
+	xmlNodePtr root = xmlNewDocNode(doc, NULL, (const xmlChar*)"Profile", NULL);
+	xmlDocSetRootElement(doc, root);
+	EnterExit::RecordGlobalHitMap(root);
+	const char* names[] = { "cpuSleeper", "cpuSpinner", "cpuSaver" };
+	size_t hits[3], cpu[3], offCpu[3];
+	for(int i = 0; i < 3; i++){
+		xmlNodePtr node = XmlHelpers::FindChildWithAttribute(root, "HitMap", "MethodName", names[i]);
+		hits[i] = node == NULL ? 0 : XmlHelpers::getIntAttr(node, "CpuHits");
+		cpu[i] = node == NULL ? 0 : XmlHelpers::getIntAttr(node, "CpuNanos");
+		offCpu[i] = node == NULL ? 0 : XmlHelpers::getIntAttr(node, "OffCpuNanos");
+	}
+	xmlFreeDoc(doc);
+
+	// Windows only counts cpu time in whole quanta, so don't ask for much.
+	bool ok = hits[0] == 5 && hits[1] == 5 && hits[2] == 0 &&
+		offCpu[0] > cpu[0] * 4 && cpu[1] > offCpu[1] * 2 && cpu[1] >= 50000000;
+	printf("cpuSleeper cpu (%d us) off-cpu (%d us), cpuSpinner cpu (%d us) off-cpu (%d us) %s\n",
+		(int)(cpu[0] / 1000), (int)(offCpu[0] / 1000), (int)(cpu[1] / 1000), (int)(offCpu[1] / 1000),
+		ok ? "OK" : "ERROR");
+}
@@ -50,6 +50,28 @@ int main(void)
 
 	DEBUG(FL, "This is a debug message.");
 
+	printf("Testing rate limiting - 10,000 warnings from one call site at 100/sec, burst 10:\n");
+	Log::SetRateLimit(100, 10);
+	for(int i = 0; i < 10000; i++){
+		WARN(FL, "database is locked - retry %d", i);
+	}
+	Log::SetRateLimit(0, 0);
+
+	printf("Testing repeat collapsing - 1,000 identical messages:\n");
+	Log::SetCollapseRepeats(true);
+	for(int i = 0; i < 1000; i++){
+		WARN(FL, "Socket timeout.");
+	}
+	INFO(FL, "A different message ends the run of repeats.");
+	Log::SetCollapseRepeats(false);
+
+	printf("Suppression counters:\n");
+	vector<LogSiteStats> stats = Log::GetSuppressionStats();
+	for(size_t i = 0; i < stats.size(); i++){
+		printf("%s:%d rate limited (%lu) repeated (%lu)\n", stats[i].file, stats[i].line,
+			(unsigned long)stats[i].rateLimited, (unsigned long)stats[i].repeated);
+	}
+
 	TRACE(FL, "That's it.  Main is done.");
 
 	printf("Log Test Done\n");
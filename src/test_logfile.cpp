@@ -1,8 +1,10 @@
 #include "Log.h"
 #include "LogMsg.h"
 #include "LogFile.h"
+#include "LogFileReader.h"
 #include "AnException.h"
 #include "dptr.h"
+#include "Timer.h"
 using namespace SLib;
 
 #include <stdarg.h>
@@ -10,6 +12,8 @@ using namespace SLib;
 void runTest1();
 void runTest2();
 void runTest3();
+void runTest4();
+bool checkNewestWindow(LogFile& lf, int count);
 LogMsg* buildMessage(const char* file, int line, const char* msg, ...);
 
 int main(void)
@@ -22,6 +26,8 @@ int main(void)
 
 		runTest3();
 
+		runTest4();
+
 	} catch (AnException& e){
 		printf("Exception caught: %s\n", e.Msg() );
 		printf("Aborting tests.\n" );
@@ -80,16 +86,192 @@ void runTest1()
 
 void runTest2()
 {
-	// Open a new log file and write some messages to it.
-	
+	// Write far more messages than will fit into a small file that re-uses itself.
+	printf("Writing 2,000,000 messages to a 64K re-used log file testLogFile2.log\n");
+	int count = 2000000;
+	Timer tt;
+	tt.Start();
+	{ // for scope
+		LogFile lf("testLogFile2.log",
+			1024 * 64, // 64K max size
+			1000, // entries max
+			1024 * 8, // 8K string table
+			100, // 100 strings
+			true, // re-use
+			true  // clear at startup
+		);
+		for(int i = 0; i < count; i ++){
+			dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d%s", i,
+				(i % 7) == 0 ? " with some extra text to vary the length" : "");
+			lm->id = i;
+			lf.writeMsg(*lm);
+		}
+		lf.close();
+	}
+	tt.Finish();
+	printf("Wrote (%d) messages in %f seconds = %.0f msgs/sec\n", count, tt.Duration(),
+		(double)count / tt.Duration() );
 
+	// Re-open it, and make sure what's left is the newest messages with no gaps.
+	LogFile lf2("testLogFile2.log",
+		1024 * 64, // 64K max size
+		1000, // entries max
+		1024 * 8, // 8K string table
+		100, // 100 strings
+		true, // re-use
+		false  // don't clear at startup
+	);
+	checkNewestWindow(lf2, count);
+	lf2.close();
 }
 
 void runTest3()
 {
-	// Open a new log file and write some messages to it.
-	
+	// The same messages through stdio and through the memory mapped write path.
+	printf("Writing 500,000 messages to a 4M re-used log file with stdio and with a memory map\n");
+	int count = 500000;
+	const char* labels[] = { "stdio:", "mmap, no sync:", "mmap, sync/1000:" };
+	int syncEvery[] = { -1, 0, 1000 };
+	for(int pass = 0; pass < 3; pass++){
+		Timer tt;
+		tt.Start();
+		{ // for scope
+			LogFile lf("testLogFile3.log",
+				1024 * 1024 * 4, // 4M max size
+				20000, // entries max
+				1024 * 64, // 64K string table
+				1000, // 1K strings
+				true, // re-use
+				true  // clear at startup
+			);
+			if(syncEvery[pass] >= 0){
+				lf.useMemoryMap( syncEvery[pass] );
+			}
+			for(int i = 0; i < count; i ++){
+				dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d%s", i,
+					(i % 7) == 0 ? " with some extra text to vary the length" : "");
+				lm->id = i;
+				lf.writeMsg(*lm);
+			}
+			lf.close();
+		}
+		tt.Finish();
+		printf("%-17s %d messages in %f seconds = %.0f msgs/sec\n", labels[pass], count,
+			tt.Duration(), (double)count / tt.Duration() );
 
+		// Whichever way it was written, it reads back the same through stdio.
+		LogFile lf2("testLogFile3.log",
+			1024 * 1024 * 4, // 4M max size
+			20000, // entries max
+			1024 * 64, // 64K string table
+			1000, // 1K strings
+			true, // re-use
+			false  // don't clear at startup
+		);
+		checkNewestWindow(lf2, count);
+		lf2.close();
+	}
+}
+
+void runTest4()
+{
+	// The zero-copy reader against getAllMessages, on a file that has wrapped.
+	printf("Reading a wrapped log file testLogFile4.log with LogFileReader\n");
+	LogFile lf("testLogFile4.log",
+		1024 * 256, // 256K max size
+		2000, // entries max
+		1024 * 8, // 8K string table
+		100, // 100 strings
+		true, // re-use
+		true  // clear at startup
+	);
+	int count = 20000;
+	for(int i = 0; i < count; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Reader Message #%d%s", i,
+			(i % 5) == 0 ? " with a longer tail on it" : "");
+		lm->id = i;
+		lm->channel = i % 7;
+		lm->appName = "test_logfile";
+		lm->machineName = "localhost";
+		lf.writeMsg(*lm);
+	}
+
+	dptr< vector<LogMsg*> > msgs = lf.getAllMessages();
+	LogFileReader reader("testLogFile4.log");
+	LogFileRecord rec;
+	size_t i = 0;
+	int bad = 0;
+	while(reader.next( rec )){
+		if(i >= msgs->size()){
+			bad++;
+			continue;
+		}
+		LogMsg* lm = (*msgs)[i++];
+		if(rec.id() != lm->id || rec.channel() != lm->channel || rec.line() != lm->line ||
+			rec.msg().str() != lm->msg || rec.file().str() != lm->file ||
+			rec.appName().str() != lm->appName || rec.machineName().str() != lm->machineName
+		){
+			bad++;
+		}
+	}
+	printf("Reader returned (%d) getAllMessages returned (%d) bad (%d) %s\n", (int)i,
+		(int)msgs->size(), bad, i == msgs->size() && i > 100 && bad == 0 ? "OK" : "ERROR");
+	for(size_t j = 0; j < msgs->size(); j++){
+		delete (*msgs)[j];
+	}
+
+	// Resume part way through.
+	int resumeAt = count - 50;
+	reader.seekAfter( resumeAt );
+	int found = 0;
+	int first = -1;
+	while(reader.next( rec )){
+		if(first < 0) first = rec.id();
+		found++;
+	}
+	printf("seekAfter(%d) found (%d) starting at (%d) expected (49, %d) %s\n", resumeAt,
+		found, first, resumeAt + 1, found == 49 && first == resumeAt + 1 ? "OK" : "ERROR");
+
+	// Follow the writer as it keeps going.
+	for(int j = count; j < count + 10; j ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Reader Message #%d", j);
+		lm->id = j;
+		lf.writeMsg(*lm);
+	}
+	reader.refresh();
+	found = 0;
+	while(reader.next( rec )){
+		found++;
+	}
+	printf("refresh picked up (%d) new messages, last id (%d) expected (10, %d) %s\n", found,
+		reader.lastID(), count + 9, found == 10 && reader.lastID() == count + 9 ? "OK" : "ERROR");
+
+	lf.close();
+}
+
+bool checkNewestWindow(LogFile& lf, int count)
+{
+	// What's left should be the newest messages with no gaps.
+	dptr< vector<LogMsg*> > msgs = lf.getAllMessages();
+	int bad = 0;
+	for(size_t i = 0; i < msgs->size(); i++){
+		LogMsg* lm = (*msgs)[i];
+		int expected = count - (int)msgs->size() + (int)i;
+		twine text; text.format("Test Message #%d%s", expected,
+			(expected % 7) == 0 ? " with some extra text to vary the length" : "");
+		if(lm->id != expected || lm->msg != text){
+			bad++;
+		}
+	}
+	bool ok = msgs->size() > 100 && (int)msgs->size() == lf.messageCount() && bad == 0 &&
+		lf.getNewestMessageID() == count - 1;
+	printf("Messages kept (%d) message count (%d) oldest (%d) newest (%d) bad (%d) %s\n",
+		(int)msgs->size(), lf.messageCount(), lf.getOldestMessageID(), lf.getNewestMessageID(),
+		bad, ok ? "OK" : "ERROR");
+	for(size_t i = 0; i < msgs->size(); i++){
+		delete (*msgs)[i];
+	}
+	return ok;
 }
 
 LogMsg* buildMessage(const char* file, int line, const char* msg, ...)
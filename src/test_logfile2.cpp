@@ -1,16 +1,38 @@
 #include "Log.h"
 #include "LogMsg.h"
 #include "LogFile2.h"
+#include "PartitionedLogFile2.h"
+#include "MergedLogReader.h"
+#include "LogFile.h"
+#include "ZipFile.h"
 #include "AnException.h"
 #include "dptr.h"
 #include "Timer.h"
+#include "Thread.h"
+#include "File.h"
 using namespace SLib;
 
 #include <stdarg.h>
 
+#include <algorithm>
+using namespace std;
+
 void runTest1();
 void runTest2();
 void runTest3();
+void runTest4();
+void runTest5();
+void runTest6();
+void runTest7();
+void runTest8();
+void runTest9();
+void runTest10();
+int mergeInOrder(const twine& pattern, const LogFile2Filter& filter, int maxBuffered, vector<int>& order,
+	int maxOpen = 16);
+int countWords(LogFile2& lf, const char* words, bool phrase);
+void writeSchemaMessages(LogFile2& lf, int count);
+void* readerThread(void* v);
+void printLatencies(const char* label, vector<uint64_t>& lat);
 LogMsg* buildMessage(const char* file, int line, const char* msg, ...);
 
 int main(void)
@@ -23,6 +45,20 @@ int main(void)
 
 		runTest3();
 
+		runTest4();
+
+		runTest5();
+
+		runTest6();
+
+		runTest7();
+
+		runTest8();
+
+		runTest9();
+
+		runTest10();
+
 	} catch (AnException& e){
 		printf("Exception caught: %s\n", e.Msg() );
 		printf("Aborting tests.\n" );
@@ -105,6 +141,629 @@ void runTest3()
 	printf("Duration for runTest3 is (%f)\n", tt.Duration() );
 }
 
+void runTest4()
+{
+	// Compare how long writeMsg blocks the calling thread with and without the
+	// background flush thread.
+	int count = 50000;
+	vector<uint64_t> lat;
+	lat.reserve(count);
+
+	for(int pass = 0; pass < 2; pass++){
+		twine fileName = pass == 0 ? "testLogFile5.log" : "testLogFile6.log";
+		printf("Opening a new log file %s - writing %d messages %s.\n", fileName(), count,
+			pass == 0 ? "flushing on the writer thread" : "with the background flush thread");
+		LogFile2 lf(fileName, (size_t)(1024 * 1024 * 50)); // 50M max size
+		if(pass == 1){
+			lf.startFlushThread();
+		}
+
+		lat.clear();
+		for(int i = 0; i < count; i ++){
+			dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+			uint64_t start = Timer::GetCycleCount();
+			lf.writeMsg(*lm);
+			lat.push_back( Timer::GetCycleCount() - start );
+		}
+		lf.flush();
+		lf.close();
+		printLatencies(pass == 0 ? "writer flush" : "flush thread", lat);
+	}
+}
+
+static volatile bool readerDone = false;
+
+void runTest5()
+{
+	// Write to a WAL mode file while another connection keeps reading from it.
+	Timer tt;
+	tt.Start();
+	printf("Opening a new log file testLogFile7.log in WAL mode - writing 50,000 messages with a reader.\n");
+	twine fileName = "testLogFile7.log";
+	LogFile2 lf(fileName, (size_t)(1024 * 1024 * 50)); // 50M max size
+	lf.setStorage( LogFile2Storage::Concurrent() );
+	dptr<LogMsg> first = buildMessage(FL, "First message");
+	lf.writeMsg( *first );
+	lf.flush();
+
+	readerDone = false;
+	Thread reader;
+	reader.start( readerThread, &fileName );
+
+	for(int i = 0; i < 50000; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+		lf.writeMsg(*lm);
+	}
+	lf.flush();
+	readerDone = true;
+	reader.join();
+
+	printf("Message count after the writer is done (%d)\n", lf.messageCount() );
+	lf.close();
+	tt.Finish();
+	printf("Duration for runTest5 is (%f)\n", tt.Duration() );
+}
+
+void runTest6()
+{
+	// Filtered queries through a cursor, compared with the raw where clause version.
+	Timer tt;
+	tt.Start();
+	printf("Opening a new log file testLogFile8.log with indexes - writing 20,000 messages.\n");
+	twine fileName = "testLogFile8.log";
+	remove( fileName() );
+	LogFile2 lf(fileName, (size_t)(1024 * 1024 * 50)); // 50M max size
+	LogFile2Storage storage;
+	storage.indexes = true;
+	lf.setStorage( storage );
+	lf.setCacheSize( 1000 );
+
+	vector<LogMsg*> batch;
+	for(int i = 0; i < 20000; i ++){
+		LogMsg* lm = buildMessage(FL, "Test Message #%d%s", i, (i % 100) == 0 ? " needle_50%" : "");
+		lm->channel = i % 7;
+		lm->tid = (i % 4) + 1;
+		lm->appSession = (i % 10) == 0 ? "session-a" : "session-b";
+		batch.push_back( lm );
+	}
+	lf.writeMsgBatch( &batch );
+	lf.flush();
+
+	LogFile2Filter filter;
+	filter.channels = LOGFILE2_CHANNEL(1) | LOGFILE2_CHANNEL(3);
+	filter.tid = 2;
+	int expected = lf.messageCount( "where channel in (1,3) and tid = 2" );
+
+	// A small page size makes the cursor page many times.
+	int found = 0;
+	int lastID = 0;
+	dptr<LogFile2Cursor> cursor = lf.query( filter, 64 );
+	while(true){
+		dptr<LogMsg> lm; lm = cursor->next();
+		if(lm == NULL) break;
+		if(lm->id <= lastID || lm->tid != 2 || (lm->channel != 1 && lm->channel != 3)){
+			printf("ERROR: cursor returned an unexpected row (%d)\n", lm->id);
+		}
+		lastID = lm->id;
+		found++;
+	}
+	printf("Channel and thread filter found (%d) expected (%d) %s\n", found, expected,
+		found == expected ? "OK" : "ERROR");
+
+	// Wildcards in the text filter must be taken literally.
+	LogFile2Filter textFilter;
+	textFilter.text = "needle_50%";
+	textFilter.appSession = "session-a";
+	cursor = lf.query( textFilter );
+	found = 0;
+	while(true){
+		dptr<LogMsg> lm; lm = cursor->next();
+		if(lm == NULL) break;
+		found++;
+	}
+	printf("Text and session filter found (%d) expected (200) %s\n", found,
+		found == 200 ? "OK" : "ERROR");
+
+	// A caught up cursor picks up new messages on the next call.
+	dptr<LogMsg> late = buildMessage(FL, "Late needle_50%% message");
+	late->appSession = "session-a";
+	lf.writeMsg( *late );
+	lf.flush();
+	dptr<LogMsg> lm; lm = cursor->next();
+	printf("Cursor picked up the late message: %s\n", lm != NULL ? "OK" : "ERROR");
+
+	// The text filter is case sensitive, as LogDump's always was.
+	LogFile2Filter caseFilter;
+	caseFilter.text = "NEEDLE_50%";
+	cursor = lf.query( caseFilter );
+	dptr<LogMsg> upper; upper = cursor->next();
+	printf("Text filter is case sensitive: %s\n", upper == NULL ? "OK" : "ERROR");
+	cursor = (LogFile2Cursor*)NULL; // cursors go before the log file
+
+	lf.close();
+	tt.Finish();
+	printf("Duration for runTest6 is (%f)\n", tt.Duration() );
+}
+
+void runTest7()
+{
+	// Compare the dictionary schema with the old flat logtable, and check compression.
+	Timer tt;
+	tt.Start();
+	printf("Writing 20,000 messages to an old style file (testLogFile9.log) and a new one (testLogFile10.log).\n");
+	twine oldName = "testLogFile9.log";
+	twine newName = "testLogFile10.log";
+	remove( oldName() );
+	remove( newName() );
+
+	// Build an old style file the way earlier versions of LogFile2 did.
+	sqlite3* db = NULL;
+	sqlite3_open( oldName(), &db );
+	sqlite3_exec( db, "create table logtable ( id integer primary key autoincrement, "
+		"file varchar(20), line int, tid int, timestamp_a int, timestamp_b int, channel int, "
+		"appName varchar(10), machineName varchar(10), appSession varchar(10), msg varchar(10) );",
+		NULL, NULL, NULL );
+	sqlite3_exec( db, "insert into logtable (file, line, tid, timestamp_a, timestamp_b, channel, "
+		"appName, machineName, appSession, msg) values ('old.cpp', 1, 1, 0, 0, 3, 'oldApp', "
+		"'oldMachine', '', 'A message from an old file');", NULL, NULL, NULL );
+	sqlite3_close( db );
+
+	{ // for scope
+		LogFile2 oldFile( oldName, (size_t)(1024 * 1024 * 50) );
+		oldFile.setCacheSize( 1000 );
+		dptr<LogMsg> first; first = oldFile.getMessage( 1 );
+		printf("Old file first message: %s %s\n", first != NULL ? first->msg() : "(missing)",
+			first != NULL && first->appName == "oldApp" ? "OK" : "ERROR");
+		writeSchemaMessages( oldFile, 20000 );
+		oldFile.close();
+	}
+
+	{ // for scope
+		LogFile2 newFile( newName, (size_t)(1024 * 1024 * 50) );
+		LogFile2Storage storage;
+		storage.compressAbove = 128;
+		newFile.setStorage( storage );
+		newFile.setCacheSize( 1000 );
+		writeSchemaMessages( newFile, 20000 );
+
+		// Reassembled rows must match what we wrote - compressed or not.
+		int bad = 0;
+		vector<LogMsg*>* msgs = newFile.getMessages( "where id <= 100" );
+		for(size_t i = 0; i < msgs->size(); i++){
+			LogMsg* lm = msgs->at(i);
+			twine expected; expected.format( "Test Message #%d", lm->id - 1 );
+			if(lm->id % 2 == 0){
+				for(int j = 0; j < 20; j++){
+					expected.append( " with a long repeating tail" );
+				}
+			}
+			if(lm->msg != expected || lm->appName != "test_logfile2" || lm->appSession != "session-c"){
+				bad++;
+			}
+			delete lm;
+		}
+		delete msgs;
+		printf("Reassembled messages checked - (%d) bad %s\n", bad, bad == 0 ? "OK" : "ERROR");
+		printf("Compressed rows (%d)\n", newFile.messageCount( "where msgflags <> 0" ) );
+
+		// Compressed rows are matched in memory - by the same rules as the SQL uses.
+		LogFile2Filter tailFilter;
+		tailFilter.text = "long repeating tail";
+		int tails = 0;
+		dptr<LogFile2Cursor> cursor = newFile.query( tailFilter );
+		while(true){
+			dptr<LogMsg> lm; lm = cursor->next();
+			if(lm == NULL) break;
+			tails++;
+		}
+		tailFilter.text = "Long Repeating Tail";
+		cursor = newFile.query( tailFilter );
+		dptr<LogMsg> upper; upper = cursor->next();
+		cursor = (LogFile2Cursor*)NULL; // cursors go before the log file
+		int phrase = countWords( newFile, "LONG Repeating", true );
+		printf("Compressed text found (%d) mixed case text (%d) mixed case phrase (%d) expected (10000, 0, 10000) %s\n",
+			tails, upper == NULL ? 0 : 1, phrase,
+			tails == 10000 && upper == NULL && phrase == 10000 ? "OK" : "ERROR");
+		newFile.close();
+	}
+
+	File oldFile( oldName );
+	File newFile( newName );
+	printf("Old schema file size (%d) dictionary schema file size (%d)\n",
+		(int)oldFile.size(), (int)newFile.size() );
+
+	tt.Finish();
+	printf("Duration for runTest7 is (%f)\n", tt.Duration() );
+}
+
+void runTest8()
+{
+	// Hourly partitions: 30 hours of messages, keeping the newest 24 partitions.
+	Timer tt;
+	tt.Start();
+	printf("Writing 30 hours of messages to hourly partitions of testLogPart - keeping 24.\n");
+	twine baseName = "testLogPart";
+	remove( (baseName + ".manifest")() );
+
+	time_t base = 1700000000 - (1700000000 % LOGFILE2_PARTITION_HOUR);
+	{ // for scope
+		PartitionedLogFile2 plf( baseName, LOGFILE2_PARTITION_HOUR, 24 );
+		plf.setCacheSize( 1000 );
+		for(int hour = 0; hour < 30; hour++){
+			vector<LogMsg*> batch;
+			for(int i = 0; i < 1000; i++){
+				LogMsg* lm = buildMessage(FL, "Hour %d message %d", hour, i);
+				lm->timestamp.tv_sec = base + hour * LOGFILE2_PARTITION_HOUR + (i * 3);
+				batch.push_back( lm );
+			}
+			plf.writeMsgBatch( &batch );
+		}
+		// One that arrives late lands in the current partition.
+		dptr<LogMsg> late = buildMessage(FL, "Late message");
+		late->timestamp.tv_sec = base + 28 * LOGFILE2_PARTITION_HOUR;
+		plf.writeMsg( *late );
+		plf.close();
+
+		vector<LogPartition> parts = plf.partitions();
+		printf("Partitions kept (%d) expected (24) %s\n", (int)parts.size(),
+			parts.size() == 24 ? "OK" : "ERROR");
+		int dropped = 0;
+		for(int hour = 0; hour < 6; hour++){
+			char stamp[32];
+			time_t when = base + hour * LOGFILE2_PARTITION_HOUR;
+			strftime( stamp, sizeof(stamp), "%Y%m%d%H", gmtime( &when ) );
+			if(!File::Exists( baseName + "." + stamp )){
+				dropped++;
+			}
+		}
+		printf("Oldest partition files dropped (%d) expected (6) %s\n", dropped,
+			dropped == 6 ? "OK" : "ERROR");
+
+		// Three hours in the middle should only touch three partitions.
+		LogFile2Filter filter;
+		filter.since = base + 10 * LOGFILE2_PARTITION_HOUR;
+		filter.until = base + 13 * LOGFILE2_PARTITION_HOUR - 1;
+		PartitionedLogFile2Cursor cursor( plf, filter );
+		int found = 0;
+		while(true){
+			dptr<LogMsg> lm; lm = cursor.next();
+			if(lm == NULL) break;
+			found++;
+		}
+		printf("Range query visited (%d) partitions found (%d) messages expected (3, 3000) %s\n",
+			(int)cursor.partitionCount(), found,
+			cursor.partitionCount() == 3 && found == 3000 ? "OK" : "ERROR");
+
+		// The late message widened the newest partition to cover its time.
+		LogFile2Filter lateFilter;
+		lateFilter.since = base + 28 * LOGFILE2_PARTITION_HOUR;
+		lateFilter.until = base + 28 * LOGFILE2_PARTITION_HOUR;
+		lateFilter.text = "Late";
+		PartitionedLogFile2Cursor lateCursor( plf, lateFilter );
+		dptr<LogMsg> lm; lm = lateCursor.next();
+		printf("Late message found: %s\n", lm != NULL ? "OK" : "ERROR");
+
+		// Clean up after ourselves
+		for(size_t i = 0; i < parts.size(); i++){
+			File::Delete( parts[i].fileName );
+		}
+	}
+	remove( (baseName + ".manifest")() );
+
+	// Back to an older bucket after a close: a late message widens that partition, not the
+	// newest one, and a new bucket older than the rest goes at the front of the manifest.
+	{ // for scope
+		PartitionedLogFile2 plf( baseName, LOGFILE2_PARTITION_HOUR );
+		int hours[] = { 2, 5, -1, 2, 1, -1, 0 }; // -1 closes
+		for(int i = 0; i < 7; i++){
+			if(hours[i] < 0){
+				plf.close();
+				continue;
+			}
+			dptr<LogMsg> lm = buildMessage(FL, "Reopened hour %d", hours[i]);
+			lm->timestamp.tv_sec = base + hours[i] * LOGFILE2_PARTITION_HOUR + 60;
+			plf.writeMsg( *lm );
+		}
+		plf.close();
+
+		vector<LogPartition> parts = plf.partitions();
+		bool ordered = parts.size() == 3;
+		for(size_t i = 1; ordered && i < parts.size(); i++){
+			ordered = parts[i - 1].end < parts[i].end;
+		}
+		printf("Partitions (%d) oldest first expected (3) %s\n", (int)parts.size(),
+			ordered ? "OK" : "ERROR");
+		printf("Late message widened the hour 2 partition: %s\n", ordered &&
+			parts[1].start == base + 1 * LOGFILE2_PARTITION_HOUR + 60 &&
+			parts[2].start == base + 5 * LOGFILE2_PARTITION_HOUR + 60 ? "OK" : "ERROR");
+
+		LogFile2Filter filter;
+		filter.since = base + 1 * LOGFILE2_PARTITION_HOUR;
+		filter.until = base + 2 * LOGFILE2_PARTITION_HOUR - 1;
+		PartitionedLogFile2Cursor cursor( plf, filter );
+		int found = 0;
+		while(true){
+			dptr<LogMsg> lm; lm = cursor.next();
+			if(lm == NULL) break;
+			found++;
+		}
+		printf("Hour 1 query found (%d) messages expected (1) %s\n", found, found == 1 ? "OK" : "ERROR");
+
+		for(size_t i = 0; i < parts.size(); i++){
+			File::Delete( parts[i].fileName );
+		}
+	}
+	remove( (baseName + ".manifest")() );
+
+	tt.Finish();
+	printf("Duration for runTest8 is (%f)\n", tt.Duration() );
+}
+
+void runTest9()
+{
+	// Word searches: the same answers with and without the word index.
+	Timer tt;
+	tt.Start();
+	printf("Writing 20,000 messages to testLogFile11.log - searching before and after adding the word index.\n");
+	twine fileName = "testLogFile11.log";
+	remove( fileName() );
+	LogFile2 lf(fileName, (size_t)(1024 * 1024 * 50)); // 50M max size
+	lf.setCacheSize( 1000 );
+
+	vector<LogMsg*> batch;
+	for(int i = 0; i < 20000; i ++){
+		LogMsg* lm = buildMessage(FL, "Order %d shipped to warehouse_%d%s", i, i % 13,
+			(i % 250) == 0 ? " after a Deadlock retry" : (i % 250) == 1 ? " retry after deadlock" : "");
+		batch.push_back( lm );
+	}
+	lf.writeMsgBatch( &batch );
+	lf.flush();
+
+	// "deadlocks" and "deadlockretry" contain our words, but aren't them.
+	dptr<LogMsg> partial = buildMessage(FL, "Two deadlocks, no deadlockretry");
+	lf.writeMsg( *partial );
+	lf.flush();
+
+	int scanBoth = countWords( lf, "deadlock retry", false );
+	int scanPhrase = countWords( lf, "deadlock retry", true );
+	int scanNumber = countWords( lf, "order 4250", false );
+	int scanShort = countWords( lf, "a", false );
+
+	// Adding the index to a file that has messages in it indexes them all.
+	LogFile2Storage storage;
+	storage.textIndex = true;
+	lf.setStorage( storage );
+
+	// These go through writeRows and into the index as they are written.
+	for(int i = 20000; i < 20500; i ++){
+		LogMsg* lm = buildMessage(FL, "Order %d shipped to warehouse_%d%s", i, i % 13,
+			(i % 250) == 0 ? " after a Deadlock retry" : "");
+		batch.push_back( lm );
+	}
+	lf.writeMsgBatch( &batch );
+	lf.flush();
+
+	int indexBoth = countWords( lf, "deadlock retry", false );
+	int indexPhrase = countWords( lf, "deadlock retry", true );
+	int indexNumber = countWords( lf, "order 4250", false );
+	int indexShort = countWords( lf, "a", false );
+
+	printf("Word index in use: %s\n", lf.hasTextIndex() ? "OK" : "ERROR");
+	printf("Both words found (%d) before the index (%d) after expected (160, 162) %s\n",
+		scanBoth, indexBoth, scanBoth == 160 && indexBoth == 162 ? "OK" : "ERROR");
+	printf("Phrase found (%d) before the index (%d) after expected (80, 82) %s\n",
+		scanPhrase, indexPhrase, scanPhrase == 80 && indexPhrase == 82 ? "OK" : "ERROR");
+	printf("Number search found (%d) before the index (%d) after expected (1, 1) %s\n",
+		scanNumber, indexNumber, scanNumber == 1 && indexNumber == 1 ? "OK" : "ERROR");
+	printf("One letter word found (%d) before the index (%d) after expected (80, 82) %s\n",
+		scanShort, indexShort, scanShort == 80 && indexShort == 82 ? "OK" : "ERROR");
+
+	// Words with nothing to search for are an error, not a match for everything.
+	bool refused = false;
+	try {
+		countWords( lf, "--", false );
+	} catch (AnException&){
+		refused = true;
+	}
+	printf("Search without any words refused: %s\n", refused ? "OK" : "ERROR");
+
+	lf.close();
+	remove( fileName() );
+	tt.Finish();
+	printf("Duration for runTest9 is (%f)\n", tt.Duration() );
+}
+
+void runTest10()
+{
+	// Four files - two LogFile2s, one rotated into a zip, and a binary LogFile - each
+	// with every fourth message.  Merged, they should come back as one run.
+	Timer tt;
+	tt.Start();
+	printf("Writing 4,000 messages across 4 files in testMerge - merging them back in time order.\n");
+	File::RmDir( "testMerge" );
+	File::EnsurePath( "testMerge/a" );
+	File::EnsurePath( "testMerge/tmp/a" );
+#ifndef _WIN32
+	setenv( "TMPDIR", "testMerge/tmp", 1 ); // so we can see what the archive is unpacked into
+#endif
+	time_t base = time( NULL ) - 3600;
+	{
+		LogFile2 lf1( twine("testMerge/merge.log.1"), (size_t)(1024 * 1024 * 10) );
+		LogFile2 lf2( twine("testMerge/merge.log.2"), (size_t)(1024 * 1024 * 10) );
+		LogFile2 lf3( twine("testMerge/merge.log.3"), (size_t)(1024 * 1024 * 10) );
+		LogFile lf4( "testMerge/merge.log.4", 1024 * 1024 * 10, 10000, 1024 * 1024, 1024 * 10, false, true );
+		for(int i = 0; i < 4000; i ++){
+			dptr<LogMsg> lm = buildMessage(FL, "Merged message %d", i);
+			lm->channel = 3; // Info
+			lm->id = i / 4 + 1; // LogFile keeps the caller's ids
+#ifdef _WIN32
+			lm->timestamp.time = base + i / 10;
+			lm->timestamp.millitm = (unsigned short)((i % 10) * 10);
+#else
+			lm->timestamp.tv_sec = base + i / 10;
+			lm->timestamp.tv_usec = (i % 10) * 1000;
+#endif
+			switch(i % 4){
+				case 0: lf1.writeMsg( *lm ); break;
+				case 1: lf2.writeMsg( *lm ); break;
+				case 2: lf3.writeMsg( *lm ); break;
+				case 3: lf4.writeMsg( *lm ); break;
+			}
+		}
+	}
+	// The way LogFile2::createNewFile leaves a rotated file:
+	ZipFile zf( "testMerge/merge.log.3.zip" );
+	zf.AddFile( "testMerge/merge.log.3" );
+	zf.Close();
+	File::Delete( "testMerge/merge.log.3" );
+
+	LogFile2Filter all;
+	vector<int> order;
+	int files = mergeInOrder( "testMerge/merge.log.*", all, 20000, order );
+	bool inOrder = order.size() == 4000;
+	for(size_t i = 0; inOrder && i < order.size(); i++){
+		inOrder = order[i] == (int)i;
+	}
+	printf("Merged (%d) files returned (%d) messages in order expected (4, 4000) %s\n",
+		files, (int)order.size(), files == 4 && inOrder ? "OK" : "ERROR");
+
+	// A tiny budget means a one message batch per file - the answer shouldn't change.
+	vector<int> small;
+	mergeInOrder( "testMerge/merge.log.*", all, 8, small );
+	printf("Merged with an 8 message budget returned (%d) messages %s\n",
+		(int)small.size(), small == order ? "OK" : "ERROR");
+
+	// 1, 10-19, 100-199, 1000-1999.  The LogFile checks this in memory, the others in SQL.
+	LogFile2Filter text;
+	text.text = "message 1";
+	vector<int> found;
+	mergeInOrder( "testMerge/merge.log.*", text, 20000, found );
+	bool sorted = true;
+	for(size_t i = 1; sorted && i < found.size(); i++){
+		sorted = found[i - 1] < found[i];
+	}
+	printf("Merged text filter found (%d) expected (1111) %s\n", (int)found.size(),
+		found.size() == 1111 && sorted ? "OK" : "ERROR");
+
+	// Every file format matches the same way: text with case, words without.
+	LogFile2Filter upper;
+	upper.text = "MERGED message";
+	vector<int> upperFound;
+	mergeInOrder( "testMerge/merge.log.*", upper, 20000, upperFound );
+	LogFile2Filter words;
+	words.words = "MERGED message";
+	words.phrase = true;
+	vector<int> wordsFound;
+	mergeInOrder( "testMerge/merge.log.*", words, 20000, wordsFound );
+	printf("Merged mixed case text found (%d) mixed case phrase found (%d) expected (0, 4000) %s\n",
+		(int)upperFound.size(), (int)wordsFound.size(),
+		upperFound.size() == 0 && wordsFound.size() == 4000 ? "OK" : "ERROR");
+
+	// Only two of the four files open at once - they overlap, so they take turns.
+	vector<int> twoOpen;
+	mergeInOrder( "testMerge/merge.log.*", all, 400, twoOpen, 2 );
+	printf("Merged with two files open at a time returned (%d) messages %s\n",
+		(int)twoOpen.size(), twoOpen == order ? "OK" : "ERROR");
+	// The archive is unpacked under TMPDIR, never next to it, and removed afterwards.
+	vector<twine> scratch = File::listFolders( "testMerge/tmp" );
+	int left = 0;
+	for(size_t i = 0; i < scratch.size(); i++){
+		if(scratch[i].startsWith( "slibmerge." )){
+			left++;
+		}
+	}
+	printf("Unpacked archive cleaned up: %s\n",
+		left == 0 && !File::Exists( "testMerge/merge.log.3.zip.merge" ) ? "OK" : "ERROR");
+#ifndef _WIN32
+	unsetenv( "TMPDIR" );
+#endif
+
+	File::RmDir( "testMerge" );
+	tt.Finish();
+	printf("Duration for runTest10 is (%f)\n", tt.Duration() );
+}
+
+int mergeInOrder(const twine& pattern, const LogFile2Filter& filter, int maxBuffered, vector<int>& order,
+	int maxOpen)
+{
+	MergedLogReader mlr( filter, 2, maxBuffered, maxOpen );
+	int files = mlr.addFiles( pattern );
+	while(true){
+		dptr<LogMsg> lm; lm = mlr.next();
+		if(lm == NULL) break;
+		order.push_back( (int)lm->msg.substr( 15 ).get_int() ); // "Merged message N"
+	}
+	return files;
+}
+
+int countWords(LogFile2& lf, const char* words, bool phrase)
+{
+	LogFile2Filter filter;
+	filter.words = words;
+	filter.phrase = phrase;
+	int found = 0;
+	dptr<LogFile2Cursor> cursor = lf.query( filter, 64 );
+	while(true){
+		dptr<LogMsg> lm; lm = cursor->next();
+		if(lm == NULL) break;
+		found++;
+	}
+	return found;
+}
+
+void writeSchemaMessages(LogFile2& lf, int count)
+{
+	for(int i = 0; i < count; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+		if(i % 2 == 1){
+			for(int j = 0; j < 20; j++){
+				lm->msg.append( " with a long repeating tail" );
+			}
+		}
+		lm->appName = "test_logfile2";
+		lm->machineName = "localhost";
+		lm->appSession = "session-c";
+		lf.writeMsg( *lm );
+	}
+	lf.flush();
+}
+
+void* readerThread(void* v)
+{
+	twine* fileName = (twine*)v;
+	LogFile2 reader(true, *fileName);
+	int reads = 0;
+	while(!readerDone){
+		reader.beginSnapshot();
+		int newest = reader.getNewestMessageID();
+		vector<LogMsg*>* msgs = reader.getMessages( "where id > 0", 100, 0 );
+		for(size_t i = 0; i < msgs->size(); i++){
+			delete msgs->at(i);
+		}
+		delete msgs;
+		reader.endSnapshot();
+		if(newest > 0){
+			reads++;
+		}
+	}
+	printf("Reader finished (%d) snapshot reads while the writer was running\n", reads);
+	return NULL;
+}
+
+void printLatencies(const char* label, vector<uint64_t>& lat)
+{
+	sort(lat.begin(), lat.end());
+	size_t n = lat.size();
+	printf("writeMsg latency (us) %-12s: p50 (%lu) p90 (%lu) p99 (%lu) p99.9 (%lu) max (%lu)\n",
+		label,
+		(unsigned long)lat[ n * 50 / 100 ],
+		(unsigned long)lat[ n * 90 / 100 ],
+		(unsigned long)lat[ n * 99 / 100 ],
+		(unsigned long)lat[ n * 999 / 1000 ],
+		(unsigned long)lat[ n - 1 ]
+	);
+}
+
 LogMsg* buildMessage(const char* file, int line, const char* msg, ...)
 {
 	LogMsg* lm = new LogMsg(file, line);
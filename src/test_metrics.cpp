@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+ *
+ * This file is a part of slib - a c++ utility library
+ *
+ * The slib project, including all files needed to compile
+ * it, is free software; you can redistribute it and/or use it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  See file COPYING for details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "AnException.h"
+#include "EnEx.h"
+#include "Log.h"
+#include "LogFile2.h"
+#include "Pool.h"
+#include "MetricsServer.h"
+using namespace SLib;
+
+// A pool of ints, to have something to report on.
+class int_create {
+	public:
+		int* operator()(int* init){ return new int(*init); }
+};
+
+class int_destroy {
+	public:
+		void operator()(int* i){ delete i; }
+};
+
+typedef Pool<int*, int*, int_create, int_destroy> IntPool;
+
+twine fetch(unsigned short port, const char* path);
+int expect(const twine& output, const char* what, const char* needle);
+void metricsWork(void);
+
+int main (void)
+{
+	int errors = 0;
+	try {
+		for(int i = 0; i < 10; i++){
+			metricsWork();
+		}
+		uint64_t errorsBefore = Log::MessageCount(1);
+		for(int i = 0; i < 3; i++){
+			ERRORL(FL, "test_metrics error message %d", i);
+		}
+		printf("Error channel counted (%d) messages %s\n", (int)(Log::MessageCount(1) - errorsBefore),
+			Log::MessageCount(1) - errorsBefore == 3 ? "OK" : "ERROR");
+
+		int init = 7;
+		IntPool pool;
+		pool.SetInitInfo(&init);
+		int* held = pool.Acquire();
+
+		remove("test_metrics.db");
+		twine fileName = "test_metrics.db";
+		LogFile2 lf(fileName);
+		lf.setCacheSize(100); // so our message stays in the cache
+		LogMsg lm(FL);
+		lm.msg = "test_metrics cached message";
+		lf.writeMsg(lm);
+
+		MetricsServer ms(0, "127.0.0.1");
+		ms.AddPool("ints", pool);
+		ms.AddLogFile("test", &lf);
+		ms.Start();
+		printf("Metrics server listening on port (%d)\n", (int)ms.Port());
+
+		twine text = fetch(ms.Port(), "/metrics");
+		errors += expect(text, "status", "HTTP/1.0 200 OK\r\n");
+		errors += expect(text, "content type", "Content-Type: text/plain; version=0.0.4");
+		errors += expect(text, "EnEx calls", "\nslib_enex_calls_total{method=\"metricsWork\"} 10\n");
+		errors += expect(text, "EnEx summary", "\n# TYPE slib_enex_duration_seconds summary\n");
+		errors += expect(text, "EnEx count", "\nslib_enex_duration_seconds_count{method=\"metricsWork\"} 10\n");
+		errors += expect(text, "Log counter", "\nslib_log_messages_total{channel=\"error\"} ");
+		errors += expect(text, "Pool size", "\nslib_pool_objects{pool=\"ints\"} 5\n");
+		errors += expect(text, "Pool in use", "\nslib_pool_in_use{pool=\"ints\"} 1\n");
+		errors += expect(text, "LogFile2 cache depth", "\nslib_logfile2_cache_depth{file=\"test\"} 1\n");
+		bool plain = text.find("# EOF") == TWINE_NOT_FOUND; // that's OpenMetrics, not 0.0.4
+		printf("No end marker %s\n", plain ? "OK" : "ERROR");
+		errors += plain ? 0 : 1;
+
+		twine json = fetch(ms.Port(), "/metrics.json");
+		errors += expect(json, "JSON type", "Content-Type: application/json");
+		errors += expect(json, "JSON EnEx", "{\"method\":\"metricsWork\",\"hits\":10,");
+		errors += expect(json, "JSON pool", "{\"name\":\"slib_pool_in_use\",\"pool\":\"ints\",\"value\":1}");
+
+		twine query = fetch(ms.Port(), "/metrics?format=json");
+		errors += expect(query, "JSON by query", "{\"method\":\"metricsWork\",\"hits\":10,");
+
+		twine missing = fetch(ms.Port(), "/nothing");
+		errors += expect(missing, "not found", "HTTP/1.0 404 Not Found\r\n");
+
+		ms.Stop();
+		pool.Release(held);
+	} catch (AnException& e){
+		printf("Exception: %s\n", e.Msg());
+		errors++;
+	}
+	remove("test_metrics.db");
+
+	printf("test_metrics %s\n", errors == 0 ? "OK" : "ERROR");
+	return errors == 0 ? 0 : 1;
+}
+
+twine fetch(unsigned short port, const char* path)
+{
+	Socket client((char*)"127.0.0.1", port);
+	twine request;
+	request.format("GET %s HTTP/1.0\r\nHost: localhost\r\n\r\n", path);
+	client.SendData(request);
+
+	// The server closes the connection when it has sent everything.
+	twine response;
+	char buffer[4096];
+	int got;
+	while((got = client.TimedGetRawData(buffer, sizeof(buffer), 5000)) > 0){
+		response.append(buffer, got);
+	}
+	return response;
+}
+
+int expect(const twine& output, const char* what, const char* needle)
+{
+	if(output.find(needle) == TWINE_NOT_FOUND){
+		printf("%s ERROR - missing (%s) in:\n%s\n", what, needle, output());
+		return 1;
+	}
+	printf("%s OK\n", what);
+	return 0;
+}
+
+void metricsWork(void)
+{
+	ENEX_SITE("metricsWork");
+	volatile int work = 0;
+	for(int i = 0; i < 1000; i++){
+		work++;
+	}
+}
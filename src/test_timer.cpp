@@ -21,8 +21,13 @@
 #include <stdio.h>
 
 #include "Timer.h"
+#include "Clock.h"
+#include "LogMsg.h"
+#include "Tools.h"
 using namespace SLib;
 
+int checkClock(void);
+
 int main (void)
 {
 	int i;
@@ -44,5 +49,78 @@ int main (void)
 	t.Finish();
 	printf("Time for 10000 float mults is (%f)\n", t.Duration());
 
+
+	return checkClock();
 }
 
+int checkClock(void)
+{
+	int ret = 0;
+	printf("Clock source is (%s), %.0f ticks per second\n", Clock::SourceName(),
+		Clock::TicksPerSecond() );
+
+	// Ticks never go backwards
+	uint64_t last = Clock::Ticks();
+	for(int i = 0; i < 1000000; i++){
+		uint64_t now = Clock::Ticks();
+		if(now < last){
+			printf("ERROR: Clock went backwards (%llu) -> (%llu)\n", (unsigned long long)last,
+				(unsigned long long)now );
+			ret = 1;
+			break;
+		}
+		last = now;
+	}
+
+	// A 100ms sleep measures as 100ms, give or take the scheduler
+	Timer tt;
+	tt.Start();
+	Tools::msleep( 100 );
+	tt.Finish();
+	uint64_t ns = tt.DurationNanos();
+	printf("100ms sleep measured (%llu) ns\n", (unsigned long long)ns);
+	if(ns < 99000000 || ns > 150000000){
+		printf("ERROR: 100ms sleep measured (%llu) ns\n", (unsigned long long)ns);
+		ret = 1;
+	}
+
+	// Conversions round trip
+	uint64_t ticks = Clock::NanosToTicks( 1000000 );
+	uint64_t back = Clock::TicksToNanos( ticks );
+	if(back < 999000 || back > 1001000){
+		printf("ERROR: 1ms round trip came back as (%llu) ns\n", (unsigned long long)back);
+		ret = 1;
+	}
+
+	// The wall clock we hand out is close to the system's
+	LogMsg lm;
+	time_t now = time(NULL);
+#ifdef _WIN32
+	time_t stamp = lm.timestamp.time;
+#else
+	time_t stamp = lm.timestamp.tv_sec;
+#endif
+	if(stamp < now - 1 || stamp > now + 1){
+		printf("ERROR: LogMsg timestamp (%ld) is not close to now (%ld)\n", (long)stamp, (long)now);
+		ret = 1;
+	}
+
+	// How long a read takes
+	int count = 10000000;
+	uint64_t start = Clock::Ticks();
+	for(int i = 0; i < count; i++){
+		last = Clock::Ticks();
+	}
+	printf("Clock::Ticks() takes (%.2f) ns\n", (double)Clock::Elapsed(start, last) / count);
+	start = Clock::Ticks();
+	for(int i = 0; i < count / 10; i++){
+		last = Timer::GetCycleCount();
+	}
+	printf("Timer::GetCycleCount() takes (%.2f) ns\n",
+		(double)Clock::Elapsed(start, Clock::Ticks()) / (count / 10) );
+
+	if(ret == 0){
+		printf("OK\n");
+	}
+	return ret;
+}
@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <vector>
+using namespace std;
+
+#include "LogMsg.h"
+#include "LogFile2.h"
+#include "AnException.h"
+#include "Timer.h"
+#include "Thread.h"
+using namespace SLib;
+
+void *produce(void* v);
+void runPass(int producers, bool bulk);
+void runSearch(bool textIndex);
+int countMatches(LogFile2& lf, const LogFile2Filter& filter, double& seconds);
+
+/// Total number of messages written for each pass, split across the producers.
+static int total_count = 400000;
+
+/// Number of messages each producer hands over at once.
+static int batch_size = 500;
+
+struct ProducerArgs {
+	LogFile2* lf;
+	int count;
+	bool bulk;
+};
+
+int main(void)
+{
+	int producers[] = { 1, 4, 16 };
+
+	try {
+		for(int i = 0; i < 3; i++){
+			runPass( producers[i], false );
+			runPass( producers[i], true );
+		}
+		runSearch( false );
+		runSearch( true );
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		return -1;
+	}
+
+	return 0;
+}
+
+void runPass(int producers, bool bulk)
+{
+	twine fileName = "thrashLogFile2.log";
+	remove( fileName() );
+
+	LogFile2 lf( fileName, (size_t)(1024 * 1024 * 1024) );
+	lf.setCacheSize( 5000 );
+	lf.startFlushThread();
+
+	vector < Thread * > th_vect;
+	vector < ProducerArgs > args( producers );
+	Timer tt;
+
+	tt.Start();
+	for(int i = 0; i < producers; i++){
+		args[i].lf = &lf;
+		args[i].count = total_count / producers;
+		args[i].bulk = bulk;
+		Thread *t = new Thread();
+		t->start(produce, &args[i]);
+		th_vect.push_back(t);
+	}
+	for(int i = 0; i < producers; i++){
+		th_vect[i]->join();
+		delete th_vect[i];
+	}
+	lf.close(); // includes the final flush
+	tt.Finish();
+
+	int written = (total_count / producers) * producers;
+	printf("%2d producer(s) %-14s %d messages in %f seconds = %.0f msgs/sec\n", producers,
+		bulk ? "writeMsgBatch:" : "writeMsg:", written, tt.Duration(),
+		(double)written / tt.Duration() );
+
+	remove( fileName() );
+}
+
+void *produce(void* v)
+{
+	ProducerArgs* args = (ProducerArgs*)v;
+	vector<LogMsg*> batch;
+	batch.reserve( batch_size );
+
+	for(int i = 0; i < args->count; i++){
+		LogMsg* lm = new LogMsg(__FILE__, __LINE__);
+		lm->msg.format("Thrash message #%d from this producer", i);
+		lm->channel = 3; // Info
+		lm->appName = "thrash_logfile2";
+		lm->machineName = "localhost";
+		if(args->bulk){
+			batch.push_back( lm );
+			if((int)batch.size() >= batch_size){
+				args->lf->writeMsgBatch( &batch ); // takes the messages, leaves batch empty
+			}
+		} else {
+			args->lf->writeMsg( *lm );
+			delete lm;
+		}
+	}
+	if(batch.size() != 0){
+		args->lf->writeMsgBatch( &batch );
+	}
+	return NULL;
+}
+
+void runSearch(bool textIndex)
+{
+	// A rare word in a big file: LIKE has to read every row, the word index doesn't.
+	twine fileName = "thrashLogFile2Search.log";
+	remove( fileName() );
+	int count = 400000;
+
+	LogFile2 lf( fileName, (size_t)(1024 * 1024 * 1024) );
+	LogFile2Storage storage;
+	storage.textIndex = textIndex;
+	lf.setStorage( storage );
+	lf.setCacheSize( 5000 );
+
+	Timer tt;
+	tt.Start();
+	vector<LogMsg*> batch;
+	for(int i = 0; i < count; i++){
+		LogMsg* lm = new LogMsg(__FILE__, __LINE__);
+		lm->msg.format("Request %d for user_%d completed in %d ms%s", i, i % 977, i % 113,
+			(i % 10000) == 5000 ? " after a deadlock retry" : "");
+		lm->channel = 3; // Info
+		batch.push_back( lm );
+		if(batch.size() >= 500){
+			lf.writeMsgBatch( &batch );
+		}
+	}
+	lf.writeMsgBatch( &batch );
+	lf.flush();
+	tt.Finish();
+	printf("Wrote %d messages %s the word index in %f seconds = %.0f msgs/sec\n", count,
+		textIndex ? "with" : "without", tt.Duration(), (double)count / tt.Duration() );
+
+	double likeSeconds = 0, wordSeconds = 0;
+	LogFile2Filter like;
+	like.text = "deadlock";
+	int likeCount = countMatches( lf, like, likeSeconds );
+
+	LogFile2Filter words;
+	words.words = "deadlock retry";
+	words.phrase = true;
+	int wordCount = countMatches( lf, words, wordSeconds );
+
+	printf("  LIKE scan found (%d) in %f seconds, word search%s found (%d) in %f seconds\n",
+		likeCount, likeSeconds, textIndex ? "" : " (no index)", wordCount, wordSeconds );
+
+	lf.close();
+	remove( fileName() );
+}
+
+int countMatches(LogFile2& lf, const LogFile2Filter& filter, double& seconds)
+{
+	Timer tt;
+	tt.Start();
+	int found = 0;
+	LogFile2Cursor* cursor = lf.query( filter );
+	while(true){
+		LogMsg* lm = cursor->next();
+		if(lm == NULL) break;
+		delete lm;
+		found++;
+	}
+	delete cursor;
+	tt.Finish();
+	seconds = tt.Duration();
+	return found;
+}